@@ -0,0 +1,276 @@
+#include "anomaly.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <math.h>
+
+/* The voltage right after Full still relaxes from the charger's CV level;
+ * self-discharge is measured from a reference taken after this settle time,
+ * over at least the window below */
+#define SELF_DISCHARGE_SETTLE_US  (10 * 60 * 1000000LL)
+#define SELF_DISCHARGE_WINDOW_US  (30 * 60 * 1000000LL)
+
+/* Time constant of the temperature slope estimate */
+#define TEMP_SLOPE_TAU_SEC        60.0f
+
+/* A spike must also stand out from the usual raw-vs-smoothed spread */
+#define NOISE_DEV_ALPHA           0.05f
+#define NOISE_DEV_FACTOR          6.0f
+#define NOISE_HOLDOFF_US          (60 * 1000000LL)
+
+static anomaly_config_t s_cfg;
+static uint32_t s_counts[ANOMALY_TYPE_COUNT];
+
+/* Per-session state, reset on a new cell_id */
+static char s_cell_id[24];
+static uint32_t s_fired;                 /* Bit per anomaly_type_t already reported */
+static bool s_charging_seen;
+static bool s_full_seen;
+static bool s_cv_reached;
+static float s_peak_voltage;             /* Highest voltage while charging, before Full */
+static int64_t s_charge_start_us;
+static int64_t s_full_at_us;
+static int64_t s_ref_us;                 /* Self-discharge reference, 0 = not taken */
+static float s_ref_voltage;
+
+/* Continuous detectors */
+static bool s_have_prev;
+static int64_t s_prev_us;
+static float s_prev_temp;
+static float s_temp_slope;               /* °C/min */
+static bool s_temp_armed;
+static float s_noise_dev_mv;             /* Smoothed |raw - smoothed| */
+static int64_t s_last_noise_us;
+static bool s_spike_pending;             /* Last sample was a spike candidate */
+static sensor_data_t s_spike_sample;
+static int64_t s_spike_us;
+static float s_spike_mv;
+
+static const char *const s_type_names[ANOMALY_TYPE_COUNT] = {
+    "voltage_sag", "cv_timeout", "self_discharge", "temp_rise", "adc_noise",
+};
+
+static const char *const s_type_units[ANOMALY_TYPE_COUNT] = {
+    "mV", "s", "mV/h", "C/min", "mV",
+};
+
+void anomaly_get_default_config(anomaly_config_t *cfg)
+{
+    cfg->sag_mv = CONFIG_CHARGER_ANOMALY_SAG_MV;
+    cfg->cv_mv = CONFIG_CHARGER_ANOMALY_CV_MV;
+    cfg->cv_budget_sec = CONFIG_CHARGER_ANOMALY_CV_BUDGET_MIN * 60;
+    cfg->self_discharge_mv_per_h = CONFIG_CHARGER_ANOMALY_SELF_DISCHARGE_MV_PER_H;
+    cfg->temp_rise_c_per_min = CONFIG_CHARGER_ANOMALY_TEMP_RISE_DECI_C_PER_MIN / 10.0f;
+    cfg->spike_mv = CONFIG_CHARGER_ANOMALY_SPIKE_MV;
+}
+
+static void reset_session(const char *cell_id)
+{
+    strncpy(s_cell_id, cell_id, sizeof(s_cell_id) - 1);
+    s_cell_id[sizeof(s_cell_id) - 1] = '\0';
+    s_fired = 0;
+    s_charging_seen = false;
+    s_full_seen = false;
+    s_cv_reached = false;
+    s_peak_voltage = 0;
+    s_charge_start_us = 0;
+    s_full_at_us = 0;
+    s_ref_us = 0;
+    s_ref_voltage = 0;
+    s_have_prev = false;
+    s_temp_slope = 0;
+    s_temp_armed = true;
+    s_noise_dev_mv = 0;
+    s_spike_pending = false;
+}
+
+void anomaly_init(const anomaly_config_t *cfg)
+{
+    if (cfg) {
+        s_cfg = *cfg;
+    } else {
+        anomaly_get_default_config(&s_cfg);
+    }
+    memset(s_counts, 0, sizeof(s_counts));
+    s_last_noise_us = 0;
+    reset_session("");
+}
+
+void anomaly_set_config(const anomaly_config_t *cfg)
+{
+    s_cfg = *cfg;
+}
+
+static void report(const sensor_data_t *in, anomaly_type_t type, float value, float threshold,
+                  anomaly_event_t *out, size_t *n)
+{
+    s_fired |= 1u << type;
+    s_counts[type]++;
+    anomaly_event_t *e = &out[(*n)++];
+    e->type = type;
+    memcpy(e->cell_id, in->cell_id, sizeof(e->cell_id));
+    e->timestamp_ns = in->timestamp_ns;
+    e->time_synced = in->time_synced;
+    e->value = value;
+    e->threshold = threshold;
+}
+
+static bool fired(anomaly_type_t type)
+{
+    return (s_fired >> type) & 1u;
+}
+
+/* Charging phase: sag below the peak, and the time budget to reach CV */
+static void check_charge(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out, size_t *n)
+{
+    const float v = in->battery_voltage;
+
+    if (in->charge_state == CHARGE_STATE_CHARGING) {
+        if (!s_charging_seen) {
+            s_charging_seen = true;
+            s_charge_start_us = t_us;
+        }
+        if (!s_full_seen) {
+            if (v > s_peak_voltage) {
+                s_peak_voltage = v;
+            }
+            const float sag_mv = (s_peak_voltage - v) * 1000.0f;
+            if (!fired(ANOMALY_VOLTAGE_SAG) && sag_mv >= (float)s_cfg.sag_mv) {
+                report(in, ANOMALY_VOLTAGE_SAG, sag_mv, (float)s_cfg.sag_mv, out, n);
+            }
+        }
+    }
+
+    if (v * 1000.0f >= (float)s_cfg.cv_mv) {
+        s_cv_reached = true;
+    }
+    if (s_charging_seen && !s_cv_reached && !fired(ANOMALY_CV_TIMEOUT)) {
+        const float elapsed_sec = (float)(t_us - s_charge_start_us) / 1000000.0f;
+        if (elapsed_sec > (float)s_cfg.cv_budget_sec) {
+            report(in, ANOMALY_CV_TIMEOUT, elapsed_sec, (float)s_cfg.cv_budget_sec, out, n);
+        }
+    }
+}
+
+/* After Full: the voltage should hold, apart from the first relaxation */
+static void check_self_discharge(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out, size_t *n)
+{
+    if (in->charge_state == CHARGE_STATE_FULL && !s_full_seen) {
+        s_full_seen = true;
+        s_full_at_us = t_us;
+    }
+    if (!s_full_seen) {
+        return;
+    }
+    /* Charger topping up again: start over from the next Full */
+    if (in->charge_state == CHARGE_STATE_CHARGING) {
+        s_full_seen = false;
+        s_ref_us = 0;
+        return;
+    }
+
+    if (s_ref_us == 0) {
+        if (t_us - s_full_at_us >= SELF_DISCHARGE_SETTLE_US) {
+            s_ref_us = t_us;
+            s_ref_voltage = in->battery_voltage;
+        }
+        return;
+    }
+
+    const int64_t elapsed_us = t_us - s_ref_us;
+    if (elapsed_us < SELF_DISCHARGE_WINDOW_US || fired(ANOMALY_SELF_DISCHARGE)) {
+        return;
+    }
+    const float rate = (s_ref_voltage - in->battery_voltage) * 1000.0f * 3600.0f /
+                       ((float)elapsed_us / 1000000.0f);
+    if (rate > (float)s_cfg.self_discharge_mv_per_h) {
+        report(in, ANOMALY_SELF_DISCHARGE, rate, (float)s_cfg.self_discharge_mv_per_h, out, n);
+    }
+}
+
+/* Time-weighted EMA of dT/dt, so it means the same at every sample rate.
+ * Uses the cell NTC when fitted, otherwise the die temperature. */
+static void check_temp_rise(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out, size_t *n)
+{
+    const float temp = isnan(in->cell_temp) ? in->internal_temp : in->cell_temp;
+
+    if (s_have_prev && t_us > s_prev_us) {
+        const float dt_sec = (float)(t_us - s_prev_us) / 1000000.0f;
+        const float rate = (temp - s_prev_temp) * 60.0f / dt_sec;
+        const float alpha = 1.0f - expf(-dt_sec / TEMP_SLOPE_TAU_SEC);
+        s_temp_slope += alpha * (rate - s_temp_slope);
+
+        if (s_temp_armed && s_temp_slope > s_cfg.temp_rise_c_per_min) {
+            s_temp_armed = false;
+            report(in, ANOMALY_TEMP_RISE, s_temp_slope, s_cfg.temp_rise_c_per_min, out, n);
+        } else if (!s_temp_armed && s_temp_slope < 0.5f * s_cfg.temp_rise_c_per_min) {
+            s_temp_armed = true;
+        }
+    }
+    s_have_prev = true;
+    s_prev_us = t_us;
+    s_prev_temp = temp;
+}
+
+/* A raw reading far from the smoothed voltage, and far outside the usual
+ * spread between the two, that is back to normal on the next sample is an
+ * ADC or contact glitch. One that stays off is a real step or a removal. */
+static void check_noise(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out, size_t *n)
+{
+    const float dev_mv = fabsf(in->raw_voltage - in->battery_voltage) * 1000.0f;
+    const bool spike = dev_mv >= (float)s_cfg.spike_mv &&
+                       dev_mv >= NOISE_DEV_FACTOR * s_noise_dev_mv;
+
+    if (s_spike_pending) {
+        s_spike_pending = false;
+        if (!spike && (s_last_noise_us == 0 || s_spike_us - s_last_noise_us >= NOISE_HOLDOFF_US)) {
+            s_last_noise_us = s_spike_us;
+            report(&s_spike_sample, ANOMALY_ADC_NOISE, s_spike_mv, (float)s_cfg.spike_mv, out, n);
+        }
+    }
+    if (spike) {
+        /* Decide on the next sample; keep it out of the spread estimate */
+        s_spike_pending = true;
+        s_spike_sample = *in;
+        s_spike_us = t_us;
+        s_spike_mv = dev_mv;
+        return;
+    }
+    s_noise_dev_mv += NOISE_DEV_ALPHA * (dev_mv - s_noise_dev_mv);
+}
+
+size_t anomaly_push(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out)
+{
+    size_t n = 0;
+
+    if (!in->cell_present) {
+        /* Keep the session across a short removal; the slope estimate
+         * restarts with the cell */
+        s_have_prev = false;
+        s_spike_pending = false;
+        return 0;
+    }
+    if (strcmp(in->cell_id, s_cell_id) != 0) {
+        reset_session(in->cell_id);
+    }
+
+    check_charge(in, t_us, out, &n);
+    check_self_discharge(in, t_us, out, &n);
+    check_temp_rise(in, t_us, out, &n);
+    check_noise(in, t_us, out, &n);
+    return n;
+}
+
+void anomaly_get_counts(uint32_t counts[ANOMALY_TYPE_COUNT])
+{
+    memcpy(counts, s_counts, sizeof(s_counts));
+}
+
+const char *anomaly_type_str(anomaly_type_t type)
+{
+    return type < ANOMALY_TYPE_COUNT ? s_type_names[type] : "unknown";
+}
+
+const char *anomaly_unit_str(anomaly_type_t type)
+{
+    return type < ANOMALY_TYPE_COUNT ? s_type_units[type] : "";
+}
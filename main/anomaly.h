@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor.h"
+
+/* Streaming anomaly detection
+ *
+ * Runs on every sample with a fixed amount of state per charger bay and
+ * reports faults as they happen, instead of leaving them to be spotted on a
+ * dashboard. Each detector fires once per session (temperature rise and ADC
+ * noise re-arm) and is reset when a new cell is inserted.
+ *
+ * Kept free of ESP-IDF calls so tools/anomalyreplay can run recorded
+ * sessions through the same code.
+ */
+
+#define ANOMALY_MAX_EVENTS  5
+
+typedef enum {
+    ANOMALY_VOLTAGE_SAG,      /* Voltage fell while still charging */
+    ANOMALY_CV_TIMEOUT,       /* CV voltage not reached within the budget */
+    ANOMALY_SELF_DISCHARGE,   /* Voltage drops too fast after Full */
+    ANOMALY_TEMP_RISE,        /* Temperature rising too fast */
+    ANOMALY_ADC_NOISE,        /* Raw reading far off the smoothed voltage */
+    ANOMALY_TYPE_COUNT
+} anomaly_type_t;
+
+/* Thresholds, tunable at runtime through params.c */
+typedef struct {
+    uint32_t sag_mv;                   /* Drop below the charging peak */
+    uint32_t cv_mv;                    /* Voltage that counts as CV reached */
+    uint32_t cv_budget_sec;            /* Charging time allowed to reach it */
+    uint32_t self_discharge_mv_per_h;  /* Drop rate allowed after Full */
+    float temp_rise_c_per_min;         /* Smoothed temperature slope allowed */
+    uint32_t spike_mv;                 /* Raw-vs-smoothed deviation that is a spike */
+} anomaly_config_t;
+
+/* One alert */
+typedef struct {
+    anomaly_type_t type;
+    char cell_id[24];
+    int64_t timestamp_ns;     /* Sample time, as in sensor_data_t */
+    bool time_synced;
+    float value;              /* Measured value, in the threshold's unit */
+    float threshold;
+} anomaly_event_t;
+
+/**
+ * Fill a config with the Kconfig defaults
+ * @param cfg Config to fill
+ */
+void anomaly_get_default_config(anomaly_config_t *cfg);
+
+/**
+ * Initialize (or reset) the detectors
+ * @param cfg Thresholds to use, or NULL for the Kconfig defaults
+ */
+void anomaly_init(const anomaly_config_t *cfg);
+
+/**
+ * Replace the thresholds without resetting detector state
+ * @param cfg New thresholds
+ */
+void anomaly_set_config(const anomaly_config_t *cfg);
+
+/**
+ * Run one sample through every detector
+ * @param in Sample (after sensor_read)
+ * @param t_us Monotonic sample time (esp_timer_get_time)
+ * @param out Room for ANOMALY_MAX_EVENTS events
+ * @return Number of events written to out
+ */
+size_t anomaly_push(const sensor_data_t *in, int64_t t_us, anomaly_event_t *out);
+
+/**
+ * Get the number of events raised since init, per type
+ * @param counts Array of ANOMALY_TYPE_COUNT entries to fill
+ */
+void anomaly_get_counts(uint32_t counts[ANOMALY_TYPE_COUNT]);
+
+/**
+ * Get the name of an anomaly type (used as the InfluxDB tag)
+ * @param type Anomaly type
+ * @return Name, e.g. "voltage_sag"
+ */
+const char *anomaly_type_str(anomaly_type_t type);
+
+/**
+ * Get the unit of an event's value and threshold
+ * @param type Anomaly type
+ * @return Unit, e.g. "mV"
+ */
+const char *anomaly_unit_str(anomaly_type_t type);
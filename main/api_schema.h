@@ -0,0 +1,105 @@
+#pragma once
+
+/* Binary API schema
+ *
+ * Integer map keys used when an endpoint answers with CBOR (Accept:
+ * application/cbor). Shared with the host decoder in tools/cbordecode, so
+ * this header must stay free of ESP-IDF includes. Keys are never reused;
+ * retire a field by deleting its line and leaving the number unused.
+ *
+ * X(key, name, type): type is the CBOR item the device writes -
+ * UINT, INT, FLOAT (float32), BOOL, TEXT, UINT_ARRAY or ARRAY (of maps).
+ */
+
+/* Bumped only for incompatible changes; new keys don't need it */
+#define API_SCHEMA_VERSION  1
+
+/* /api/data: one map */
+#define API_DATA_FIELDS(X) \
+    X(0,  schema,              UINT)   \
+    X(1,  voltage,             FLOAT)  \
+    X(2,  percentage,          FLOAT)  \
+    X(3,  temperature,         FLOAT)  \
+    X(4,  charge_state,        UINT)   \
+    X(5,  cell_id,             TEXT)   \
+    X(6,  charging_time_sec,   UINT)   \
+    X(7,  cell_present,        BOOL)   \
+    X(8,  timestamp_ms,        INT)    \
+    X(9,  time_synced,         BOOL)   \
+    X(10, sample_interval_ms,  UINT)   \
+    X(11, upload_interval_sec, UINT)   \
+    X(12, sched_mode,          UINT)   \
+    X(13, sched_reason,        UINT)   \
+    X(14, device_id,           TEXT)   \
+    X(15, cell_temp,           FLOAT)  \
+    X(16, over_temp,           BOOL)   \
+    X(17, ir_mohm,             FLOAT)
+
+/* /api/sessions: array of maps. time_in_state_sec is indexed by charge_state */
+#define API_SESSION_FIELDS(X) \
+    X(1,  cell_id,             TEXT)   \
+    X(2,  active,              BOOL)   \
+    X(3,  start_ns,            INT)    \
+    X(4,  end_ns,              INT)    \
+    X(5,  duration_sec,        UINT)   \
+    X(6,  samples,             UINT)   \
+    X(7,  start_voltage,       FLOAT)  \
+    X(8,  end_voltage,         FLOAT)  \
+    X(9,  min_voltage,         FLOAT)  \
+    X(10, max_voltage,         FLOAT)  \
+    X(11, peak_temp,           FLOAT)  \
+    X(12, time_to_cv_sec,      INT)    \
+    X(13, time_to_full_sec,    INT)    \
+    X(14, cc_charge_mah,       FLOAT)  \
+    X(15, time_in_state_sec,   UINT_ARRAY) \
+    X(16, ir_mohm,             FLOAT)
+
+/* /api/series: map of pool stats plus "sessions", an array of maps */
+#define API_SERIES_FIELDS(X) \
+    X(1,  pages_total,         UINT)   \
+    X(2,  pages_free,          UINT)   \
+    X(3,  page_size,           UINT)   \
+    X(4,  evicted_pages,       UINT)   \
+    X(5,  sessions,            ARRAY)
+
+#define API_SERIES_SESSION_FIELDS(X) \
+    X(1,  cell_id,             TEXT)   \
+    X(2,  active,              BOOL)   \
+    X(3,  samples,             UINT)   \
+    X(4,  bytes,               UINT)   \
+    X(5,  duration_ms,         INT)
+
+/* Enum names, in code order; must match charge_state_t, sched_mode_t
+ * and sink_id_t */
+#define API_CHARGE_STATE_NAMES  { "No Cell", "Charging", "Full", "Discharging", "Idle" }
+#define API_SCHED_MODE_NAMES    { "fast", "normal", "slow" }
+#define API_SINK_NAMES          { "influx_v2", "influx_v1", "remote_write", "journal" }
+
+/* Key constants, e.g. API_DATA_voltage */
+enum {
+#define X(key, name, type) API_DATA_##name = key,
+    API_DATA_FIELDS(X)
+#undef X
+};
+
+enum {
+#define X(key, name, type) API_SESSION_##name = key,
+    API_SESSION_FIELDS(X)
+#undef X
+};
+
+enum {
+#define X(key, name, type) API_SERIES_##name = key,
+    API_SERIES_FIELDS(X)
+#undef X
+};
+
+enum {
+#define X(key, name, type) API_SERIES_SESSION_##name = key,
+    API_SERIES_SESSION_FIELDS(X)
+#undef X
+};
+
+/* Number of entries in a field list, e.g. API_FIELD_COUNT(API_DATA_FIELDS) */
+#define API_FIELD_COUNT_ONE(key, name, type)  + 1
+#define API_FIELD_COUNT(fields)  (0 fields(API_FIELD_COUNT_ONE))
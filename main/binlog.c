@@ -0,0 +1,59 @@
+#include "binlog.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#define BINLOG_RECORDS  CONFIG_CHARGER_BINLOG_RECORDS
+
+/* Record s lives in slot s % BINLOG_RECORDS */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static binlog_record_t s_ring[BINLOG_RECORDS];
+static uint32_t s_next_seq = 0;
+
+static uint32_t oldest_seq(void)
+{
+    return s_next_seq > BINLOG_RECORDS ? s_next_seq - BINLOG_RECORDS : 0;
+}
+
+void binlog_write(binlog_event_t event, const uint32_t *args, size_t nargs)
+{
+    if (nargs > BINLOG_MAX_ARGS) {
+        nargs = BINLOG_MAX_ARGS;
+    }
+    const uint32_t time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    portENTER_CRITICAL(&s_lock);
+    binlog_record_t *rec = &s_ring[s_next_seq % BINLOG_RECORDS];
+    rec->seq = s_next_seq++;
+    rec->time_ms = time_ms;
+    rec->event = (uint16_t)event;
+    rec->nargs = (uint8_t)nargs;
+    rec->reserved = 0;
+    memcpy(rec->args, args, nargs * sizeof(uint32_t));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t binlog_read(uint32_t *seq, binlog_record_t *out, size_t max)
+{
+    size_t count = 0;
+    portENTER_CRITICAL(&s_lock);
+    uint32_t s = *seq;
+    if (s < oldest_seq()) {
+        s = oldest_seq();
+    }
+    for (; s < s_next_seq && count < max; s++) {
+        out[count++] = s_ring[s % BINLOG_RECORDS];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    *seq = s;
+    return count;
+}
+
+void binlog_get_stats(binlog_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    stats->capacity = BINLOG_RECORDS;
+    stats->written = s_next_seq;
+    stats->oldest_seq = oldest_seq();
+    portEXIT_CRITICAL(&s_lock);
+}
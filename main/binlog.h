@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "binlog_events.h"
+
+/* Binary structured log
+ *
+ * Hot-path diagnostics (one line per sample, one per upload) are recorded
+ * as an event id plus raw 32-bit arguments in a RAM ring instead of being
+ * formatted and written to the UART. Formatting happens on the host, from
+ * the same event table (binlog_events.h), when /api/logs is fetched:
+ *
+ *   curl -s http://charger/api/logs | charger-logdecode
+ *
+ * The ring holds CONFIG_CHARGER_BINLOG_RECORDS records; the oldest are
+ * overwritten. Writers may run in any task.
+ */
+
+typedef enum {
+#define BINLOG_EVENT_ENUM(id, name, level, tag, format) BINLOG_EV_##name = id,
+    BINLOG_EVENTS(BINLOG_EVENT_ENUM)
+#undef BINLOG_EVENT_ENUM
+} binlog_event_t;
+
+typedef struct {
+    uint32_t capacity;        /* Records the ring holds */
+    uint32_t written;         /* Records written since boot */
+    uint32_t oldest_seq;      /* Oldest record still in the ring */
+} binlog_stats_t;
+
+/**
+ * Record an event
+ * @param event Event id
+ * @param args Raw arguments, one per conversion in the event's format
+ * @param nargs Number of arguments (extra ones beyond BINLOG_MAX_ARGS are dropped)
+ */
+void binlog_write(binlog_event_t event, const uint32_t *args, size_t nargs);
+
+/* Pass a float argument by its bit pattern */
+static inline uint32_t binlog_f(float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+/* BINLOG(SENSOR_SAMPLE, binlog_f(v), ...): integers are passed as is */
+#define BINLOG(name, ...) \
+    binlog_write(BINLOG_EV_##name, (const uint32_t[]){ __VA_ARGS__ }, \
+                 sizeof((const uint32_t[]){ __VA_ARGS__ }) / sizeof(uint32_t))
+
+/**
+ * Copy records out of the ring, oldest first
+ * @param seq In: first sequence number wanted; records already overwritten
+ *            are skipped. Out: sequence number to continue from.
+ * @param out Buffer for the records
+ * @param max Capacity of out
+ * @return Number of records copied (0 when caught up)
+ */
+size_t binlog_read(uint32_t *seq, binlog_record_t *out, size_t max);
+
+/**
+ * Get ring figures
+ * @param stats Filled with the current values
+ */
+void binlog_get_stats(binlog_stats_t *stats);
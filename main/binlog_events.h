@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Binary log schema
+ *
+ * Events recorded by binlog.c and the layout of a /api/logs dump. Shared
+ * with the host decoder in tools/logdecode, so this header must stay free
+ * of ESP-IDF includes. Event ids are never reused; retire an event by
+ * deleting its line and leaving the number unused.
+ *
+ * X(id, name, level, tag, format): level is one of E W I D. The format is
+ * printf-style and is only expanded by the decoder. Each conversion takes
+ * one 32-bit argument: %d %i (int32), %u %x %X (uint32), %f %e %g (float),
+ * and %{charge_state} / %{sched_mode} / %{sink} for the names in
+ * api_schema.h.
+ */
+
+/* Bumped when the record or dump layout changes */
+#define BINLOG_VERSION   1
+
+#define BINLOG_MAX_ARGS  5
+
+#define BINLOG_EVENTS(X) \
+    X(2, INFLUX_BATCH,  I, "influxdb", "Sending %u points (%u bytes)") \
+    X(4, SINK_WRITE,    I, "sink",     "%{sink}: status %d for %u bytes in %u ms") \
+    X(5, SENSOR_SAMPLE, I, "sensor",   "Battery: %.3fV (raw %.3fV), Temp: %.1fC, Cell: %.1fC, State: %{charge_state}")
+
+/* One record, little-endian as stored on the device */
+typedef struct {
+    uint32_t seq;             /* Increments with every record written */
+    uint32_t time_ms;         /* Since boot */
+    uint16_t event;           /* Id from BINLOG_EVENTS */
+    uint8_t nargs;
+    uint8_t reserved;
+    uint32_t args[BINLOG_MAX_ARGS];
+} binlog_record_t;
+
+/* Start of a dump, followed by records oldest first */
+typedef struct {
+    char magic[4];            /* "BLOG" */
+    uint16_t version;         /* BINLOG_VERSION */
+    uint16_t record_size;     /* sizeof(binlog_record_t) */
+    uint32_t uptime_ms;       /* Device uptime when the dump was taken */
+    uint32_t synced;          /* 1 if utc_ms is wall-clock time */
+    int64_t utc_ms;           /* Device clock at uptime_ms */
+} binlog_dump_header_t;
@@ -0,0 +1,40 @@
+#include "boot_trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "boot";
+
+/* Milliseconds since boot; 0 means not reached (nothing happens at t=0) */
+static volatile int32_t s_marks_ms[BOOT_EVENT_COUNT];
+
+static const char *s_event_names[BOOT_EVENT_COUNT] = {
+    [BOOT_EVENT_SENSOR_READY]     = "sensor_ready",
+    [BOOT_EVENT_FIRST_SAMPLE]     = "first_sample",
+    [BOOT_EVENT_WIFI_CONNECTED]   = "wifi_connected",
+    [BOOT_EVENT_WEBSERVER_READY]  = "webserver_ready",
+    [BOOT_EVENT_TIME_SYNCED]      = "time_synced",
+    [BOOT_EVENT_FIRST_UPLOAD]     = "first_upload",
+};
+
+void boot_trace_mark(boot_event_t event)
+{
+    if (event >= BOOT_EVENT_COUNT || s_marks_ms[event] != 0) {
+        return;
+    }
+    const int32_t ms = (int32_t)(esp_timer_get_time() / 1000);
+    s_marks_ms[event] = ms > 0 ? ms : 1;
+    ESP_LOGI(TAG, "%s at %ld ms", s_event_names[event], (long)s_marks_ms[event]);
+}
+
+int32_t boot_trace_get_ms(boot_event_t event)
+{
+    if (event >= BOOT_EVENT_COUNT || s_marks_ms[event] == 0) {
+        return -1;
+    }
+    return s_marks_ms[event];
+}
+
+const char* boot_trace_event_str(boot_event_t event)
+{
+    return event < BOOT_EVENT_COUNT ? s_event_names[event] : "unknown";
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Bring-up milestones, in the order they normally happen */
+typedef enum {
+    BOOT_EVENT_SENSOR_READY,
+    BOOT_EVENT_FIRST_SAMPLE,
+    BOOT_EVENT_WIFI_CONNECTED,
+    BOOT_EVENT_WEBSERVER_READY,
+    BOOT_EVENT_TIME_SYNCED,
+    BOOT_EVENT_FIRST_UPLOAD,
+    BOOT_EVENT_COUNT
+} boot_event_t;
+
+/**
+ * Record a milestone (only its first occurrence is kept)
+ * @param event Milestone reached
+ */
+void boot_trace_mark(boot_event_t event);
+
+/**
+ * Get the time a milestone was first reached
+ * @param event Milestone
+ * @return Milliseconds since boot, or -1 if not reached yet
+ */
+int32_t boot_trace_get_ms(boot_event_t event);
+
+/**
+ * Get a short name for a milestone
+ * @param event Milestone
+ * @return Static string (e.g. "first_sample")
+ */
+const char* boot_trace_event_str(boot_event_t event);
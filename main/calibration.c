@@ -0,0 +1,252 @@
+#include "calibration.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *TAG = "calibration";
+
+/* NVS keys */
+static const char NVS_NAMESPACE[] = "calibration";
+static const char NVS_KEY_POINTS[] = "points";
+
+/* Lookup table over the ADC pin range, one node every 64 mV (0..3.39 V) */
+#define CAL_LUT_SHIFT   6
+#define CAL_LUT_SIZE    54
+
+/* Readings closer than this at the pin are the same point */
+#define CAL_MERGE_MV    5
+
+/* Plausible battery/pin ratio of any segment: rejects swapped or mistyped
+ * references, and a falling curve */
+#define CAL_MIN_RATIO   1
+#define CAL_MAX_RATIO   20
+
+/* Saved curve, sorted by pin voltage; only the httpd task changes it */
+static calibration_point_t s_points[CALIBRATION_MAX_POINTS];
+static size_t s_count = 0;
+
+/* Captured since the last save/discard */
+static calibration_point_t s_pending[CALIBRATION_MAX_POINTS];
+static size_t s_pending_count = 0;
+
+/* Battery voltage (uV) at each node; read by the sampler, swapped by httpd */
+static int32_t s_lut[CAL_LUT_SIZE];
+static bool s_lut_valid = false;
+static portMUX_TYPE s_lut_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Evaluate the piecewise-linear curve through sorted points, extending the
+ * end segments beyond the calibrated range */
+static int32_t curve_uv(const calibration_point_t *p, size_t n, int32_t pin_mv)
+{
+    size_t i = 0;
+    while (i + 2 < n && pin_mv > p[i + 1].pin_mv) {
+        i++;
+    }
+    const int64_t dx = p[i + 1].pin_mv - p[i].pin_mv;
+    const int64_t dy_uv = (int64_t)(p[i + 1].reference_mv - p[i].reference_mv) * 1000;
+    return (int32_t)((int64_t)p[i].reference_mv * 1000 + dy_uv * (pin_mv - p[i].pin_mv) / dx);
+}
+
+static void install(const calibration_point_t *p, size_t n)
+{
+    int32_t lut[CAL_LUT_SIZE];
+    for (int i = 0; i < CAL_LUT_SIZE; i++) {
+        lut[i] = curve_uv(p, n, i << CAL_LUT_SHIFT);
+    }
+
+    portENTER_CRITICAL(&s_lut_lock);
+    memcpy(s_lut, lut, sizeof(s_lut));
+    s_lut_valid = true;
+    portEXIT_CRITICAL(&s_lut_lock);
+
+    memcpy(s_points, p, n * sizeof(*p));
+    s_count = n;
+}
+
+static int compare_points(const void *a, const void *b)
+{
+    const calibration_point_t *pa = a;
+    const calibration_point_t *pb = b;
+    return (pa->pin_mv > pb->pin_mv) - (pa->pin_mv < pb->pin_mv);
+}
+
+/* Sort, merge near-duplicates and check the result; returns the point count
+ * or 0 with err filled in */
+static size_t fit(calibration_point_t *p, size_t n, char *err, size_t err_len)
+{
+    qsort(p, n, sizeof(*p), compare_points);
+
+    size_t out = 0;
+    for (size_t i = 0; i < n; ) {
+        int64_t pin_sum = 0, ref_sum = 0;
+        size_t j = i;
+        while (j < n && p[j].pin_mv - p[i].pin_mv <= CAL_MERGE_MV) {
+            pin_sum += p[j].pin_mv;
+            ref_sum += p[j].reference_mv;
+            j++;
+        }
+        p[out].pin_mv = (int32_t)(pin_sum / (int64_t)(j - i));
+        p[out].reference_mv = (int32_t)(ref_sum / (int64_t)(j - i));
+        out++;
+        i = j;
+    }
+
+    if (out < 2) {
+        snprintf(err, err_len, "need readings at two or more different voltages");
+        return 0;
+    }
+    for (size_t i = 0; i + 1 < out; i++) {
+        const int32_t dx = p[i + 1].pin_mv - p[i].pin_mv;
+        const int32_t dy = p[i + 1].reference_mv - p[i].reference_mv;
+        if (dy < dx * CAL_MIN_RATIO || dy > dx * CAL_MAX_RATIO) {
+            snprintf(err, err_len, "readings at %ld and %ld mV don't fit a voltage divider",
+                     (long)p[i].reference_mv, (long)p[i + 1].reference_mv);
+            return 0;
+        }
+    }
+    return out;
+}
+
+esp_err_t calibration_init(void)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        ESP_LOGI(TAG, "No calibration, using the divider ratio");
+        return ESP_OK;
+    }
+
+    calibration_point_t points[CALIBRATION_MAX_POINTS];
+    size_t len = sizeof(points);
+    const esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_POINTS, points, &len);
+    nvs_close(nvs_handle);
+
+    if (err != ESP_OK || len % sizeof(calibration_point_t) != 0) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Ignoring unreadable calibration (%s)", esp_err_to_name(err));
+        }
+        return ESP_OK;
+    }
+
+    char reason[80];
+    const size_t n = fit(points, len / sizeof(calibration_point_t), reason, sizeof(reason));
+    if (n == 0) {
+        ESP_LOGW(TAG, "Ignoring saved calibration: %s", reason);
+        return ESP_OK;
+    }
+    install(points, n);
+    ESP_LOGI(TAG, "Calibrated with %u points (%ld..%ld mV)", (unsigned)n,
+             (long)points[0].reference_mv, (long)points[n - 1].reference_mv);
+    return ESP_OK;
+}
+
+bool calibration_apply(int pin_mv, int32_t *battery_mv)
+{
+    if (pin_mv < 0) {
+        pin_mv = 0;
+    }
+    int idx = pin_mv >> CAL_LUT_SHIFT;
+    if (idx > CAL_LUT_SIZE - 2) {
+        idx = CAL_LUT_SIZE - 2;
+    }
+    const int32_t frac = pin_mv - (idx << CAL_LUT_SHIFT);
+
+    portENTER_CRITICAL(&s_lut_lock);
+    const bool valid = s_lut_valid;
+    const int32_t y0 = s_lut[idx];
+    const int32_t y1 = s_lut[idx + 1];
+    portEXIT_CRITICAL(&s_lut_lock);
+
+    if (!valid) {
+        return false;
+    }
+    const int32_t uv = y0 + (int32_t)(((int64_t)(y1 - y0) * frac) >> CAL_LUT_SHIFT);
+    *battery_mv = uv / 1000;
+    return true;
+}
+
+esp_err_t calibration_add_point(int32_t pin_mv, int32_t reference_mv)
+{
+    if (s_pending_count == CALIBRATION_MAX_POINTS) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_pending[s_pending_count++] = (calibration_point_t){
+        .pin_mv = pin_mv,
+        .reference_mv = reference_mv,
+    };
+    ESP_LOGI(TAG, "Point %u: %ld mV at the pin for %ld mV", (unsigned)s_pending_count,
+             (long)pin_mv, (long)reference_mv);
+    return ESP_OK;
+}
+
+esp_err_t calibration_save(char *err, size_t err_len)
+{
+    if (s_pending_count == 0) {
+        snprintf(err, err_len, "no readings captured");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    calibration_point_t points[CALIBRATION_MAX_POINTS];
+    memcpy(points, s_pending, s_pending_count * sizeof(*points));
+    const size_t n = fit(points, s_pending_count, err, err_len);
+    if (n == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(nvs_handle, NVS_KEY_POINTS, points, n * sizeof(*points));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (ret != ESP_OK) {
+        snprintf(err, err_len, "saving to NVS failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    install(points, n);
+    s_pending_count = 0;
+    ESP_LOGI(TAG, "Saved calibration with %u points", (unsigned)n);
+    return ESP_OK;
+}
+
+void calibration_discard(void)
+{
+    s_pending_count = 0;
+}
+
+esp_err_t calibration_clear(void)
+{
+    portENTER_CRITICAL(&s_lut_lock);
+    s_lut_valid = false;
+    portEXIT_CRITICAL(&s_lut_lock);
+    s_count = 0;
+
+    nvs_handle_t nvs_handle;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = nvs_erase_key(nvs_handle, NVS_KEY_POINTS);
+    if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(TAG, "Calibration cleared, using the divider ratio");
+    return ret;
+}
+
+void calibration_get_status(calibration_status_t *status)
+{
+    status->active = s_count > 0;
+    status->count = s_count;
+    memcpy(status->points, s_points, sizeof(status->points));
+    status->pending_count = s_pending_count;
+    memcpy(status->pending, s_pending, sizeof(status->pending));
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Per-device battery voltage calibration
+ *
+ * Maps the ADC pin voltage to the battery voltage through a piecewise-linear
+ * curve fitted to readings taken at known reference voltages. This replaces
+ * the nominal divider ratio, so resistor tolerance and ADC gain error of
+ * each board are corrected together. The curve is kept as points in NVS and
+ * expanded into a lookup table at load time.
+ */
+
+#define CALIBRATION_MAX_POINTS  8
+
+/* One reference reading */
+typedef struct {
+    int32_t pin_mv;           /* ADC pin voltage measured (mV) */
+    int32_t reference_mv;     /* Battery terminal voltage applied (mV) */
+} calibration_point_t;
+
+typedef struct {
+    bool active;                                      /* A saved table is in use */
+    size_t count;                                     /* Points of the saved table */
+    calibration_point_t points[CALIBRATION_MAX_POINTS];
+    size_t pending_count;                             /* Captured, not yet saved */
+    calibration_point_t pending[CALIBRATION_MAX_POINTS];
+} calibration_status_t;
+
+/**
+ * Load the saved calibration from NVS
+ * @return ESP_OK on success (no calibration is not an error)
+ */
+esp_err_t calibration_init(void);
+
+/**
+ * Convert an ADC pin voltage with the saved calibration
+ * Hot path: one table lookup and a linear interpolation in integers.
+ * @param pin_mv ADC pin voltage (mV)
+ * @param battery_mv Pointer to store the battery voltage (mV)
+ * @return false if no calibration is saved (use the divider ratio)
+ */
+bool calibration_apply(int pin_mv, int32_t *battery_mv);
+
+/**
+ * Record a reading taken at a known battery terminal voltage
+ * @param pin_mv Averaged ADC pin voltage (mV)
+ * @param reference_mv Voltage applied at the battery terminals (mV)
+ * @return ESP_OK, ESP_ERR_NO_MEM if CALIBRATION_MAX_POINTS are captured
+ */
+esp_err_t calibration_add_point(int32_t pin_mv, int32_t reference_mv);
+
+/**
+ * Fit the captured points, save them to NVS and start using them
+ * Points closer than a few mV are merged. At least two distinct points are
+ * needed and the battery voltage must rise with the pin voltage.
+ * @param err Filled with a reason on failure
+ * @param err_len Size of err
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE / ESP_ERR_INVALID_ARG
+ */
+esp_err_t calibration_save(char *err, size_t err_len);
+
+/**
+ * Drop captured points that were not saved
+ */
+void calibration_discard(void);
+
+/**
+ * Erase the saved calibration and go back to the divider ratio
+ * @return ESP_OK on success
+ */
+esp_err_t calibration_clear(void);
+
+/**
+ * Get the saved and captured points
+ * @param status Pointer to store the status
+ */
+void calibration_get_status(calibration_status_t *status);
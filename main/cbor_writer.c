@@ -0,0 +1,117 @@
+#include "cbor_writer.h"
+#include <string.h>
+
+/* Major types (RFC 8949 section 3.1) */
+#define CBOR_UINT    0
+#define CBOR_NEGINT  1
+#define CBOR_TEXT    3
+#define CBOR_ARRAY   4
+#define CBOR_MAP     5
+
+#define CBOR_FALSE    0xf4
+#define CBOR_TRUE     0xf5
+#define CBOR_FLOAT32  0xfa
+
+static void put_bytes(cbor_writer_t *w, const void *data, size_t len)
+{
+    if (w->overflow || w->len + len > w->cap) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/* Initial byte plus the shortest big-endian argument that holds value */
+static void put_head(cbor_writer_t *w, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t n;
+    
+    if (value < 24) {
+        head[0] = (uint8_t)(major << 5 | value);
+        n = 1;
+    } else if (value <= UINT8_MAX) {
+        head[0] = (uint8_t)(major << 5 | 24);
+        head[1] = (uint8_t)value;
+        n = 2;
+    } else if (value <= UINT16_MAX) {
+        head[0] = (uint8_t)(major << 5 | 25);
+        head[1] = (uint8_t)(value >> 8);
+        head[2] = (uint8_t)value;
+        n = 3;
+    } else if (value <= UINT32_MAX) {
+        head[0] = (uint8_t)(major << 5 | 26);
+        for (int i = 0; i < 4; i++) {
+            head[1 + i] = (uint8_t)(value >> (24 - 8 * i));
+        }
+        n = 5;
+    } else {
+        head[0] = (uint8_t)(major << 5 | 27);
+        for (int i = 0; i < 8; i++) {
+            head[1 + i] = (uint8_t)(value >> (56 - 8 * i));
+        }
+        n = 9;
+    }
+    put_bytes(w, head, n);
+}
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->overflow = false;
+}
+
+void cbor_put_map(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_MAP, count);
+}
+
+void cbor_put_array(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_ARRAY, count);
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t value)
+{
+    put_head(w, CBOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *w, int64_t value)
+{
+    if (value >= 0) {
+        put_head(w, CBOR_UINT, (uint64_t)value);
+    } else {
+        /* -1 - n encoding; avoids overflow for INT64_MIN */
+        put_head(w, CBOR_NEGINT, (uint64_t)(-(value + 1)));
+    }
+}
+
+void cbor_put_float(cbor_writer_t *w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    const uint8_t out[5] = {
+        CBOR_FLOAT32,
+        (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits
+    };
+    put_bytes(w, out, sizeof(out));
+}
+
+void cbor_put_bool(cbor_writer_t *w, bool value)
+{
+    const uint8_t b = value ? CBOR_TRUE : CBOR_FALSE;
+    put_bytes(w, &b, 1);
+}
+
+void cbor_put_text(cbor_writer_t *w, const char *str)
+{
+    const size_t len = str ? strlen(str) : 0;
+    put_head(w, CBOR_TEXT, len);
+    if (len) {
+        put_bytes(w, str, len);
+    }
+}
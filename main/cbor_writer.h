@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Minimal CBOR (RFC 8949) encoder into a caller-provided buffer
+ * Only what the API needs: definite-length maps/arrays, integers, float32,
+ * booleans and text. Writes past the end set overflow instead of failing
+ * each call; check it once at the end. */
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+} cbor_writer_t;
+
+/**
+ * Start writing into a buffer
+ * @param w Writer to initialize
+ * @param buf Output buffer
+ * @param cap Size of buf
+ */
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap);
+
+/**
+ * Start a map of count key/value pairs
+ * @param w Writer
+ * @param count Number of pairs that follow
+ */
+void cbor_put_map(cbor_writer_t *w, size_t count);
+
+/**
+ * Start an array of count items
+ * @param w Writer
+ * @param count Number of items that follow
+ */
+void cbor_put_array(cbor_writer_t *w, size_t count);
+
+/**
+ * Write an unsigned integer (also used for map keys)
+ * @param w Writer
+ * @param value Value
+ */
+void cbor_put_uint(cbor_writer_t *w, uint64_t value);
+
+/**
+ * Write a signed integer
+ * @param w Writer
+ * @param value Value
+ */
+void cbor_put_int(cbor_writer_t *w, int64_t value);
+
+/**
+ * Write a single-precision float
+ * @param w Writer
+ * @param value Value
+ */
+void cbor_put_float(cbor_writer_t *w, float value);
+
+/**
+ * Write a boolean
+ * @param w Writer
+ * @param value Value
+ */
+void cbor_put_bool(cbor_writer_t *w, bool value);
+
+/**
+ * Write a UTF-8 text string
+ * @param w Writer
+ * @param str NUL-terminated string (NULL is written as "")
+ */
+void cbor_put_text(cbor_writer_t *w, const char *str);
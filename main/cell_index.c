@@ -0,0 +1,140 @@
+#include "cell_index.h"
+#include "time_manager.h"
+#include "supervisor.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <math.h>
+
+static const char *TAG = "cell_index";
+
+/* NVS keys */
+static const char NVS_NAMESPACE[] = "cell_index";
+static const char NVS_KEY_ENTRIES[] = "entries2";    /* With the timebase */
+
+#define CELL_INDEX_SIZE         CONFIG_CHARGER_CELL_INDEX_SIZE
+#define CELL_RESUME_WINDOW_SEC  CONFIG_CHARGER_RESUME_WINDOW_SEC
+#define CELL_RESUME_TOLERANCE   (CONFIG_CHARGER_RESUME_VOLTAGE_MV / 1000.0f)
+
+/* Newest entry first */
+static cell_index_entry_t s_entries[CELL_INDEX_SIZE];
+static size_t s_count = 0;
+
+/* Age of an entry in seconds, or -1 if its time can't be compared with
+ * now: boot-relative from another boot, or UTC while not synced. A
+ * boot-relative time from this boot maps to UTC once synced. */
+static int64_t entry_age_sec(const cell_index_entry_t *entry, int64_t now_ns)
+{
+    int64_t removed_ns = entry->removed_at_sec * 1000000000LL;
+    if (!entry->utc) {
+        const uint32_t boot = supervisor_get_boot_count();
+        if (boot == 0 || entry->boot_count != boot) {
+            return -1;
+        }
+        removed_ns = time_manager_to_utc_ns(removed_ns);
+    }
+    if (time_manager_is_utc(removed_ns) != time_manager_is_utc(now_ns)) {
+        return -1;
+    }
+    return (now_ns - removed_ns) / 1000000000LL;
+}
+
+static void cell_index_save(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS for writing");
+        return;
+    }
+
+    err = nvs_set_blob(nvs_handle, NVS_KEY_ENTRIES, s_entries, s_count * sizeof(cell_index_entry_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save cell index: %s", esp_err_to_name(err));
+    }
+}
+
+esp_err_t cell_index_init(void)
+{
+    s_count = 0;
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        ESP_LOGI(TAG, "No cell index in NVS yet");
+        return ESP_OK;
+    }
+
+    size_t len = sizeof(s_entries);
+    const esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_ENTRIES, s_entries, &len);
+    nvs_close(nvs_handle);
+
+    if (err == ESP_OK && len % sizeof(cell_index_entry_t) == 0) {
+        s_count = len / sizeof(cell_index_entry_t);
+        ESP_LOGI(TAG, "Loaded %u recently removed cells", (unsigned)s_count);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Ignoring unreadable cell index (%s)", esp_err_to_name(err));
+    }
+    return ESP_OK;
+}
+
+void cell_index_record_removal(const char *cell_id, float last_voltage, uint32_t charging_time_sec)
+{
+    if (cell_id == NULL || cell_id[0] == '\0') {
+        return;
+    }
+
+    /* Drop an older entry for the same cell and make room at the front */
+    size_t keep = 0;
+    for (size_t i = 0; i < s_count; i++) {
+        if (strcmp(s_entries[i].cell_id, cell_id) != 0) {
+            s_entries[keep++] = s_entries[i];
+        }
+    }
+    s_count = keep < CELL_INDEX_SIZE ? keep : CELL_INDEX_SIZE - 1;
+    memmove(&s_entries[1], &s_entries[0], s_count * sizeof(cell_index_entry_t));
+
+    cell_index_entry_t *entry = &s_entries[0];
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->cell_id, cell_id, sizeof(entry->cell_id) - 1);
+    entry->last_voltage = last_voltage;
+    entry->charging_time_sec = charging_time_sec;
+    const int64_t now_ns = time_manager_get_timestamp_ns();
+    entry->removed_at_sec = now_ns / 1000000000LL;
+    entry->boot_count = supervisor_get_boot_count();
+    entry->utc = time_manager_is_utc(now_ns);
+    s_count++;
+
+    cell_index_save();
+}
+
+bool cell_index_match(float voltage, cell_index_entry_t *out)
+{
+    const int64_t now_ns = time_manager_get_timestamp_ns();
+
+    for (size_t i = 0; i < s_count; i++) {
+        const cell_index_entry_t *entry = &s_entries[i];
+        const int64_t age = entry_age_sec(entry, now_ns);
+        if (age < 0 || age > CELL_RESUME_WINDOW_SEC) {
+            continue;
+        }
+        if (fabsf(voltage - entry->last_voltage) > CELL_RESUME_TOLERANCE) {
+            continue;
+        }
+
+        *out = *entry;
+        memmove(&s_entries[i], &s_entries[i + 1], (s_count - i - 1) * sizeof(cell_index_entry_t));
+        s_count--;
+        cell_index_save();
+
+        ESP_LOGI(TAG, "Matched %s (removed %llds ago, %.3fV -> %.3fV)",
+                 out->cell_id, (long long)age, out->last_voltage, voltage);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/* One recently removed cell */
+typedef struct {
+    char cell_id[24];
+    float last_voltage;          /* Smoothed voltage just before removal (V) */
+    uint32_t charging_time_sec;  /* Session age at removal */
+    int64_t removed_at_sec;      /* Time of removal (time_manager), UTC or since boot */
+    uint32_t boot_count;         /* Boot it was removed in (supervisor) */
+    bool utc;                    /* removed_at_sec is UTC rather than since boot */
+} cell_index_entry_t;
+
+/**
+ * Load the index of recently removed cells from NVS
+ * @return ESP_OK on success (an empty index is not an error)
+ */
+esp_err_t cell_index_init(void);
+
+/**
+ * Remember a removed cell so it can be recognised when re-inserted
+ * @param cell_id ID of the removed cell
+ * @param last_voltage Voltage before removal (V)
+ * @param charging_time_sec Session age at removal
+ */
+void cell_index_record_removal(const char *cell_id, float last_voltage, uint32_t charging_time_sec);
+
+/**
+ * Look for a recently removed cell matching a newly inserted one
+ * A match must have been removed within the resume window and have a
+ * voltage within tolerance. Times since boot only compare within the
+ * boot they were taken in, and a UTC removal only once synced again. The matched entry is taken out of the index.
+ * @param voltage Voltage of the inserted cell (V)
+ * @param out Filled with the matching entry
+ * @return true if a cell matched
+ */
+bool cell_index_match(float voltage, cell_index_entry_t *out);
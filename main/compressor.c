@@ -0,0 +1,294 @@
+#include "compressor.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* Swinging door compression
+ *
+ * A segment starts at the last emitted (archive) point A. For every new
+ * point P the "door" keeps the range of slopes from A that pass within
+ * +/- bound of every point seen since A. When that range becomes empty,
+ * the segment is closed at the previous point H: the value emitted at H's
+ * time lies on a slope from the range, so the straight line between two
+ * emitted points stays within the bound of every skipped sample. Voltage
+ * and the two temperatures each have their own door; any one opening closes
+ * the segment for all. Without an NTC the cell temperature is NAN, which
+ * never narrows its door.
+ *
+ * The samples a segment skips are kept until it closes and then checked
+ * against the emitted line, so the reported error is measured rather than
+ * assumed from the bound.
+ */
+
+static compressor_config_t s_cfg;
+static compressor_stats_t s_stats;
+
+static bool s_have_archive = false;
+static sensor_data_t s_archive;
+static int64_t s_archive_t_us = 0;
+
+static bool s_have_held = false;
+static sensor_data_t s_held;
+static int64_t s_held_t_us = 0;
+
+/* Samples skipped since the archive point, for the error statistics */
+typedef struct {
+    float dt;                 /* Seconds after the archive point */
+    float voltage;
+    float internal_temp;
+    float cell_temp;
+} dropped_t;
+
+static dropped_t s_dropped[COMPRESSOR_SEGMENT_MAX];
+static uint16_t s_dropped_count = 0;
+
+/* Feasible slope range per channel (units per second) */
+static float s_v_up, s_v_low;
+static float s_t_up, s_t_low;
+static float s_c_up, s_c_low;    /* Cell (NTC) temperature */
+
+void compressor_get_default_config(compressor_config_t *cfg)
+{
+#if CONFIG_CHARGER_COMPRESS_SWINGING_DOOR
+    cfg->mode = COMPRESSOR_MODE_SWINGING_DOOR;
+#elif CONFIG_CHARGER_COMPRESS_DEADBAND
+    cfg->mode = COMPRESSOR_MODE_DEADBAND;
+#else
+    cfg->mode = COMPRESSOR_MODE_OFF;
+#endif
+    cfg->voltage_bound = CONFIG_CHARGER_COMPRESS_VOLTAGE_MV / 1000.0f;
+    cfg->temp_bound = CONFIG_CHARGER_COMPRESS_TEMP_DECI_C / 10.0f;
+    cfg->max_gap_sec = CONFIG_CHARGER_COMPRESS_MAX_GAP_SEC;
+}
+
+static void reset_door(void)
+{
+    s_v_up = FLT_MAX;
+    s_v_low = -FLT_MAX;
+    s_t_up = FLT_MAX;
+    s_t_low = -FLT_MAX;
+    s_c_up = FLT_MAX;
+    s_c_low = -FLT_MAX;
+}
+
+void compressor_init(const compressor_config_t *cfg)
+{
+    if (cfg) {
+        s_cfg = *cfg;
+    } else {
+        compressor_get_default_config(&s_cfg);
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_have_archive = false;
+    s_have_held = false;
+    reset_door();
+}
+
+void compressor_set_config(const compressor_config_t *cfg)
+{
+    const bool mode_changed = cfg->mode != s_cfg.mode;
+    s_cfg = *cfg;
+    if (mode_changed) {
+        s_have_archive = false;
+        s_have_held = false;
+        reset_door();
+    }
+}
+
+static void set_archive(const sensor_data_t *p, int64_t t_us)
+{
+    s_archive = *p;
+    s_archive_t_us = t_us;
+    s_have_archive = true;
+    s_have_held = false;
+    s_dropped_count = 0;
+    reset_door();
+}
+
+/* NAN channels (no NTC) compare as no error */
+static void track_error(float voltage_err, float temp_err, float cell_err)
+{
+    voltage_err = fabsf(voltage_err);
+    temp_err = fmaxf(fabsf(temp_err), isnan(cell_err) ? 0.0f : fabsf(cell_err));
+    if (voltage_err > s_stats.max_voltage_err) {
+        s_stats.max_voltage_err = voltage_err;
+    }
+    if (temp_err > s_stats.max_temp_err) {
+        s_stats.max_temp_err = temp_err;
+    }
+}
+
+/* The held point won't be emitted. Deadband reconstructs it as the
+ * archive value; swinging door only knows its line once the segment
+ * closes, so it is kept until then. */
+static void drop_held(void)
+{
+    if (!s_have_held) {
+        return;
+    }
+    if (s_cfg.mode == COMPRESSOR_MODE_DEADBAND) {
+        track_error(s_held.battery_voltage - s_archive.battery_voltage,
+                    s_held.internal_temp - s_archive.internal_temp,
+                    s_held.cell_temp - s_archive.cell_temp);
+    } else if (s_dropped_count < COMPRESSOR_SEGMENT_MAX) {
+        dropped_t *d = &s_dropped[s_dropped_count++];
+        d->dt = (float)(s_held_t_us - s_archive_t_us) / 1000000.0f;
+        d->voltage = s_held.battery_voltage;
+        d->internal_temp = s_held.internal_temp;
+        d->cell_temp = s_held.cell_temp;
+    }
+    s_have_held = false;
+}
+
+static void emit(sensor_data_t *out, size_t *n, const sensor_data_t *p)
+{
+    out[(*n)++] = *p;
+    s_stats.points_out++;
+}
+
+/* Close the open segment at the held point and make it the new archive */
+static void close_segment(sensor_data_t *out, size_t *n)
+{
+    sensor_data_t end = s_held;
+
+    if (s_cfg.mode == COMPRESSOR_MODE_SWINGING_DOOR) {
+        const float dt = (float)(s_held_t_us - s_archive_t_us) / 1000000.0f;
+        end.battery_voltage = s_archive.battery_voltage + dt * 0.5f * (s_v_up + s_v_low);
+        end.internal_temp = s_archive.internal_temp + dt * 0.5f * (s_t_up + s_t_low);
+        end.cell_temp = s_archive.cell_temp + dt * 0.5f * (s_c_up + s_c_low);
+
+        /* Every sample of the segment against the line A-end */
+        track_error(end.battery_voltage - s_held.battery_voltage,
+                    end.internal_temp - s_held.internal_temp,
+                    end.cell_temp - s_held.cell_temp);
+        for (uint16_t i = 0; i < s_dropped_count; i++) {
+            const dropped_t *d = &s_dropped[i];
+            const float f = d->dt / dt;
+            track_error(s_archive.battery_voltage + f * (end.battery_voltage - s_archive.battery_voltage) - d->voltage,
+                        s_archive.internal_temp + f * (end.internal_temp - s_archive.internal_temp) - d->internal_temp,
+                        s_archive.cell_temp + f * (end.cell_temp - s_archive.cell_temp) - d->cell_temp);
+        }
+    }
+
+    emit(out, n, &end);
+    set_archive(&end, s_held_t_us);
+}
+
+/* Narrow the door with point p; returns false if it no longer closes */
+static bool door_admits(const sensor_data_t *p, int64_t t_us)
+{
+    const float dt = (float)(t_us - s_archive_t_us) / 1000000.0f;
+    const float dv = p->battery_voltage - s_archive.battery_voltage;
+    const float dtemp = p->internal_temp - s_archive.internal_temp;
+    const float dcell = p->cell_temp - s_archive.cell_temp;
+
+    const float v_up = fminf(s_v_up, (dv + s_cfg.voltage_bound) / dt);
+    const float v_low = fmaxf(s_v_low, (dv - s_cfg.voltage_bound) / dt);
+    const float t_up = fminf(s_t_up, (dtemp + s_cfg.temp_bound) / dt);
+    const float t_low = fmaxf(s_t_low, (dtemp - s_cfg.temp_bound) / dt);
+    const float c_up = fminf(s_c_up, (dcell + s_cfg.temp_bound) / dt);
+    const float c_low = fmaxf(s_c_low, (dcell - s_cfg.temp_bound) / dt);
+
+    if (v_up < v_low || t_up < t_low || c_up < c_low) {
+        return false;
+    }
+    s_v_up = v_up;
+    s_v_low = v_low;
+    s_t_up = t_up;
+    s_t_low = t_low;
+    s_c_up = c_up;
+    s_c_low = c_low;
+    return true;
+}
+
+/* A new internal resistance estimate; NAN means none yet */
+static bool ir_changed(float a, float b)
+{
+    return isnan(a) ? !isnan(b) : a != b;
+}
+
+size_t compressor_push(const sensor_data_t *in, int64_t t_us, sensor_data_t *out)
+{
+    size_t n = 0;
+    s_stats.points_in++;
+
+    if (s_cfg.mode == COMPRESSOR_MODE_OFF) {
+        emit(out, &n, in);
+        return n;
+    }
+
+    if (!s_have_archive) {
+        emit(out, &n, in);
+        set_archive(in, t_us);
+        return n;
+    }
+
+    /* Nothing to record while the bay stays empty */
+    if (!in->cell_present && !s_archive.cell_present) {
+        return 0;
+    }
+
+    if (t_us <= s_archive_t_us) {
+        return 0;
+    }
+
+    const bool discrete_change = in->cell_present != s_archive.cell_present ||
+                                 in->charge_state != s_archive.charge_state ||
+                                 in->over_temp != s_archive.over_temp ||
+                                 ir_changed(in->ir_mohm, s_archive.ir_mohm) ||
+                                 strcmp(in->cell_id, s_archive.cell_id) != 0;
+    const bool gap_expired = (t_us - s_archive_t_us) >= (int64_t)s_cfg.max_gap_sec * 1000000LL;
+
+    if (discrete_change || gap_expired) {
+        if (s_have_held) {
+            close_segment(out, &n);
+        }
+        emit(out, &n, in);
+        set_archive(in, t_us);
+        return n;
+    }
+
+    if (s_cfg.mode == COMPRESSOR_MODE_DEADBAND) {
+        if (fabsf(in->battery_voltage - s_archive.battery_voltage) > s_cfg.voltage_bound ||
+            fabsf(in->internal_temp - s_archive.internal_temp) > s_cfg.temp_bound ||
+            fabsf(in->cell_temp - s_archive.cell_temp) > s_cfg.temp_bound) {
+            drop_held();
+            emit(out, &n, in);
+            set_archive(in, t_us);
+        } else {
+            drop_held();
+            s_held = *in;
+            s_held_t_us = t_us;
+            s_have_held = true;
+        }
+        return n;
+    }
+
+    if (!door_admits(in, t_us) || (s_have_held && s_dropped_count == COMPRESSOR_SEGMENT_MAX)) {
+        /* Held point always exists here: a single point always fits the
+         * door. A full segment closes at the held point too; the door
+         * narrowed by this sample still holds every earlier one. */
+        close_segment(out, &n);
+        door_admits(in, t_us);
+    }
+    drop_held();
+    s_held = *in;
+    s_held_t_us = t_us;
+    s_have_held = true;
+    return n;
+}
+
+size_t compressor_flush(sensor_data_t *out)
+{
+    size_t n = 0;
+    if (s_have_archive && s_have_held) {
+        close_segment(out, &n);
+    }
+    return n;
+}
+
+void compressor_get_stats(compressor_stats_t *stats)
+{
+    *stats = s_stats;
+}
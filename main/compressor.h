@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sensor.h"
+
+/* Maximum number of points a single push can emit */
+#define COMPRESSOR_MAX_EMIT  2
+
+/* Compression algorithm */
+typedef enum {
+    COMPRESSOR_MODE_OFF,            /* Emit every sample */
+    COMPRESSOR_MODE_DEADBAND,       /* Emit when a value leaves +/- bound of the last emitted one */
+    COMPRESSOR_MODE_SWINGING_DOOR   /* Emit segment end points, linear reconstruction */
+} compressor_mode_t;
+
+/* Compression settings */
+typedef struct {
+    compressor_mode_t mode;
+    float voltage_bound;      /* Max reconstruction error for voltage (V) */
+    float temp_bound;         /* Max reconstruction error for temperature (°C) */
+    uint32_t max_gap_sec;     /* Always emit at least one point this often */
+} compressor_config_t;
+
+/* Maximum number of samples between two emitted points in swinging door
+ * mode; each is kept until the segment closes so its reconstruction error
+ * can be measured. A longer segment is closed early. */
+#define COMPRESSOR_SEGMENT_MAX  128
+
+/* Compression statistics since init
+ * The errors are |reconstructed - measured| over every pushed sample, with
+ * the curve rebuilt from the emitted points the way the mode intends:
+ * straight lines for swinging door, the last value held for deadband. */
+typedef struct {
+    uint32_t points_in;       /* Samples pushed */
+    uint32_t points_out;      /* Points emitted */
+    float max_voltage_err;    /* Largest voltage reconstruction error (V) */
+    float max_temp_err;       /* Largest die or cell temperature reconstruction error (°C) */
+} compressor_stats_t;
+
+/**
+ * Fill a config with the Kconfig defaults
+ * @param cfg Config to fill
+ */
+void compressor_get_default_config(compressor_config_t *cfg);
+
+/**
+ * Initialize (or reset) the compressor
+ * @param cfg Settings to use, or NULL for the Kconfig defaults
+ */
+void compressor_init(const compressor_config_t *cfg);
+
+/**
+ * Replace the settings without resetting statistics
+ * Call from the sampling task. A mode change restarts the current segment,
+ * so the next sample is always emitted.
+ * @param cfg New settings
+ */
+void compressor_set_config(const compressor_config_t *cfg);
+
+/**
+ * Feed one sample to the compressor
+ * Charge state, over-temperature, cell and presence changes always close
+ * the current segment so discrete fields are reproduced exactly.
+ * @param in Sample (after sensor_read and scheduler_update)
+ * @param t_us Monotonic sample time (esp_timer_get_time)
+ * @param out Array of COMPRESSOR_MAX_EMIT points to fill
+ * @return Number of points written to out (0..COMPRESSOR_MAX_EMIT)
+ */
+size_t compressor_push(const sensor_data_t *in, int64_t t_us, sensor_data_t *out);
+
+/**
+ * Close the open segment and emit its end point, if any
+ * @param out Point to fill
+ * @return Number of points written to out (0 or 1)
+ */
+size_t compressor_flush(sensor_data_t *out);
+
+/**
+ * Get compression statistics
+ * @param stats Pointer to store statistics
+ */
+void compressor_get_stats(compressor_stats_t *stats);
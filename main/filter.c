@@ -0,0 +1,389 @@
+#include "filter.h"
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+#include <math.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+/* Interval-dependent coefficients are redesigned when the interval moves
+ * by more than this fraction (scheduler mode change, not jitter) */
+#define FILTER_DT_TOLERANCE   0.05
+
+#define FILTER_EMA_ALPHA      0.1f  /* Weight per second (0.1 = 10% new, 90% old at 1 Hz) */
+
+#define EMA_SHIFT             16    /* Q16 weight */
+#define BIQUAD_SHIFT          28    /* Q4.28 coefficients */
+#define BIQUAD_STATE_SHIFT    8     /* Biquad state in 1/256 uV, against dead band */
+#define KALMAN_SHIFT          24    /* Q24 gains; the slope gain gets small */
+
+/* Readings this many sigma off the prediction, twice in a row and on the
+ * same side, are a step (charger start/stop), not noise: re-seed */
+#define KALMAN_STEP_SIGMA     5
+
+/* Bilinear transform stops behaving near Nyquist */
+#define BIQUAD_MAX_FC_RATIO   0.45
+
+static const char *const s_stage_names[FILTER_STAGE_COUNT] = {
+    "trimmed_mean", "median", "boxcar", "cic2", "ema", "biquad", "kalman",
+};
+
+/* Only the sampling task changes the config */
+static filter_config_t s_cfg = {
+    .decimator = CONFIG_CHARGER_FILTER_DECIMATOR,
+    .stages = CONFIG_CHARGER_FILTER_STAGES,
+    .ema_alpha = FILTER_EMA_ALPHA,
+    .cutoff_mhz = CONFIG_CHARGER_FILTER_CUTOFF_MHZ,
+    .kalman_noise_uv = CONFIG_CHARGER_FILTER_KALMAN_NOISE_UV,
+    .kalman_accel_uv_s2 = CONFIG_CHARGER_FILTER_KALMAN_ACCEL_NV_S2 / 1000.0f,
+};
+static bool s_primed = false;
+static int64_t s_last_us = 0;
+
+/* EMA */
+static int32_t s_ema_uv;
+static int32_t s_ema_gain_q16;
+static int64_t s_ema_dt_us = 0;
+
+/* Biquad, direct form I */
+static int32_t s_bq_b[3];
+static int32_t s_bq_a[2];                 /* a1, a2 (a0 = 1) */
+static int64_t s_bq_x[2];                 /* Inputs, 1/256 uV */
+static int64_t s_bq_y[2];                 /* Outputs, 1/256 uV */
+static int64_t s_bq_dt_us = 0;
+
+/* Kalman: voltage and slope, steady-state (alpha-beta) gains */
+static int64_t s_kf_nv;
+static int64_t s_kf_slope_nv_s;
+static int32_t s_kf_alpha_q24;
+static int32_t s_kf_beta_q24;
+static int64_t s_kf_dt_us = 0;
+static int s_kf_outliers = 0;           /* Consecutive, signed by side */
+
+/* Cost per stage; decimation may run in httpd (calibration capture) */
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static filter_stage_stats_t s_stats[FILTER_STAGE_COUNT];
+static uint64_t s_total_cycles[FILTER_STAGE_COUNT];
+
+void filter_get_default_config(filter_config_t *cfg)
+{
+    cfg->decimator = CONFIG_CHARGER_FILTER_DECIMATOR;
+    cfg->stages = CONFIG_CHARGER_FILTER_STAGES;
+    cfg->ema_alpha = FILTER_EMA_ALPHA;
+    cfg->cutoff_mhz = CONFIG_CHARGER_FILTER_CUTOFF_MHZ;
+    cfg->kalman_noise_uv = CONFIG_CHARGER_FILTER_KALMAN_NOISE_UV;
+    cfg->kalman_accel_uv_s2 = CONFIG_CHARGER_FILTER_KALMAN_ACCEL_NV_S2 / 1000.0f;
+}
+
+static void record(filter_stage_t stage, uint32_t cycles)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    filter_stage_stats_t *st = &s_stats[stage];
+    st->calls++;
+    s_total_cycles[stage] += cycles;
+    if (cycles > st->max_cycles) {
+        st->max_cycles = cycles;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static bool needs_design(int64_t dt_us, int64_t *designed_dt_us)
+{
+    if (*designed_dt_us != 0 &&
+        fabs((double)(dt_us - *designed_dt_us)) <= FILTER_DT_TOLERANCE * (double)*designed_dt_us) {
+        return false;
+    }
+    *designed_dt_us = dt_us;
+    return true;
+}
+
+/* ---- Decimators (ADC codes) ---- */
+
+static void sort_codes(int *v, size_t n)
+{
+    for (size_t i = 1; i < n; i++) {
+        const int x = v[i];
+        size_t j = i;
+        while (j > 0 && v[j - 1] > x) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+int filter_trimmed_mean(int *samples, size_t n)
+{
+    sort_codes(samples, n);
+    const size_t drop = n / 4;
+    int sum = 0;
+    for (size_t i = drop; i < n - drop; i++) {
+        sum += samples[i];
+    }
+    return sum / (int)(n - 2 * drop);
+}
+
+static int median(int *samples, size_t n)
+{
+    sort_codes(samples, n);
+    return (n & 1) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2] + 1) / 2;
+}
+
+static int boxcar(const int *samples, size_t n)
+{
+    int sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    return (sum + (int)n / 2) / (int)n;
+}
+
+/* Two integrators over the burst and one order-2 comb with delay R = n/2
+ * at the last sample: y = I2[2R-1] - 2 I2[R-1], gain R^2 */
+static int cic2(const int *samples, size_t n)
+{
+    const size_t r = n / 2;
+    const size_t first = n - 2 * r;       /* Odd burst: skip the oldest code */
+    if (r == 0) {
+        return samples[0];
+    }
+    int32_t i1 = 0;
+    int32_t i2 = 0;
+    int32_t i2_mid = 0;
+    for (size_t k = first; k < n; k++) {
+        i1 += samples[k];
+        i2 += i1;
+        if (k == first + r - 1) {
+            i2_mid = i2;
+        }
+    }
+    const int32_t gain = (int32_t)(r * r);
+    return (i2 - 2 * i2_mid + gain / 2) / gain;
+}
+
+int filter_decimate(int *samples, size_t n)
+{
+    const filter_stage_t stage = (filter_stage_t)s_cfg.decimator;
+    const uint32_t start = esp_cpu_get_cycle_count();
+    int code;
+    switch (stage) {
+        case FILTER_STAGE_MEDIAN: code = median(samples, n);              break;
+        case FILTER_STAGE_BOXCAR: code = boxcar(samples, n);              break;
+        case FILTER_STAGE_CIC2:   code = cic2(samples, n);                break;
+        default:                  code = filter_trimmed_mean(samples, n); break;
+    }
+    record(stage < FILTER_DECIMATOR_COUNT ? stage : FILTER_STAGE_TRIMMED_MEAN,
+           esp_cpu_get_cycle_count() - start);
+    return code;
+}
+
+/* ---- Smoothing stages (uV) ---- */
+
+static int32_t ema_run(int32_t x, int64_t dt_us)
+{
+    if (needs_design(dt_us, &s_ema_dt_us)) {
+        /* Same weight per second at every sample rate */
+        const double gain = 1.0 - pow(1.0 - s_cfg.ema_alpha, dt_us / 1e6);
+        s_ema_gain_q16 = (int32_t)lround(gain * (1 << EMA_SHIFT));
+    }
+    const int64_t step = (int64_t)(x - s_ema_uv) * s_ema_gain_q16;
+    s_ema_uv += (int32_t)((step + (1 << (EMA_SHIFT - 1))) >> EMA_SHIFT);
+    return s_ema_uv;
+}
+
+static void biquad_design(int64_t dt_us)
+{
+    const double fs = 1e6 / (double)dt_us;
+    double fc = s_cfg.cutoff_mhz / 1000.0;
+    if (fc > BIQUAD_MAX_FC_RATIO * fs) {
+        fc = BIQUAD_MAX_FC_RATIO * fs;
+    }
+    const double k = tan(M_PI * fc / fs);
+    const double norm = 1.0 / (1.0 + M_SQRT2 * k + k * k);
+    const double one = (double)(1 << BIQUAD_SHIFT);
+    s_bq_a[0] = (int32_t)lround(2.0 * (k * k - 1.0) * norm * one);
+    s_bq_a[1] = (int32_t)lround((1.0 - M_SQRT2 * k + k * k) * norm * one);
+
+    /* Numerator from the quantised denominator, so DC gain is exactly 1 */
+    const int32_t sum = (1 << BIQUAD_SHIFT) + s_bq_a[0] + s_bq_a[1];
+    s_bq_b[0] = sum / 4;
+    s_bq_b[2] = sum / 4;
+    s_bq_b[1] = sum - 2 * (sum / 4);
+}
+
+/* Q4.28 coefficient times a 1/256 uV state passes int64 above about
+ * 25 V, within the divider range, so whole microvolts and the 1/256
+ * remainders are summed apart */
+typedef struct {
+    int64_t whole;
+    int64_t frac;
+} biquad_acc_t;
+
+static void biquad_mac(biquad_acc_t *acc, int32_t c, int64_t state)
+{
+    const int64_t whole = state >> BIQUAD_STATE_SHIFT;
+    acc->whole += (int64_t)c * whole;
+    acc->frac += (int64_t)c * (state - whole * (1 << BIQUAD_STATE_SHIFT));
+}
+
+static int32_t biquad_run(int32_t x, int64_t dt_us)
+{
+    if (needs_design(dt_us, &s_bq_dt_us)) {
+        biquad_design(dt_us);
+    }
+    const int64_t xq = (int64_t)x * (1 << BIQUAD_STATE_SHIFT);
+    biquad_acc_t acc = { 0, 0 };
+    biquad_mac(&acc, s_bq_b[0], xq);
+    biquad_mac(&acc, s_bq_b[1], s_bq_x[0]);
+    biquad_mac(&acc, s_bq_b[2], s_bq_x[1]);
+    biquad_mac(&acc, -s_bq_a[0], s_bq_y[0]);
+    biquad_mac(&acc, -s_bq_a[1], s_bq_y[1]);
+
+    /* (whole << STATE_SHIFT + frac) >> BIQUAD_SHIFT, rounded */
+    const int whole_shift = BIQUAD_SHIFT - BIQUAD_STATE_SHIFT;
+    const int64_t q = acc.whole >> whole_shift;
+    const int64_t r = acc.whole - q * (1LL << whole_shift);
+    const int64_t yq = q + ((r * (1 << BIQUAD_STATE_SHIFT) + acc.frac + (1LL << (BIQUAD_SHIFT - 1))) >> BIQUAD_SHIFT);
+    s_bq_x[1] = s_bq_x[0];
+    s_bq_x[0] = xq;
+    s_bq_y[1] = s_bq_y[0];
+    s_bq_y[0] = yq;
+    return (int32_t)((yq + (1 << (BIQUAD_STATE_SHIFT - 1))) >> BIQUAD_STATE_SHIFT);
+}
+
+/* Steady-state Kalman gains of the constant-slope model for this interval
+ * (Kalata's tracking index) */
+static void kalman_design(int64_t dt_us)
+{
+    const double dt = dt_us / 1e6;
+    const double lambda = s_cfg.kalman_accel_uv_s2 * dt * dt / (double)s_cfg.kalman_noise_uv;
+    const double r = (4.0 + lambda - sqrt(8.0 * lambda + lambda * lambda)) / 4.0;
+    const double one = (double)(1 << KALMAN_SHIFT);
+    s_kf_alpha_q24 = (int32_t)lround((1.0 - r * r) * one);
+    s_kf_beta_q24 = (int32_t)lround(2.0 * (1.0 - r) * (1.0 - r) * one);
+}
+
+static int32_t kalman_run(int32_t x, int64_t dt_us)
+{
+    if (needs_design(dt_us, &s_kf_dt_us)) {
+        kalman_design(dt_us);
+    }
+    const int64_t predicted = s_kf_nv + s_kf_slope_nv_s * dt_us / 1000000;
+    const int64_t residual = (int64_t)x * 1000 - predicted;
+    const int64_t gate_nv = (int64_t)s_cfg.kalman_noise_uv * 1000 * KALMAN_STEP_SIGMA;
+    if (residual > gate_nv || residual < -gate_nv) {
+        const int side = residual > 0 ? 1 : -1;
+        s_kf_outliers = (s_kf_outliers * side > 0) ? s_kf_outliers + side : side;
+        if (s_kf_outliers * side >= 2) {
+            s_kf_nv = (int64_t)x * 1000;
+            s_kf_slope_nv_s = 0;
+            s_kf_outliers = 0;
+            return x;
+        }
+        /* A lone outlier only moves the prediction, not the slope */
+        s_kf_nv = predicted;
+        return (int32_t)((s_kf_nv + 500) / 1000);
+    }
+    s_kf_outliers = 0;
+    s_kf_nv = predicted + ((residual * s_kf_alpha_q24) >> KALMAN_SHIFT);
+    s_kf_slope_nv_s += ((residual * s_kf_beta_q24) >> KALMAN_SHIFT) * 1000000 / dt_us;
+    return (int32_t)((s_kf_nv + 500) / 1000);
+}
+
+static void seed_stage(filter_stage_t stage, int32_t uv)
+{
+    switch (stage) {
+        case FILTER_STAGE_EMA:
+            s_ema_uv = uv;
+            break;
+        case FILTER_STAGE_BIQUAD:
+            /* Steady state at uv */
+            s_bq_x[0] = s_bq_x[1] = (int64_t)uv * (1 << BIQUAD_STATE_SHIFT);
+            s_bq_y[0] = s_bq_y[1] = (int64_t)uv * (1 << BIQUAD_STATE_SHIFT);
+            break;
+        case FILTER_STAGE_KALMAN:
+            s_kf_nv = (int64_t)uv * 1000;
+            s_kf_slope_nv_s = 0;
+            s_kf_outliers = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+static bool in_chain(filter_stage_t stage)
+{
+    return (s_cfg.stages & FILTER_STAGE_BIT(stage)) != 0;
+}
+
+void filter_set_config(const filter_config_t *cfg)
+{
+    /* Stages left out of the old chain have been following its output
+     * (see filter_push), so joining the chain doesn't jump */
+    s_cfg = *cfg;
+    s_ema_dt_us = 0;
+    s_bq_dt_us = 0;
+    s_kf_dt_us = 0;
+}
+
+void filter_reset(int32_t uv, int64_t t_us)
+{
+    for (filter_stage_t st = FILTER_STAGE_EMA; st < FILTER_STAGE_COUNT; st++) {
+        seed_stage(st, uv);
+    }
+    s_last_us = t_us;
+    s_primed = true;
+}
+
+int32_t filter_push(int32_t uv, int64_t t_us)
+{
+    if (!s_primed) {
+        filter_reset(uv, t_us);
+        return uv;
+    }
+    int64_t dt_us = t_us - s_last_us;
+    if (dt_us <= 0) {
+        dt_us = 1;
+    }
+    s_last_us = t_us;
+
+    /* Enum order: the low-pass stages feed the Kalman filter */
+    int32_t v = uv;
+    for (filter_stage_t stage = FILTER_STAGE_EMA; stage < FILTER_STAGE_COUNT; stage++) {
+        if (!in_chain(stage)) {
+            continue;
+        }
+        const uint32_t start = esp_cpu_get_cycle_count();
+        switch (stage) {
+            case FILTER_STAGE_EMA:    v = ema_run(v, dt_us);    break;
+            case FILTER_STAGE_BIQUAD: v = biquad_run(v, dt_us); break;
+            case FILTER_STAGE_KALMAN: v = kalman_run(v, dt_us); break;
+            default:                                            break;
+        }
+        record(stage, esp_cpu_get_cycle_count() - start);
+    }
+
+    /* Stages left out follow the output, ready to be switched in */
+    for (filter_stage_t st = FILTER_STAGE_EMA; st < FILTER_STAGE_COUNT; st++) {
+        if (!in_chain(st)) {
+            seed_stage(st, v);
+        }
+    }
+    return v;
+}
+
+void filter_get_stats(filter_stats_t *stats)
+{
+    stats->config = s_cfg;
+    portENTER_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < FILTER_STAGE_COUNT; i++) {
+        stats->stages[i] = s_stats[i];
+        stats->stages[i].avg_cycles = s_stats[i].calls ?
+            (uint32_t)(s_total_cycles[i] / s_stats[i].calls) : 0;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+const char *filter_stage_str(filter_stage_t stage)
+{
+    return stage < FILTER_STAGE_COUNT ? s_stage_names[stage] : "unknown";
+}
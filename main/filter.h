@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Battery voltage filter pipeline
+ *
+ * Two levels, both in integer arithmetic (no FPU on the C6):
+ *  - a decimator turns each oversampled burst of ADC codes into one code:
+ *    trimmed mean, median, boxcar (CIC order 1) or CIC order 2
+ *  - any of three smoothing stages runs on the resulting cell voltage
+ *    (uV) once per sample, in this order: EMA, 2nd-order Butterworth
+ *    low-pass (biquad) and a constant-slope Kalman filter
+ *
+ * The sample interval is set by the scheduler, so coefficients that depend
+ * on it are redesigned (in float) only when the interval changes; the
+ * per-sample work is fixed point. All state is static. Cycles spent in
+ * each stage are counted for /api/diag.
+ */
+
+/* Stages; the first four are decimators */
+typedef enum {
+    FILTER_STAGE_TRIMMED_MEAN,    /* Mean of the middle half */
+    FILTER_STAGE_MEDIAN,
+    FILTER_STAGE_BOXCAR,          /* Plain mean (CIC order 1) */
+    FILTER_STAGE_CIC2,            /* CIC order 2: triangular weights */
+    FILTER_STAGE_EMA,             /* Exponential moving average, time-scaled */
+    FILTER_STAGE_BIQUAD,          /* 2nd-order Butterworth low-pass */
+    FILTER_STAGE_KALMAN,          /* Voltage + slope, steady-state gains; re-seeds on steps */
+    FILTER_STAGE_COUNT
+} filter_stage_t;
+
+#define FILTER_DECIMATOR_COUNT  (FILTER_STAGE_CIC2 + 1)
+
+/* Bit of a smoothing stage in filter_config_t.stages */
+#define FILTER_STAGE_BIT(stage)  (1u << ((stage) - FILTER_DECIMATOR_COUNT))
+#define FILTER_STAGES_ALL        (FILTER_STAGE_BIT(FILTER_STAGE_COUNT) - 1)
+
+/* Tunable at runtime through params.c */
+typedef struct {
+    uint32_t decimator;           /* filter_stage_t, one of the decimators */
+    uint32_t stages;              /* Smoothing stages, FILTER_STAGE_BIT each: 1 EMA,
+                                   * 2 biquad, 4 Kalman (e.g. 6); 0 for none */
+    float ema_alpha;              /* EMA weight per second of elapsed time */
+    uint32_t cutoff_mhz;          /* Biquad corner frequency */
+    uint32_t kalman_noise_uv;     /* Reading noise (1 sigma) */
+    float kalman_accel_uv_s2;     /* How fast the slope may change (1 sigma) */
+} filter_config_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t avg_cycles;
+    uint32_t max_cycles;
+} filter_stage_stats_t;
+
+typedef struct {
+    filter_config_t config;
+    filter_stage_stats_t stages[FILTER_STAGE_COUNT];
+} filter_stats_t;
+
+/**
+ * Fill a config with the Kconfig defaults
+ * @param cfg Config to fill
+ */
+void filter_get_default_config(filter_config_t *cfg);
+
+/**
+ * Replace the configuration
+ * Call from the sampling task. Stages that stay in the chain keep their
+ * state; new ones start from the current output.
+ * @param cfg New configuration (stages within FILTER_STAGES_ALL)
+ */
+void filter_set_config(const filter_config_t *cfg);
+
+/**
+ * Reduce a burst of battery ADC codes with the configured decimator
+ * @param samples ADC codes (reordered in place), successful reads only
+ * @param n Number of codes (at least 1)
+ * @return One ADC code
+ */
+int filter_decimate(int *samples, size_t n);
+
+/**
+ * Trimmed mean of a burst, for channels outside the pipeline (NTC)
+ * @param samples ADC codes (sorted in place)
+ * @param n Number of codes (at least 1; below 4 none are trimmed)
+ * @return Mean of the middle half
+ */
+int filter_trimmed_mean(int *samples, size_t n);
+
+/**
+ * Restart the smoothing chain at a value, e.g. when a cell is inserted
+ * @param uv Cell voltage (uV)
+ * @param t_us Monotonic time of the reading (esp_timer_get_time)
+ */
+void filter_reset(int32_t uv, int64_t t_us);
+
+/**
+ * Run one reading through the smoothing chain
+ * The first reading after boot or filter_reset() primes the chain.
+ * @param uv Cell voltage (uV)
+ * @param t_us Monotonic time of the reading (esp_timer_get_time)
+ * @return Smoothed voltage (uV)
+ */
+int32_t filter_push(int32_t uv, int64_t t_us);
+
+/**
+ * Get the configuration and per-stage cost
+ * @param stats Filled with the current values
+ */
+void filter_get_stats(filter_stats_t *stats);
+
+/**
+ * Get the name of a stage
+ * @param stage Stage
+ * @return Name, e.g. "kalman"
+ */
+const char *filter_stage_str(filter_stage_t stage);
@@ -0,0 +1,157 @@
+#include "heap_monitor.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+#include "sdkconfig.h"
+
+#define HEAP_SAMPLE_US  (CONFIG_CHARGER_HEAP_SAMPLE_MIN * 60LL * 1000000LL)
+
+/* Written by the sampling task, read by httpd */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static heap_sample_t s_history[HEAP_HISTORY_LEN];
+static size_t s_count = 0;
+static uint32_t s_stride = 1;             /* Sample periods per history entry */
+static uint32_t s_periods = 0;            /* Sample periods elapsed */
+static int64_t s_next_us = HEAP_SAMPLE_US;
+
+/* Updated by every mbedTLS allocation, from any task */
+static portMUX_TYPE s_tls_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_tls_current = 0;
+static uint32_t s_tls_peak = 0;
+static uint32_t s_tls_mark_peak = 0;
+
+#if CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+
+/* Each block starts with its size so frees can be counted; 8 bytes keep
+ * the alignment heap_caps_calloc gives */
+#define TLS_BLOCK_HEADER  8
+
+static void tls_count(int32_t delta)
+{
+    portENTER_CRITICAL(&s_tls_lock);
+    s_tls_current += delta;
+    if (s_tls_current > s_tls_peak) {
+        s_tls_peak = s_tls_current;
+    }
+    if (s_tls_current > s_tls_mark_peak) {
+        s_tls_mark_peak = s_tls_current;
+    }
+    portEXIT_CRITICAL(&s_tls_lock);
+}
+
+/* Replace mbedTLS's allocator (same caps as CONFIG_MBEDTLS_INTERNAL_MEM_ALLOC) */
+void *esp_mbedtls_mem_calloc(size_t n, size_t size)
+{
+    if (size != 0 && n > (SIZE_MAX - TLS_BLOCK_HEADER) / size) {
+        return NULL;
+    }
+    const uint32_t bytes = n * size;
+    uint8_t *block = heap_caps_calloc(1, bytes + TLS_BLOCK_HEADER, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (block == NULL) {
+        return NULL;
+    }
+    memcpy(block, &bytes, sizeof(bytes));
+    tls_count(bytes);
+    return block + TLS_BLOCK_HEADER;
+}
+
+void esp_mbedtls_mem_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    uint8_t *block = (uint8_t *)ptr - TLS_BLOCK_HEADER;
+    uint32_t bytes;
+    memcpy(&bytes, block, sizeof(bytes));
+    tls_count(-(int32_t)bytes);
+    heap_caps_free(block);
+}
+
+#endif
+
+void heap_monitor_poll(void)
+{
+    const int64_t now = esp_timer_get_time();
+    if (now < s_next_us) {
+        return;
+    }
+    s_next_us += HEAP_SAMPLE_US;
+    s_periods++;
+    if (s_periods % s_stride != 0) {
+        return;
+    }
+
+    const heap_sample_t sample = {
+        .free = heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        .largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+    };
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_count == HEAP_HISTORY_LEN) {
+        /* Keep entries at even multiples of the doubled stride */
+        for (size_t i = 0; i < HEAP_HISTORY_LEN / 2; i++) {
+            s_history[i] = s_history[2 * i + 1];
+        }
+        s_count = HEAP_HISTORY_LEN / 2;
+        s_stride *= 2;
+    }
+    if (s_periods % s_stride == 0) {
+        s_history[s_count++] = sample;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+/* Slope of free heap over the history, bytes per day */
+static int32_t trend(const heap_sample_t *history, size_t n, uint32_t interval_sec)
+{
+    if (n < 3) {
+        return 0;
+    }
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double x = (double)i;
+        const double y = history[i].free;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    const double slope = (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+    return (int32_t)(slope * 86400.0 / interval_sec);
+}
+
+void heap_monitor_get_report(heap_report_t *report)
+{
+    portENTER_CRITICAL(&s_lock);
+    report->count = s_count;
+    report->interval_sec = s_stride * CONFIG_CHARGER_HEAP_SAMPLE_MIN * 60;
+    memcpy(report->history, s_history, s_count * sizeof(s_history[0]));
+    portEXIT_CRITICAL(&s_lock);
+
+    report->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    report->trend_bytes_per_day = trend(report->history, report->count, report->interval_sec);
+}
+
+uint32_t heap_monitor_tls_mark(void)
+{
+    portENTER_CRITICAL(&s_tls_lock);
+    s_tls_mark_peak = s_tls_current;
+    const uint32_t current = s_tls_current;
+    portEXIT_CRITICAL(&s_tls_lock);
+    return current;
+}
+
+void heap_monitor_get_tls(heap_tls_usage_t *usage)
+{
+    portENTER_CRITICAL(&s_tls_lock);
+#if CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+    usage->counted = true;
+#else
+    usage->counted = false;
+#endif
+    usage->current = s_tls_current;
+    usage->peak = s_tls_peak;
+    usage->mark_peak = s_tls_mark_peak;
+    portEXIT_CRITICAL(&s_tls_lock);
+}
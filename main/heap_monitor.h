@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Heap usage over the life of the firmware
+ *
+ * Free heap and largest free block are sampled every
+ * CONFIG_CHARGER_HEAP_SAMPLE_MIN. When the history is full, every other
+ * sample is dropped and the interval doubles, so a fixed-size history
+ * always covers the whole uptime: a week at hourly samples, two weeks at
+ * two-hourly and so on. A leak shows up as a negative trend.
+ */
+
+#define HEAP_HISTORY_LEN  64
+
+typedef struct {
+    uint32_t free;            /* Bytes free when sampled */
+    uint32_t largest_block;   /* Largest free block when sampled */
+} heap_sample_t;
+
+typedef struct {
+    uint32_t interval_sec;    /* Spacing of the history, grows as it is compacted */
+    size_t count;             /* Samples in history, oldest first */
+    heap_sample_t history[HEAP_HISTORY_LEN];
+    uint32_t min_free;        /* Lowest free heap since boot */
+    int32_t trend_bytes_per_day;  /* Least-squares slope of free heap, 0 until 3 samples */
+} heap_report_t;
+
+/* mbedTLS heap, counted when CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC routes its
+ * allocations through heap_monitor.c */
+typedef struct {
+    bool counted;             /* false: mbedTLS uses its own allocator */
+    uint32_t current;         /* Bytes held now (open TLS connections) */
+    uint32_t peak;            /* Most held at once since boot */
+    uint32_t mark_peak;       /* Most held since the last heap_monitor_tls_mark() */
+} heap_tls_usage_t;
+
+/**
+ * Sample the heap if the interval has passed
+ * Call from the sampling loop.
+ */
+void heap_monitor_poll(void);
+
+/**
+ * Get the history and trend
+ * @param report Filled with the current values
+ */
+void heap_monitor_get_report(heap_report_t *report);
+
+/**
+ * Start a new window for mark_peak, e.g. before a TLS handshake
+ * With several TLS clients the window covers all of them.
+ * @return Bytes held by mbedTLS now, the baseline of the window
+ */
+uint32_t heap_monitor_tls_mark(void);
+
+/**
+ * Get mbedTLS heap use
+ * @param usage Filled with the current values
+ */
+void heap_monitor_get_tls(heap_tls_usage_t *usage);
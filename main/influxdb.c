@@ -1,78 +1,138 @@
 #include "influxdb.h"
 #include "config.h"
+#include "scheduler.h"
 #include <stdio.h>
 #include <string.h>
-#include "esp_log.h"
-#include "esp_http_client.h"
+#include <math.h>
 
-static const char *TAG = "influxdb";
-
-esp_err_t influxdb_send(const sensor_data_t *data)
+int influxdb_format_point(const sensor_data_t *data, char *buf, size_t len)
 {
-    char url[384];
-    char post_data[512];
-    char auth_header[256];
-
-    /* Build InfluxDB URL with nanosecond precision */
-    snprintf(url, sizeof(url), "%s/api/v2/write?org=%s&bucket=%s&precision=ns",
-             g_config.influx_url, g_config.influx_org, g_config.influx_bucket);
-
     /* Build Line Protocol data for battery charging
      * Measurement: battery_charging
      * Tags: device (charger name), cell_id (unique per cell session)
-     * Fields: voltage, percentage, temp, charge_state, charging_time
+     * Fields: voltage, percentage, temp, cell_temp (NTC only), over_temp,
+     *         ir_mohm (once measured),
+     *         charge_state, charging_time,
+     *         scheduler decision (sample/upload interval, mode, reason)
      */
     const char *state_str = sensor_charge_state_str(data->charge_state);
     
-    snprintf(post_data, sizeof(post_data),
+    /* Cell temperature only where an NTC is fitted */
+    char cell_temp[24] = "";
+    if (!isnan(data->cell_temp)) {
+        snprintf(cell_temp, sizeof(cell_temp), "cell_temp=%.1f,", data->cell_temp);
+    }
+    
+    /* Internal resistance once a charge step has been captured */
+    char ir[24] = "";
+    if (!isnan(data->ir_mohm)) {
+        snprintf(ir, sizeof(ir), "ir_mohm=%.0f,", data->ir_mohm);
+    }
+    
+    return snprintf(buf, len,
              "battery_charging,device=%s,cell_id=%s "
-             "voltage=%.3f,percentage=%.1f,temp=%.1f,charge_state=\"%s\","
-             "charging_time_sec=%lui,cell_present=%s "
+             "voltage=%.3f,percentage=%.1f,temp=%.1f,%s%sover_temp=%s,charge_state=\"%s\","
+             "charging_time_sec=%lui,cell_present=%s,"
+             "sample_interval_ms=%lui,upload_interval_sec=%lui,"
+             "sched_mode=\"%s\",sched_reason=\"%s\" "
              "%lld",
              g_config.device_id,
              data->cell_id[0] ? data->cell_id : "none",
              data->battery_voltage,
              data->battery_percentage,
              data->internal_temp,
+             cell_temp,
+             ir,
+             data->over_temp ? "true" : "false",
              state_str,
              data->charging_time_sec,
              data->cell_present ? "true" : "false",
+             data->sample_interval_ms,
+             data->upload_interval_sec,
+             scheduler_mode_str(data->sched_mode),
+             scheduler_reason_str(data->sched_reason),
              data->timestamp_ns);
+}
 
-    /* Build authorization header */
-    snprintf(auth_header, sizeof(auth_header), "Token %s", g_config.influx_token);
-
-    ESP_LOGI(TAG, "Sending to InfluxDB: %s", post_data);
-
-    const esp_http_client_config_t http_config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .timeout_ms = 5000,
-    };
+int influxdb_format_batch(const sensor_data_t *points, size_t count, char *buf, size_t len)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (used + 1 >= len) {
+            return -1;
+        }
+        const int n = influxdb_format_point(&points[i], buf + used, len - used - 1);
+        if (n < 0 || (size_t)n >= len - used - 1) {
+            return -1;
+        }
+        used += n;
+        buf[used++] = '\n';
+    }
+    return (int)used;
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&http_config);
-    
-    esp_http_client_set_header(client, "Authorization", auth_header);
-    esp_http_client_set_header(client, "Content-Type", "text/plain");
-    esp_http_client_set_post_field(client, post_data, strlen(post_data));
+int influxdb_format_session(const session_summary_t *summary, char *buf, size_t len)
+{
+    char charge[32] = "";
+    char ir[24] = "";
 
-    esp_err_t err = esp_http_client_perform(client);
-    
-    if (err == ESP_OK) {
-        int status = esp_http_client_get_status_code(client);
-        ESP_LOGI(TAG, "InfluxDB HTTP Status = %d", status);
-        
-        if (status >= 200 && status < 300) {
-            ESP_LOGI(TAG, "Data sent to InfluxDB successfully");
-            err = ESP_OK;
-        } else {
-            ESP_LOGE(TAG, "InfluxDB returned error status: %d", status);
-            err = ESP_FAIL;
-        }
-    } else {
-        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+    if (summary->cc_charge_mah >= 0) {
+        snprintf(charge, sizeof(charge), ",cc_charge_mah=%.1f", summary->cc_charge_mah);
     }
+    if (summary->ir_mohm >= 0) {
+        snprintf(ir, sizeof(ir), ",ir_mohm=%.0f", summary->ir_mohm);
+    }
+
+    /* One record per session
+     * Measurement: battery_session
+     * Tags: device, cell_id
+     * Fields: voltages, peak temperature, time per state, time to CV/Full,
+     *         internal resistance (if measured)
+     */
+    return snprintf(buf, len,
+             "battery_session,device=%s,cell_id=%s "
+             "duration_sec=%lui,samples=%lui,"
+             "start_voltage=%.3f,end_voltage=%.3f,min_voltage=%.3f,max_voltage=%.3f,"
+             "peak_temp=%.1f,"
+             "time_charging_sec=%lui,time_full_sec=%lui,time_idle_sec=%lui,time_discharging_sec=%lui,"
+             "time_to_cv_sec=%ldi,time_to_full_sec=%ldi%s%s "
+             "%lld",
+             g_config.device_id,
+             summary->cell_id,
+             summary->duration_sec,
+             summary->samples,
+             summary->start_voltage,
+             summary->end_voltage,
+             summary->min_voltage,
+             summary->max_voltage,
+             summary->peak_temp,
+             summary->time_in_state_sec[CHARGE_STATE_CHARGING],
+             summary->time_in_state_sec[CHARGE_STATE_FULL],
+             summary->time_in_state_sec[CHARGE_STATE_IDLE],
+             summary->time_in_state_sec[CHARGE_STATE_DISCHARGING],
+             (long)summary->time_to_cv_sec,
+             (long)summary->time_to_full_sec,
+             charge,
+             ir,
+             summary->end_ns);
+}
 
-    esp_http_client_cleanup(client);
-    return err;
+int influxdb_format_alert(const anomaly_event_t *event, char *buf, size_t len)
+{
+    /* One record per alert
+     * Measurement: battery_alert
+     * Tags: device, cell_id, type
+     * Fields: measured value, threshold it crossed, their unit
+     */
+    return snprintf(buf, len,
+             "battery_alert,device=%s,cell_id=%s,type=%s "
+             "value=%.3f,threshold=%.3f,unit=\"%s\" "
+             "%lld",
+             g_config.device_id,
+             event->cell_id,
+             anomaly_type_str(event->type),
+             event->value,
+             event->threshold,
+             anomaly_unit_str(event->type),
+             event->timestamp_ns);
 }
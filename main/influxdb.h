@@ -1,11 +1,49 @@
 #pragma once
 
-#include "esp_err.h"
+#include <stddef.h>
 #include "sensor.h"
+#include "session.h"
+#include "anomaly.h"
+
+/* Upper bound for one line protocol point */
+#define INFLUXDB_LINE_MAX_LEN     640
+
+/* Maximum points per batched write */
+#define INFLUXDB_BATCH_MAX_POINTS 16
+
+/**
+ * Format one point as InfluxDB line protocol (no trailing newline)
+ * @param data Sensor/battery readings to format
+ * @param buf Output buffer
+ * @param len Size of output buffer
+ * @return Length of the line as returned by snprintf
+ */
+int influxdb_format_point(const sensor_data_t *data, char *buf, size_t len);
+
+/**
+ * Format points as a line protocol body, one point per line
+ * @param points Points to format
+ * @param count Number of points
+ * @param buf Output buffer
+ * @param len Size of output buffer
+ * @return Length of the body, -1 if it doesn't fit
+ */
+int influxdb_format_batch(const sensor_data_t *points, size_t count, char *buf, size_t len);
+
+/**
+ * Format a cell session summary (measurement battery_session)
+ * @param summary Summary of the closed session, with UTC timestamps
+ * @param buf Output buffer
+ * @param len Size of output buffer
+ * @return Length of the line as returned by snprintf
+ */
+int influxdb_format_session(const session_summary_t *summary, char *buf, size_t len);
 
 /**
- * Send battery charging data to InfluxDB
- * @param data Sensor/battery readings to send
- * @return ESP_OK on successful transmission (HTTP 2xx)
+ * Format an anomaly alert (measurement battery_alert)
+ * @param event Alert, with a UTC timestamp
+ * @param buf Output buffer
+ * @param len Size of output buffer
+ * @return Length of the line as returned by snprintf
  */
-esp_err_t influxdb_send(const sensor_data_t *data);
+int influxdb_format_alert(const anomaly_event_t *event, char *buf, size_t len);
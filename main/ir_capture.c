@@ -0,0 +1,309 @@
+#include "ir_capture.h"
+#include "sensor.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "static_alloc.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sdkconfig.h"
+
+static const char *TAG = "ir_capture";
+
+#if CONFIG_CHARGER_IR_ENABLE
+
+/* Below the thermal watchdog, above the sampler and the network tasks */
+#define IR_TASK_STACK       3072
+#define IR_TASK_PRIO        15
+
+#define IR_POLL_READS       4     /* ADC reads averaged per poll */
+#define IR_BURST_READS      4     /* ADC reads averaged per burst sample */
+#define IR_READ_RETRIES     3     /* A read that collides with the sampler's fails */
+#define IR_CONFIRM_POLLS    2     /* Polls past the threshold before triggering */
+
+/* Both sides of the step must be a cell, not an empty holder */
+#define IR_MIN_CELL_MV      2500
+/* Beyond this the step wasn't I x R (charger plugged in mid-poll, etc.) */
+#define IR_MAX_MOHM         2000
+
+static adc_oneshot_unit_handle_t s_adc = NULL;
+static adc_cali_handle_t s_cali = NULL;
+static adc_channel_t s_channel;
+
+/* Pre-trigger ring, only touched by the capture task */
+static int16_t s_ring[IR_PRE_SAMPLES];
+static int s_ring_pos = 0;
+static int s_ring_fill = 0;
+
+/* Last capture; written by the capture task, read by the sampler and httpd */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static ir_record_t s_record;
+static bool s_have_record = false;
+static uint32_t s_taken_seq = 0;
+static ir_stats_t s_stats = { .enabled = true };
+
+/* Battery mV from a few averaged reads, or -1 if the ADC stayed busy */
+static int read_battery_mv(int reads)
+{
+    int sum = 0;
+    int count = 0;
+    for (int i = 0; i < reads; i++) {
+        for (int attempt = 0; attempt < IR_READ_RETRIES; attempt++) {
+            int raw;
+            if (adc_oneshot_read(s_adc, s_channel, &raw) == ESP_OK) {
+                sum += raw;
+                count++;
+                break;
+            }
+        }
+    }
+    if (count == 0) {
+        return -1;
+    }
+
+    const int raw_avg = sum / count;
+    int pin_mv;
+    if (s_cali == NULL || adc_cali_raw_to_voltage(s_cali, raw_avg, &pin_mv) != ESP_OK) {
+        pin_mv = (raw_avg * 3100) / 4095;
+    }
+    return (int)lroundf(sensor_pin_to_voltage(pin_mv) * 1000.0f);
+}
+
+static int median_mv(const int16_t *values, int n)
+{
+    int16_t sorted[IR_PRE_SAMPLES];
+    memcpy(sorted, values, n * sizeof(*values));
+    for (int i = 1; i < n; i++) {
+        const int16_t v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    return sorted[n / 2];
+}
+
+static int min_mv(const int16_t *values, int n)
+{
+    int lowest = values[0];
+    for (int i = 1; i < n; i++) {
+        if (values[i] < lowest) {
+            lowest = values[i];
+        }
+    }
+    return lowest;
+}
+
+static void ring_push(int mv)
+{
+    s_ring[s_ring_pos] = (int16_t)mv;
+    s_ring_pos = (s_ring_pos + 1) % IR_PRE_SAMPLES;
+    if (s_ring_fill < IR_PRE_SAMPLES) {
+        s_ring_fill++;
+    }
+}
+
+/* Record the burst and confirmation window, then judge the step */
+static void capture(int64_t trigger_us, int pre_median_mv, int direction, TickType_t *last_wake)
+{
+    ir_record_t rec = {
+        .poll_us = CONFIG_CHARGER_IR_POLL_MS * 1000,
+    };
+    for (int i = 0; i < IR_PRE_SAMPLES; i++) {
+        rec.pre_mv[i] = s_ring[(s_ring_pos + i) % IR_PRE_SAMPLES];
+    }
+
+    const int64_t burst_start = esp_timer_get_time();
+    int prev = pre_median_mv;
+    for (int i = 0; i < IR_BURST_SAMPLES; i++) {
+        const int mv = read_battery_mv(IR_BURST_READS);
+        prev = mv >= 0 ? mv : prev;
+        rec.burst_mv[i] = (int16_t)prev;
+    }
+    rec.burst_us = (uint32_t)(esp_timer_get_time() - burst_start);
+
+    for (int i = 0; i < IR_POST_SAMPLES; i++) {
+        vTaskDelayUntil(last_wake, pdMS_TO_TICKS(CONFIG_CHARGER_IR_POLL_MS));
+        const int mv = read_battery_mv(IR_POLL_READS);
+        prev = mv >= 0 ? mv : prev;
+        rec.post_mv[i] = (int16_t)prev;
+    }
+
+    const int step_mv = median_mv(rec.burst_mv, IR_BURST_SAMPLES) - pre_median_mv;
+    const int held_mv = median_mv(rec.post_mv, IR_POST_SAMPLES) - pre_median_mv;
+    float ir_mohm = NAN;
+    if (CONFIG_CHARGER_CHARGE_CURRENT_MA > 0) {
+        ir_mohm = abs(step_mv) * 1000.0f / CONFIG_CHARGER_CHARGE_CURRENT_MA;
+    }
+
+    /* A cell on both sides, a step in the triggering direction that is
+     * still there after the confirmation window, and a plausible size */
+    const char *reject = NULL;
+    if (min_mv(rec.pre_mv, IR_PRE_SAMPLES) < IR_MIN_CELL_MV ||
+        min_mv(rec.post_mv, IR_POST_SAMPLES) < IR_MIN_CELL_MV) {
+        reject = "no cell on one side";
+    } else if (step_mv * direction < CONFIG_CHARGER_IR_TRIGGER_MV / 2) {
+        reject = "gone before the burst";
+    } else if (held_mv * direction < abs(step_mv) / 2) {
+        reject = "did not hold";
+    } else if (ir_mohm > IR_MAX_MOHM) {
+        reject = "implausibly large";
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats.triggers++;
+    if (reject) {
+        s_stats.rejected++;
+    } else {
+        s_stats.accepted++;
+        rec.result = (ir_result_t){
+            .seq = s_stats.accepted,
+            .time_us = trigger_us,
+            .edge = direction > 0 ? IR_EDGE_CHARGE_START : IR_EDGE_CHARGE_STOP,
+            .step_mv = step_mv,
+            .ir_mohm = ir_mohm,
+        };
+        s_record = rec;
+        s_have_record = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (reject) {
+        ESP_LOGD(TAG, "Step of %d mV rejected: %s", step_mv, reject);
+    } else {
+        ESP_LOGI(TAG, "%s step of %d mV: %.0f mOhm", ir_capture_edge_str(rec.result.edge),
+                 step_mv, ir_mohm);
+    }
+}
+
+static void capture_task(void *arg)
+{
+    int16_t candidates[IR_CONFIRM_POLLS];
+    int pending = 0;
+    int direction = 0;
+    int base_mv = 0;
+    int64_t first_us = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_CHARGER_IR_POLL_MS));
+        const int mv = read_battery_mv(IR_POLL_READS);
+        if (mv < 0) {
+            continue;
+        }
+        if (s_ring_fill < IR_PRE_SAMPLES) {
+            ring_push(mv);
+            continue;
+        }
+
+        if (pending == 0) {
+            base_mv = median_mv(s_ring, IR_PRE_SAMPLES);
+        }
+        const int dev = mv - base_mv;
+        const int dir = dev > 0 ? 1 : -1;
+        if (abs(dev) >= CONFIG_CHARGER_IR_TRIGGER_MV && (pending == 0 || dir == direction)) {
+            if (pending == 0) {
+                first_us = esp_timer_get_time();
+                direction = dir;
+            }
+            candidates[pending++] = (int16_t)mv;
+            if (pending == IR_CONFIRM_POLLS) {
+                capture(first_us, base_mv, direction, &last_wake);
+                /* Re-arm once the ring holds only the new level */
+                s_ring_fill = 0;
+                pending = 0;
+            }
+            continue;
+        }
+
+        /* A spike, not a step: the candidates go back into the baseline */
+        for (int i = 0; i < pending; i++) {
+            ring_push(candidates[i]);
+        }
+        pending = 0;
+        ring_push(mv);
+    }
+}
+
+esp_err_t ir_capture_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali,
+                          adc_channel_t channel)
+{
+    s_adc = adc;
+    s_cali = cali;
+    s_channel = channel;
+
+    if (RTOS_TASK_CREATE(capture_task, "ir_capture", IR_TASK_STACK, NULL,
+                         IR_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Watching for steps of %d mV every %d ms (%d mA charge current)",
+             CONFIG_CHARGER_IR_TRIGGER_MV, CONFIG_CHARGER_IR_POLL_MS,
+             CONFIG_CHARGER_CHARGE_CURRENT_MA);
+    return ESP_OK;
+}
+
+bool ir_capture_take(ir_result_t *result)
+{
+    portENTER_CRITICAL(&s_lock);
+    const bool fresh = s_have_record && s_record.result.seq != s_taken_seq;
+    if (fresh) {
+        *result = s_record.result;
+        s_taken_seq = s_record.result.seq;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return fresh;
+}
+
+bool ir_capture_get_record(ir_record_t *record)
+{
+    portENTER_CRITICAL(&s_lock);
+    const bool have = s_have_record;
+    if (have) {
+        *record = s_record;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return have;
+}
+
+void ir_capture_get_stats(ir_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+#else /* !CONFIG_CHARGER_IR_ENABLE */
+
+esp_err_t ir_capture_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali,
+                          adc_channel_t channel)
+{
+    ESP_LOGI(TAG, "Internal resistance capture disabled");
+    return ESP_OK;
+}
+
+bool ir_capture_take(ir_result_t *result)
+{
+    return false;
+}
+
+bool ir_capture_get_record(ir_record_t *record)
+{
+    return false;
+}
+
+void ir_capture_get_stats(ir_stats_t *stats)
+{
+    *stats = (ir_stats_t){ 0 };
+}
+
+#endif
+
+const char *ir_capture_edge_str(ir_edge_t edge)
+{
+    return edge == IR_EDGE_CHARGE_START ? "charge_start" : "charge_stop";
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+
+/* Internal resistance from charge current steps
+ *
+ * When the charger starts or stops driving current into a cell, the cell
+ * voltage steps by I x R before polarisation builds up. The sampling loop
+ * only sees that step through the smoothing filter, a sample later at best. A capture task polls
+ * the battery channel every few ms into a pre-trigger ring, like an
+ * oscilloscope. A step that holds for two polls triggers a back-to-back
+ * burst of raw readings and a short confirmation window. The resistance is
+ * the step between the pre-trigger and burst medians divided by
+ * CONFIG_CHARGER_CHARGE_CURRENT_MA.
+ *
+ * Only edges with a cell present on both sides count; insertion and
+ * removal steps are the open-circuit voltage, not I x R.
+ */
+
+#define IR_PRE_SAMPLES    32    /* Pre-trigger ring, one per poll */
+#define IR_BURST_SAMPLES  32    /* Back-to-back right after the trigger */
+#define IR_POST_SAMPLES   16    /* One per poll, confirms the step held */
+
+typedef enum {
+    IR_EDGE_CHARGE_START,     /* Voltage stepped up: current applied */
+    IR_EDGE_CHARGE_STOP,      /* Voltage stepped down: current removed */
+} ir_edge_t;
+
+/* One accepted capture */
+typedef struct {
+    uint32_t seq;             /* Increments with every accepted capture */
+    int64_t time_us;          /* esp_timer time of the trigger */
+    ir_edge_t edge;
+    int32_t step_mv;          /* Burst median minus pre-trigger median */
+    float ir_mohm;            /* |step| / charge current, NAN if the current is not set */
+} ir_result_t;
+
+/* The waveform behind the last capture, battery mV */
+typedef struct {
+    ir_result_t result;
+    uint32_t poll_us;         /* Spacing of the pre and post samples */
+    uint32_t burst_us;        /* Duration of the whole burst */
+    int16_t pre_mv[IR_PRE_SAMPLES];     /* Oldest first */
+    int16_t burst_mv[IR_BURST_SAMPLES];
+    int16_t post_mv[IR_POST_SAMPLES];
+} ir_record_t;
+
+typedef struct {
+    bool enabled;             /* CONFIG_CHARGER_IR_ENABLE */
+    uint32_t triggers;        /* Steps that triggered a burst */
+    uint32_t accepted;        /* Of those, captures that passed the checks */
+    uint32_t rejected;        /* Spikes, presence changes, implausible values */
+} ir_stats_t;
+
+/**
+ * Start the capture task
+ * Does nothing when CONFIG_CHARGER_IR_ENABLE is off.
+ * @param adc ADC1 unit already created by sensor_init
+ * @param cali Calibration scheme of that unit, or NULL
+ * @param channel Battery channel, already configured
+ * @return ESP_OK on success
+ */
+esp_err_t ir_capture_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali,
+                          adc_channel_t channel);
+
+/**
+ * Take the latest capture if it hasn't been taken yet
+ * @param result Filled with the capture
+ * @return true if a new capture was returned
+ */
+bool ir_capture_take(ir_result_t *result);
+
+/**
+ * Get the last capture with its waveform
+ * @param record Filled with the capture
+ * @return true if there has been a capture since boot
+ */
+bool ir_capture_get_record(ir_record_t *record);
+
+/**
+ * Get capture counters
+ * @param stats Filled with the counters
+ */
+void ir_capture_get_stats(ir_stats_t *stats);
+
+/**
+ * Get the name of an edge type
+ * @param edge Edge type
+ * @return "charge_start" or "charge_stop"
+ */
+const char *ir_capture_edge_str(ir_edge_t edge);
@@ -6,50 +6,112 @@
  * - Automatic cell detection and unique ID generation
  * - Charging state detection (charging, full, idle, discharging)
  * - WiFi connectivity
- * - Data logging to InfluxDB every minute
+ * - Data logging to InfluxDB every minute (or Prometheus remote-write
+ *   and a flash journal, see sink.h)
  * - Web dashboard with real-time graph
  * - Web-based provisioning for first-time setup
  * 
  * Operation:
  * 1. Check if provisioned (config exists in NVS or .env file)
  *    - If not: Start AP mode + web server for configuration
- * 2. Connect to WiFi
- * 3. Start web server for dashboard
- * 4. Continuously monitor battery:
- *    - Read voltage and temperature every second
+ * 2. Start sampling right away; WiFi, SNTP and the web server come up
+ *    in parallel (see network_bringup_task)
+ * 3. Continuously monitor battery:
+ *    - Read voltage and temperature (every second by default)
  *    - Detect cell connection/disconnection
  *    - Generate unique cell ID on new cell
  *    - Track charging state and time
- *    - Send data to InfluxDB every 60 seconds
+ *    - Send data to InfluxDB (every 60 seconds by default)
+ *    - Adapt both rates to the charge phase (see scheduler.c)
+ *    - Samples taken before SNTP sync are timestamped from boot and
+ *      converted to UTC when uploaded
  */
 
 #include <string.h>
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_timer.h"
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "static_alloc.h"
 #include "config.h"
 #include "wifi_manager.h"
 #include "sensor.h"
-#include "influxdb.h"
+#include "sink.h"
 #include "provisioning.h"
 #include "time_manager.h"
 #include "webserver.h"
+#include "scheduler.h"
+#include "compressor.h"
+#include "uploader.h"
+#include "series_store.h"
+#include "session.h"
+#include "boot_trace.h"
+#include "ota.h"
+#include "params.h"
+#include "anomaly.h"
+#include "heap_monitor.h"
+#include "supervisor.h"
 
 static const char *TAG = "main";
 
-/* Update interval for InfluxDB (60 seconds) */
-#define INFLUXDB_UPDATE_INTERVAL_SEC  60
-
-/* Sensor read interval (1 second) */
-#define SENSOR_READ_INTERVAL_MS       1000
+#define BRINGUP_TASK_STACK  4096
+#define BRINGUP_TASK_PRIO   5
+#define WIFI_CONNECT_TIMEOUT_MS  20000
 
 /* Global sensor data for web dashboard access */
 static sensor_data_t g_sensor_data;
 static SemaphoreHandle_t g_sensor_mutex = NULL;
 
+/* Bring up WiFi, SNTP and the web server while the sampler runs */
+static void network_bringup_task(void *arg)
+{
+    if (wifi_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start WiFi");
+        esp_restart();
+    }
+
+    /* SNTP keeps retrying on its own until the link is up */
+    if (time_manager_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start SNTP, uploads stay on hold");
+    }
+
+    /* The server binds to all interfaces, so it can start before the IP */
+    const bool web_ok = webserver_start() == ESP_OK;
+    if (!web_ok) {
+        ESP_LOGW(TAG, "Failed to start web server");
+    } else {
+        boot_trace_mark(BOOT_EVENT_WEBSERVER_READY);
+    }
+
+    /* Retries run in wifi_manager; keep sampling however long it takes */
+    while (wifi_wait_connected(WIFI_CONNECT_TIMEOUT_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "Still waiting for WiFi");
+    }
+    boot_trace_mark(BOOT_EVENT_WIFI_CONNECTED);
+
+    /* Reachable for the next update, so a new image has proven itself */
+    if (web_ok) {
+        ota_confirm();
+    }
+
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "System ready - monitoring battery");
+    ESP_LOGI(TAG, "Dashboard: http://%s/", wifi_get_ip());
+    ESP_LOGI(TAG, "====================================");
+
+    /* Uploads are held until the first sync; release them as soon as it lands */
+    while (!time_manager_wait_synced(60000)) {
+        ESP_LOGW(TAG, "Still waiting for NTP sync, samples use time since boot");
+    }
+    boot_trace_mark(BOOT_EVENT_TIME_SYNCED);
+    uploader_flush_now();
+
+    vTaskDelete(NULL);
+}
+
 /* Get current sensor data (thread-safe) */
 esp_err_t main_get_sensor_data(sensor_data_t *data)
 {
@@ -72,7 +134,7 @@ void app_main(void)
     ESP_LOGI(TAG, "====================================");
 
     /* Create mutex for sensor data access */
-    g_sensor_mutex = xSemaphoreCreateMutex();
+    g_sensor_mutex = RTOS_MUTEX_CREATE();
     if (g_sensor_mutex == NULL) {
         ESP_LOGE(TAG, "Failed to create sensor mutex");
         esp_restart();
@@ -81,6 +143,9 @@ void app_main(void)
     /* Initialize NVS */
     config_init_nvs();
 
+    /* A freshly updated image must confirm itself or it is rolled back */
+    ota_init();
+
     /* Load configuration */
     memset(&g_config, 0, sizeof(g_config));
     
@@ -106,37 +171,77 @@ void app_main(void)
         ESP_LOGE(TAG, "Failed to initialize sensor");
         esp_restart();
     }
+    boot_trace_mark(BOOT_EVENT_SENSOR_READY);
+
+    /* Sample and upload rates follow the charge phase */
+    scheduler_init(NULL);
 
-    /* Connect to WiFi */
-    if (wifi_connect() != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to connect to WiFi");
+    /* Full-rate session curves are kept compressed in RAM */
+    if (series_store_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize series store");
         esp_restart();
     }
 
-    /* Initialize NTP and sync time */
-    if (time_manager_init() != ESP_OK) {
-        ESP_LOGW(TAG, "NTP sync failed, timestamps may be inaccurate");
+    /* Per-cell summaries are aggregated sample by sample */
+    session_init();
+
+    /* Only points needed to reconstruct the curve are uploaded */
+    compressor_init(NULL);
+
+    /* Faults are flagged as they happen, not left for the dashboard */
+    anomaly_init(NULL);
+
+    /* Saved tuning overrides the defaults from the first sample on */
+    if (params_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Runtime parameters unavailable, using defaults");
     }
 
-    /* Start web server for dashboard */
-    if (webserver_start() != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to start web server");
+    /* Each backend gets its own task and retry queue */
+    if (sink_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start upload sinks");
+        esp_restart();
     }
 
-    ESP_LOGI(TAG, "====================================");
-    ESP_LOGI(TAG, "System ready - monitoring battery");
-    ESP_LOGI(TAG, "Dashboard: http://%s/", wifi_get_ip());
-    ESP_LOGI(TAG, "====================================");
+    if (uploader_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start uploader");
+        esp_restart();
+    }
+
+    /* Stalled subsystems are restarted on their own from here on */
+    if (supervisor_start() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start supervisor, stalls go unnoticed");
+    }
+
+    /* Network comes up in the background; sampling doesn't wait for it */
+    if (RTOS_TASK_CREATE(network_bringup_task, "bringup", BRINGUP_TASK_STACK, NULL,
+                         BRINGUP_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create bring-up task");
+        esp_restart();
+    }
 
     /* Main monitoring loop */
-    int64_t last_influx_send = 0;
+    uint32_t sample_interval_ms = CONFIG_CHARGER_SAMPLE_NORMAL_MS;
+    bool was_over_temp = false;
     
     while (1) {
+        /* Pick up parameters changed through /api/config */
+        params_apply_pending();
+
+        /* Free heap history for /api/heap */
+        heap_monitor_poll();
+
         /* Read sensor data */
         sensor_data_t sensor_data;
         if (sensor_read(&sensor_data) == ESP_OK) {
-            /* Get current timestamp */
+            /* Get current timestamp (time since boot until SNTP syncs) */
             sensor_data.timestamp_ns = time_manager_get_timestamp_ns();
+            sensor_data.time_synced = time_manager_is_utc(sensor_data.timestamp_ns);
+            boot_trace_mark(BOOT_EVENT_FIRST_SAMPLE);
+            
+            /* Pick sample and upload rates for this phase */
+            const bool new_cell = sensor_is_new_cell();
+            scheduler_update(&sensor_data, new_cell);
+            sample_interval_ms = sensor_data.sample_interval_ms;
             
             /* Update global sensor data (thread-safe) */
             if (xSemaphoreTake(g_sensor_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
@@ -144,35 +249,52 @@ void app_main(void)
                 xSemaphoreGive(g_sensor_mutex);
             }
             
+            /* Keep every sample in the session curve */
+            const int64_t sample_time = esp_timer_get_time();
+            series_store_append(&sensor_data, sample_time);
+            
+            /* Update the session summary; upload it once the cell is gone */
+            session_summary_t summary;
+            if (session_update(&sensor_data, sample_time, &summary)) {
+                uploader_enqueue_session(&summary);
+            }
+            
+            /* Raise alerts; each one is uploaded right away */
+            anomaly_event_t events[ANOMALY_MAX_EVENTS];
+            const size_t event_count = anomaly_push(&sensor_data, sample_time, events);
+            for (size_t i = 0; i < event_count; i++) {
+                ESP_LOGW(TAG, "Anomaly on %s: %s %.1f %s (limit %.1f)", events[i].cell_id,
+                         anomaly_type_str(events[i].type), events[i].value,
+                         anomaly_unit_str(events[i].type), events[i].threshold);
+                uploader_enqueue_alert(&events[i]);
+            }
+            
+            /* Compress and queue for upload */
+            sensor_data_t points[COMPRESSOR_MAX_EMIT];
+            const size_t count = compressor_push(&sensor_data, sample_time, points);
+            for (size_t i = 0; i < count; i++) {
+                uploader_enqueue(&points[i]);
+            }
+            uploader_set_interval(sensor_data.upload_interval_sec);
+            
             /* Check if new cell was just connected */
-            if (sensor_is_new_cell()) {
+            if (new_cell) {
                 ESP_LOGI(TAG, "New cell detected: %s (%.2fV)", 
                          sensor_data.cell_id, sensor_data.battery_voltage);
                 /* Send immediately on new cell */
-                influxdb_send(&sensor_data);
-                last_influx_send = esp_timer_get_time();
+                uploader_flush_now();
             }
             
-            /* Send to InfluxDB every 60 seconds if cell is present */
-            int64_t now = esp_timer_get_time();
-            if (sensor_data.cell_present && 
-                (now - last_influx_send) >= (INFLUXDB_UPDATE_INTERVAL_SEC * 1000000LL)) {
-                
-                ESP_LOGI(TAG, "Sending update: %.2fV (%.0f%%), %s, %lus", 
-                         sensor_data.battery_voltage,
-                         sensor_data.battery_percentage,
-                         sensor_charge_state_str(sensor_data.charge_state),
-                         sensor_data.charging_time_sec);
-                
-                if (influxdb_send(&sensor_data) == ESP_OK) {
-                    last_influx_send = now;
-                } else {
-                    ESP_LOGW(TAG, "Failed to send to InfluxDB");
-                }
+            /* Report a thermal trip without waiting for the upload interval */
+            if (sensor_data.over_temp && !was_over_temp) {
+                uploader_flush_now();
             }
+            was_over_temp = sensor_data.over_temp;
         }
         
-        /* Wait before next reading */
-        vTaskDelay(pdMS_TO_TICKS(SENSOR_READ_INTERVAL_MS));
+        /* Wait before next reading; a parameter change ends the wait early */
+        supervisor_heartbeat(SUPERVISOR_SAMPLER,
+                             sample_interval_ms + CONFIG_CHARGER_HEALTH_SAMPLE_STALL_SEC * 1000);
+        params_wait(sample_interval_ms);
     }
 }
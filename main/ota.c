@@ -0,0 +1,226 @@
+#include "ota.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "ota";
+
+#define OTA_RESTART_DELAY_US  (1000 * 1000)
+
+/* Update state; only the httpd task touches it (one handler at a time) */
+static esp_ota_handle_t s_handle = 0;
+static const esp_partition_t *s_target = NULL;
+static mbedtls_sha256_context s_sha;
+static int64_t s_start_us = 0;
+static ota_stats_t s_stats = { .last_error = ESP_OK };
+
+static bool s_pending_verify = false;
+static esp_timer_handle_t s_confirm_timer = NULL;
+static esp_timer_handle_t s_restart_timer = NULL;
+
+static void confirm_timeout_cb(void *arg)
+{
+    ESP_LOGE(TAG, "New image not confirmed within %d s, rolling back",
+             CONFIG_CHARGER_OTA_CONFIRM_SEC);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+static void restart_cb(void *arg)
+{
+    ESP_LOGI(TAG, "Restarting into the new image");
+    esp_restart();
+}
+
+void ota_init(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_app_desc_t *desc = esp_app_get_description();
+    ESP_LOGI(TAG, "Running %s from %s", desc->version, running->label);
+
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    if (invalid != NULL) {
+        ESP_LOGW(TAG, "Image in %s was rolled back", invalid->label);
+    }
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+
+    s_pending_verify = true;
+    ESP_LOGW(TAG, "First boot of a new image, confirming once the network is up");
+
+    const esp_timer_create_args_t args = {
+        .callback = confirm_timeout_cb,
+        .name = "ota_confirm",
+    };
+    if (esp_timer_create(&args, &s_confirm_timer) == ESP_OK) {
+        esp_timer_start_once(s_confirm_timer, (uint64_t)CONFIG_CHARGER_OTA_CONFIRM_SEC * 1000000ULL);
+    }
+}
+
+void ota_confirm(void)
+{
+    if (!s_pending_verify) {
+        return;
+    }
+    if (s_confirm_timer) {
+        esp_timer_stop(s_confirm_timer);
+    }
+    if (esp_ota_mark_app_valid_cancel_rollback() == ESP_OK) {
+        s_pending_verify = false;
+        ESP_LOGI(TAG, "New image confirmed");
+    }
+}
+
+bool ota_is_pending_verify(void)
+{
+    return s_pending_verify;
+}
+
+esp_err_t ota_begin(size_t image_size)
+{
+    if (s_stats.in_progress) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_target = esp_ota_get_next_update_partition(NULL);
+    if (s_target == NULL) {
+        ESP_LOGE(TAG, "No OTA partition to write to");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (image_size == 0 || image_size > s_target->size) {
+        ESP_LOGE(TAG, "Image of %u bytes doesn't fit %s (%lu bytes)",
+                 (unsigned)image_size, s_target->label, s_target->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* Sequential writes erase sector by sector instead of all up front */
+    const esp_err_t ret = esp_ota_begin(s_target, OTA_WITH_SEQUENTIAL_WRITES, &s_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(ret));
+        s_stats.last_error = ret;
+        return ret;
+    }
+
+    mbedtls_sha256_init(&s_sha);
+    mbedtls_sha256_starts(&s_sha, 0);
+
+    s_start_us = esp_timer_get_time();
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.in_progress = true;
+    s_stats.image_size = image_size;
+    s_stats.last_error = ESP_OK;
+
+    ESP_LOGI(TAG, "Writing %u byte image to %s", (unsigned)image_size, s_target->label);
+    return ESP_OK;
+}
+
+static void update_timing(void)
+{
+    s_stats.elapsed_ms = (uint32_t)((esp_timer_get_time() - s_start_us) / 1000);
+    s_stats.throughput_kbps = s_stats.elapsed_ms
+        ? (uint32_t)((uint64_t)s_stats.bytes_written * 8 / s_stats.elapsed_ms) : 0;
+}
+
+static void fail(esp_err_t err)
+{
+    esp_ota_abort(s_handle);
+    mbedtls_sha256_free(&s_sha);
+    update_timing();
+    s_stats.in_progress = false;
+    s_stats.last_error = err;
+}
+
+esp_err_t ota_write(const void *data, size_t len)
+{
+    if (!s_stats.in_progress) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_stats.bytes_written + len > s_stats.image_size) {
+        fail(ESP_ERR_INVALID_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const esp_err_t ret = esp_ota_write(s_handle, data, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_write failed at %lu: %s", s_stats.bytes_written, esp_err_to_name(ret));
+        fail(ret);
+        return ret;
+    }
+    mbedtls_sha256_update(&s_sha, data, len);
+    s_stats.bytes_written += len;
+    return ESP_OK;
+}
+
+esp_err_t ota_finish(const uint8_t expected_sha256[32])
+{
+    if (!s_stats.in_progress) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_stats.bytes_written != s_stats.image_size) {
+        fail(ESP_ERR_INVALID_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&s_sha, digest);
+    mbedtls_sha256_free(&s_sha);
+    if (memcmp(digest, expected_sha256, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch, image discarded");
+        esp_ota_abort(s_handle);
+        update_timing();
+        s_stats.in_progress = false;
+        s_stats.last_error = ESP_ERR_INVALID_CRC;
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    /* esp_ota_end checks the image header and its own appended digest */
+    esp_err_t ret = esp_ota_end(s_handle);
+    if (ret == ESP_OK) {
+        ret = esp_ota_set_boot_partition(s_target);
+    }
+    update_timing();
+    s_stats.in_progress = false;
+    s_stats.last_error = ret;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Image rejected: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Wrote %lu bytes to %s in %lu ms (%lu kbit/s)",
+             s_stats.bytes_written, s_target->label, s_stats.elapsed_ms, s_stats.throughput_kbps);
+    return ESP_OK;
+}
+
+void ota_abort(void)
+{
+    if (s_stats.in_progress) {
+        ESP_LOGW(TAG, "Update aborted after %lu bytes", s_stats.bytes_written);
+        fail(ESP_ERR_INVALID_STATE);
+    }
+}
+
+void ota_schedule_restart(void)
+{
+    if (s_restart_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = restart_cb,
+            .name = "ota_restart",
+        };
+        if (esp_timer_create(&args, &s_restart_timer) != ESP_OK) {
+            esp_restart();
+        }
+    }
+    esp_timer_start_once(s_restart_timer, OTA_RESTART_DELAY_US);
+}
+
+void ota_get_stats(ota_stats_t *stats)
+{
+    *stats = s_stats;
+}
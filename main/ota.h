@@ -0,0 +1,79 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Result of the last update attempt since boot */
+typedef struct {
+    bool in_progress;
+    uint32_t bytes_written;
+    uint32_t image_size;
+    uint32_t elapsed_ms;
+    uint32_t throughput_kbps;     /* Bytes written per ms * 8 (kbit/s) */
+    esp_err_t last_error;         /* ESP_OK if the last update succeeded */
+} ota_stats_t;
+
+/**
+ * Check the running image and arm the rollback timer
+ * A freshly updated image that isn't confirmed with ota_confirm() within
+ * CONFIG_CHARGER_OTA_CONFIRM_SEC is marked invalid and the previous one
+ * boots again. Resets before that roll back in the bootloader.
+ */
+void ota_init(void);
+
+/**
+ * Mark the running image as good
+ * Call once the device is reachable again (WiFi up, web server running).
+ * Does nothing for images that are not pending verification.
+ */
+void ota_confirm(void);
+
+/**
+ * Check whether the running image still waits for ota_confirm()
+ * @return true until confirmed (always false for confirmed images)
+ */
+bool ota_is_pending_verify(void);
+
+/**
+ * Start writing a new image to the inactive app partition
+ * Flash is erased as the image arrives, so there is no long pause here.
+ * @param image_size Total image size in bytes
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if an update is running,
+ *         ESP_ERR_INVALID_SIZE if the image doesn't fit
+ */
+esp_err_t ota_begin(size_t image_size);
+
+/**
+ * Write the next part of the image and add it to the running SHA-256
+ * @param data Image bytes
+ * @param len Number of bytes
+ * @return ESP_OK on success; the update is aborted on failure
+ */
+esp_err_t ota_write(const void *data, size_t len);
+
+/**
+ * Verify the image and select it for the next boot
+ * @param expected_sha256 SHA-256 of the whole image as sent by the client
+ * @return ESP_OK, ESP_ERR_INVALID_CRC on a hash mismatch,
+ *         ESP_ERR_OTA_VALIDATE_FAILED if the image itself is invalid
+ */
+esp_err_t ota_finish(const uint8_t expected_sha256[32]);
+
+/**
+ * Abandon an update in progress
+ */
+void ota_abort(void);
+
+/**
+ * Restart into the new image after a short delay
+ * The delay lets the HTTP response reach the client first.
+ */
+void ota_schedule_restart(void);
+
+/**
+ * Get figures of the last update
+ * @param stats Pointer to store statistics
+ */
+void ota_get_stats(ota_stats_t *stats);
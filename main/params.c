@@ -0,0 +1,288 @@
+#include "params.h"
+#include "session.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "static_alloc.h"
+#include <string.h>
+#include <stdio.h>
+
+static const char *TAG = "params";
+
+static const char NVS_NAMESPACE[] = "params";
+
+#define P(field)  offsetof(params_t, field)
+
+_Static_assert(sizeof(compressor_mode_t) == sizeof(uint32_t), "compressor mode is stored as u32");
+
+static const param_def_t s_defs[] = {
+    { "sensor.voltage_divider",      "s_divider",    PARAM_TYPE_FLOAT, P(sensor.voltage_divider),        1.0, 20.0,   "ratio" },
+    { "sensor.cell_detect_voltage",  "s_detect_v",   PARAM_TYPE_FLOAT, P(sensor.cell_detect_voltage),    0.5, 4.0,    "V" },
+    { "sensor.cell_full_voltage",    "s_full_v",     PARAM_TYPE_FLOAT, P(sensor.cell_full_voltage),      3.0, 4.5,    "V" },
+    { "sensor.rising_mv",            "s_rise_mv",    PARAM_TYPE_U32,   P(sensor.rising_mv),              1, 1000,     "mV" },
+    { "sensor.falling_mv",           "s_fall_mv",    PARAM_TYPE_U32,   P(sensor.falling_mv),             1, 1000,     "mV" },
+    { "sensor.stable_count",         "s_stable_cnt", PARAM_TYPE_U32,   P(sensor.stable_count),           3, 3600,     "samples" },
+    { "scheduler.fast_sample_ms",    "sc_fast_ms",   PARAM_TYPE_U32,   P(scheduler.fast_sample_ms),      100, 60000,  "ms" },
+    { "scheduler.normal_sample_ms",  "sc_norm_ms",   PARAM_TYPE_U32,   P(scheduler.normal_sample_ms),    100, 60000,  "ms" },
+    { "scheduler.slow_sample_ms",    "sc_slow_ms",   PARAM_TYPE_U32,   P(scheduler.slow_sample_ms),      100, 600000, "ms" },
+    { "scheduler.fast_upload_sec",   "sc_fast_up",   PARAM_TYPE_U32,   P(scheduler.fast_upload_sec),     1, 3600,     "s" },
+    { "scheduler.normal_upload_sec", "sc_norm_up",   PARAM_TYPE_U32,   P(scheduler.normal_upload_sec),   1, 3600,     "s" },
+    { "scheduler.slow_upload_sec",   "sc_slow_up",   PARAM_TYPE_U32,   P(scheduler.slow_upload_sec),     1, 86400,    "s" },
+    { "scheduler.slope_mv_per_min",  "sc_slope",     PARAM_TYPE_U32,   P(scheduler.slope_mv_per_min),    1, 10000,    "mV/min" },
+    { "scheduler.fast_hold_sec",     "sc_hold",      PARAM_TYPE_U32,   P(scheduler.fast_hold_sec),       0, 3600,     "s" },
+    { "scheduler.early_cc_sec",      "sc_early_cc",  PARAM_TYPE_U32,   P(scheduler.early_cc_sec),        0, 7200,     "s" },
+    { "scheduler.stable_sec",        "sc_stable",    PARAM_TYPE_U32,   P(scheduler.stable_sec),          0, 86400,    "s" },
+    { "compressor.mode",             "c_mode",       PARAM_TYPE_U32,   P(compressor.mode),               0, 2,        "0=off 1=deadband 2=swinging door" },
+    { "compressor.voltage_bound",    "c_volt",       PARAM_TYPE_FLOAT, P(compressor.voltage_bound),      0.0, 1.0,    "V" },
+    { "compressor.temp_bound",       "c_temp",       PARAM_TYPE_FLOAT, P(compressor.temp_bound),         0.0, 100.0,  "C" },
+    { "compressor.max_gap_sec",      "c_gap",        PARAM_TYPE_U32,   P(compressor.max_gap_sec),        1, 86400,    "s" },
+    { "anomaly.sag_mv",              "a_sag",        PARAM_TYPE_U32,   P(anomaly.sag_mv),                5, 1000,     "mV" },
+    { "anomaly.cv_mv",               "a_cv_mv",      PARAM_TYPE_U32,   P(anomaly.cv_mv),                 3500, 4400,  "mV" },
+    { "anomaly.cv_budget_sec",       "a_cv_budget",  PARAM_TYPE_U32,   P(anomaly.cv_budget_sec),         600, 86400,  "s" },
+    { "anomaly.self_discharge_mv_per_h", "a_self_dis", PARAM_TYPE_U32, P(anomaly.self_discharge_mv_per_h), 1, 1000,   "mV/h" },
+    { "anomaly.temp_rise_c_per_min", "a_temp_rise",  PARAM_TYPE_FLOAT, P(anomaly.temp_rise_c_per_min),   0.1, 10.0,   "C/min" },
+    { "anomaly.spike_mv",            "a_spike",      PARAM_TYPE_U32,   P(anomaly.spike_mv),              10, 2000,    "mV" },
+    { "filter.decimator",            "f_decim",      PARAM_TYPE_U32,   P(filter.decimator),              0, 3,        "0=trimmed mean 1=median 2=boxcar 3=cic2" },
+    { "filter.stages",               "f_stages",     PARAM_TYPE_U32,   P(filter.stages),                 0, FILTER_STAGES_ALL, "bits 1=ema 2=biquad 4=kalman" },
+    { "filter.ema_alpha",            "s_ema_alpha",  PARAM_TYPE_FLOAT, P(filter.ema_alpha),              0.01, 1.0,   "per s" },
+    { "filter.cutoff_mhz",           "f_cutoff",     PARAM_TYPE_U32,   P(filter.cutoff_mhz),             1, 5000,     "mHz" },
+    { "filter.kalman_noise_uv",      "f_kf_noise",   PARAM_TYPE_U32,   P(filter.kalman_noise_uv),        100, 100000, "uV" },
+    { "filter.kalman_accel_uv_s2",   "f_kf_accel",   PARAM_TYPE_FLOAT, P(filter.kalman_accel_uv_s2),     0.001, 1000.0, "uV/s^2" },
+};
+
+#define PARAM_COUNT  (sizeof(s_defs) / sizeof(s_defs[0]))
+
+static params_t s_defaults;
+static params_t s_current;
+static uint32_t s_generation = 0;
+static uint32_t s_applied_generation = UINT32_MAX;
+static SemaphoreHandle_t s_lock = NULL;
+static SemaphoreHandle_t s_changed = NULL;   /* Wakes the sampler early */
+
+/* Values are stored as 32-bit words; floats by their bit pattern */
+static uint32_t get_word(const params_t *p, const param_def_t *def)
+{
+    uint32_t word;
+    memcpy(&word, (const uint8_t *)p + def->offset, sizeof(word));
+    return word;
+}
+
+static void set_word(params_t *p, const param_def_t *def, uint32_t word)
+{
+    memcpy((uint8_t *)p + def->offset, &word, sizeof(word));
+}
+
+static void set_value(params_t *p, const param_def_t *def, double value)
+{
+    if (def->type == PARAM_TYPE_FLOAT) {
+        const float f = (float)value;
+        memcpy((uint8_t *)p + def->offset, &f, sizeof(f));
+    } else {
+        set_word(p, def, (uint32_t)value);
+    }
+}
+
+double params_value(const params_t *p, const param_def_t *def)
+{
+    if (def->type == PARAM_TYPE_FLOAT) {
+        float f;
+        memcpy(&f, (const uint8_t *)p + def->offset, sizeof(f));
+        return f;
+    }
+    return get_word(p, def);
+}
+
+static const param_def_t *find(const char *name)
+{
+    for (size_t i = 0; i < PARAM_COUNT; i++) {
+        if (strcmp(s_defs[i].name, name) == 0) {
+            return &s_defs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Rules that involve more than one value */
+static bool check_consistency(const params_t *p, char *err, size_t err_len)
+{
+    if (p->sensor.cell_detect_voltage >= p->sensor.cell_full_voltage) {
+        snprintf(err, err_len, "sensor.cell_detect_voltage must be below sensor.cell_full_voltage");
+        return false;
+    }
+    const scheduler_config_t *s = &p->scheduler;
+    if (s->fast_sample_ms > s->normal_sample_ms || s->normal_sample_ms > s->slow_sample_ms) {
+        snprintf(err, err_len, "sample intervals must be fast <= normal <= slow");
+        return false;
+    }
+    if (s->fast_upload_sec > s->normal_upload_sec || s->normal_upload_sec > s->slow_upload_sec) {
+        snprintf(err, err_len, "upload intervals must be fast <= normal <= slow");
+        return false;
+    }
+    return true;
+}
+
+esp_err_t params_init(void)
+{
+    s_lock = RTOS_MUTEX_CREATE();
+    s_changed = RTOS_BINARY_CREATE();
+    if (s_lock == NULL || s_changed == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    sensor_get_default_config(&s_defaults.sensor);
+    scheduler_get_default_config(&s_defaults.scheduler);
+    compressor_get_default_config(&s_defaults.compressor);
+    anomaly_get_default_config(&s_defaults.anomaly);
+    filter_get_default_config(&s_defaults.filter);
+    s_current = s_defaults;
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        ESP_LOGI(TAG, "No saved parameters, using defaults");
+        return ESP_OK;
+    }
+
+    /* Saved values outside the current ranges are ignored, not clamped */
+    params_t loaded = s_current;
+    int overrides = 0;
+    for (size_t i = 0; i < PARAM_COUNT; i++) {
+        const param_def_t *def = &s_defs[i];
+        uint32_t word;
+        if (nvs_get_u32(nvs_handle, def->nvs_key, &word) != ESP_OK) {
+            continue;
+        }
+        params_t candidate = loaded;
+        set_word(&candidate, def, word);
+        const double v = params_value(&candidate, def);
+        if (v < def->min || v > def->max) {
+            ESP_LOGW(TAG, "Ignoring saved %s: out of range", def->name);
+            continue;
+        }
+        loaded = candidate;
+        overrides++;
+    }
+    nvs_close(nvs_handle);
+
+    char err[96];
+    if (!check_consistency(&loaded, err, sizeof(err))) {
+        ESP_LOGW(TAG, "Saved parameters rejected (%s), using defaults", err);
+        return ESP_OK;
+    }
+    s_current = loaded;
+    ESP_LOGI(TAG, "%d of %u parameters loaded from NVS", overrides, (unsigned)PARAM_COUNT);
+    return ESP_OK;
+}
+
+size_t params_count(void)
+{
+    return PARAM_COUNT;
+}
+
+const param_def_t *params_def(size_t index)
+{
+    return index < PARAM_COUNT ? &s_defs[index] : NULL;
+}
+
+uint32_t params_get(params_t *out, params_t *defaults)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_current;
+    const uint32_t generation = s_generation;
+    xSemaphoreGive(s_lock);
+
+    if (defaults) {
+        *defaults = s_defaults;
+    }
+    return generation;
+}
+
+static void save(const param_change_t *changes, size_t count, const params_t *p)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Can't open NVS, changes last until reboot");
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const param_def_t *def = find(changes[i].name);
+        if (changes[i].reset) {
+            nvs_erase_key(nvs_handle, def->nvs_key);
+        } else {
+            nvs_set_u32(nvs_handle, def->nvs_key, get_word(p, def));
+        }
+    }
+    if (nvs_commit(nvs_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "NVS commit failed, changes last until reboot");
+    }
+    nvs_close(nvs_handle);
+}
+
+esp_err_t params_update(const param_change_t *changes, size_t count, char *err, size_t err_len)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    params_t candidate = s_current;
+
+    for (size_t i = 0; i < count; i++) {
+        const param_def_t *def = find(changes[i].name);
+        if (def == NULL) {
+            xSemaphoreGive(s_lock);
+            snprintf(err, err_len, "unknown parameter %s", changes[i].name);
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (changes[i].reset) {
+            set_word(&candidate, def, get_word(&s_defaults, def));
+            continue;
+        }
+        const double v = changes[i].value;
+        if (!(v >= def->min && v <= def->max) ||
+            (def->type == PARAM_TYPE_U32 && v != (double)(uint32_t)v)) {
+            xSemaphoreGive(s_lock);
+            snprintf(err, err_len, "%s must be %s in %g..%g", def->name,
+                     def->type == PARAM_TYPE_U32 ? "an integer" : "a number", def->min, def->max);
+            return ESP_ERR_INVALID_ARG;
+        }
+        set_value(&candidate, def, v);
+    }
+
+    if (!check_consistency(&candidate, err, err_len)) {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_current = candidate;
+    s_generation++;
+    xSemaphoreGive(s_lock);
+
+    save(changes, count, &candidate);
+    ESP_LOGI(TAG, "%u parameter(s) changed", (unsigned)count);
+    xSemaphoreGive(s_changed);
+    return ESP_OK;
+}
+
+void params_apply_pending(void)
+{
+    /* A racy read is fine: a missed increment is caught on the next sample */
+    if (s_lock == NULL || s_applied_generation == s_generation) {
+        return;
+    }
+
+    params_t p;
+    s_applied_generation = params_get(&p, NULL);
+    sensor_set_config(&p.sensor);
+    session_set_cv_voltage(p.sensor.cell_full_voltage);
+    scheduler_set_config(&p.scheduler);
+    compressor_set_config(&p.compressor);
+    anomaly_set_config(&p.anomaly);
+    filter_set_config(&p.filter);
+}
+
+void params_wait(uint32_t timeout_ms)
+{
+    if (s_changed == NULL) {
+        vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+        return;
+    }
+    xSemaphoreTake(s_changed, pdMS_TO_TICKS(timeout_ms));
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sensor.h"
+#include "scheduler.h"
+#include "compressor.h"
+#include "anomaly.h"
+#include "filter.h"
+
+/* Runtime-tunable parameters
+ *
+ * Every setting the sampler uses, with its type and range, persisted in
+ * NVS and exposed at /api/config. Changes are validated as a set, swapped
+ * in under a lock and picked up by the sampling task between two samples,
+ * so a sample never sees half of an update. No restart is needed.
+ */
+
+typedef enum {
+    PARAM_TYPE_U32,
+    PARAM_TYPE_FLOAT,
+} param_type_t;
+
+/* One registry entry */
+typedef struct {
+    const char *name;         /* API name, e.g. "sensor.voltage_divider" */
+    const char *nvs_key;      /* NVS key (max 15 characters) */
+    param_type_t type;
+    size_t offset;            /* Offset of the value in params_t */
+    double min;
+    double max;
+    const char *unit;
+} param_def_t;
+
+/* All tunable values, grouped by the module that consumes them */
+typedef struct {
+    sensor_config_t sensor;
+    scheduler_config_t scheduler;
+    compressor_config_t compressor;
+    anomaly_config_t anomaly;
+    filter_config_t filter;
+} params_t;
+
+/* One requested change */
+typedef struct {
+    const char *name;
+    bool reset;               /* Go back to the default instead of value */
+    double value;
+} param_change_t;
+
+/**
+ * Load defaults and the values saved in NVS
+ * The loaded set is applied by the first params_apply_pending() call.
+ * @return ESP_OK on success (no saved values is not an error)
+ */
+esp_err_t params_init(void);
+
+/**
+ * Number of registry entries
+ * @return Entry count
+ */
+size_t params_count(void);
+
+/**
+ * Get a registry entry
+ * @param index 0 .. params_count() - 1
+ * @return Entry, or NULL if out of range
+ */
+const param_def_t *params_def(size_t index);
+
+/**
+ * Copy the current values
+ * @param out Pointer to store the values
+ * @param defaults Optional pointer to store the defaults, or NULL
+ * @return Generation, incremented by every successful update
+ */
+uint32_t params_get(params_t *out, params_t *defaults);
+
+/**
+ * Read one value out of a set
+ * @param p Values from params_get
+ * @param def Registry entry
+ * @return The value as a double
+ */
+double params_value(const params_t *p, const param_def_t *def);
+
+/**
+ * Validate and apply a set of changes, all or nothing
+ * @param changes Requested changes
+ * @param count Number of changes
+ * @param err Filled with a reason on failure
+ * @param err_len Size of err
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for an unknown name,
+ *         ESP_ERR_INVALID_ARG for a value out of range or inconsistent
+ */
+esp_err_t params_update(const param_change_t *changes, size_t count, char *err, size_t err_len);
+
+/**
+ * Hand updated values to sensor, session, scheduler, compressor, anomaly
+ * and filter
+ * Call from the sampling task between samples. Cheap when nothing changed.
+ */
+void params_apply_pending(void);
+
+/**
+ * Sleep until the next sample is due or parameters change
+ * @param timeout_ms Sample interval
+ */
+void params_wait(uint32_t timeout_ms);
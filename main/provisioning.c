@@ -1,5 +1,6 @@
 #include "provisioning.h"
 #include "config.h"
+#include "wifi_manager.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -7,9 +8,16 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
 #include "esp_http_server.h"
+#include "esp_crt_bundle.h"
+#include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "static_alloc.h"
+#include "sdkconfig.h"
 
 static const char *TAG = "provisioning";
 
@@ -17,8 +25,61 @@ static const char *TAG = "provisioning";
 #define AP_PASSWORD   ""
 #define AP_MAX_CONN   1
 
+#define SCAN_MAX_APS          20
+#define SCAN_MAX_AGE_MS       15000    /* Older results start a new scan */
+#define CHECK_TASK_STACK      8192     /* esp_http_client with TLS */
+#define CHECK_WIFI_TIMEOUT_MS 20000
+#define CHECK_WIFI_TRIES      3
+#define CHECK_HTTP_TIMEOUT_MS 8000
+#define REBOOT_DELAY_MS       3000     /* Lets the page pick up the result */
+
+#define STA_CONNECTED_BIT     BIT0
+#define STA_GOT_IP_BIT        BIT1
+#define STA_FAILED_BIT        BIT2
+
+/* Where the submitted settings are; names match /api/provision */
+typedef enum {
+    CHECK_IDLE,
+    CHECK_WIFI,       /* Joining the network */
+    CHECK_INFLUX,     /* Pinging InfluxDB through it */
+    CHECK_FAILED,     /* Nothing saved, see the message */
+    CHECK_SAVED,      /* Stored in NVS, restarting */
+} check_state_t;
+
+static const char *const s_state_names[] = { "idle", "wifi", "influx", "failed", "saved" };
+
+typedef struct {
+    char ssid[33];
+    int8_t rssi;
+    uint8_t channel;
+    bool secure;
+} scan_ap_t;
+
 static httpd_handle_t server = NULL;
 
+/* Scan results, written by the event loop and read by the server */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static scan_ap_t s_scan[SCAN_MAX_APS];
+static uint16_t s_scan_count = 0;
+static int64_t s_scan_done_us = 0;
+static bool s_scanning = false;
+
+/* Settings under test; only written by the server while no check runs */
+static config_t s_pending;
+static bool s_skip_influx = false;
+static volatile check_state_t s_state = CHECK_IDLE;
+static char s_message[96] = "";
+
+static TaskHandle_t s_check_task = NULL;
+static EventGroupHandle_t s_sta_events = NULL;
+static esp_netif_t *s_sta_netif = NULL;
+static uint8_t s_sta_reason = 0;
+static char s_sta_ip[16] = "";
+
+#if CONFIG_CHARGER_SINK_TLS_PINNED
+extern const char sink_ca_pem_start[] asm("_binary_sink_ca_pem_start");
+#endif
+
 /* Embedded HTML files */
 extern const uint8_t provisioning_html_start[] asm("_binary_provisioning_html_start");
 extern const uint8_t provisioning_html_end[]   asm("_binary_provisioning_html_end");
@@ -49,53 +110,55 @@ static void url_decode(char *dst, const char *src)
     *dst++ = '\0';
 }
 
+/* Streams the template, substituting {{NAME}} placeholders as it goes,
+ * so the page needs no buffer of its own */
 static esp_err_t provisioning_get_handler(httpd_req_t *req)
 {
-    /* Copy template to buffer */
-    const size_t template_len = provisioning_html_end - provisioning_html_start;
-    char *html = malloc(template_len + 1024); // Extra space for substitutions
-    if (!html) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
-        return ESP_FAIL;
-    }
+    const struct {
+        const char *placeholder;
+        const char *value;
+    } fields[] = {
+        { "{{WIFI_SSID}}",     g_config.wifi_ssid },
+        { "{{WIFI_PASSWORD}}", g_config.wifi_password },
+        { "{{INFLUX_URL}}",    g_config.influx_url },
+        { "{{INFLUX_ORG}}",    g_config.influx_org },
+        { "{{INFLUX_BUCKET}}", g_config.influx_bucket },
+        { "{{INFLUX_TOKEN}}",  g_config.influx_token },
+        { "{{DEVICE_ID}}",     g_config.device_id },
+        { "{{TIMEZONE}}",      g_config.timezone },
+    };
     
-    /* Allocate temp buffer on heap instead of stack */
-    char *temp = malloc(4096);
-    if (!temp) {
-        free(html);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    httpd_resp_set_type(req, "text/html");
+    const char *p = (const char *)provisioning_html_start;
+    const char *end = (const char *)provisioning_html_end;
+    const char *text = p;
+    while (p < end) {
+        const char *value = NULL;
+        size_t skip = 0;
+        if (*p == '{') {
+            for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]) && value == NULL; i++) {
+                const size_t len = strlen(fields[i].placeholder);
+                if ((size_t)(end - p) >= len && memcmp(p, fields[i].placeholder, len) == 0) {
+                    value = fields[i].value;
+                    skip = len;
+                }
+            }
+        }
+        if (value == NULL) {
+            p++;
+            continue;
+        }
+        if (httpd_resp_send_chunk(req, text, p - text) != ESP_OK ||
+            httpd_resp_send_chunk(req, value, strlen(value)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        p += skip;
+        text = p;
+    }
+    if (end > text && httpd_resp_send_chunk(req, text, end - text) != ESP_OK) {
         return ESP_FAIL;
     }
-    
-    memcpy(html, provisioning_html_start, template_len);
-    html[template_len] = '\0';
-    
-    /* Replace placeholders with actual values */
-    char *p;
-    
-    /* Helper macro for replacements */
-    #define REPLACE(placeholder, value) \
-        if ((p = strstr(html, placeholder)) != NULL) { \
-            snprintf(temp, 4096, "%.*s%s%s", \
-                (int)(p - html), html, value, p + strlen(placeholder)); \
-            strcpy(html, temp); \
-        }
-    
-    REPLACE("{{WIFI_SSID}}", g_config.wifi_ssid);
-    REPLACE("{{WIFI_PASSWORD}}", g_config.wifi_password);
-    REPLACE("{{INFLUX_URL}}", g_config.influx_url);
-    REPLACE("{{INFLUX_ORG}}", g_config.influx_org);
-    REPLACE("{{INFLUX_BUCKET}}", g_config.influx_bucket);
-    REPLACE("{{INFLUX_TOKEN}}", g_config.influx_token);
-    REPLACE("{{DEVICE_ID}}", g_config.device_id);
-    REPLACE("{{TIMEZONE}}", g_config.timezone);
-    
-    #undef REPLACE
-    
-    httpd_resp_send(req, html, HTTPD_RESP_USE_STRLEN);
-    free(temp);
-    free(html);
-    return ESP_OK;
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 static esp_err_t favicon_handler(httpd_req_t *req)
@@ -105,6 +168,247 @@ static esp_err_t favicon_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+static void set_state(check_state_t state, const char *message)
+{
+    portENTER_CRITICAL(&s_lock);
+    strncpy(s_message, message, sizeof(s_message) - 1);
+    s_state = state;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Check %s: %s", s_state_names[state], message);
+}
+
+/* Results come back as WIFI_EVENT_SCAN_DONE; no-op while busy */
+static void scan_start(void)
+{
+    bool start = false;
+    portENTER_CRITICAL(&s_lock);
+    if (!s_scanning && s_state != CHECK_WIFI && s_state != CHECK_INFLUX && s_state != CHECK_SAVED) {
+        s_scanning = true;
+        start = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!start) {
+        return;
+    }
+
+    const wifi_scan_config_t scan_config = { .show_hidden = false };
+    const esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Scan not started: %s", esp_err_to_name(err));
+        s_scanning = false;
+    }
+}
+
+static void scan_done(void)
+{
+    static wifi_ap_record_t records[SCAN_MAX_APS];
+    uint16_t n = SCAN_MAX_APS;
+    if (esp_wifi_scan_get_ap_records(&n, records) != ESP_OK) {
+        n = 0;
+    }
+    /* Cut short by a check: keep the previous results */
+    if (!s_scanning) {
+        return;
+    }
+
+    /* Strongest first; one entry per network, hidden ones skipped */
+    scan_ap_t aps[SCAN_MAX_APS];
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        const char *ssid = (const char *)records[i].ssid;
+        bool seen = ssid[0] == '\0';
+        for (uint16_t j = 0; j < count && !seen; j++) {
+            seen = strcmp(aps[j].ssid, ssid) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        strncpy(aps[count].ssid, ssid, sizeof(aps[count].ssid) - 1);
+        aps[count].ssid[sizeof(aps[count].ssid) - 1] = '\0';
+        aps[count].rssi = records[i].rssi;
+        aps[count].channel = records[i].primary;
+        aps[count].secure = records[i].authmode != WIFI_AUTH_OPEN;
+        count++;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    memcpy(s_scan, aps, count * sizeof(aps[0]));
+    s_scan_count = count;
+    s_scan_done_us = esp_timer_get_time();
+    s_scanning = false;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Scan found %u networks", count);
+}
+
+static void wifi_event_handler(void *arg, esp_event_base_t event_base,
+                               int32_t event_id, void *event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        scan_done();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        xEventGroupSetBits(s_sta_events, STA_CONNECTED_BIT);
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        const wifi_event_sta_disconnected_t *disconnected = event_data;
+        s_sta_reason = disconnected->reason;
+        xEventGroupSetBits(s_sta_events, STA_FAILED_BIT);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t *event = event_data;
+        snprintf(s_sta_ip, sizeof(s_sta_ip), IPSTR, IP2STR(&event->ip_info.ip));
+        xEventGroupSetBits(s_sta_events, STA_GOT_IP_BIT);
+    }
+}
+
+/* Join the submitted network with the settings wifi_manager will use */
+static esp_err_t check_wifi(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    const bool scanning = s_scanning;
+    s_scanning = false;
+    portEXIT_CRITICAL(&s_lock);
+    if (scanning) {
+        esp_wifi_scan_stop();
+    }
+    esp_wifi_disconnect();
+
+    /* A static address needs no lease: joining is the whole check */
+    wifi_config_t wifi_config;
+    const bool static_ip = wifi_prepare_sta(s_sta_netif, s_pending.wifi_ssid, s_pending.wifi_password,
+                                            &wifi_config);
+    const EventBits_t done_bits = STA_GOT_IP_BIT | (static_ip ? STA_CONNECTED_BIT : 0);
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) {
+        set_state(CHECK_FAILED, "Invalid WiFi settings");
+        return err;
+    }
+
+    const int64_t deadline_us = esp_timer_get_time() + CHECK_WIFI_TIMEOUT_MS * 1000LL;
+    EventBits_t bits = 0;
+    for (int attempt = 0; attempt < CHECK_WIFI_TRIES; attempt++) {
+        xEventGroupClearBits(s_sta_events, STA_CONNECTED_BIT | STA_GOT_IP_BIT | STA_FAILED_BIT);
+        esp_wifi_connect();
+        const int64_t left_us = deadline_us - esp_timer_get_time();
+        bits = xEventGroupWaitBits(s_sta_events, done_bits | STA_FAILED_BIT, pdFALSE, pdFALSE,
+                                   left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) : 0);
+        if ((bits & done_bits) != 0) {
+            if (static_ip) {
+                esp_netif_ip_info_t ip_info;
+                esp_netif_get_ip_info(s_sta_netif, &ip_info);
+                snprintf(s_sta_ip, sizeof(s_sta_ip), IPSTR, IP2STR(&ip_info.ip));
+            }
+            char message[sizeof(s_message)];
+            snprintf(message, sizeof(message), "Connected to %s as %s", s_pending.wifi_ssid, s_sta_ip);
+            set_state(CHECK_WIFI, message);
+            return ESP_OK;
+        }
+        /* A wrong password or a missing network won't get better */
+        if ((bits & STA_FAILED_BIT) == 0 ||
+            s_sta_reason == WIFI_REASON_NO_AP_FOUND ||
+            s_sta_reason == WIFI_REASON_AUTH_FAIL ||
+            s_sta_reason == WIFI_REASON_HANDSHAKE_TIMEOUT ||
+            s_sta_reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) {
+            break;
+        }
+        ESP_LOGW(TAG, "Attempt %d failed (reason %d)", attempt + 1, s_sta_reason);
+    }
+
+    char message[sizeof(s_message)];
+    if ((bits & STA_FAILED_BIT) == 0) {
+        snprintf(message, sizeof(message), "%s",
+                 (bits & STA_CONNECTED_BIT) != 0 ? "Joined the network but got no IP address"
+                                                 : "Timed out joining the network");
+    } else if (s_sta_reason == WIFI_REASON_NO_AP_FOUND) {
+        snprintf(message, sizeof(message), "Network %s not found (WPA2 or better is needed)",
+                 s_pending.wifi_ssid);
+    } else if (s_sta_reason == WIFI_REASON_AUTH_FAIL ||
+               s_sta_reason == WIFI_REASON_HANDSHAKE_TIMEOUT ||
+               s_sta_reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) {
+        snprintf(message, sizeof(message), "Wrong WiFi password");
+    } else {
+        snprintf(message, sizeof(message), "Could not join the network (reason %d)", s_sta_reason);
+    }
+    esp_wifi_disconnect();
+    set_state(CHECK_FAILED, message);
+    return ESP_FAIL;
+}
+
+/* GET <url>/ping: answered by InfluxDB 1.x and 2.x and VictoriaMetrics
+ * without a token, so it tests reachability (and TLS), not credentials */
+static esp_err_t check_influx(void)
+{
+    char url[sizeof(s_pending.influx_url) + 8];
+    size_t len = strlen(s_pending.influx_url);
+    while (len > 0 && s_pending.influx_url[len - 1] == '/') {
+        len--;
+    }
+    snprintf(url, sizeof(url), "%.*s/ping", (int)len, s_pending.influx_url);
+
+    esp_http_client_config_t http_config = {
+        .url = url,
+        .method = HTTP_METHOD_GET,
+        .timeout_ms = CHECK_HTTP_TIMEOUT_MS,
+    };
+    if (strncmp(url, "https://", 8) == 0) {
+#if CONFIG_CHARGER_SINK_TLS_PINNED
+        http_config.cert_pem = sink_ca_pem_start;
+#else
+        http_config.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+    }
+
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL) {
+        set_state(CHECK_FAILED, "Invalid InfluxDB URL");
+        return ESP_FAIL;
+    }
+    const esp_err_t err = esp_http_client_perform(client);
+    const int status = esp_http_client_get_status_code(client);
+    esp_http_client_cleanup(client);
+
+    char message[sizeof(s_message)];
+    if (err != ESP_OK) {
+        snprintf(message, sizeof(message), "InfluxDB unreachable (%s)", esp_err_to_name(err));
+    } else if (status < 200 || status >= 300) {
+        snprintf(message, sizeof(message), "InfluxDB URL answered %d to /ping", status);
+    } else {
+        return ESP_OK;
+    }
+    esp_wifi_disconnect();
+    set_state(CHECK_FAILED, message);
+    return ESP_FAIL;
+}
+
+/* Tests what /save submitted, then stores it and restarts - away from the
+ * httpd task, so the page keeps getting answers meanwhile */
+static void check_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (check_wifi() != ESP_OK) {
+            continue;
+        }
+        if (!s_skip_influx) {
+            set_state(CHECK_INFLUX, "Connecting to InfluxDB");
+            if (check_influx() != ESP_OK) {
+                continue;
+            }
+        }
+
+        g_config = s_pending;
+        g_config.provisioned = true;
+        if (config_save_to_nvs() != ESP_OK) {
+            esp_wifi_disconnect();
+            set_state(CHECK_FAILED, "Could not save the configuration");
+            continue;
+        }
+        set_state(CHECK_SAVED, "Configuration saved, restarting");
+        vTaskDelay(pdMS_TO_TICKS(REBOOT_DELAY_MS));
+        esp_restart();
+    }
+}
+
+/* Parses the form into s_pending and starts the check; the outcome is
+ * polled from /api/provision */
 static esp_err_t provisioning_post_handler(httpd_req_t *req)
 {
     char buf[1024];
@@ -115,6 +419,13 @@ static esp_err_t provisioning_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
+    const check_state_t state = s_state;
+    if (state == CHECK_WIFI || state == CHECK_INFLUX || state == CHECK_SAVED) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "A check is already running");
+        return ESP_OK;
+    }
+
     ret = httpd_req_recv(req, buf, remaining);
     if (ret <= 0) {
         if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
@@ -124,66 +435,137 @@ static esp_err_t provisioning_post_handler(httpd_req_t *req)
     }
     buf[ret] = '\0';
 
-    ESP_LOGI(TAG, "Received form data: %s", buf);
-
-    /* Parse form data */
+    /* Parse form data; fields left out keep their current values */
     char value[128];
     char decoded[128];
+    s_pending = g_config;
     
     if (httpd_query_key_value(buf, "wifi_ssid", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.wifi_ssid, decoded, sizeof(g_config.wifi_ssid) - 1);
-        ESP_LOGI(TAG, "WiFi SSID: %s", g_config.wifi_ssid);
+        strncpy(s_pending.wifi_ssid, decoded, sizeof(s_pending.wifi_ssid) - 1);
+        ESP_LOGI(TAG, "WiFi SSID: %s", s_pending.wifi_ssid);
     }
     if (httpd_query_key_value(buf, "wifi_pass", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.wifi_password, decoded, sizeof(g_config.wifi_password) - 1);
-        ESP_LOGI(TAG, "WiFi password length: %d", strlen(g_config.wifi_password));
+        strncpy(s_pending.wifi_password, decoded, sizeof(s_pending.wifi_password) - 1);
+        ESP_LOGI(TAG, "WiFi password length: %d", strlen(s_pending.wifi_password));
     }
     if (httpd_query_key_value(buf, "influx_url", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.influx_url, decoded, sizeof(g_config.influx_url) - 1);
+        strncpy(s_pending.influx_url, decoded, sizeof(s_pending.influx_url) - 1);
     }
     if (httpd_query_key_value(buf, "influx_org", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.influx_org, decoded, sizeof(g_config.influx_org) - 1);
+        strncpy(s_pending.influx_org, decoded, sizeof(s_pending.influx_org) - 1);
     }
     if (httpd_query_key_value(buf, "influx_bucket", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.influx_bucket, decoded, sizeof(g_config.influx_bucket) - 1);
+        strncpy(s_pending.influx_bucket, decoded, sizeof(s_pending.influx_bucket) - 1);
     }
     if (httpd_query_key_value(buf, "influx_token", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.influx_token, decoded, sizeof(g_config.influx_token) - 1);
+        strncpy(s_pending.influx_token, decoded, sizeof(s_pending.influx_token) - 1);
     }
     if (httpd_query_key_value(buf, "device_id", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.device_id, decoded, sizeof(g_config.device_id) - 1);
+        strncpy(s_pending.device_id, decoded, sizeof(s_pending.device_id) - 1);
     }
     if (httpd_query_key_value(buf, "timezone", value, sizeof(value)) == ESP_OK) {
         url_decode(decoded, value);
-        strncpy(g_config.timezone, decoded, sizeof(g_config.timezone) - 1);
+        strncpy(s_pending.timezone, decoded, sizeof(s_pending.timezone) - 1);
     } else {
         /* Default to UTC if not provided */
-        strncpy(g_config.timezone, "UTC", sizeof(g_config.timezone) - 1);
+        strncpy(s_pending.timezone, "UTC", sizeof(s_pending.timezone) - 1);
     }
+    s_skip_influx = httpd_query_key_value(buf, "skip_influx", value, sizeof(value)) == ESP_OK ||
+                    s_pending.influx_url[0] == '\0';
 
-    /* Save configuration */
-    g_config.provisioned = true;
-    config_save_to_nvs();
-    
-    ESP_LOGI(TAG, "Configuration saved, rebooting in 3 seconds...");
+    if (s_pending.wifi_ssid[0] == '\0') {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "WiFi SSID missing");
+        return ESP_FAIL;
+    }
 
-    const size_t success_html_len = success_html_end - success_html_start;
-    httpd_resp_send(req, (const char *)success_html_start, success_html_len);
+    set_state(CHECK_WIFI, "Joining the network");
+    xTaskNotifyGive(s_check_task);
+
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, "{\"state\":\"wifi\"}");
+    return ESP_OK;
+}
+
+/* Cached results at once; stale ones start a scan for the next poll */
+static esp_err_t scan_get_handler(httpd_req_t *req)
+{
+    scan_ap_t aps[SCAN_MAX_APS];
+    portENTER_CRITICAL(&s_lock);
+    const uint16_t count = s_scan_count;
+    memcpy(aps, s_scan, count * sizeof(aps[0]));
+    const int64_t done_us = s_scan_done_us;
+    portEXIT_CRITICAL(&s_lock);
 
-    /* Schedule reboot */
-    vTaskDelay(pdMS_TO_TICKS(3000));
-    esp_restart();
+    const int64_t age_ms = done_us == 0 ? -1 : (esp_timer_get_time() - done_us) / 1000;
+    if (age_ms < 0 || age_ms > SCAN_MAX_AGE_MS) {
+        scan_start();
+    }
 
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "scanning", s_scanning);
+    cJSON_AddNumberToObject(root, "age_ms", (double)age_ms);
+    cJSON *networks = cJSON_AddArrayToObject(root, "networks");
+    for (uint16_t i = 0; i < count; i++) {
+        cJSON *ap = cJSON_CreateObject();
+        cJSON_AddStringToObject(ap, "ssid", aps[i].ssid);
+        cJSON_AddNumberToObject(ap, "rssi", aps[i].rssi);
+        cJSON_AddNumberToObject(ap, "channel", aps[i].channel);
+        cJSON_AddBoolToObject(ap, "secure", aps[i].secure);
+        cJSON_AddItemToArray(networks, ap);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, json_str);
+    cJSON_free(json_str);
+    return ESP_OK;
+}
+
+static esp_err_t status_get_handler(httpd_req_t *req)
+{
+    char message[sizeof(s_message)];
+    portENTER_CRITICAL(&s_lock);
+    const check_state_t state = s_state;
+    memcpy(message, s_message, sizeof(message));
+    portEXIT_CRITICAL(&s_lock);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "state", s_state_names[state]);
+    cJSON_AddStringToObject(root, "message", message);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_sendstr(req, json_str);
+    cJSON_free(json_str);
     return ESP_OK;
 }
 
+static esp_err_t success_get_handler(httpd_req_t *req)
+{
+    const size_t success_html_len = success_html_end - success_html_start;
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, (const char *)success_html_start, success_html_len);
+}
+
 static httpd_handle_t start_server(void)
 {
     httpd_config_t config_server = HTTPD_DEFAULT_CONFIG();
@@ -221,6 +603,30 @@ static httpd_handle_t start_server(void)
         };
         httpd_register_uri_handler(server, &uri_post);
 
+        const httpd_uri_t uri_scan = {
+            .uri = "/api/scan",
+            .method = HTTP_GET,
+            .handler = scan_get_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &uri_scan);
+
+        const httpd_uri_t uri_status = {
+            .uri = "/api/provision",
+            .method = HTTP_GET,
+            .handler = status_get_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &uri_status);
+
+        const httpd_uri_t uri_success = {
+            .uri = "/success",
+            .method = HTTP_GET,
+            .handler = success_get_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &uri_success);
+
         return server;
     }
 
@@ -234,12 +640,22 @@ void provisioning_start(void)
     ESP_LOGI(TAG, "Starting provisioning mode");
     ESP_LOGI(TAG, "====================================");
 
+    s_sta_events = RTOS_EVENT_GROUP_CREATE();
+    if (s_sta_events == NULL ||
+        RTOS_TASK_CREATE(check_task, "prov_check", CHECK_TASK_STACK, NULL, 5, &s_check_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the check task");
+        esp_restart();
+    }
+
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_ap();
+    s_sta_netif = esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
 
     wifi_config_t wifi_config = {
         .ap = {
@@ -252,7 +668,9 @@ void provisioning_start(void)
         },
     };
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
+    /* The station side scans and tests the submitted network while the
+     * access point keeps serving the page */
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
@@ -264,8 +682,9 @@ void provisioning_start(void)
     ESP_LOGI(TAG, "====================================");
 
     start_server();
+    scan_start();
 
-    /* Keep running in provisioning mode */
+    /* Keep running in provisioning mode; check_task restarts the device */
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
@@ -2,6 +2,9 @@
 
 /**
  * Start provisioning mode - runs AP with web server for configuration
+ * The station side runs alongside (APSTA): it scans for /api/scan and
+ * tests submitted settings by joining the network and pinging InfluxDB.
+ * Settings are saved to NVS, and the device restarted, only if that works.
  * This function never returns
  */
 void provisioning_start(void);
@@ -0,0 +1,188 @@
+#include "remote_write.h"
+#include "snappy.h"
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Protobuf wire types */
+#define WIRE_VARINT  0
+#define WIRE_FIXED64 1
+#define WIRE_LEN     2
+
+/* prompb field numbers; all below 16, so every tag is one byte */
+#define WRITE_REQUEST_TIMESERIES  1
+#define TIMESERIES_LABELS         1
+#define TIMESERIES_SAMPLES        2
+#define LABEL_NAME                1
+#define LABEL_VALUE               2
+#define SAMPLE_VALUE              1
+#define SAMPLE_TIMESTAMP          2
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    bool overflow;
+} pb_writer_t;
+
+typedef struct {
+    const char *name;
+    float (*value)(const sensor_data_t *p);     /* NAN when the point has none */
+} metric_t;
+
+static float battery_voltage(const sensor_data_t *p) { return p->battery_voltage; }
+static float battery_percent(const sensor_data_t *p) { return p->battery_percentage; }
+static float internal_temp(const sensor_data_t *p) { return p->internal_temp; }
+static float cell_temp(const sensor_data_t *p) { return p->cell_temp; }
+static float cell_ir(const sensor_data_t *p) { return p->ir_mohm; }
+static float charging_time(const sensor_data_t *p) { return (float)p->charging_time_sec; }
+static float over_temp(const sensor_data_t *p) { return p->over_temp ? 1.0f : 0.0f; }
+static float charge_state(const sensor_data_t *p) { return (float)p->charge_state; }
+
+static const metric_t s_metrics[] = {
+    { "charger_battery_voltage_volts",  battery_voltage },
+    { "charger_battery_percent",        battery_percent },
+    { "charger_internal_temp_celsius",  internal_temp },
+    { "charger_cell_temp_celsius",      cell_temp },
+    { "charger_cell_ir_milliohms",      cell_ir },
+    { "charger_charging_time_seconds",  charging_time },
+    { "charger_over_temp",              over_temp },
+    { "charger_charge_state",           charge_state },
+};
+
+static uint8_t s_raw[REMOTE_WRITE_RAW_MAX];
+
+static size_t varint_size(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/* A length-delimited field with a body of len bytes */
+static size_t field_size(size_t len)
+{
+    return 1 + varint_size(len) + len;
+}
+
+static void put_raw(pb_writer_t *w, const void *data, size_t n)
+{
+    if (w->overflow || n > w->cap - w->len) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+}
+
+static void put_varint(pb_writer_t *w, uint64_t v)
+{
+    uint8_t tmp[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        tmp[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    tmp[n++] = (uint8_t)v;
+    put_raw(w, tmp, n);
+}
+
+static void put_tag(pb_writer_t *w, uint32_t field, uint32_t wire)
+{
+    put_varint(w, (field << 3) | wire);
+}
+
+static void put_string(pb_writer_t *w, uint32_t field, const char *s)
+{
+    const size_t len = strlen(s);
+    put_tag(w, field, WIRE_LEN);
+    put_varint(w, len);
+    put_raw(w, s, len);
+}
+
+static size_t label_size(const char *name, const char *value)
+{
+    return field_size(strlen(name)) + field_size(strlen(value));
+}
+
+static void put_label(pb_writer_t *w, const char *name, const char *value)
+{
+    put_tag(w, TIMESERIES_LABELS, WIRE_LEN);
+    put_varint(w, label_size(name, value));
+    put_string(w, LABEL_NAME, name);
+    put_string(w, LABEL_VALUE, value);
+}
+
+static size_t sample_size(int64_t timestamp_ms)
+{
+    return 1 + sizeof(double) + 1 + varint_size((uint64_t)timestamp_ms);
+}
+
+static void put_sample(pb_writer_t *w, double value, int64_t timestamp_ms)
+{
+    /* fixed64 is little-endian, as are the ESP32 and the host tools */
+    put_tag(w, TIMESERIES_SAMPLES, WIRE_LEN);
+    put_varint(w, sample_size(timestamp_ms));
+    put_tag(w, SAMPLE_VALUE, WIRE_FIXED64);
+    put_raw(w, &value, sizeof(value));
+    put_tag(w, SAMPLE_TIMESTAMP, WIRE_VARINT);
+    put_varint(w, (uint64_t)timestamp_ms);
+}
+
+/* One series: a metric over a run of points of the same cell */
+static void put_series(pb_writer_t *w, const metric_t *metric, const sensor_data_t *points,
+                       size_t count, const char *device)
+{
+    const char *cell_id = points[0].cell_id[0] ? points[0].cell_id : "none";
+
+    /* Labels sorted by name, as remote-write requires */
+    size_t len = field_size(label_size("__name__", metric->name)) +
+                 field_size(label_size("cell_id", cell_id)) +
+                 field_size(label_size("device", device));
+    size_t samples = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!isnan(metric->value(&points[i]))) {
+            len += field_size(sample_size(points[i].timestamp_ns / 1000000));
+            samples++;
+        }
+    }
+    if (samples == 0) {
+        return;
+    }
+
+    put_tag(w, WRITE_REQUEST_TIMESERIES, WIRE_LEN);
+    put_varint(w, len);
+    put_label(w, "__name__", metric->name);
+    put_label(w, "cell_id", cell_id);
+    put_label(w, "device", device);
+    for (size_t i = 0; i < count; i++) {
+        const float value = metric->value(&points[i]);
+        if (!isnan(value)) {
+            put_sample(w, value, points[i].timestamp_ns / 1000000);
+        }
+    }
+}
+
+size_t remote_write_encode(const sensor_data_t *points, size_t count, const char *device,
+                           uint8_t *out, size_t out_len)
+{
+    pb_writer_t w = { .buf = s_raw, .cap = sizeof(s_raw) };
+
+    for (size_t m = 0; m < sizeof(s_metrics) / sizeof(s_metrics[0]); m++) {
+        for (size_t start = 0; start < count; ) {
+            size_t end = start + 1;
+            while (end < count && strcmp(points[end].cell_id, points[start].cell_id) == 0) {
+                end++;
+            }
+            put_series(&w, &s_metrics[m], &points[start], end - start, device);
+            start = end;
+        }
+    }
+    if (w.overflow) {
+        return 0;
+    }
+    return snappy_compress(s_raw, w.len, out, out_len);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sensor.h"
+
+/* Prometheus remote-write encoding
+ *
+ * Points become a WriteRequest protobuf (prompb), snappy-compressed as
+ * remote-write 1.0 requires. One series per metric and cell:
+ *
+ *   charger_battery_voltage_volts{device, cell_id}
+ *   charger_battery_percent, charger_internal_temp_celsius,
+ *   charger_cell_temp_celsius (NTC only), charger_cell_ir_milliohms (once
+ *   measured), charger_charging_time_seconds, charger_over_temp (0/1),
+ *   charger_charge_state (index into API_CHARGE_STATE_NAMES)
+ *
+ * Timestamps are milliseconds, so points must carry UTC time. Free of
+ * ESP-IDF includes apart from sensor.h so tools/sinkcheck can build it.
+ */
+
+/* Uncompressed protobuf per request; a batch of INFLUXDB_BATCH_MAX_POINTS
+ * for one cell takes about 3 KB */
+#define REMOTE_WRITE_RAW_MAX  8192
+
+/**
+ * Encode points as one compressed remote-write request
+ * Not reentrant: builds the protobuf in a static buffer.
+ * @param points Points with UTC timestamps, oldest first
+ * @param count Number of points
+ * @param device Value of the device label
+ * @param out Output buffer
+ * @param out_len Size of out, at least snappy_max_compressed_length(REMOTE_WRITE_RAW_MAX)
+ * @return Length of the request body, 0 if the points don't fit
+ */
+size_t remote_write_encode(const sensor_data_t *points, size_t count, const char *device,
+                           uint8_t *out, size_t out_len);
@@ -0,0 +1,190 @@
+#include "scheduler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <math.h>
+
+static const char *TAG = "scheduler";
+
+/* Time constant of the slope estimator (EMA over dV/dt) */
+#define SLOPE_TAU_US  (30 * 1000000LL)
+
+static scheduler_config_t s_cfg;
+
+static charge_state_t s_last_state = CHARGE_STATE_NO_CELL;
+static float s_last_voltage = 0;
+static int64_t s_last_time_us = 0;
+static float s_slope_mv_min = 0;
+static int64_t s_fast_until_us = 0;
+static int64_t s_stable_since_us = 0;
+static sched_mode_t s_mode = SCHED_MODE_NORMAL;
+static sched_reason_t s_reason = SCHED_REASON_DEFAULT;
+
+void scheduler_get_default_config(scheduler_config_t *cfg)
+{
+    cfg->fast_sample_ms = CONFIG_CHARGER_SAMPLE_FAST_MS;
+    cfg->normal_sample_ms = CONFIG_CHARGER_SAMPLE_NORMAL_MS;
+    cfg->slow_sample_ms = CONFIG_CHARGER_SAMPLE_SLOW_MS;
+    cfg->fast_upload_sec = CONFIG_CHARGER_UPLOAD_FAST_SEC;
+    cfg->normal_upload_sec = CONFIG_CHARGER_UPLOAD_NORMAL_SEC;
+    cfg->slow_upload_sec = CONFIG_CHARGER_UPLOAD_SLOW_SEC;
+    cfg->slope_mv_per_min = CONFIG_CHARGER_SCHED_SLOPE_MV_PER_MIN;
+    cfg->fast_hold_sec = CONFIG_CHARGER_SCHED_FAST_HOLD_SEC;
+    cfg->early_cc_sec = CONFIG_CHARGER_SCHED_EARLY_CC_SEC;
+    cfg->stable_sec = CONFIG_CHARGER_SCHED_STABLE_SEC;
+}
+
+void scheduler_init(const scheduler_config_t *cfg)
+{
+    if (cfg) {
+        s_cfg = *cfg;
+    } else {
+        scheduler_get_default_config(&s_cfg);
+    }
+
+    s_last_state = CHARGE_STATE_NO_CELL;
+    s_last_time_us = 0;
+    s_slope_mv_min = 0;
+    s_fast_until_us = 0;
+    s_stable_since_us = 0;
+    s_mode = SCHED_MODE_NORMAL;
+    s_reason = SCHED_REASON_DEFAULT;
+
+    ESP_LOGI(TAG, "Sample interval fast/normal/slow: %lu/%lu/%lu ms, upload: %lu/%lu/%lu s",
+             s_cfg.fast_sample_ms, s_cfg.normal_sample_ms, s_cfg.slow_sample_ms,
+             s_cfg.fast_upload_sec, s_cfg.normal_upload_sec, s_cfg.slow_upload_sec);
+}
+
+void scheduler_set_config(const scheduler_config_t *cfg)
+{
+    s_cfg = *cfg;
+}
+
+/* Track dV/dt in mV/min with an EMA whose weight follows the elapsed time,
+ * so the estimate means the same thing at every sample rate */
+static void update_slope(float voltage, int64_t now)
+{
+    if (s_last_time_us > 0 && now > s_last_time_us) {
+        const int64_t dt_us = now - s_last_time_us;
+        const float inst = (voltage - s_last_voltage) * 1000.0f * (60000000.0f / (float)dt_us);
+        const float alpha = (float)dt_us / (float)(SLOPE_TAU_US + dt_us);
+        s_slope_mv_min = alpha * inst + (1.0f - alpha) * s_slope_mv_min;
+    }
+    s_last_voltage = voltage;
+    s_last_time_us = now;
+}
+
+void scheduler_update(sensor_data_t *data, bool new_cell)
+{
+    const int64_t now = esp_timer_get_time();
+    sched_mode_t mode;
+    sched_reason_t reason;
+
+    if (!data->cell_present) {
+        /* Keep polling at the normal rate so insertion is noticed quickly */
+        s_last_state = CHARGE_STATE_NO_CELL;
+        s_last_time_us = 0;
+        s_slope_mv_min = 0;
+        s_fast_until_us = 0;
+        s_stable_since_us = 0;
+        mode = SCHED_MODE_NORMAL;
+        reason = SCHED_REASON_NO_CELL;
+    } else {
+        sched_reason_t trigger = SCHED_REASON_DEFAULT;
+
+        if (new_cell) {
+            s_last_time_us = 0;
+            s_slope_mv_min = 0;
+            trigger = SCHED_REASON_NEW_CELL;
+        } else if (data->charge_state != s_last_state) {
+            trigger = SCHED_REASON_TRANSITION;
+        }
+
+        update_slope(data->battery_voltage, now);
+        if (trigger == SCHED_REASON_DEFAULT && fabsf(s_slope_mv_min) >= (float)s_cfg.slope_mv_per_min) {
+            trigger = SCHED_REASON_SLOPE;
+        }
+
+        if (trigger != SCHED_REASON_DEFAULT) {
+            s_fast_until_us = now + (int64_t)s_cfg.fast_hold_sec * 1000000LL;
+            s_stable_since_us = 0;
+            mode = SCHED_MODE_FAST;
+            reason = trigger;
+        } else if (data->charge_state == CHARGE_STATE_CHARGING &&
+                   data->charging_time_sec < s_cfg.early_cc_sec) {
+            s_stable_since_us = 0;
+            mode = SCHED_MODE_FAST;
+            reason = SCHED_REASON_EARLY_CC;
+        } else if (now < s_fast_until_us) {
+            mode = SCHED_MODE_FAST;
+            reason = SCHED_REASON_HOLD;
+        } else if (data->charge_state == CHARGE_STATE_IDLE || data->charge_state == CHARGE_STATE_FULL) {
+            if (s_stable_since_us == 0) {
+                s_stable_since_us = now;
+            }
+            if (now - s_stable_since_us >= (int64_t)s_cfg.stable_sec * 1000000LL) {
+                mode = SCHED_MODE_SLOW;
+                reason = SCHED_REASON_STABLE;
+            } else {
+                mode = SCHED_MODE_NORMAL;
+                reason = SCHED_REASON_DEFAULT;
+            }
+        } else {
+            s_stable_since_us = 0;
+            mode = SCHED_MODE_NORMAL;
+            reason = SCHED_REASON_DEFAULT;
+        }
+
+        s_last_state = data->charge_state;
+    }
+
+    if (mode != s_mode) {
+        ESP_LOGI(TAG, "Mode %s -> %s (%s, slope %.1f mV/min)",
+                 scheduler_mode_str(s_mode), scheduler_mode_str(mode),
+                 scheduler_reason_str(reason), s_slope_mv_min);
+    }
+    s_mode = mode;
+    s_reason = reason;
+
+    switch (mode) {
+        case SCHED_MODE_FAST:
+            data->sample_interval_ms = s_cfg.fast_sample_ms;
+            data->upload_interval_sec = s_cfg.fast_upload_sec;
+            break;
+        case SCHED_MODE_SLOW:
+            data->sample_interval_ms = s_cfg.slow_sample_ms;
+            data->upload_interval_sec = s_cfg.slow_upload_sec;
+            break;
+        default:
+            data->sample_interval_ms = s_cfg.normal_sample_ms;
+            data->upload_interval_sec = s_cfg.normal_upload_sec;
+            break;
+    }
+    data->sched_mode = (uint8_t)mode;
+    data->sched_reason = (uint8_t)reason;
+}
+
+const char* scheduler_mode_str(uint8_t mode)
+{
+    switch (mode) {
+        case SCHED_MODE_FAST:   return "fast";
+        case SCHED_MODE_NORMAL: return "normal";
+        case SCHED_MODE_SLOW:   return "slow";
+        default:                return "unknown";
+    }
+}
+
+const char* scheduler_reason_str(uint8_t reason)
+{
+    switch (reason) {
+        case SCHED_REASON_DEFAULT:    return "default";
+        case SCHED_REASON_NEW_CELL:   return "new_cell";
+        case SCHED_REASON_TRANSITION: return "transition";
+        case SCHED_REASON_SLOPE:      return "slope";
+        case SCHED_REASON_EARLY_CC:   return "early_cc";
+        case SCHED_REASON_HOLD:       return "hold";
+        case SCHED_REASON_STABLE:     return "stable";
+        case SCHED_REASON_NO_CELL:    return "no_cell";
+        default:                      return "unknown";
+    }
+}
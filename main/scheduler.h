@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include "sensor.h"
+
+/* Scheduler modes, ordered from densest to sparsest acquisition */
+typedef enum {
+    SCHED_MODE_FAST,    /* Transition, steep slope or early CC phase */
+    SCHED_MODE_NORMAL,  /* Cell present, nothing noteworthy */
+    SCHED_MODE_SLOW     /* Idle/Full and stable for a while */
+} sched_mode_t;
+
+/* Why the scheduler picked the current mode */
+typedef enum {
+    SCHED_REASON_DEFAULT,     /* No trigger, normal operation */
+    SCHED_REASON_NEW_CELL,    /* Cell was just inserted */
+    SCHED_REASON_TRANSITION,  /* Charge state changed */
+    SCHED_REASON_SLOPE,       /* |dV/dt| above threshold */
+    SCHED_REASON_EARLY_CC,    /* First minutes of a charge */
+    SCHED_REASON_HOLD,        /* Still inside the fast hold window */
+    SCHED_REASON_STABLE,      /* Idle/Full long enough to back off */
+    SCHED_REASON_NO_CELL      /* Waiting for a cell */
+} sched_reason_t;
+
+/* Scheduler thresholds and rates */
+typedef struct {
+    uint32_t fast_sample_ms;        /* Sample interval in fast mode */
+    uint32_t normal_sample_ms;      /* Sample interval in normal mode */
+    uint32_t slow_sample_ms;        /* Sample interval in slow mode */
+    uint32_t fast_upload_sec;       /* Upload interval in fast mode */
+    uint32_t normal_upload_sec;     /* Upload interval in normal mode */
+    uint32_t slow_upload_sec;       /* Upload interval in slow mode */
+    uint32_t slope_mv_per_min;      /* |dV/dt| that forces fast mode */
+    uint32_t fast_hold_sec;         /* Stay fast this long after a trigger */
+    uint32_t early_cc_sec;          /* Charge age considered "early CC" */
+    uint32_t stable_sec;            /* Idle/Full this long before going slow */
+} scheduler_config_t;
+
+/**
+ * Fill a config with the Kconfig defaults
+ * @param cfg Config to fill
+ */
+void scheduler_get_default_config(scheduler_config_t *cfg);
+
+/**
+ * Initialize the scheduler
+ * @param cfg Thresholds to use, or NULL for the Kconfig defaults
+ */
+void scheduler_init(const scheduler_config_t *cfg);
+
+/**
+ * Replace thresholds and rates without resetting the current decision
+ * Call from the sampling task; takes effect with the next sample.
+ * @param cfg New thresholds
+ */
+void scheduler_set_config(const scheduler_config_t *cfg);
+
+/**
+ * Feed a fresh sample to the scheduler and record its decision
+ * Fills sample_interval_ms, upload_interval_sec, sched_mode and
+ * sched_reason in the sample so the decision ends up in telemetry.
+ * @param data Current sensor data (after sensor_read)
+ * @param new_cell true if this sample is the first of a new cell session
+ */
+void scheduler_update(sensor_data_t *data, bool new_cell);
+
+/**
+ * Get string representation of a scheduler mode
+ * @param mode The mode (sched_mode_t)
+ * @return Human-readable string
+ */
+const char* scheduler_mode_str(uint8_t mode);
+
+/**
+ * Get string representation of a scheduler reason
+ * @param reason The reason (sched_reason_t)
+ * @return Human-readable string
+ */
+const char* scheduler_reason_str(uint8_t reason);
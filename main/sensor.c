@@ -1,4 +1,10 @@
 #include "sensor.h"
+#include "cell_index.h"
+#include "calibration.h"
+#include "thermal.h"
+#include "ir_capture.h"
+#include "filter.h"
+#include "binlog.h"
 #include "esp_log.h"
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
@@ -10,6 +16,8 @@
 #include "esp_random.h"
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include "sdkconfig.h"
 
 static const char *TAG = "sensor";
 
@@ -17,20 +25,30 @@ static const char *TAG = "sensor";
 #define BATTERY_ADC_CHANNEL  ADC_CHANNEL_1  /* GPIO1 */
 #define BATTERY_ADC_ATTEN    ADC_ATTEN_DB_11
 #define BATTERY_ADC_SAMPLES  16
-#define VOLTAGE_DIVIDER      3.33 /* Voltage divider ratio: (R1+R2)/R2, e.g. 200k+100k = 3.0, adjust as needed */
-
-/* Voltage smoothing - exponential moving average */
-#define VOLTAGE_EMA_ALPHA    0.1f  /* Lower = more smoothing (0.1 = 10% new, 90% old) */
+#define ADC_READ_RETRIES     3     /* The thermal watchdog and IR capture share the unit */
+#define VOLTAGE_DIVIDER      3.33f /* Default divider ratio: (R1+R2)/R2, e.g. 200k+100k = 3.0, adjust as needed */
 
 /* Cell detection threshold */
-#define CELL_DETECT_VOLTAGE  2.5  /* Minimum voltage to consider a cell present */
-#define CELL_FULL_VOLTAGE    4.15 /* Voltage considered fully charged */
+#define CELL_DETECT_VOLTAGE  2.5f  /* Minimum voltage to consider a cell present */
+#define CELL_FULL_VOLTAGE    4.15f /* Voltage considered fully charged */
+#define CELL_DEBOUNCE_US     (CONFIG_CHARGER_PRESENCE_DEBOUNCE_MS * 1000LL) /* Presence change must persist this long */
 
-/* Voltage change thresholds for state detection (in mV) */
+/* Voltage change thresholds for state detection (in mV); the values above
+ * and these are defaults for sensor_config_t */
 #define VOLTAGE_RISING_THRESHOLD   3   /* mV increase over period to consider charging */
 #define VOLTAGE_FALLING_THRESHOLD  3   /* mV decrease over period to consider discharging */
 #define VOLTAGE_STABLE_COUNT       30  /* Number of stable readings to confirm state */
 #define VOLTAGE_HISTORY_SIZE       60  /* Number of readings to compare for trend (60s at 1s intervals) */
+#define VOLTAGE_HISTORY_INTERVAL_US 1000000LL /* Trend history advances at most once per second */
+
+static sensor_config_t s_cfg = {
+    .voltage_divider = VOLTAGE_DIVIDER,
+    .cell_detect_voltage = CELL_DETECT_VOLTAGE,
+    .cell_full_voltage = CELL_FULL_VOLTAGE,
+    .rising_mv = VOLTAGE_RISING_THRESHOLD,
+    .falling_mv = VOLTAGE_FALLING_THRESHOLD,
+    .stable_count = VOLTAGE_STABLE_COUNT,
+};
 
 static adc_oneshot_unit_handle_t adc_handle = NULL;
 static adc_cali_handle_t adc_cali_handle = NULL;
@@ -42,11 +60,32 @@ static bool s_new_cell_flag = false;
 static char s_cell_id[24] = {0};
 static int64_t s_cell_connect_time = 0;
 static float s_smoothed_voltage = 0;
+static bool s_filter_primed = false;
+static int64_t s_presence_change_time = 0;
+static float s_last_cell_voltage = 0;
+static int64_t s_last_history_time = 0;
 static float s_voltage_history[VOLTAGE_HISTORY_SIZE] = {0};
 static int s_history_index = 0;
 static bool s_history_filled = false;
 static int s_stable_count = 0;
 static charge_state_t s_last_charge_state = CHARGE_STATE_NO_CELL;
+static int64_t s_cell_inserted_time = 0;
+static float s_ir_mohm = NAN;
+
+void sensor_get_default_config(sensor_config_t *cfg)
+{
+    cfg->voltage_divider = VOLTAGE_DIVIDER;
+    cfg->cell_detect_voltage = CELL_DETECT_VOLTAGE;
+    cfg->cell_full_voltage = CELL_FULL_VOLTAGE;
+    cfg->rising_mv = VOLTAGE_RISING_THRESHOLD;
+    cfg->falling_mv = VOLTAGE_FALLING_THRESHOLD;
+    cfg->stable_count = VOLTAGE_STABLE_COUNT;
+}
+
+void sensor_set_config(const sensor_config_t *cfg)
+{
+    s_cfg = *cfg;
+}
 
 esp_err_t sensor_init(void)
 {
@@ -102,6 +141,24 @@ esp_err_t sensor_init(void)
     
     ESP_LOGI(TAG, "Internal temperature sensor initialized");
     
+    /* Cell NTC and its over-temperature watchdog, if fitted */
+    err = thermal_init(adc_handle, adc_cali_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    /* Internal resistance from charge current steps */
+    err = ir_capture_init(adc_handle, adc_cali_handle, BATTERY_ADC_CHANNEL);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Internal resistance capture unavailable");
+    }
+    
+    /* Recently removed cells, to recognise them when re-inserted */
+    cell_index_init();
+    
+    /* Per-board divider correction, if one was saved */
+    calibration_init();
+    
     return ESP_OK;
 }
 
@@ -115,88 +172,179 @@ static void generate_cell_id(void)
     ESP_LOGI(TAG, "Generated new cell ID: %s", s_cell_id);
 }
 
-esp_err_t sensor_read(sensor_data_t *data)
+static int raw_to_mv(int raw)
+{
+    int mv;
+    if (adc_cali_handle == NULL || adc_cali_raw_to_voltage(adc_cali_handle, raw, &mv) != ESP_OK) {
+        /* Rough approximation if calibration failed */
+        mv = (raw * 3100) / 4095;
+    }
+    return mv;
+}
+
+/* A read that collides with another task's on the ADC unit fails; retry
+ * it a few times before giving up on the sample */
+static bool read_code(adc_channel_t channel, int *code)
+{
+    for (int attempt = 0; attempt < ADC_READ_RETRIES; attempt++) {
+        if (adc_oneshot_read(adc_handle, channel, code) == ESP_OK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* One oversampled acquisition pass; the NTC (if fitted) is read in the same
+ * pass, interleaved with the battery channel. Only successful reads are
+ * decimated; fails if no battery read succeeded. *ntc_pin_mv is -1 if no
+ * NTC read succeeded. */
+static esp_err_t acquire(int *battery_pin_mv, int *ntc_pin_mv)
 {
-    esp_err_t err;
-    
-    /* Measure battery voltage with oversampling */
     int adc_samples[BATTERY_ADC_SAMPLES];
+    size_t adc_count = 0;
+#if CONFIG_CHARGER_NTC_ENABLE
+    int ntc_samples[BATTERY_ADC_SAMPLES];
+    size_t ntc_count = 0;
+#endif
     for (int i = 0; i < BATTERY_ADC_SAMPLES; i++) {
-        err = adc_oneshot_read(adc_handle, BATTERY_ADC_CHANNEL, &adc_samples[i]);
-        if (err != ESP_OK) {
-            adc_samples[i] = 0;
+        if (read_code(BATTERY_ADC_CHANNEL, &adc_samples[adc_count])) {
+            adc_count++;
+        }
+#if CONFIG_CHARGER_NTC_ENABLE
+        if (ntc_pin_mv && read_code(THERMAL_ADC_CHANNEL, &ntc_samples[ntc_count])) {
+            ntc_count++;
         }
+#endif
         vTaskDelay(pdMS_TO_TICKS(5));
     }
     
-    /* Sort samples and take median of middle 8 (discard 4 lowest and 4 highest) */
-    for (int i = 0; i < BATTERY_ADC_SAMPLES - 1; i++) {
-        for (int j = i + 1; j < BATTERY_ADC_SAMPLES; j++) {
-            if (adc_samples[i] > adc_samples[j]) {
-                int temp = adc_samples[i];
-                adc_samples[i] = adc_samples[j];
-                adc_samples[j] = temp;
-            }
-        }
+    if (adc_count > 0) {
+        *battery_pin_mv = raw_to_mv(filter_decimate(adc_samples, adc_count));
     }
-    
-    /* Average the middle 8 samples */
-    int adc_raw_sum = 0;
-    for (int i = 4; i < BATTERY_ADC_SAMPLES - 4; i++) {
-        adc_raw_sum += adc_samples[i];
+#if CONFIG_CHARGER_NTC_ENABLE
+    if (ntc_pin_mv) {
+        *ntc_pin_mv = ntc_count > 0 ? raw_to_mv(filter_trimmed_mean(ntc_samples, ntc_count)) : -1;
+    }
+#else
+    if (ntc_pin_mv) {
+        *ntc_pin_mv = -1;
     }
-    int adc_raw_avg = adc_raw_sum / 8;
+#endif
+    return adc_count > 0 ? ESP_OK : ESP_FAIL;
+}
+
+float sensor_pin_to_voltage(int pin_mv)
+{
+    /* A per-board calibration table replaces the nominal divider ratio */
+    int32_t battery_mv;
+    if (calibration_apply(pin_mv, &battery_mv)) {
+        return battery_mv / 1000.0f;
+    }
+    return (pin_mv * s_cfg.voltage_divider) / 1000.0f;
+}
+
+esp_err_t sensor_read_pin_mv(int *pin_mv)
+{
+    return acquire(pin_mv, NULL);
+}
+
+esp_err_t sensor_read(sensor_data_t *data)
+{
+    esp_err_t err;
     
-    /* Convert to voltage */
     int voltage_mv;
-    if (adc_cali_handle) {
-        adc_cali_raw_to_voltage(adc_cali_handle, adc_raw_avg, &voltage_mv);
-    } else {
-        /* Rough approximation if calibration failed */
-        voltage_mv = (adc_raw_avg * 3100) / 4095;
+    int ntc_mv;
+    err = acquire(&voltage_mv, &ntc_mv);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No battery ADC read succeeded, skipping sample");
+        return err;
     }
+    const float raw_voltage = sensor_pin_to_voltage(voltage_mv);
     
-    /* Apply voltage divider ratio to get actual battery voltage */
-    float raw_voltage = (voltage_mv * VOLTAGE_DIVIDER) / 1000.0f;
-    
-    /* Apply exponential moving average for smoothing */
-    if (s_smoothed_voltage == 0) {
-        s_smoothed_voltage = raw_voltage;  /* Initialize on first read */
+    /* Debounce presence on the raw reading: a change must persist for
+     * CELL_DEBOUNCE_US before it is accepted, so contact bounce neither
+     * splits the session nor drags the smoothed voltage down */
+    const int64_t now = esp_timer_get_time();
+    const bool raw_present = (raw_voltage >= s_cfg.cell_detect_voltage);
+    bool present = s_cell_was_present;
+    if (raw_present != s_cell_was_present) {
+        if (s_presence_change_time == 0) {
+            s_presence_change_time = now;
+        }
+        if (now - s_presence_change_time >= CELL_DEBOUNCE_US) {
+            present = raw_present;
+            s_presence_change_time = 0;
+        }
     } else {
-        s_smoothed_voltage = (VOLTAGE_EMA_ALPHA * raw_voltage) + ((1.0f - VOLTAGE_EMA_ALPHA) * s_smoothed_voltage);
+        s_presence_change_time = 0;
     }
-    data->battery_voltage = s_smoothed_voltage;
     
-    /* Check if cell is present */
-    data->cell_present = (data->battery_voltage >= CELL_DETECT_VOLTAGE);
+    /* Smooth through the filter chain (filter.c), which primes itself on
+     * the first reading. Hold the value while a presence change is still
+     * being debounced. */
+    const int32_t raw_uv = (int32_t)lroundf(raw_voltage * 1000000.0f);
+    if (!s_filter_primed || raw_present == s_cell_was_present) {
+        s_smoothed_voltage = filter_push(raw_uv, now) / 1000000.0f;
+        s_filter_primed = true;
+    }
+    data->battery_voltage = s_smoothed_voltage;
+    data->cell_present = present;
+    data->raw_voltage = raw_voltage;
     
     /* Handle cell connection/disconnection */
     if (data->cell_present && !s_cell_was_present) {
-        /* New cell just connected */
-        generate_cell_id();
-        s_cell_connect_time = esp_timer_get_time();
+        /* Cell connected: resume the previous session if this is the same
+         * cell coming back shortly after removal, otherwise start a new one */
+        filter_reset(raw_uv, now);
+        s_smoothed_voltage = raw_voltage;
+        data->battery_voltage = raw_voltage;
+        cell_index_entry_t previous;
+        if (cell_index_match(raw_voltage, &previous)) {
+            strncpy(s_cell_id, previous.cell_id, sizeof(s_cell_id) - 1);
+            s_cell_connect_time = now - (int64_t)previous.charging_time_sec * 1000000LL;
+            ESP_LOGI(TAG, "Resuming cell %s at %lus", s_cell_id, previous.charging_time_sec);
+        } else {
+            generate_cell_id();
+            s_cell_connect_time = now;
+        }
         s_new_cell_flag = true;
-        s_smoothed_voltage = data->battery_voltage;
+        s_cell_inserted_time = now;
+        s_ir_mohm = NAN;
         /* Reset voltage history */
         for (int i = 0; i < VOLTAGE_HISTORY_SIZE; i++) {
             s_voltage_history[i] = data->battery_voltage;
         }
         s_history_index = 0;
         s_history_filled = true;
+        s_last_history_time = 0;
         s_stable_count = 0;
         s_last_charge_state = CHARGE_STATE_IDLE;
         ESP_LOGI(TAG, "Cell connected! Voltage: %.2fV", data->battery_voltage);
     } else if (!data->cell_present && s_cell_was_present) {
-        /* Cell was removed */
+        /* Cell was removed: remember it in case it comes back */
         ESP_LOGI(TAG, "Cell removed");
+        cell_index_record_removal(s_cell_id, s_last_cell_voltage,
+                                  (uint32_t)((now - s_cell_connect_time) / 1000000));
         s_cell_id[0] = '\0';
         s_cell_connect_time = 0;
-        s_smoothed_voltage = 0;
+        filter_reset(raw_uv, now);
+        s_smoothed_voltage = raw_voltage;
         s_history_filled = false;
         s_last_charge_state = CHARGE_STATE_NO_CELL;
     }
+    if (data->cell_present && raw_present) {
+        s_last_cell_voltage = s_smoothed_voltage;
+    }
     s_cell_was_present = data->cell_present;
     
+    /* Steps captured since the last sample belong to this cell if they
+     * came after it was inserted */
+    ir_result_t ir;
+    if (ir_capture_take(&ir) && data->cell_present && ir.time_us >= s_cell_inserted_time) {
+        s_ir_mohm = ir.ir_mohm;
+    }
+    data->ir_mohm = data->cell_present ? s_ir_mohm : NAN;
+    
     /* Copy cell ID and calculate charging time */
     strncpy(data->cell_id, s_cell_id, sizeof(data->cell_id) - 1);
     if (data->cell_present && s_cell_connect_time > 0) {
@@ -245,10 +393,20 @@ esp_err_t sensor_read(sensor_data_t *data)
         ESP_LOGW(TAG, "Failed to read internal temperature: %s", esp_err_to_name(err));
     }
     
+    /* Cell temperature from the NTC read in the same pass, NAN if no read
+     * succeeded; the flag is the watchdog's, which may have tripped
+     * between samples */
+    data->cell_temp = ntc_mv < 0 ? NAN : thermal_pin_mv_to_celsius(ntc_mv);
+    data->over_temp = thermal_is_over_temp();
+    
     /* Update charge state */
     sensor_update_charge_state(data);
     
-    ESP_LOGI(TAG, "Battery: %.2fV (%.0f%%), Temp: %.1f°C, State: %s", 
+    /* Every sample: recorded in the binary log, formatted only on demand */
+    BINLOG(SENSOR_SAMPLE, binlog_f(data->battery_voltage), binlog_f(data->raw_voltage),
+           binlog_f(data->internal_temp), binlog_f(data->cell_temp),
+           (uint32_t)data->charge_state);
+    ESP_LOGD(TAG, "Battery: %.2fV (%.0f%%), Temp: %.1f°C, State: %s", 
              data->battery_voltage, data->battery_percentage, 
              data->internal_temp, sensor_charge_state_str(data->charge_state));
     
@@ -263,6 +421,15 @@ void sensor_update_charge_state(sensor_data_t *data)
         return;
     }
     
+    /* The trend thresholds are per history window, so only advance the
+     * history at 1 Hz even when the scheduler samples faster */
+    const int64_t now = esp_timer_get_time();
+    if (s_last_history_time != 0 && (now - s_last_history_time) < VOLTAGE_HISTORY_INTERVAL_US) {
+        data->charge_state = s_last_charge_state;
+        return;
+    }
+    s_last_history_time = now;
+    
     /* Store current voltage in history ring buffer */
     s_voltage_history[s_history_index] = data->battery_voltage;
     s_history_index = (s_history_index + 1) % VOLTAGE_HISTORY_SIZE;
@@ -285,7 +452,7 @@ void sensor_update_charge_state(sensor_data_t *data)
     /* Determine trend with hysteresis */
     charge_state_t detected_state = s_last_charge_state;
     
-    if (voltage_diff_mv > VOLTAGE_RISING_THRESHOLD) {
+    if (voltage_diff_mv > (float)s_cfg.rising_mv) {
         /* Voltage trending up - charging */
         if (s_last_charge_state != CHARGE_STATE_CHARGING) {
             s_stable_count++;
@@ -296,7 +463,7 @@ void sensor_update_charge_state(sensor_data_t *data)
         } else {
             s_stable_count = 0;
         }
-    } else if (voltage_diff_mv < -VOLTAGE_FALLING_THRESHOLD) {
+    } else if (voltage_diff_mv < -(float)s_cfg.falling_mv) {
         /* Voltage trending down - discharging */
         if (s_last_charge_state != CHARGE_STATE_DISCHARGING) {
             s_stable_count++;
@@ -310,13 +477,13 @@ void sensor_update_charge_state(sensor_data_t *data)
     } else {
         /* Voltage stable */
         s_stable_count++;
-        if (s_stable_count >= VOLTAGE_STABLE_COUNT) {
-            if (data->battery_voltage >= CELL_FULL_VOLTAGE) {
+        if (s_stable_count >= (int)s_cfg.stable_count) {
+            if (data->battery_voltage >= s_cfg.cell_full_voltage) {
                 detected_state = CHARGE_STATE_FULL;
             } else {
                 detected_state = CHARGE_STATE_IDLE;
             }
-            s_stable_count = VOLTAGE_STABLE_COUNT; /* Cap to avoid overflow */
+            s_stable_count = (int)s_cfg.stable_count; /* Cap to avoid overflow */
         }
     }
     
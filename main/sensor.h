@@ -16,15 +16,48 @@ typedef enum {
 /* Battery/charging data structure */
 typedef struct {
     float battery_voltage;        /* V */
+    float raw_voltage;            /* V - this reading before smoothing */
     float battery_percentage;     /* % */
     float internal_temp;          /* °C - ESP32 internal temperature */
+    float cell_temp;              /* °C - NTC on the cell, NAN if not fitted */
+    bool over_temp;               /* Cell over temperature (thermal watchdog) */
+    float ir_mohm;                /* mOhm - last internal resistance estimate for this cell, NAN if none */
     charge_state_t charge_state;  /* Current charging state */
     char cell_id[24];             /* Unique ID for current cell session */
     uint32_t charging_time_sec;   /* Seconds since cell was connected */
     int64_t timestamp_ns;         /* Timestamp in nanoseconds (UTC) */
+    bool time_synced;             /* false: timestamp_ns is time since boot */
     bool cell_present;            /* Whether a cell is detected */
+    uint32_t sample_interval_ms;  /* Acquisition interval chosen by the scheduler */
+    uint32_t upload_interval_sec; /* Upload interval chosen by the scheduler */
+    uint8_t sched_mode;           /* Scheduler mode (sched_mode_t) */
+    uint8_t sched_reason;         /* Why that mode was chosen (sched_reason_t) */
 } sensor_data_t;
 
+/* Detection thresholds, tunable at runtime through params.c */
+typedef struct {
+    float voltage_divider;        /* (R1+R2)/R2 of the battery divider */
+    float cell_detect_voltage;    /* V; below this no cell is present */
+    float cell_full_voltage;      /* V; stable at or above this means Full */
+    uint32_t rising_mv;           /* Rise over the trend window that means charging */
+    uint32_t falling_mv;          /* Drop over the trend window that means discharging */
+    uint32_t stable_count;        /* Stable readings before Idle/Full */
+} sensor_config_t;
+
+/**
+ * Fill a config with the built-in defaults
+ * @param cfg Config to fill
+ */
+void sensor_get_default_config(sensor_config_t *cfg);
+
+/**
+ * Replace the detection thresholds
+ * Call from the sampling task (between sensor_read calls); the tracking
+ * state is kept.
+ * @param cfg New thresholds
+ */
+void sensor_set_config(const sensor_config_t *cfg);
+
 /**
  * Initialize ADC for battery voltage and internal temperature sensor
  * @return ESP_OK on success
@@ -34,10 +67,28 @@ esp_err_t sensor_init(void);
 /**
  * Read current battery voltage and temperature
  * @param data Pointer to store sensor readings
- * @return ESP_OK on success
+ * @return ESP_OK on success, ESP_FAIL if no battery ADC read succeeded
+ *         (skip the sample)
  */
 esp_err_t sensor_read(sensor_data_t *data);
 
+/**
+ * Take one oversampled reading of the battery ADC pin
+ * Safe to call from another task while sampling runs (used to capture
+ * calibration points). Takes about 80 ms.
+ * @param pin_mv Pointer to store the pin voltage before the divider (mV)
+ * @return ESP_OK on success, ESP_FAIL if no ADC read succeeded
+ */
+esp_err_t sensor_read_pin_mv(int *pin_mv);
+
+/**
+ * Convert a battery ADC pin voltage to cell voltage
+ * Uses the saved calibration table, or the divider ratio without one.
+ * @param pin_mv Pin voltage (mV)
+ * @return Cell voltage (V), unsmoothed
+ */
+float sensor_pin_to_voltage(int pin_mv);
+
 /**
  * Update charging state based on voltage history
  * Call this periodically to track state changes
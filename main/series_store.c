@@ -0,0 +1,511 @@
+#include "series_store.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "static_alloc.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <math.h>
+
+static const char *TAG = "series";
+
+/* Compressed per-session series store
+ *
+ * Samples are packed into fixed-size pages taken from a static pool. Each
+ * page starts with one full sample in its header; every following sample is
+ * stored Gorilla-style as a bit stream:
+ *   - timestamp as delta-of-delta (10 ms units)
+ *   - voltage (mV) and temperature (0.1 °C) as delta to the previous sample
+ *   - charge state as a single "unchanged" bit, or 1 + 3 bits
+ * Each signed value uses a variable-length bucket:
+ *   '0' = 0, '10' + 4 bits, '110' + 8 bits, '1110' + 12 bits, '1111' + 32 bits
+ * At 1 Hz a stable curve costs a few bits per sample, so a multi-hour
+ * session fits in tens of KB. When the pool runs out, the oldest closed
+ * session is reclaimed first, then the oldest page of the oldest session.
+ */
+
+#define SERIES_PAGE_SIZE       512
+#define SERIES_PAGE_NONE       0xFFFF
+#define SERIES_POOL_PAGES      CONFIG_CHARGER_SERIES_PAGES
+#define SERIES_MAX_SESSIONS    CONFIG_CHARGER_SERIES_SESSIONS
+#define SERIES_TIME_UNIT_US    10000   /* 10 ms, one FreeRTOS tick */
+#define SERIES_MAX_SAMPLE_BITS (3 * (4 + 32) + 4)
+
+typedef struct {
+    uint32_t gen;          /* Bumped on every allocation, invalidates iterators */
+    uint16_t next;         /* Next page of the session */
+    uint16_t count;        /* Samples in this page */
+    uint16_t bit_len;      /* Bits used in data[] */
+    uint8_t first_state;
+    uint8_t reserved;
+    int64_t first_t_cs;
+    int32_t first_mv;
+    int16_t first_temp;
+    int16_t reserved2;
+} page_header_t;
+
+typedef struct {
+    page_header_t hdr;
+    uint8_t data[SERIES_PAGE_SIZE - sizeof(page_header_t)];
+} series_page_t;
+
+typedef struct {
+    bool used;
+    bool active;
+    char cell_id[24];
+    uint32_t gen;          /* Creation order, also invalidates iterators */
+    uint16_t head;
+    uint16_t tail;
+    uint16_t pages;
+    uint32_t samples;
+    int64_t last_t_cs;
+    int32_t last_delta;
+    int32_t last_mv;
+    int16_t last_temp;
+    uint8_t last_state;
+} series_session_t;
+
+static series_page_t s_pages[SERIES_POOL_PAGES];
+static series_session_t s_sessions[SERIES_MAX_SESSIONS];
+static uint16_t s_free_head = SERIES_PAGE_NONE;
+static uint32_t s_pages_free = 0;
+static uint32_t s_page_gen = 0;
+static uint32_t s_session_gen = 0;
+static uint32_t s_evicted_pages = 0;
+static int s_active = -1;
+static SemaphoreHandle_t s_lock = NULL;
+
+/* ---- Bit stream ---- */
+
+static void put_bits(uint8_t *buf, uint32_t *pos, uint32_t value, int nbits)
+{
+    for (int i = nbits - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+        }
+        (*pos)++;
+    }
+}
+
+static uint32_t get_bits(const uint8_t *buf, uint32_t *pos, int nbits)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < nbits; i++) {
+        value = (value << 1) | ((buf[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+        (*pos)++;
+    }
+    return value;
+}
+
+static void put_signed(uint8_t *buf, uint32_t *pos, int32_t v)
+{
+    if (v == 0) {
+        put_bits(buf, pos, 0x0, 1);
+    } else if (v >= -8 && v <= 7) {
+        put_bits(buf, pos, 0x2, 2);
+        put_bits(buf, pos, (uint32_t)v & 0xF, 4);
+    } else if (v >= -128 && v <= 127) {
+        put_bits(buf, pos, 0x6, 3);
+        put_bits(buf, pos, (uint32_t)v & 0xFF, 8);
+    } else if (v >= -2048 && v <= 2047) {
+        put_bits(buf, pos, 0xE, 4);
+        put_bits(buf, pos, (uint32_t)v & 0xFFF, 12);
+    } else {
+        put_bits(buf, pos, 0xF, 4);
+        put_bits(buf, pos, (uint32_t)v, 32);
+    }
+}
+
+static int32_t sign_extend(uint32_t v, int nbits)
+{
+    const uint32_t m = 1u << (nbits - 1);
+    return (int32_t)((v ^ m) - m);
+}
+
+static int32_t get_signed(const uint8_t *buf, uint32_t *pos)
+{
+    if (get_bits(buf, pos, 1) == 0) {
+        return 0;
+    }
+    if (get_bits(buf, pos, 1) == 0) {
+        return sign_extend(get_bits(buf, pos, 4), 4);
+    }
+    if (get_bits(buf, pos, 1) == 0) {
+        return sign_extend(get_bits(buf, pos, 8), 8);
+    }
+    if (get_bits(buf, pos, 1) == 0) {
+        return sign_extend(get_bits(buf, pos, 12), 12);
+    }
+    return (int32_t)get_bits(buf, pos, 32);
+}
+
+/* ---- Page pool ---- */
+
+static void page_free(uint16_t page)
+{
+    s_pages[page].hdr.gen = ++s_page_gen;
+    s_pages[page].hdr.next = s_free_head;
+    s_free_head = page;
+    s_pages_free++;
+}
+
+static void session_free(series_session_t *sess)
+{
+    uint16_t page = sess->head;
+    while (page != SERIES_PAGE_NONE) {
+        const uint16_t next = s_pages[page].hdr.next;
+        page_free(page);
+        page = next;
+    }
+    memset(sess, 0, sizeof(*sess));
+}
+
+static series_session_t *oldest_session(bool closed_only)
+{
+    series_session_t *oldest = NULL;
+    for (int i = 0; i < SERIES_MAX_SESSIONS; i++) {
+        series_session_t *sess = &s_sessions[i];
+        if (!sess->used || (closed_only && sess->active)) {
+            continue;
+        }
+        if (oldest == NULL || sess->gen < oldest->gen) {
+            oldest = sess;
+        }
+    }
+    return oldest;
+}
+
+/* Make room: drop the oldest closed session, else the oldest page of the
+ * oldest session that has more than one page */
+static bool reclaim(void)
+{
+    series_session_t *victim = oldest_session(true);
+    if (victim) {
+        s_evicted_pages += victim->pages;
+        ESP_LOGW(TAG, "Pool full, dropping session %s (%u pages)", victim->cell_id, victim->pages);
+        session_free(victim);
+        return true;
+    }
+
+    victim = oldest_session(false);
+    if (victim == NULL || victim->pages < 2) {
+        return false;
+    }
+    const uint16_t page = victim->head;
+    victim->head = s_pages[page].hdr.next;
+    victim->samples -= s_pages[page].hdr.count;
+    victim->pages--;
+    page_free(page);
+    s_evicted_pages++;
+    return true;
+}
+
+static uint16_t page_alloc(void)
+{
+    if (s_free_head == SERIES_PAGE_NONE && !reclaim()) {
+        return SERIES_PAGE_NONE;
+    }
+    const uint16_t page = s_free_head;
+    s_free_head = s_pages[page].hdr.next;
+    s_pages_free--;
+
+    memset(&s_pages[page], 0, sizeof(series_page_t));
+    s_pages[page].hdr.gen = ++s_page_gen;
+    s_pages[page].hdr.next = SERIES_PAGE_NONE;
+    return page;
+}
+
+/* ---- Sessions ---- */
+
+static int session_begin(const char *cell_id)
+{
+    int slot = -1;
+    for (int i = 0; i < SERIES_MAX_SESSIONS; i++) {
+        if (!s_sessions[i].used) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        series_session_t *victim = oldest_session(true);
+        if (victim == NULL) {
+            return -1;
+        }
+        s_evicted_pages += victim->pages;
+        session_free(victim);
+        slot = victim - s_sessions;
+    }
+
+    series_session_t *sess = &s_sessions[slot];
+    memset(sess, 0, sizeof(*sess));
+    sess->used = true;
+    sess->active = true;
+    sess->gen = ++s_session_gen;
+    sess->head = SERIES_PAGE_NONE;
+    sess->tail = SERIES_PAGE_NONE;
+    strncpy(sess->cell_id, cell_id, sizeof(sess->cell_id) - 1);
+    ESP_LOGI(TAG, "Recording session %s", sess->cell_id);
+    return slot;
+}
+
+static void session_close(void)
+{
+    if (s_active >= 0) {
+        series_session_t *sess = &s_sessions[s_active];
+        sess->active = false;
+        ESP_LOGI(TAG, "Session %s closed: %lu samples in %u bytes",
+                 sess->cell_id, sess->samples, (unsigned)(sess->pages * SERIES_PAGE_SIZE));
+        s_active = -1;
+    }
+}
+
+esp_err_t series_store_init(void)
+{
+    s_lock = RTOS_MUTEX_CREATE();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(s_sessions, 0, sizeof(s_sessions));
+    s_free_head = SERIES_PAGE_NONE;
+    s_pages_free = 0;
+    for (int i = SERIES_POOL_PAGES - 1; i >= 0; i--) {
+        page_free(i);
+    }
+    s_active = -1;
+
+    ESP_LOGI(TAG, "Series store: %d pages of %d bytes, %d sessions",
+             SERIES_POOL_PAGES, SERIES_PAGE_SIZE, SERIES_MAX_SESSIONS);
+    return ESP_OK;
+}
+
+esp_err_t series_store_append(const sensor_data_t *data, int64_t t_us)
+{
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    if (!data->cell_present || data->cell_id[0] == '\0') {
+        session_close();
+        goto out;
+    }
+
+    if (s_active >= 0 && strcmp(s_sessions[s_active].cell_id, data->cell_id) != 0) {
+        session_close();
+    }
+    if (s_active < 0) {
+        /* A re-inserted cell keeps its cell_id: continue its curve */
+        series_session_t *latest = NULL;
+        for (int i = 0; i < SERIES_MAX_SESSIONS; i++) {
+            if (s_sessions[i].used && (latest == NULL || s_sessions[i].gen > latest->gen)) {
+                latest = &s_sessions[i];
+            }
+        }
+        if (latest && strcmp(latest->cell_id, data->cell_id) == 0) {
+            latest->active = true;
+            s_active = latest - s_sessions;
+            ESP_LOGI(TAG, "Resuming session %s", latest->cell_id);
+        }
+    }
+    if (s_active < 0) {
+        s_active = session_begin(data->cell_id);
+        if (s_active < 0) {
+            err = ESP_ERR_NO_MEM;
+            goto out;
+        }
+    }
+
+    series_session_t *sess = &s_sessions[s_active];
+    const int64_t t_cs = t_us / SERIES_TIME_UNIT_US;
+    const int32_t mv = (int32_t)lroundf(data->battery_voltage * 1000.0f);
+    const int16_t temp = (int16_t)lroundf(data->internal_temp * 10.0f);
+    const uint8_t state = (uint8_t)data->charge_state;
+
+    series_page_t *tail = sess->tail != SERIES_PAGE_NONE ? &s_pages[sess->tail] : NULL;
+    if (tail == NULL || tail->hdr.count == UINT16_MAX ||
+        tail->hdr.bit_len + SERIES_MAX_SAMPLE_BITS > sizeof(tail->data) * 8) {
+        /* Start a page with a full sample in its header */
+        const uint16_t page = page_alloc();
+        if (page == SERIES_PAGE_NONE) {
+            err = ESP_ERR_NO_MEM;
+            goto out;
+        }
+        series_page_t *p = &s_pages[page];
+        p->hdr.count = 1;
+        p->hdr.first_t_cs = t_cs;
+        p->hdr.first_mv = mv;
+        p->hdr.first_temp = temp;
+        p->hdr.first_state = state;
+        /* The session may have lost its head to reclaim() */
+        if (sess->tail != SERIES_PAGE_NONE && sess->pages > 0) {
+            s_pages[sess->tail].hdr.next = page;
+        } else {
+            sess->head = page;
+        }
+        sess->tail = page;
+        sess->pages++;
+        sess->last_delta = 0;
+    } else {
+        uint32_t pos = tail->hdr.bit_len;
+        const int32_t delta = (int32_t)(t_cs - sess->last_t_cs);
+        put_signed(tail->data, &pos, delta - sess->last_delta);
+        put_signed(tail->data, &pos, mv - sess->last_mv);
+        put_signed(tail->data, &pos, temp - sess->last_temp);
+        if (state == sess->last_state) {
+            put_bits(tail->data, &pos, 0, 1);
+        } else {
+            put_bits(tail->data, &pos, 1, 1);
+            put_bits(tail->data, &pos, state & 0x7, 3);
+        }
+        tail->hdr.bit_len = pos;
+        tail->hdr.count++;
+        sess->last_delta = delta;
+    }
+
+    sess->samples++;
+    sess->last_t_cs = t_cs;
+    sess->last_mv = mv;
+    sess->last_temp = temp;
+    sess->last_state = state;
+
+out:
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+static void iter_seek_page(series_iter_t *it, uint16_t page)
+{
+    it->page = page;
+    it->page_gen = page != SERIES_PAGE_NONE ? s_pages[page].hdr.gen : 0;
+    it->index = 0;
+    it->bit_pos = 0;
+}
+
+bool series_store_iter_init(series_iter_t *it, const char *cell_id)
+{
+    memset(it, 0, sizeof(*it));
+    it->slot = -1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < SERIES_MAX_SESSIONS; i++) {
+        const series_session_t *sess = &s_sessions[i];
+        if (!sess->used || (cell_id && cell_id[0] && strcmp(sess->cell_id, cell_id) != 0)) {
+            continue;
+        }
+        if (it->slot < 0 || sess->gen > s_sessions[it->slot].gen) {
+            it->slot = i;
+        }
+    }
+    if (it->slot >= 0) {
+        it->session_gen = s_sessions[it->slot].gen;
+        iter_seek_page(it, s_sessions[it->slot].head);
+    }
+    xSemaphoreGive(s_lock);
+
+    return it->slot >= 0;
+}
+
+bool series_store_iter_next(series_iter_t *it, series_sample_t *out)
+{
+    bool found = false;
+    if (it->slot < 0) {
+        return false;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const series_session_t *sess = &s_sessions[it->slot];
+    if (!sess->used || sess->gen != it->session_gen) {
+        goto out;
+    }
+
+    while (it->page != SERIES_PAGE_NONE) {
+        const series_page_t *p = &s_pages[it->page];
+        if (p->hdr.gen != it->page_gen) {
+            /* Page was reclaimed under us */
+            it->page = SERIES_PAGE_NONE;
+            goto out;
+        }
+        if (it->index < p->hdr.count) {
+            break;
+        }
+        if (it->page == sess->tail) {
+            goto out;  /* Caught up with the writer */
+        }
+        iter_seek_page(it, p->hdr.next);
+    }
+    if (it->page == SERIES_PAGE_NONE) {
+        goto out;
+    }
+
+    const series_page_t *p = &s_pages[it->page];
+    if (it->index == 0) {
+        it->prev_t_cs = p->hdr.first_t_cs;
+        it->prev_mv = p->hdr.first_mv;
+        it->prev_temp = p->hdr.first_temp;
+        it->prev_state = p->hdr.first_state;
+        it->prev_delta = 0;
+    } else {
+        it->prev_delta += get_signed(p->data, &it->bit_pos);
+        it->prev_t_cs += it->prev_delta;
+        it->prev_mv += get_signed(p->data, &it->bit_pos);
+        it->prev_temp += get_signed(p->data, &it->bit_pos);
+        if (get_bits(p->data, &it->bit_pos, 1)) {
+            it->prev_state = get_bits(p->data, &it->bit_pos, 3);
+        }
+    }
+    it->index++;
+
+    out->t_ms = it->prev_t_cs * (SERIES_TIME_UNIT_US / 1000);
+    out->voltage_mv = it->prev_mv;
+    out->temp_dc = it->prev_temp;
+    out->charge_state = it->prev_state;
+    found = true;
+
+out:
+    xSemaphoreGive(s_lock);
+    return found;
+}
+
+size_t series_store_list(series_session_info_t *out, size_t max)
+{
+    size_t n = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    /* Newest first: repeatedly pick the highest generation below the last one */
+    uint32_t below = UINT32_MAX;
+    while (n < max) {
+        const series_session_t *best = NULL;
+        for (int i = 0; i < SERIES_MAX_SESSIONS; i++) {
+            const series_session_t *sess = &s_sessions[i];
+            if (sess->used && sess->gen < below && (best == NULL || sess->gen > best->gen)) {
+                best = sess;
+            }
+        }
+        if (best == NULL) {
+            break;
+        }
+        below = best->gen;
+
+        series_session_info_t *info = &out[n++];
+        memset(info, 0, sizeof(*info));
+        strncpy(info->cell_id, best->cell_id, sizeof(info->cell_id) - 1);
+        info->active = best->active;
+        info->samples = best->samples;
+        info->bytes = best->pages * SERIES_PAGE_SIZE;
+        info->first_t_ms = best->head != SERIES_PAGE_NONE ?
+                           s_pages[best->head].hdr.first_t_cs * (SERIES_TIME_UNIT_US / 1000) : 0;
+        info->last_t_ms = best->last_t_cs * (SERIES_TIME_UNIT_US / 1000);
+    }
+
+    xSemaphoreGive(s_lock);
+    return n;
+}
+
+void series_store_get_stats(series_store_stats_t *stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stats->pages_total = SERIES_POOL_PAGES;
+    stats->pages_free = s_pages_free;
+    stats->page_size = SERIES_PAGE_SIZE;
+    stats->evicted_pages = s_evicted_pages;
+    xSemaphoreGive(s_lock);
+}
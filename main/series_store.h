@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sensor.h"
+
+/* One decoded sample of a session curve */
+typedef struct {
+    int64_t t_ms;          /* Monotonic time (esp_timer, 10 ms resolution) */
+    int32_t voltage_mv;    /* Battery voltage in mV */
+    int16_t temp_dc;       /* Temperature in 0.1 °C */
+    uint8_t charge_state;  /* charge_state_t */
+} series_sample_t;
+
+/* Summary of one stored session */
+typedef struct {
+    char cell_id[24];
+    bool active;           /* Still being appended to */
+    uint32_t samples;      /* Samples currently stored */
+    uint32_t bytes;        /* Page memory used by the session */
+    int64_t first_t_ms;    /* Time of the oldest stored sample */
+    int64_t last_t_ms;     /* Time of the newest sample */
+} series_session_info_t;
+
+/* Pool usage */
+typedef struct {
+    uint32_t pages_total;
+    uint32_t pages_free;
+    uint32_t page_size;
+    uint32_t evicted_pages;  /* Pages reclaimed from old sessions */
+} series_store_stats_t;
+
+/* Sequential decoder over one session; treat fields as private */
+typedef struct {
+    int slot;
+    uint32_t session_gen;
+    uint16_t page;
+    uint32_t page_gen;
+    uint16_t index;
+    uint32_t bit_pos;
+    int64_t prev_t_cs;
+    int32_t prev_delta;
+    int32_t prev_mv;
+    int16_t prev_temp;
+    uint8_t prev_state;
+} series_iter_t;
+
+/**
+ * Initialize the page pool and session table
+ * @return ESP_OK on success
+ */
+esp_err_t series_store_init(void);
+
+/**
+ * Append a sample to the session of its cell
+ * A new session starts when cell_id changes; the active session is closed
+ * when the cell is removed. Samples without a cell are ignored.
+ * @param data Current sensor data
+ * @param t_us Monotonic sample time (esp_timer_get_time)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if no page could be reclaimed
+ */
+esp_err_t series_store_append(const sensor_data_t *data, int64_t t_us);
+
+/**
+ * Start decoding the most recent session of a cell
+ * @param it Iterator to initialize
+ * @param cell_id Cell to read, or NULL/"" for the most recent session
+ * @return true if a session was found
+ */
+bool series_store_iter_init(series_iter_t *it, const char *cell_id);
+
+/**
+ * Decode the next sample
+ * Stops early if the pages being read were reclaimed meanwhile.
+ * @param it Iterator from series_store_iter_init
+ * @param out Pointer to store the sample
+ * @return true if a sample was returned
+ */
+bool series_store_iter_next(series_iter_t *it, series_sample_t *out);
+
+/**
+ * List stored sessions, newest first
+ * @param out Array to fill
+ * @param max Capacity of out
+ * @return Number of sessions written
+ */
+size_t series_store_list(series_session_info_t *out, size_t max);
+
+/**
+ * Get pool usage
+ * @param stats Pointer to store statistics
+ */
+void series_store_get_stats(series_store_stats_t *stats);
@@ -0,0 +1,196 @@
+#include "session.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "static_alloc.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <math.h>
+
+static const char *TAG = "session";
+
+#define SESSION_HISTORY_LEN   CONFIG_CHARGER_SESSION_HISTORY
+
+/* A removed cell may come back (and keep its cell_id) within this window */
+#define SESSION_RESUME_WINDOW_US  (CONFIG_CHARGER_RESUME_WINDOW_SEC * 1000000LL)
+
+static session_summary_t s_current;
+static int64_t s_start_us = 0;
+static int64_t s_last_us = 0;
+static charge_state_t s_last_state = CHARGE_STATE_NO_CELL;
+static float s_last_voltage = 0;
+static uint64_t s_state_ms[SESSION_STATE_COUNT];
+static bool s_removal_pending = false;
+static int64_t s_removed_at_us = 0;
+
+/* Ring of recently closed sessions */
+static session_summary_t s_history[SESSION_HISTORY_LEN];
+static size_t s_history_next = 0;
+static size_t s_history_count = 0;
+
+static SemaphoreHandle_t s_lock = NULL;
+
+/* Voltage at which the charger is considered to be in CV; only the
+ * sampling task sets and reads it */
+static float s_cv_voltage;
+
+void session_init(void)
+{
+    if (s_lock == NULL) {
+        s_lock = RTOS_MUTEX_CREATE();
+    }
+    sensor_config_t sensor_cfg;
+    sensor_get_default_config(&sensor_cfg);
+    s_cv_voltage = sensor_cfg.cell_full_voltage;
+    memset(&s_current, 0, sizeof(s_current));
+    s_history_next = 0;
+    s_history_count = 0;
+}
+
+void session_set_cv_voltage(float voltage)
+{
+    s_cv_voltage = voltage;
+}
+
+static void session_begin(const sensor_data_t *data, int64_t t_us)
+{
+    s_removal_pending = false;
+    memset(&s_current, 0, sizeof(s_current));
+    strncpy(s_current.cell_id, data->cell_id, sizeof(s_current.cell_id) - 1);
+    s_current.active = true;
+    s_current.start_ns = data->timestamp_ns;
+    s_current.start_voltage = data->battery_voltage;
+    s_current.min_voltage = data->battery_voltage;
+    s_current.max_voltage = data->battery_voltage;
+    s_current.peak_temp = data->internal_temp;
+    s_current.time_to_cv_sec = -1;
+    s_current.time_to_full_sec = -1;
+    s_current.cc_charge_mah = CONFIG_CHARGER_CHARGE_CURRENT_MA > 0 ? 0.0f : -1.0f;
+    s_current.ir_mohm = -1.0f;
+    s_start_us = t_us;
+    s_last_us = t_us;
+    s_last_state = data->charge_state;
+    s_last_voltage = data->battery_voltage;
+    memset(s_state_ms, 0, sizeof(s_state_ms));
+}
+
+/* Accumulate one sample; called with the lock held */
+static void session_accumulate(const sensor_data_t *data, int64_t t_us)
+{
+    const float dt_sec = (float)(t_us - s_last_us) / 1000000.0f;
+
+    /* Time between samples is credited to the state the previous sample was in */
+    if (s_last_state < SESSION_STATE_COUNT) {
+        s_state_ms[s_last_state] += (t_us - s_last_us) / 1000;
+        s_current.time_in_state_sec[s_last_state] = (uint32_t)(s_state_ms[s_last_state] / 1000);
+    }
+    if (s_current.cc_charge_mah >= 0 && s_last_state == CHARGE_STATE_CHARGING &&
+        s_last_voltage < s_cv_voltage) {
+        s_current.cc_charge_mah += CONFIG_CHARGER_CHARGE_CURRENT_MA * dt_sec / 3600.0f;
+    }
+
+    const float v = data->battery_voltage;
+    if (v < s_current.min_voltage) {
+        s_current.min_voltage = v;
+    }
+    if (v > s_current.max_voltage) {
+        s_current.max_voltage = v;
+    }
+    if (data->internal_temp > s_current.peak_temp) {
+        s_current.peak_temp = data->internal_temp;
+    }
+    if (!isnan(data->ir_mohm)) {
+        s_current.ir_mohm = data->ir_mohm;
+    }
+
+    const int32_t elapsed_sec = (int32_t)((t_us - s_start_us) / 1000000);
+    if (s_current.time_to_cv_sec < 0 && v >= s_cv_voltage) {
+        s_current.time_to_cv_sec = elapsed_sec;
+    }
+    if (s_current.time_to_full_sec < 0 && data->charge_state == CHARGE_STATE_FULL) {
+        s_current.time_to_full_sec = elapsed_sec;
+    }
+
+    s_current.end_ns = data->timestamp_ns;
+    s_current.end_voltage = v;
+    s_current.duration_sec = (uint32_t)elapsed_sec;
+    s_current.samples++;
+
+    s_last_us = t_us;
+    s_last_state = data->charge_state;
+    s_last_voltage = v;
+}
+
+/* Close the running session; called with the lock held */
+static void session_end(session_summary_t *closed)
+{
+    s_current.active = false;
+    s_removal_pending = false;
+    *closed = s_current;
+
+    s_history[s_history_next] = s_current;
+    s_history_next = (s_history_next + 1) % SESSION_HISTORY_LEN;
+    if (s_history_count < SESSION_HISTORY_LEN) {
+        s_history_count++;
+    }
+    memset(&s_current, 0, sizeof(s_current));
+
+    ESP_LOGI(TAG, "Session %s ended: %lus, %.3fV -> %.3fV, CV at %lds, Full at %lds",
+             closed->cell_id, closed->duration_sec, closed->start_voltage, closed->end_voltage,
+             (long)closed->time_to_cv_sec, (long)closed->time_to_full_sec);
+}
+
+bool session_update(const sensor_data_t *data, int64_t t_us, session_summary_t *closed)
+{
+    bool ended = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    const bool has_cell = data->cell_present && data->cell_id[0] != '\0';
+
+    if (s_current.active && !has_cell) {
+        /* Cell removed: hold the session open in case the same cell is
+         * re-inserted (see cell_index.c); the gap counts as No Cell time */
+        if (!s_removal_pending) {
+            s_removal_pending = true;
+            s_removed_at_us = t_us;
+            s_last_state = CHARGE_STATE_NO_CELL;
+        } else if (t_us - s_removed_at_us > SESSION_RESUME_WINDOW_US) {
+            session_end(closed);
+            ended = true;
+        }
+    } else if (s_current.active && strcmp(s_current.cell_id, data->cell_id) != 0) {
+        /* Different cell inserted */
+        session_end(closed);
+        ended = true;
+    } else if (s_current.active && s_removal_pending) {
+        ESP_LOGI(TAG, "Session %s resumed", s_current.cell_id);
+        s_removal_pending = false;
+    }
+
+    if (has_cell) {
+        if (!s_current.active) {
+            session_begin(data, t_us);
+        }
+        session_accumulate(data, t_us);
+    }
+
+    xSemaphoreGive(s_lock);
+    return ended;
+}
+
+size_t session_list(session_summary_t *out, size_t max)
+{
+    size_t n = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+
+    if (s_current.active && n < max) {
+        out[n++] = s_current;
+    }
+    for (size_t i = 0; i < s_history_count && n < max; i++) {
+        const size_t idx = (s_history_next + SESSION_HISTORY_LEN - 1 - i) % SESSION_HISTORY_LEN;
+        out[n++] = s_history[idx];
+    }
+
+    xSemaphoreGive(s_lock);
+    return n;
+}
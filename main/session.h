@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor.h"
+
+/* Number of charge_state_t values */
+#define SESSION_STATE_COUNT  (CHARGE_STATE_IDLE + 1)
+
+/* Compact summary of one cell session */
+typedef struct {
+    char cell_id[24];
+    bool active;                  /* Session still running */
+    int64_t start_ns;             /* UTC timestamp of the first sample */
+    int64_t end_ns;               /* UTC timestamp of the last sample */
+    uint32_t duration_sec;        /* Time the cell was present */
+    uint32_t samples;             /* Samples aggregated */
+    float start_voltage;          /* V */
+    float end_voltage;            /* V */
+    float min_voltage;            /* V */
+    float max_voltage;            /* V */
+    float peak_temp;              /* °C */
+    uint32_t time_in_state_sec[SESSION_STATE_COUNT];  /* Indexed by charge_state_t */
+    int32_t time_to_cv_sec;       /* Seconds until CV voltage was reached, -1 if never */
+    int32_t time_to_full_sec;     /* Seconds until state was Full, -1 if never */
+    float cc_charge_mah;          /* Charge put in during CC, from the configured current; <0 if unknown */
+    float ir_mohm;                /* Last internal resistance estimate; <0 if none */
+} session_summary_t;
+
+/**
+ * Initialize the session aggregator
+ */
+void session_init(void);
+
+/**
+ * Set the voltage that counts as reaching CV (time_to_cv_sec, end of CC)
+ * Call from the sampling task; params_apply_pending() passes
+ * sensor.cell_full_voltage.
+ * @param voltage Threshold (V)
+ */
+void session_set_cv_voltage(float voltage);
+
+/**
+ * Fold a sample into the current session
+ * A session starts on a new cell_id and ends when another cell is
+ * inserted, or when the cell stays removed for longer than the resume
+ * window (a re-inserted cell keeps its cell_id and session).
+ * @param data Current sensor data
+ * @param t_us Monotonic sample time (esp_timer_get_time)
+ * @param closed Filled with the summary when a session ends
+ * @return true if a session ended and *closed was filled
+ */
+bool session_update(const sensor_data_t *data, int64_t t_us, session_summary_t *closed);
+
+/**
+ * List the running session (if any) and recently closed ones, newest first
+ * @param out Array to fill
+ * @param max Capacity of out
+ * @return Number of summaries written
+ */
+size_t session_list(session_summary_t *out, size_t max);
@@ -0,0 +1,634 @@
+#include "sink.h"
+#include "config.h"
+#include "api_schema.h"
+#include "wifi_manager.h"
+#include "supervisor.h"
+#include "binlog.h"
+#include "boot_trace.h"
+#include "heap_monitor.h"
+#include "static_alloc.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "sink";
+
+#define SINK_TASK_STACK      6144
+#define SINK_TASK_PRIO       4
+#define SINK_RETRY_BYTES     (CONFIG_CHARGER_SINK_RETRY_KB * 1024)
+#define SINK_BACKOFF_MIN_MS  2000
+#define SINK_BACKOFF_MAX_MS  300000
+#define SINK_OFFLINE_POLL_MS 5000
+#define SINK_STALL_MS        (CONFIG_CHARGER_HEALTH_UPLOAD_STALL_SEC * 1000)
+
+/* Each blocking step of a request (connect, send, every receive) waits at
+ * most this. Two attempts of a few steps stay inside the stall limit, so
+ * a delivery only stalls when something outside the client hangs. */
+#define SINK_HTTP_TIMEOUT_MS (SINK_STALL_MS / 8 < 5000 ? SINK_STALL_MS / 8 : 5000)
+
+#if CONFIG_CHARGER_SINK_INFLUX_V2
+#define SINK_ON_INFLUX_V2    1
+#else
+#define SINK_ON_INFLUX_V2    0
+#endif
+#if CONFIG_CHARGER_SINK_INFLUX_V1
+#define SINK_ON_INFLUX_V1    1
+#else
+#define SINK_ON_INFLUX_V1    0
+#endif
+#if CONFIG_CHARGER_SINK_REMOTE_WRITE
+#define SINK_ON_REMOTE_WRITE 1
+#else
+#define SINK_ON_REMOTE_WRITE 0
+#endif
+#if CONFIG_CHARGER_SINK_JOURNAL
+#define SINK_ON_JOURNAL      1
+#else
+#define SINK_ON_JOURNAL      0
+#endif
+
+/* Enabled sinks; each gets a slot of the buffers below */
+#define SINK_SLOTS  (SINK_ON_INFLUX_V2 + SINK_ON_INFLUX_V1 + SINK_ON_REMOTE_WRITE + SINK_ON_JOURNAL)
+
+/* Retry queue: payloads back to back, each after its 32-bit length. A
+ * payload that doesn't fit before the end of the buffer starts over at
+ * the front; data then runs from head to end and on from 0 to tail. */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+    size_t end;
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t head_seq;        /* Number of payloads ever removed */
+} ring_t;
+
+typedef struct sink sink_t;
+
+typedef struct sink {
+    sink_format_t format;
+    bool network;             /* Needs WiFi to deliver */
+    esp_err_t (*deliver)(sink_t *s, size_t len, int *status);
+    int slot;                 /* -1 if disabled */
+    ring_t ring;
+    uint8_t *send_buf;        /* Copy of the payload being delivered */
+    TaskHandle_t task;
+    int64_t deadline_us;      /* End of the delivery in progress, 0 when idle */
+    volatile bool abort;      /* Stalled: give up the delivery and reconnect */
+    esp_http_client_handle_t client;
+    bool connected;           /* A connection was opened during this delivery */
+    int64_t attempt_us;       /* Start of the current request */
+    uint32_t tls_baseline;    /* mbedTLS heap held when it started */
+    char url[384];
+    char auth[256];
+    sink_stats_t stats;
+} sink_t;
+
+static const char *const s_names[SINK_COUNT] = API_SINK_NAMES;
+
+static sink_t s_sinks[SINK_COUNT];
+static SemaphoreHandle_t s_lock = NULL;   /* Rings, deadlines and stats of all sinks */
+static uint8_t s_rings[SINK_SLOTS][SINK_RETRY_BYTES];
+static uint8_t s_send_bufs[SINK_SLOTS][SINK_PAYLOAD_MAX];
+
+/* ---- Retry queue, called with s_lock held ---- */
+
+static bool ring_reserve(ring_t *r, size_t need, size_t *at)
+{
+    if (r->count == 0) {
+        r->head = r->tail = 0;
+        r->end = r->size;
+    }
+    if (r->count == 0 || r->tail > r->head) {
+        if (r->size - r->tail >= need) {
+            *at = r->tail;
+            return true;
+        }
+        /* Wrap; tail must stay short of head */
+        if (r->head > need) {
+            r->end = r->tail;
+            *at = 0;
+            return true;
+        }
+        return false;
+    }
+    if (r->head - r->tail > need) {
+        *at = r->tail;
+        return true;
+    }
+    return false;
+}
+
+static void ring_pop(ring_t *r)
+{
+    uint32_t len;
+    memcpy(&len, r->buf + r->head, sizeof(len));
+    r->head += sizeof(len) + len;
+    r->count--;
+    r->bytes -= len;
+    r->head_seq++;
+    if (r->count > 0 && r->head >= r->end) {
+        r->head = 0;
+        r->end = r->size;
+    }
+}
+
+static bool ring_push(ring_t *r, const void *payload, size_t len, uint32_t *dropped)
+{
+    const size_t need = sizeof(uint32_t) + len;
+    if (need > r->size) {
+        return false;
+    }
+    size_t at;
+    while (!ring_reserve(r, need, &at)) {
+        ring_pop(r);
+        (*dropped)++;
+    }
+    const uint32_t len32 = (uint32_t)len;
+    memcpy(r->buf + at, &len32, sizeof(len32));
+    memcpy(r->buf + at + sizeof(len32), payload, len);
+    r->tail = at + need;
+    r->count++;
+    r->bytes += len;
+    return true;
+}
+
+/* ---- HTTP backends ---- */
+
+#if SINK_ON_INFLUX_V2 || SINK_ON_INFLUX_V1 || SINK_ON_REMOTE_WRITE
+
+#if CONFIG_CHARGER_SINK_TLS_PINNED
+/* main/certs/sink_ca.pem, NUL-terminated */
+extern const char sink_ca_pem_start[] asm("_binary_sink_ca_pem_start");
+#endif
+
+/* Runs in the sink's task, inside esp_http_client_perform() */
+static esp_err_t http_event(esp_http_client_event_t *evt)
+{
+    sink_t *s = evt->user_data;
+    if (evt->event_id != HTTP_EVENT_ON_CONNECTED) {
+        return ESP_OK;
+    }
+
+    /* The handshake is over by now, so the window peak is its peak */
+    heap_tls_usage_t tls;
+    heap_monitor_get_tls(&tls);
+    s->connected = true;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s->stats.connects++;
+    s->stats.last_connect_ms = (uint32_t)((esp_timer_get_time() - s->attempt_us) / 1000);
+    if (s->stats.tls) {
+        s->stats.tls_heap_bytes = tls.mark_peak - s->tls_baseline;
+    }
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+/* One client per sink for the life of the firmware, so the connection
+ * and the TLS session carry over between uploads */
+static esp_http_client_handle_t client_open(sink_t *s)
+{
+    if (s->client != NULL) {
+        return s->client;
+    }
+
+    esp_http_client_config_t http_config = {
+        .url = s->url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = SINK_HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+        .event_handler = http_event,
+        .user_data = s,
+    };
+    if (s->stats.tls) {
+#if CONFIG_CHARGER_SINK_TLS_PINNED
+        http_config.cert_pem = sink_ca_pem_start;
+#else
+        http_config.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+#if CONFIG_CHARGER_SINK_TLS_RESUME
+        http_config.save_client_session = true;
+#endif
+    }
+#if CONFIG_CHARGER_SINK_INFLUX_V1
+    if (s == &s_sinks[SINK_INFLUX_V1] && CONFIG_CHARGER_SINK_INFLUX_V1_USER[0] != '\0') {
+        http_config.username = CONFIG_CHARGER_SINK_INFLUX_V1_USER;
+        http_config.password = CONFIG_CHARGER_SINK_INFLUX_V1_PASSWORD;
+        http_config.auth_type = HTTP_AUTH_TYPE_BASIC;
+    }
+#endif
+    s->client = esp_http_client_init(&http_config);
+    return s->client;
+}
+
+static esp_err_t http_deliver(sink_t *s, size_t len, int *status)
+{
+    esp_http_client_handle_t client = client_open(s);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "HTTP client init failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (s->auth[0] != '\0') {
+        esp_http_client_set_header(client, "Authorization", s->auth);
+    }
+    if (s->format == SINK_FORMAT_REMOTE_WRITE) {
+        esp_http_client_set_header(client, "Content-Type", "application/x-protobuf");
+        esp_http_client_set_header(client, "Content-Encoding", "snappy");
+        esp_http_client_set_header(client, "X-Prometheus-Remote-Write-Version", "0.1.0");
+    } else {
+        esp_http_client_set_header(client, "Content-Type", "text/plain; charset=utf-8");
+    }
+    esp_http_client_set_post_field(client, (const char *)s->send_buf, len);
+
+    esp_err_t err;
+    for (int attempt = 0; ; attempt++) {
+        s->connected = false;
+        s->attempt_us = esp_timer_get_time();
+        s->tls_baseline = heap_monitor_tls_mark();
+        err = esp_http_client_perform(client);
+        /* A kept-alive connection the server has closed since fails
+         * without connecting; try once more on a fresh one */
+        if (err == ESP_OK || s->connected || attempt > 0 || s->abort) {
+            break;
+        }
+        esp_http_client_close(client);
+    }
+
+    if (err == ESP_OK) {
+        *status = esp_http_client_get_status_code(client);
+        if (*status >= 200 && *status < 300) {
+            err = ESP_OK;
+        } else if (*status == 400 || *status == 413) {
+            /* Sending the same body again won't help */
+            err = ESP_ERR_INVALID_ARG;
+        } else {
+            err = ESP_FAIL;
+        }
+    } else {
+        *status = -1;
+    }
+
+    /* Reconnect on the next delivery only if this one failed; the TLS
+     * session is kept for resumption */
+    if (err != ESP_OK) {
+        esp_http_client_close(client);
+    }
+    return err;
+}
+
+#endif
+
+/* ---- Flash journal ---- */
+
+#if CONFIG_CHARGER_SINK_JOURNAL
+
+static bool s_journal_mounted = false;
+
+static esp_err_t journal_mount(void)
+{
+    /* Formatting only happens if there is no file system, so no .env
+     * either */
+    const esp_vfs_spiffs_conf_t spiffs_conf = {
+        .base_path = "/spiffs",
+        .partition_label = "storage",
+        .max_files = 3,
+        .format_if_mount_failed = true
+    };
+    const esp_err_t err = esp_vfs_spiffs_register(&spiffs_conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount SPIFFS for the journal (%s)", esp_err_to_name(err));
+        return err;
+    }
+    s_journal_mounted = true;
+    return ESP_OK;
+}
+
+static esp_err_t journal_deliver(sink_t *s, size_t len, int *status)
+{
+    *status = -1;
+    if (!s_journal_mounted) {
+        const esp_err_t err = journal_mount();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    /* Two files of half the budget each; the older one is discarded */
+    struct stat st;
+    if (stat(SINK_JOURNAL_PATH, &st) == 0 &&
+        st.st_size + len > CONFIG_CHARGER_SINK_JOURNAL_KB * 1024 / 2) {
+        remove(SINK_JOURNAL_OLD_PATH);
+        rename(SINK_JOURNAL_PATH, SINK_JOURNAL_OLD_PATH);
+    }
+
+    FILE *f = fopen(SINK_JOURNAL_PATH, "a");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    const bool ok = fwrite(s->send_buf, 1, len, f) == len;
+    if (fclose(f) != 0 || !ok) {
+        return ESP_FAIL;
+    }
+    *status = 0;
+    return ESP_OK;
+}
+
+#endif
+
+/* ---- Delivery task ---- */
+
+static bool copy_head(sink_t *s, size_t *len, uint32_t *seq)
+{
+    bool found = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s->ring.count > 0) {
+        uint32_t len32;
+        memcpy(&len32, s->ring.buf + s->ring.head, sizeof(len32));
+        memcpy(s->send_buf, s->ring.buf + s->ring.head + sizeof(len32), len32);
+        *len = len32;
+        *seq = s->ring.head_seq;
+        found = true;
+    }
+    xSemaphoreGive(s_lock);
+    return found;
+}
+
+static void sink_task(void *arg)
+{
+    sink_t *s = arg;
+    const sink_id_t id = (sink_id_t)(s - s_sinks);
+    uint32_t backoff_ms = 0;
+
+    while (1) {
+        size_t len;
+        uint32_t seq;
+        if (!copy_head(s, &len, &seq)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (s->network && !wifi_is_connected()) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SINK_OFFLINE_POLL_MS));
+            continue;
+        }
+
+        const int64_t start_us = esp_timer_get_time();
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s->deadline_us = start_us + SINK_STALL_MS * 1000LL;
+        xSemaphoreGive(s_lock);
+
+        int status = -1;
+        const esp_err_t err = s->deliver(s, len, &status);
+        const uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+        BINLOG(SINK_WRITE, (uint32_t)id, (uint32_t)status, (uint32_t)len, elapsed_ms);
+
+        /* The supervisor gave up on this delivery: start over on a fresh
+         * client. Only this task touches it, so it is cleaned up here. */
+        if (s->abort) {
+            s->abort = false;
+            if (s->client != NULL) {
+                esp_http_client_cleanup(s->client);
+                s->client = NULL;
+            }
+            ESP_LOGW(TAG, "%s back after a stalled delivery (%lu ms)", s_names[id], elapsed_ms);
+        }
+
+        if (err == ESP_OK || err == ESP_ERR_INVALID_ARG) {
+            backoff_ms = 0;
+        } else {
+            backoff_ms = backoff_ms == 0 ? SINK_BACKOFF_MIN_MS : backoff_ms * 2;
+            if (backoff_ms > SINK_BACKOFF_MAX_MS) {
+                backoff_ms = SINK_BACKOFF_MAX_MS;
+            }
+        }
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s->deadline_us = 0;
+        s->stats.last_status = status;
+        s->stats.last_ms = elapsed_ms;
+        s->stats.retry_in_ms = backoff_ms;
+        if (err == ESP_OK) {
+            s->stats.delivered++;
+            boot_trace_mark(BOOT_EVENT_FIRST_UPLOAD);
+        } else if (err == ESP_ERR_INVALID_ARG) {
+            s->stats.rejected++;
+        } else {
+            s->stats.failed++;
+        }
+        /* Unless submit already pushed it out to make room */
+        if (backoff_ms == 0 && s->ring.count > 0 && s->ring.head_seq == seq) {
+            ring_pop(&s->ring);
+        }
+        xSemaphoreGive(s_lock);
+
+        if (err == ESP_ERR_INVALID_ARG) {
+            ESP_LOGE(TAG, "%s refused %u bytes (HTTP %d), dropped", s_names[id], (unsigned)len, status);
+        } else if (err != ESP_OK) {
+            ESP_LOGW(TAG, "%s delivery failed (%s, status %d), retrying in %lu ms",
+                     s_names[id], esp_err_to_name(err), status, backoff_ms);
+            vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+        }
+    }
+}
+
+static esp_err_t start_task(sink_t *s)
+{
+    if (RTOS_TASK_CREATE_SLOT(sink_task, s_names[s - s_sinks], SINK_TASK_STACK, s,
+                              SINK_TASK_PRIO, &s->task, s->slot, SINK_SLOTS) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create %s task", s_names[s - s_sinks]);
+        s->task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#if SINK_SLOTS > 0
+static void enable(sink_id_t id, sink_format_t format, bool network,
+                   esp_err_t (*deliver)(sink_t *s, size_t len, int *status), int *slot)
+{
+    sink_t *s = &s_sinks[id];
+    s->format = format;
+    s->network = network;
+    s->deliver = deliver;
+    s->slot = (*slot)++;
+    s->ring.buf = s_rings[s->slot];
+    s->ring.size = sizeof(s_rings[s->slot]);
+    s->send_buf = s_send_bufs[s->slot];
+    s->stats.enabled = true;
+}
+#endif
+
+esp_err_t sink_start(void)
+{
+    for (int i = 0; i < SINK_COUNT; i++) {
+        s_sinks[i].slot = -1;
+    }
+    s_lock = RTOS_MUTEX_CREATE();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int slot = 0;
+#if CONFIG_CHARGER_SINK_INFLUX_V2
+    sink_t *v2 = &s_sinks[SINK_INFLUX_V2];
+    enable(SINK_INFLUX_V2, SINK_FORMAT_LINE, true, http_deliver, &slot);
+    snprintf(v2->url, sizeof(v2->url), "%s/api/v2/write?org=%s&bucket=%s&precision=ns",
+             g_config.influx_url, g_config.influx_org, g_config.influx_bucket);
+    snprintf(v2->auth, sizeof(v2->auth), "Token %s", g_config.influx_token);
+#endif
+#if CONFIG_CHARGER_SINK_INFLUX_V1
+    /* Same server and credentials as v2 unless set in menuconfig */
+    sink_t *v1 = &s_sinks[SINK_INFLUX_V1];
+    enable(SINK_INFLUX_V1, SINK_FORMAT_LINE, true, http_deliver, &slot);
+    snprintf(v1->url, sizeof(v1->url), "%s/write?db=%s&precision=ns",
+             CONFIG_CHARGER_SINK_INFLUX_V1_URL[0] ? CONFIG_CHARGER_SINK_INFLUX_V1_URL : g_config.influx_url,
+             CONFIG_CHARGER_SINK_INFLUX_V1_DB[0] ? CONFIG_CHARGER_SINK_INFLUX_V1_DB : g_config.influx_bucket);
+    if (CONFIG_CHARGER_SINK_INFLUX_V1_USER[0] == '\0' && g_config.influx_token[0] != '\0') {
+        snprintf(v1->auth, sizeof(v1->auth), "Token %s", g_config.influx_token);
+    }
+#endif
+#if CONFIG_CHARGER_SINK_REMOTE_WRITE
+    sink_t *rw = &s_sinks[SINK_REMOTE_WRITE];
+    enable(SINK_REMOTE_WRITE, SINK_FORMAT_REMOTE_WRITE, true, http_deliver, &slot);
+    snprintf(rw->url, sizeof(rw->url), "%s", CONFIG_CHARGER_SINK_REMOTE_WRITE_URL);
+    if (CONFIG_CHARGER_SINK_REMOTE_WRITE_TOKEN[0] != '\0') {
+        snprintf(rw->auth, sizeof(rw->auth), "Bearer %s", CONFIG_CHARGER_SINK_REMOTE_WRITE_TOKEN);
+    }
+#endif
+#if CONFIG_CHARGER_SINK_JOURNAL
+    /* Mounted up front so /api/journal works before the first write;
+     * a failure is retried on delivery */
+    enable(SINK_JOURNAL, SINK_FORMAT_LINE, false, journal_deliver, &slot);
+    journal_mount();
+#endif
+
+    for (int i = 0; i < SINK_COUNT; i++) {
+        sink_t *s = &s_sinks[i];
+        if (s->slot < 0) {
+            continue;
+        }
+        s->stats.tls = strncmp(s->url, "https://", 8) == 0;
+        const esp_err_t err = start_task(s);
+        if (err != ESP_OK) {
+            return err;
+        }
+        ESP_LOGI(TAG, "Sink %s enabled%s%s", s_names[i], s->url[0] ? ": " : "", s->url);
+    }
+    if (slot == 0) {
+        ESP_LOGW(TAG, "No upload sink enabled, samples stay on the device");
+    }
+    return ESP_OK;
+}
+
+bool sink_wants(sink_format_t format)
+{
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (s_sinks[i].slot >= 0 && s_sinks[i].format == format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void sink_submit(sink_format_t format, const void *payload, size_t len)
+{
+    for (int i = 0; i < SINK_COUNT; i++) {
+        sink_t *s = &s_sinks[i];
+        if (s->slot < 0 || s->format != format) {
+            continue;
+        }
+
+        uint32_t dropped = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (!ring_push(&s->ring, payload, len, &dropped)) {
+            dropped++;
+        }
+        s->stats.dropped += dropped;
+        xSemaphoreGive(s_lock);
+
+        if (dropped > 0) {
+            ESP_LOGW(TAG, "%s retry queue full, dropped %lu oldest payloads", s_names[i], dropped);
+        }
+        if (s->task != NULL) {
+            xTaskNotifyGive(s->task);
+        }
+    }
+}
+
+void sink_get_stats(sink_stats_t *stats)
+{
+    if (s_lock == NULL) {
+        memset(stats, 0, SINK_COUNT * sizeof(stats[0]));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < SINK_COUNT; i++) {
+        stats[i] = s_sinks[i].stats;
+        stats[i].queued = s_sinks[i].ring.count;
+        stats[i].queued_bytes = s_sinks[i].ring.bytes;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+const char *sink_name(sink_id_t id)
+{
+    return id < SINK_COUNT ? s_names[id] : "unknown";
+}
+
+static bool is_stalled(const sink_t *s, int64_t now)
+{
+    return s->slot >= 0 && s->deadline_us != 0 && now > s->deadline_us;
+}
+
+void sink_probe(void)
+{
+    if (s_lock == NULL) {
+        return;
+    }
+    const int64_t now = esp_timer_get_time();
+    bool stalled = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < SINK_COUNT; i++) {
+        stalled = stalled || is_stalled(&s_sinks[i], now);
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!stalled) {
+        supervisor_heartbeat(SUPERVISOR_SINKS, SINK_STALL_MS);
+    }
+}
+
+esp_err_t sink_abort_stalled(void)
+{
+    const int64_t now = esp_timer_get_time();
+    for (int i = 0; i < SINK_COUNT; i++) {
+        sink_t *s = &s_sinks[i];
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        const bool stalled = is_stalled(s, now);
+        if (stalled) {
+            s->abort = true;
+            s->stats.restarts++;
+        }
+        xSemaphoreGive(s_lock);
+        if (!stalled) {
+            continue;
+        }
+
+        /* The task acts on it once the blocking call returns; the payload
+         * stays at the head of the queue. One that never returns keeps the
+         * sink stalled until the supervisor reboots. */
+        ESP_LOGW(TAG, "%s stuck in a delivery, asked to reconnect (%lu payloads queued)",
+                 s_names[i], s->ring.count);
+    }
+    return ESP_OK;
+}
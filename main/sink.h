@@ -0,0 +1,111 @@
+#pragma once
+
+#include "esp_err.h"
+#include "influxdb.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Upload sinks
+ *
+ * The uploader encodes each batch once per wire format and hands it to
+ * sink_submit(), which copies it into the retry queue of every enabled
+ * sink taking that format. Each sink has its own task, so a slow or dead
+ * backend only holds up itself. A full retry queue drops its oldest
+ * payloads. Sinks are picked in menuconfig (Upload sinks).
+ *
+ * HTTP sinks keep one client for the life of the firmware, so the
+ * connection is reused between uploads. With an https URL the server
+ * certificate is checked against the ESP-IDF CA bundle or a pinned
+ * certificate, and a reconnect resumes the TLS session from its ticket
+ * instead of running a full handshake.
+ */
+
+/* Order matches API_SINK_NAMES */
+typedef enum {
+    SINK_INFLUX_V2,       /* POST /api/v2/write, token auth */
+    SINK_INFLUX_V1,       /* POST /write?db=, basic or token auth */
+    SINK_REMOTE_WRITE,    /* Prometheus remote-write 1.0 */
+    SINK_JOURNAL,         /* Line protocol appended to SPIFFS */
+    SINK_COUNT
+} sink_id_t;
+
+typedef enum {
+    SINK_FORMAT_LINE,           /* InfluxDB line protocol */
+    SINK_FORMAT_REMOTE_WRITE,   /* Snappy-compressed prompb WriteRequest */
+} sink_format_t;
+
+/* Largest payload a sink accepts: a full batch of line protocol */
+#define SINK_PAYLOAD_MAX  (INFLUXDB_BATCH_MAX_POINTS * INFLUXDB_LINE_MAX_LEN)
+
+/* Journal files, oldest first; GET /api/journal returns both */
+#define SINK_JOURNAL_PATH      "/spiffs/journal.lp"
+#define SINK_JOURNAL_OLD_PATH  "/spiffs/journal.1.lp"
+
+typedef struct {
+    bool enabled;
+    uint32_t queued;          /* Payloads waiting, including one being retried */
+    uint32_t queued_bytes;
+    uint32_t delivered;       /* Payloads the backend accepted */
+    uint32_t failed;          /* Attempts that failed and will be retried */
+    uint32_t rejected;        /* Payloads the backend refused (HTTP 400/413), not retried */
+    uint32_t dropped;         /* Payloads pushed out of a full retry queue */
+    uint32_t restarts;        /* Stalled deliveries the supervisor made start over */
+    int32_t last_status;      /* HTTP status of the last attempt, 0 for the journal, -1 if unreachable */
+    uint32_t last_ms;         /* Duration of the last attempt */
+    uint32_t retry_in_ms;     /* Backoff before the next attempt, 0 if none */
+    bool tls;                 /* URL is https */
+    uint32_t connects;        /* Connections opened; one per delivery means keep-alive isn't working */
+    uint32_t last_connect_ms; /* DNS, TCP and TLS handshake of the last connection */
+    uint32_t tls_heap_bytes;  /* mbedTLS heap the last handshake took on top of what was held before */
+} sink_stats_t;
+
+/**
+ * Create the retry queues and tasks of the enabled sinks
+ * Call after the configuration is loaded, before the uploader starts.
+ * @return ESP_OK on success
+ */
+esp_err_t sink_start(void);
+
+/**
+ * Check whether any enabled sink takes a format
+ * @param format Wire format
+ * @return true if encoding for it is worth the time
+ */
+bool sink_wants(sink_format_t format);
+
+/**
+ * Queue a payload on every enabled sink that takes its format
+ * The payload is copied; oldest payloads are dropped to make room.
+ * @param format Wire format of the payload
+ * @param payload Encoded batch, session or alert
+ * @param len Length, at most SINK_PAYLOAD_MAX
+ */
+void sink_submit(sink_format_t format, const void *payload, size_t len);
+
+/**
+ * Get delivery statistics
+ * @param stats Array of SINK_COUNT entries, indexed by sink_id_t
+ */
+void sink_get_stats(sink_stats_t *stats);
+
+/**
+ * Get a sink's name as used in /api/diag and the binary log
+ * @param id Sink
+ * @return Static string (e.g. "influx_v2")
+ */
+const char *sink_name(sink_id_t id);
+
+/**
+ * Heartbeat the supervisor unless a sink is stuck in a delivery
+ * Called by the supervisor.
+ */
+void sink_probe(void);
+
+/**
+ * Ask every sink stuck in a delivery to give it up and reconnect
+ * Called by the supervisor; doesn't wait. The task reconnects once the
+ * blocking call returns, and the payload being delivered stays queued.
+ * @return ESP_OK
+ */
+esp_err_t sink_abort_stalled(void);
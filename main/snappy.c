@@ -0,0 +1,124 @@
+#include "snappy.h"
+#include <string.h>
+
+#define BLOCK_SIZE      65536     /* Copies never reach back further than this */
+#define HASH_BITS       10
+#define MIN_MATCH       4
+
+/* Block offsets of recent 4-byte sequences */
+static uint16_t s_table[1 << HASH_BITS];
+
+static uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash(uint32_t v)
+{
+    return (v * 0x1e35a7bdu) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_varint(uint8_t *op, uint32_t v)
+{
+    while (v >= 0x80) {
+        *op++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *op++ = (uint8_t)v;
+    return op;
+}
+
+static uint8_t *put_literal(uint8_t *op, const uint8_t *lit, size_t len)
+{
+    const uint32_t n = (uint32_t)len - 1;
+    if (n < 60) {
+        *op++ = (uint8_t)(n << 2);
+    } else {
+        /* Tag 60..63: the length follows in 1..4 bytes */
+        uint8_t *tag = op++;
+        int bytes = 0;
+        for (uint32_t v = n; v > 0; v >>= 8) {
+            *op++ = (uint8_t)v;
+            bytes++;
+        }
+        *tag = (uint8_t)((59 + bytes) << 2);
+    }
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+static uint8_t *put_copy(uint8_t *op, uint32_t offset, uint32_t len)
+{
+    /* Two-byte offset copies carry at most 64 bytes; split so that at
+     * least 4 are left for the last one */
+    while (len >= 68) {
+        *op++ = (uint8_t)(2 | (63 << 2));
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        len -= 64;
+    }
+    if (len > 64) {
+        *op++ = (uint8_t)(2 | (59 << 2));
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        len -= 60;
+    }
+    if (len < 12 && offset < 2048) {
+        *op++ = (uint8_t)(1 | ((len - 4) << 2) | ((offset >> 8) << 5));
+        *op++ = (uint8_t)offset;
+    } else {
+        *op++ = (uint8_t)(2 | ((len - 1) << 2));
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+    }
+    return op;
+}
+
+size_t snappy_max_compressed_length(size_t n)
+{
+    return 32 + n + n / 6;
+}
+
+size_t snappy_compress(const uint8_t *in, size_t n, uint8_t *out, size_t out_len)
+{
+    if (n > UINT32_MAX || out_len < snappy_max_compressed_length(n)) {
+        return 0;
+    }
+
+    uint8_t *op = put_varint(out, (uint32_t)n);
+    for (size_t block = 0; block < n; block += BLOCK_SIZE) {
+        const uint8_t *src = in + block;
+        const size_t len = n - block < BLOCK_SIZE ? n - block : BLOCK_SIZE;
+        memset(s_table, 0, sizeof(s_table));
+
+        size_t lit_start = 0;
+        size_t ip = 1;
+        while (ip + MIN_MATCH <= len) {
+            const uint32_t cur = load32(src + ip);
+            const uint32_t h = hash(cur);
+            const size_t cand = s_table[h];
+            s_table[h] = (uint16_t)ip;
+            if (load32(src + cand) != cur) {
+                ip++;
+                continue;
+            }
+
+            size_t match = MIN_MATCH;
+            while (ip + match < len && src[cand + match] == src[ip + match]) {
+                match++;
+            }
+            if (ip > lit_start) {
+                op = put_literal(op, src + lit_start, ip - lit_start);
+            }
+            op = put_copy(op, (uint32_t)(ip - cand), (uint32_t)match);
+            ip += match;
+            lit_start = ip;
+        }
+        if (len > lit_start) {
+            op = put_literal(op, src + lit_start, len - lit_start);
+        }
+    }
+    return (size_t)(op - out);
+}
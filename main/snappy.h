@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Snappy block compression (raw format, no framing)
+ *
+ * What Prometheus remote-write expects as Content-Encoding: snappy. Greedy
+ * matching over a small hash table; compresses repetitive protobuf about
+ * as well as the reference encoder at a fraction of its memory. Only
+ * compression is needed on the device; tools/sinkcheck has a decoder.
+ * Free of ESP-IDF includes so the host tools can build it.
+ */
+
+/**
+ * Worst-case output size for an input of n bytes
+ * @param n Input length
+ * @return Bytes the output buffer needs to always succeed
+ */
+size_t snappy_max_compressed_length(size_t n);
+
+/**
+ * Compress a buffer
+ * Not reentrant: uses a static hash table, call from one task only.
+ * @param in Input
+ * @param n Input length
+ * @param out Output buffer
+ * @param out_len Size of out, at least snappy_max_compressed_length(n)
+ * @return Compressed length, 0 if out is too small
+ */
+size_t snappy_compress(const uint8_t *in, size_t n, uint8_t *out, size_t out_len);
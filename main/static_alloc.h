@@ -0,0 +1,73 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "sdkconfig.h"
+
+/* Long-lived RTOS objects
+ *
+ * Drop-in replacements for the FreeRTOS create calls. With
+ * CONFIG_CHARGER_STATIC_ALLOC the object and its storage (queue items, task
+ * stack) are reserved at link time, one static buffer per call site, so
+ * each site runs once; none of these objects is deleted. Without it they
+ * are the usual heap allocating calls.
+ */
+
+#if CONFIG_CHARGER_STATIC_ALLOC
+
+#define RTOS_MUTEX_CREATE() ({ \
+    static StaticSemaphore_t buf_; \
+    xSemaphoreCreateMutexStatic(&buf_); })
+
+#define RTOS_BINARY_CREATE() ({ \
+    static StaticSemaphore_t buf_; \
+    xSemaphoreCreateBinaryStatic(&buf_); })
+
+#define RTOS_EVENT_GROUP_CREATE() ({ \
+    static StaticEventGroup_t buf_; \
+    xEventGroupCreateStatic(&buf_); })
+
+#define RTOS_QUEUE_CREATE(len, item_size) ({ \
+    static uint8_t storage_[(len) * (item_size)]; \
+    static StaticQueue_t buf_; \
+    xQueueCreateStatic((len), (item_size), storage_, &buf_); })
+
+/* Same arguments and result as xTaskCreate; stack_bytes must be constant */
+#define RTOS_TASK_CREATE(fn, name, stack_bytes, arg, prio, handle) ({ \
+    static StackType_t stack_[(stack_bytes) / sizeof(StackType_t)]; \
+    static StaticTask_t tcb_; \
+    TaskHandle_t task_ = xTaskCreateStatic((fn), (name), (stack_bytes), (arg), (prio), stack_, &tcb_); \
+    TaskHandle_t *handle_ = (handle); \
+    if (handle_ != NULL) { \
+        *handle_ = task_; \
+    } \
+    task_ != NULL ? pdPASS : pdFAIL; })
+
+/* For a call site that starts several tasks: slot (below slots) picks the
+ * stack, and each slot is used once */
+#define RTOS_TASK_CREATE_SLOT(fn, name, stack_bytes, arg, prio, handle, slot, slots) ({ \
+    static StackType_t stack_[(slots)][(stack_bytes) / sizeof(StackType_t)]; \
+    static StaticTask_t tcb_[(slots)]; \
+    TaskHandle_t task_ = xTaskCreateStatic((fn), (name), (stack_bytes), (arg), (prio), \
+                                           stack_[(slot)], &tcb_[(slot)]); \
+    TaskHandle_t *handle_ = (handle); \
+    if (handle_ != NULL) { \
+        *handle_ = task_; \
+    } \
+    task_ != NULL ? pdPASS : pdFAIL; })
+
+#else
+
+#define RTOS_MUTEX_CREATE()                xSemaphoreCreateMutex()
+#define RTOS_BINARY_CREATE()               xSemaphoreCreateBinary()
+#define RTOS_EVENT_GROUP_CREATE()          xEventGroupCreate()
+#define RTOS_QUEUE_CREATE(len, item_size)  xQueueCreate((len), (item_size))
+#define RTOS_TASK_CREATE(fn, name, stack_bytes, arg, prio, handle) \
+    xTaskCreate((fn), (name), (stack_bytes), (arg), (prio), (handle))
+#define RTOS_TASK_CREATE_SLOT(fn, name, stack_bytes, arg, prio, handle, slot, slots) \
+    xTaskCreate((fn), (name), (stack_bytes), (arg), (prio), (handle))
+
+#endif
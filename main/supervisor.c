@@ -0,0 +1,283 @@
+#include "supervisor.h"
+#include "sink.h"
+#include "webserver.h"
+#include "wifi_manager.h"
+#include "static_alloc.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "supervisor";
+
+#define SUPERVISOR_TASK_STACK  3072
+#define SUPERVISOR_TASK_PRIO   6      /* Above everything it may have to restart */
+#define SUPERVISOR_CHECK_MS    1000
+#define SUPERVISOR_PROBE_MS    5000
+#define RESTART_WINDOW_US      (3600LL * 1000000LL)
+
+static const char NVS_NAMESPACE[] = "health";
+#define NVS_KEY_BOOTS   "boots"
+#define NVS_KEY_REASON  "reason"
+
+typedef struct {
+    const char *name;
+    void (*probe)(void);          /* Asks for a heartbeat, NULL if it sends its own */
+    esp_err_t (*restart)(void);   /* NULL if only a reboot brings it back; must not block */
+    bool escalate;                /* Reboot once restarts come too often */
+} subsystem_def_t;
+
+/* wifi_manager retries with backoff on its own; only an outage that
+ * outlasts all of that gets the driver restarted */
+static void wifi_probe(void)
+{
+    if (wifi_is_connected()) {
+        supervisor_heartbeat(SUPERVISOR_WIFI, CONFIG_CHARGER_HEALTH_WIFI_OUTAGE_SEC * 1000);
+    }
+}
+
+static const subsystem_def_t s_defs[SUPERVISOR_COUNT] = {
+    [SUPERVISOR_SAMPLER]   = { "sampler",   NULL,            NULL,              true },
+    /* Only deleting the task would unstick these, and it may hold a lock */
+    [SUPERVISOR_UPLOADER]  = { "uploader",  NULL,            NULL,              true },
+    [SUPERVISOR_SINKS]     = { "sinks",     sink_probe,      sink_abort_stalled, true },
+    /* httpd_stop would wait for the stuck handler */
+    [SUPERVISOR_WEBSERVER] = { "webserver", webserver_probe, NULL,              true },
+    /* A reboot doesn't bring the AP back */
+    [SUPERVISOR_WIFI]      = { "wifi",      wifi_probe,      wifi_restart,      false },
+};
+
+typedef struct {
+    int64_t deadline_us;          /* 0 until the first heartbeat */
+    int64_t within_us;            /* Last promise, also the grace after a restart */
+    int64_t last_beat_us;
+    int64_t last_restart_us;
+    int64_t window_start_us;      /* Restarts are counted per hour for escalation */
+    uint32_t window_restarts;
+    uint32_t restarts;
+    char last_reason[SUPERVISOR_REASON_LEN];
+} subsystem_state_t;
+
+/* Heartbeats come from any task; everything else is written by the
+ * supervisor task only */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static subsystem_state_t s_state[SUPERVISOR_COUNT];
+static uint32_t s_boot_count = 0;
+static char s_reboot_reason[SUPERVISOR_REASON_LEN] = "";
+
+void supervisor_heartbeat(supervisor_subsystem_t subsystem, uint32_t within_ms)
+{
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    subsystem_state_t *st = &s_state[subsystem];
+    st->last_beat_us = now;
+    st->within_us = (int64_t)within_ms * 1000;
+    st->deadline_us = now + st->within_us;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+/* Leave a reason for the next boot; NULL takes it back */
+static void save_reason(const char *reason)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    if (reason) {
+        nvs_set_str(nvs_handle, NVS_KEY_REASON, reason);
+    } else {
+        nvs_erase_key(nvs_handle, NVS_KEY_REASON);
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+static void reboot(const char *reason)
+{
+    ESP_LOGE(TAG, "Rebooting: %s", reason);
+    save_reason(reason);
+    esp_restart();
+}
+
+static void check(supervisor_subsystem_t subsystem, int64_t now)
+{
+    const subsystem_def_t *def = &s_defs[subsystem];
+    subsystem_state_t *st = &s_state[subsystem];
+
+    portENTER_CRITICAL(&s_lock);
+    const bool stalled = st->deadline_us != 0 && now > st->deadline_us;
+    const int64_t silent_ms = (now - st->last_beat_us) / 1000;
+    portEXIT_CRITICAL(&s_lock);
+    if (!stalled) {
+        return;
+    }
+
+    char reason[SUPERVISOR_REASON_LEN];
+    snprintf(reason, sizeof(reason), "%s silent for %lld ms", def->name, silent_ms);
+
+    if (now - st->window_start_us > RESTART_WINDOW_US) {
+        st->window_start_us = now;
+        st->window_restarts = 0;
+    }
+    if (def->restart == NULL) {
+        reboot(reason);
+    }
+    if (def->escalate && st->window_restarts >= CONFIG_CHARGER_HEALTH_MAX_RESTARTS) {
+        snprintf(reason, sizeof(reason), "%s stalled %lu times in an hour",
+                 def->name, st->window_restarts + 1);
+        reboot(reason);
+    }
+    st->window_restarts++;
+
+    /* The restart counts as a fresh promise, so a dead subsystem is retried
+     * after the same grace rather than on every check */
+    portENTER_CRITICAL(&s_lock);
+    st->restarts++;
+    st->last_restart_us = now;
+    st->deadline_us = now + st->within_us;
+    memcpy(st->last_reason, reason, sizeof(reason));
+    portEXIT_CRITICAL(&s_lock);
+
+    /* If the restart hangs, the Task WDT resets the chip before the
+     * supervisor could say why */
+    char pending[SUPERVISOR_REASON_LEN + 16];
+    snprintf(pending, sizeof(pending), "%s, restart hung", reason);
+    pending[SUPERVISOR_REASON_LEN - 1] = '\0';
+    save_reason(pending);
+
+    ESP_LOGE(TAG, "%s, restarting it (%lu since boot)", reason, st->restarts);
+    const esp_err_t err = def->restart();
+    save_reason(NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Restarting %s failed: %s", def->name, esp_err_to_name(err));
+    }
+}
+
+static void supervisor_task(void *arg)
+{
+    /* A restart that hangs trips the watchdog instead of stalling supervision */
+    esp_task_wdt_add(NULL);
+
+    int64_t next_probe_us = 0;
+    while (1) {
+        esp_task_wdt_reset();
+
+        int64_t now = esp_timer_get_time();
+        if (now >= next_probe_us) {
+            next_probe_us = now + SUPERVISOR_PROBE_MS * 1000LL;
+            for (int i = 0; i < SUPERVISOR_COUNT; i++) {
+                if (s_defs[i].probe != NULL) {
+                    s_defs[i].probe();
+                }
+            }
+        }
+
+        for (int i = 0; i < SUPERVISOR_COUNT; i++) {
+            now = esp_timer_get_time();
+            check((supervisor_subsystem_t)i, now);
+            esp_task_wdt_reset();
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(SUPERVISOR_CHECK_MS));
+    }
+}
+
+static void load_boot_record(void)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to open NVS, boot count unavailable");
+        return;
+    }
+    nvs_get_u32(nvs_handle, NVS_KEY_BOOTS, &s_boot_count);
+    s_boot_count++;
+    nvs_set_u32(nvs_handle, NVS_KEY_BOOTS, s_boot_count);
+
+    /* Only meant for the boot right after; a later crash must not inherit it */
+    size_t len = sizeof(s_reboot_reason);
+    if (nvs_get_str(nvs_handle, NVS_KEY_REASON, s_reboot_reason, &len) == ESP_OK) {
+        nvs_erase_key(nvs_handle, NVS_KEY_REASON);
+    } else {
+        s_reboot_reason[0] = '\0';
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+esp_err_t supervisor_start(void)
+{
+    load_boot_record();
+    ESP_LOGI(TAG, "Boot %lu, reset reason %s", s_boot_count, supervisor_reset_reason_str());
+    if (s_reboot_reason[0] != '\0') {
+        ESP_LOGW(TAG, "Previous reboot by supervisor: %s", s_reboot_reason);
+    }
+
+    /* A WiFi outage counts from boot, not only once it first connected */
+    supervisor_heartbeat(SUPERVISOR_WIFI, CONFIG_CHARGER_HEALTH_WIFI_OUTAGE_SEC * 1000);
+
+    /* The default watchdog only logs; make a hung supervisor reset the chip */
+    const esp_task_wdt_config_t wdt_config = {
+        .timeout_ms = CONFIG_CHARGER_HEALTH_WDT_SEC * 1000,
+        .idle_core_mask = BIT(0),
+        .trigger_panic = true,
+    };
+    esp_err_t err = esp_task_wdt_reconfigure(&wdt_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure task watchdog: %s", esp_err_to_name(err));
+    }
+
+    if (RTOS_TASK_CREATE(supervisor_task, "supervisor", SUPERVISOR_TASK_STACK, NULL,
+                         SUPERVISOR_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create supervisor task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+uint32_t supervisor_get_boot_count(void)
+{
+    return s_boot_count;
+}
+
+void supervisor_get_report(supervisor_report_t *report)
+{
+    const int64_t now = esp_timer_get_time();
+    report->boot_count = s_boot_count;
+    memcpy(report->reboot_reason, s_reboot_reason, sizeof(report->reboot_reason));
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < SUPERVISOR_COUNT; i++) {
+        const subsystem_state_t *st = &s_state[i];
+        supervisor_status_t *out = &report->subsystems[i];
+        out->name = s_defs[i].name;
+        out->armed = st->deadline_us != 0;
+        out->restarts = st->restarts;
+        out->heartbeat_age_ms = st->last_beat_us != 0 ? (now - st->last_beat_us) / 1000 : -1;
+        out->restart_age_ms = st->last_restart_us != 0 ? (now - st->last_restart_us) / 1000 : -1;
+        memcpy(out->last_reason, st->last_reason, sizeof(out->last_reason));
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+const char *supervisor_reset_reason_str(void)
+{
+    switch (esp_reset_reason()) {
+        case ESP_RST_POWERON:   return "power_on";
+        case ESP_RST_EXT:       return "external";
+        case ESP_RST_SW:        return "software";
+        case ESP_RST_PANIC:     return "panic";
+        case ESP_RST_INT_WDT:   return "int_wdt";
+        case ESP_RST_TASK_WDT:  return "task_wdt";
+        case ESP_RST_WDT:       return "wdt";
+        case ESP_RST_DEEPSLEEP: return "deep_sleep";
+        case ESP_RST_BROWNOUT:  return "brownout";
+        case ESP_RST_SDIO:      return "sdio";
+        default:                return "unknown";
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Subsystem liveness and self-healing
+ *
+ * Each subsystem promises its next heartbeat with supervisor_heartbeat().
+ * A supervisor task checks the promises every second. A stuck upload sink
+ * is told to abandon its delivery and reconnect, and the WiFi driver is
+ * restarted, while sampling carries on. Tasks are never deleted, since
+ * one may hold a lock: a stuck sampler, uploader or HTTP handler, or a
+ * subsystem restarted CONFIG_CHARGER_HEALTH_MAX_RESTARTS times within an
+ * hour, reboots the chip. The reason is kept in NVS for /api/health, and
+ * is written before each restart too, so a restart that hangs until the
+ * Task WDT resets the chip still leaves it behind.
+ */
+
+typedef enum {
+    SUPERVISOR_SAMPLER,
+    SUPERVISOR_UPLOADER,
+    SUPERVISOR_SINKS,
+    SUPERVISOR_WEBSERVER,
+    SUPERVISOR_WIFI,
+    SUPERVISOR_COUNT
+} supervisor_subsystem_t;
+
+#define SUPERVISOR_REASON_LEN  48
+
+typedef struct {
+    const char *name;
+    bool armed;                   /* Sent its first heartbeat */
+    uint32_t restarts;            /* Restarts since boot */
+    int64_t heartbeat_age_ms;     /* Since the last heartbeat, -1 if none yet */
+    int64_t restart_age_ms;       /* Since the last restart, -1 if none yet */
+    char last_reason[SUPERVISOR_REASON_LEN];  /* Why it was last restarted */
+} supervisor_status_t;
+
+typedef struct {
+    uint32_t boot_count;          /* Boots since the NVS partition was erased */
+    char reboot_reason[SUPERVISOR_REASON_LEN];  /* Set if the supervisor caused the last reset */
+    supervisor_status_t subsystems[SUPERVISOR_COUNT];
+} supervisor_report_t;
+
+/**
+ * Count the boot, pick up the previous reboot reason and start the
+ * supervisor task. Call once NVS is initialized.
+ * @return ESP_OK on success
+ */
+esp_err_t supervisor_start(void);
+
+/**
+ * Report a subsystem alive and promise the next report
+ * The first call arms supervision of the subsystem. Callable from any task.
+ * @param subsystem Subsystem reporting
+ * @param within_ms Longest time until the next heartbeat
+ */
+void supervisor_heartbeat(supervisor_subsystem_t subsystem, uint32_t within_ms);
+
+/**
+ * Get the boot count, reboot reason and per-subsystem status
+ * @param report Filled with the current values
+ */
+void supervisor_get_report(supervisor_report_t *report);
+
+/**
+ * Get the boot count alone, for tagging persisted boot-relative times
+ * @return Boots since the NVS partition was erased, 0 if unknown
+ */
+uint32_t supervisor_get_boot_count(void);
+
+/**
+ * Get a short name for the reason of the last reset
+ * @return Static string (e.g. "power_on", "task_wdt")
+ */
+const char *supervisor_reset_reason_str(void);
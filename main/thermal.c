@@ -0,0 +1,304 @@
+#include "thermal.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "static_alloc.h"
+#include <math.h>
+
+static const char *TAG = "thermal";
+
+#if CONFIG_CHARGER_NTC_ENABLE
+
+/* Above every application task and lwIP, below the WiFi driver */
+#define THERMAL_TASK_STACK    2048
+#define THERMAL_TASK_PRIO     20
+#define THERMAL_POLL_SAMPLES  4
+#define THERMAL_READ_RETRIES  3     /* A read that collides with the sampler's fails */
+
+/* Lookup table over the pin range, one node every 32 mV */
+#define THERMAL_LUT_SHIFT     5
+#define THERMAL_LUT_SIZE      ((CONFIG_CHARGER_NTC_SUPPLY_MV >> THERMAL_LUT_SHIFT) + 2)
+
+/* Table range (0.1 °C); a shorted NTC reads as hot and trips */
+#define THERMAL_MIN_DECI_C    (-400)
+#define THERMAL_MAX_DECI_C    1500
+
+/* Pin this close to the supply means no NTC (open circuit) */
+#define THERMAL_OPEN_MARGIN_MV  30
+
+#if CONFIG_CHARGER_NTC_CUTOFF_ACTIVE_HIGH
+#define THERMAL_CUT_LEVEL       1
+#else
+#define THERMAL_CUT_LEVEL       0
+#endif
+
+#define THERMAL_CUTOFF_DECI_C   CONFIG_CHARGER_NTC_CUTOFF_DECI_C
+#define THERMAL_RELEASE_DECI_C  (CONFIG_CHARGER_NTC_CUTOFF_DECI_C - CONFIG_CHARGER_NTC_HYSTERESIS_DECI_C)
+
+static int16_t s_lut[THERMAL_LUT_SIZE];      /* 0.1 °C at each node */
+static adc_oneshot_unit_handle_t s_adc = NULL;
+static adc_cali_handle_t s_cali = NULL;
+
+/* Written by the watchdog task, read by the sampler and httpd */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static thermal_status_t s_status = {
+    .enabled = true,
+    .cell_temp = NAN,
+    .max_cell_temp = NAN,
+    .cutoff_temp = THERMAL_CUTOFF_DECI_C / 10.0f,
+    .last_trip_ms = -1,
+};
+
+/* Steinhart-Hart coefficients through three (resistance, temperature)
+ * points: 1/T = A + B ln R + C (ln R)^3 */
+static void steinhart_hart_fit(double *a, double *b, double *c)
+{
+    const double l1 = log(CONFIG_CHARGER_NTC_R0_OHMS);
+    const double l2 = log(CONFIG_CHARGER_NTC_R25_OHMS);
+    const double l3 = log(CONFIG_CHARGER_NTC_R50_OHMS);
+    const double y1 = 1.0 / 273.15;
+    const double y2 = 1.0 / 298.15;
+    const double y3 = 1.0 / 323.15;
+
+    const double g2 = (y2 - y1) / (l2 - l1);
+    const double g3 = (y3 - y1) / (l3 - l1);
+    *c = (g3 - g2) / (l3 - l2) / (l1 + l2 + l3);
+    *b = g2 - *c * (l1 * l1 + l1 * l2 + l2 * l2);
+    *a = y1 - (*b + l1 * l1 * *c) * l1;
+}
+
+static void build_lut(void)
+{
+    double a, b, c;
+    steinhart_hart_fit(&a, &b, &c);
+
+    for (int i = 0; i < THERMAL_LUT_SIZE; i++) {
+        const int pin_mv = i << THERMAL_LUT_SHIFT;
+        int deci_c;
+        if (pin_mv <= 0) {
+            deci_c = THERMAL_MAX_DECI_C;
+        } else if (pin_mv >= CONFIG_CHARGER_NTC_SUPPLY_MV) {
+            deci_c = THERMAL_MIN_DECI_C;
+        } else {
+            const double r = (double)CONFIG_CHARGER_NTC_SERIES_OHMS * pin_mv /
+                             (CONFIG_CHARGER_NTC_SUPPLY_MV - pin_mv);
+            const double lr = log(r);
+            const double kelvin = 1.0 / (a + b * lr + c * lr * lr * lr);
+            deci_c = (int)lround((kelvin - 273.15) * 10.0);
+        }
+        if (deci_c < THERMAL_MIN_DECI_C) {
+            deci_c = THERMAL_MIN_DECI_C;
+        } else if (deci_c > THERMAL_MAX_DECI_C) {
+            deci_c = THERMAL_MAX_DECI_C;
+        }
+        s_lut[i] = (int16_t)deci_c;
+    }
+}
+
+static bool is_open(int pin_mv)
+{
+    return pin_mv >= CONFIG_CHARGER_NTC_SUPPLY_MV - THERMAL_OPEN_MARGIN_MV;
+}
+
+/* Table lookup with linear interpolation between nodes */
+static int lookup_deci_c(int pin_mv)
+{
+    if (pin_mv < 0) {
+        pin_mv = 0;
+    }
+    int idx = pin_mv >> THERMAL_LUT_SHIFT;
+    if (idx > THERMAL_LUT_SIZE - 2) {
+        idx = THERMAL_LUT_SIZE - 2;
+    }
+    const int frac = pin_mv - (idx << THERMAL_LUT_SHIFT);
+    return s_lut[idx] + (((s_lut[idx + 1] - s_lut[idx]) * frac) >> THERMAL_LUT_SHIFT);
+}
+
+static void set_cutoff(bool cut)
+{
+#if CONFIG_CHARGER_NTC_CUTOFF_GPIO >= 0
+    gpio_set_level(CONFIG_CHARGER_NTC_CUTOFF_GPIO, cut ? THERMAL_CUT_LEVEL : !THERMAL_CUT_LEVEL);
+#endif
+}
+
+/* Millivolts at the pin, -1 if no read succeeded */
+static int read_pin_mv(void)
+{
+    int sum = 0;
+    int count = 0;
+    for (int i = 0; i < THERMAL_POLL_SAMPLES; i++) {
+        for (int attempt = 0; attempt < THERMAL_READ_RETRIES; attempt++) {
+            int raw;
+            if (adc_oneshot_read(s_adc, THERMAL_ADC_CHANNEL, &raw) == ESP_OK) {
+                sum += raw;
+                count++;
+                break;
+            }
+        }
+    }
+    if (count == 0) {
+        return -1;
+    }
+    const int raw_avg = sum / count;
+
+    int pin_mv;
+    if (s_cali == NULL || adc_cali_raw_to_voltage(s_cali, raw_avg, &pin_mv) != ESP_OK) {
+        pin_mv = (raw_avg * 3100) / 4095;
+    }
+    return pin_mv;
+}
+
+static void watchdog_task(void *arg)
+{
+    int over_count = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        const int pin_mv = read_pin_mv();
+        if (pin_mv < 0) {
+            /* Nothing measured: keep the last reading and the trip count
+             * as they are rather than judge a made-up value */
+            portENTER_CRITICAL(&s_lock);
+            s_status.read_errors++;
+            portEXIT_CRITICAL(&s_lock);
+            vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_CHARGER_NTC_WATCHDOG_MS));
+            continue;
+        }
+        const bool fault = is_open(pin_mv);
+        const int deci_c = lookup_deci_c(pin_mv);
+
+        /* A few consecutive readings over the limit, so one ADC glitch
+         * doesn't cut charging; an open NTC can't be judged either way */
+        bool trip = false;
+        bool release = false;
+        if (!fault && deci_c >= THERMAL_CUTOFF_DECI_C) {
+            over_count++;
+        } else {
+            over_count = 0;
+        }
+
+        portENTER_CRITICAL(&s_lock);
+        s_status.fault = fault;
+        s_status.cell_temp = fault ? NAN : deci_c / 10.0f;
+        if (!fault && !(s_status.max_cell_temp >= s_status.cell_temp)) {
+            s_status.max_cell_temp = s_status.cell_temp;
+        }
+        if (!s_status.over_temp && over_count >= CONFIG_CHARGER_NTC_TRIP_COUNT) {
+            s_status.over_temp = true;
+            s_status.trips++;
+            s_status.last_trip_ms = esp_timer_get_time() / 1000;
+            trip = true;
+        } else if (s_status.over_temp && !fault && deci_c <= THERMAL_RELEASE_DECI_C) {
+            s_status.over_temp = false;
+            release = true;
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        if (trip) {
+            set_cutoff(true);
+            ESP_LOGE(TAG, "Cell over temperature: %.1f°C (limit %.1f°C)",
+                     deci_c / 10.0f, THERMAL_CUTOFF_DECI_C / 10.0f);
+        } else if (release) {
+            set_cutoff(false);
+            ESP_LOGW(TAG, "Cell cooled to %.1f°C, over-temperature cleared", deci_c / 10.0f);
+        }
+
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_CHARGER_NTC_WATCHDOG_MS));
+    }
+}
+
+esp_err_t thermal_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali)
+{
+    s_adc = adc;
+    s_cali = cali;
+
+    const adc_oneshot_chan_cfg_t chan_config = {
+        .atten = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    esp_err_t err = adc_oneshot_config_channel(adc, THERMAL_ADC_CHANNEL, &chan_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "NTC channel config failed");
+        return err;
+    }
+
+    build_lut();
+
+#if CONFIG_CHARGER_NTC_CUTOFF_GPIO >= 0
+    const gpio_config_t io_config = {
+        .pin_bit_mask = 1ULL << CONFIG_CHARGER_NTC_CUTOFF_GPIO,
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    err = gpio_config(&io_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cut-off GPIO config failed");
+        return err;
+    }
+    set_cutoff(false);
+#endif
+
+    if (RTOS_TASK_CREATE(watchdog_task, "thermal", THERMAL_TASK_STACK, NULL,
+                         THERMAL_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "NTC on ADC1 channel %d, limit %.1f°C, polled every %d ms",
+             CONFIG_CHARGER_NTC_ADC_CHANNEL, THERMAL_CUTOFF_DECI_C / 10.0f,
+             CONFIG_CHARGER_NTC_WATCHDOG_MS);
+    return ESP_OK;
+}
+
+float thermal_pin_mv_to_celsius(int pin_mv)
+{
+    if (is_open(pin_mv)) {
+        return NAN;
+    }
+    return lookup_deci_c(pin_mv) / 10.0f;
+}
+
+bool thermal_is_over_temp(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    const bool over = s_status.over_temp;
+    portEXIT_CRITICAL(&s_lock);
+    return over;
+}
+
+void thermal_get_status(thermal_status_t *status)
+{
+    portENTER_CRITICAL(&s_lock);
+    *status = s_status;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+#else /* !CONFIG_CHARGER_NTC_ENABLE */
+
+esp_err_t thermal_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali)
+{
+    ESP_LOGI(TAG, "No NTC configured, cell temperature not monitored");
+    return ESP_OK;
+}
+
+float thermal_pin_mv_to_celsius(int pin_mv)
+{
+    return NAN;
+}
+
+bool thermal_is_over_temp(void)
+{
+    return false;
+}
+
+void thermal_get_status(thermal_status_t *status)
+{
+    *status = (thermal_status_t){
+        .cell_temp = NAN,
+        .max_cell_temp = NAN,
+        .cutoff_temp = NAN,
+        .last_trip_ms = -1,
+    };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+#include "sdkconfig.h"
+
+/* Cell temperature from an NTC thermistor
+ *
+ * The NTC sits between the ADC pin and ground with a fixed resistor to the
+ * divider supply. Pin voltage is turned into temperature with a table built
+ * at init from the Steinhart-Hart fit of three datasheet points. A
+ * high-priority watchdog task polls the NTC every few ms, independent of the
+ * sampling loop, and trips over-temperature (optionally driving a cut-off
+ * GPIO) within a few polls.
+ */
+
+#if CONFIG_CHARGER_NTC_ENABLE
+#define THERMAL_ADC_CHANNEL  ((adc_channel_t)CONFIG_CHARGER_NTC_ADC_CHANNEL)
+#endif
+
+typedef struct {
+    bool enabled;             /* CONFIG_CHARGER_NTC_ENABLE */
+    bool fault;               /* NTC open circuit: temperature unknown */
+    bool over_temp;           /* Tripped, not yet cooled below the release point */
+    float cell_temp;          /* °C, last watchdog reading (NAN on fault) */
+    float max_cell_temp;      /* °C, highest reading since boot */
+    float cutoff_temp;        /* °C, trip point */
+    uint32_t trips;           /* Over-temperature events since boot */
+    int64_t last_trip_ms;     /* Uptime of the last trip, -1 if none */
+    uint32_t read_errors;     /* Polls skipped because no ADC read succeeded */
+} thermal_status_t;
+
+/**
+ * Configure the NTC channel, build the lookup table and start the watchdog
+ * Does nothing when CONFIG_CHARGER_NTC_ENABLE is off.
+ * @param adc ADC1 unit already created by sensor_init
+ * @param cali Calibration scheme of that unit, or NULL
+ * @return ESP_OK on success
+ */
+esp_err_t thermal_init(adc_oneshot_unit_handle_t adc, adc_cali_handle_t cali);
+
+/**
+ * Convert an NTC pin voltage to temperature
+ * @param pin_mv ADC pin voltage (mV)
+ * @return °C, or NAN if the NTC is open or not enabled
+ */
+float thermal_pin_mv_to_celsius(int pin_mv);
+
+/**
+ * Check the watchdog's over-temperature flag
+ * @return true from the trip until the cell cools below the release point
+ */
+bool thermal_is_over_temp(void);
+
+/**
+ * Get the watchdog state
+ * @param status Pointer to store the state
+ */
+void thermal_get_status(thermal_status_t *status);
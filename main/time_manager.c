@@ -2,6 +2,10 @@
 #include "config.h"
 #include "esp_log.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "static_alloc.h"
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
@@ -9,7 +13,41 @@
 static const char *TAG = "time_mgr";
 
 #define SNTP_SERVER "pool.ntp.org"
-#define SNTP_TIMEOUT_MS 15000
+
+#define TIME_SYNCED_BIT BIT0
+
+/* Anything earlier than 2020-01-01 is a boot-relative timestamp */
+#define TIME_VALID_NS   (1577836800LL * 1000000000LL)
+
+/* Shortest sync interval used for a drift estimate; SNTP jitter (a few
+ * ms) over 10 minutes is still only a few ppm */
+#define DRIFT_MIN_INTERVAL_US   (600LL * 1000000LL)
+
+/* Beyond this the measurement is wrong (server step), not the crystal */
+#define DRIFT_MAX_PPB           200000
+
+/* Weight of a new drift measurement */
+#define DRIFT_EMA_WEIGHT        4   /* 1/4 */
+
+/* A resync error is slewed out at this rate rather than stepped, so
+ * timestamps never go backwards; 250 ms samples move by at most 1.25 ms */
+#define SLEW_PPM                5000
+
+/* Larger errors (a server step) are stepped; a step back is held flat */
+#define SLEW_MAX_NS             1000000000LL
+
+static EventGroupHandle_t s_time_event_group;
+
+/* UTC = anchor_utc + (mono - anchor_mono) * (1 + drift) + slew so far */
+static portMUX_TYPE s_clock_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_anchor_mono_us = 0;
+static int64_t s_anchor_utc_ns = 0;
+static int64_t s_slew_ns = 0;       /* Resync error still being applied */
+static int64_t s_slew_us = 0;       /* Applied linearly over this long */
+static int64_t s_last_ns = 0;       /* Last timestamp handed out */
+static int32_t s_drift_ppb = 0;
+static bool s_drift_valid = false;
+static time_clock_stats_t s_stats;
 
 /* Convert timezone name to POSIX TZ string */
 static const char* get_posix_tz(const char *tz_name)
@@ -32,62 +70,165 @@ static const char* get_posix_tz(const char *tz_name)
     return tz_name;
 }
 
-/* SNTP sync callback */
+/* Extrapolate UTC from the last anchor; called with the lock held */
+static int64_t anchored_utc_ns(int64_t mono_us)
+{
+    const int64_t elapsed_us = mono_us - s_anchor_mono_us;
+    int64_t utc_ns = s_anchor_utc_ns + elapsed_us * 1000LL + elapsed_us * s_drift_ppb / 1000000LL;
+    if (elapsed_us >= s_slew_us) {
+        utc_ns += s_slew_ns;
+    } else if (elapsed_us > 0) {
+        utc_ns += s_slew_ns * elapsed_us / s_slew_us;
+    }
+    return utc_ns;
+}
+
+/* SNTP sync callback (runs in the lwIP task) */
 static void time_sync_notification_cb(struct timeval *tv)
 {
-    ESP_LOGI(TAG, "NTP time synchronized");
+    const int64_t mono_us = esp_timer_get_time();
+    const int64_t utc_ns = (int64_t)tv->tv_sec * 1000000000LL + (int64_t)tv->tv_usec * 1000LL;
+    const bool first = !time_manager_is_synced();
+
+    portENTER_CRITICAL(&s_clock_lock);
+    int64_t anchor_utc_ns = utc_ns;
+    int64_t slew_ns = 0;
+    if (!first) {
+        /* How far our extrapolation was off, and what rate would have been
+         * right; the last sync's time is the anchor plus its whole slew */
+        const int64_t extrapolated_ns = anchored_utc_ns(mono_us);
+        const int64_t error_ns = utc_ns - extrapolated_ns;
+        const int64_t interval_us = mono_us - s_anchor_mono_us;
+        s_stats.last_error_us = (int32_t)(error_ns / 1000);
+
+        if (interval_us >= DRIFT_MIN_INTERVAL_US) {
+            const double measured_ppb = (double)(utc_ns - s_anchor_utc_ns - s_slew_ns - interval_us * 1000LL) *
+                                        1e6 / (double)interval_us;
+            if (measured_ppb > -DRIFT_MAX_PPB && measured_ppb < DRIFT_MAX_PPB) {
+                s_drift_ppb = s_drift_valid
+                    ? (int32_t)(s_drift_ppb + (measured_ppb - s_drift_ppb) / DRIFT_EMA_WEIGHT)
+                    : (int32_t)measured_ppb;
+                s_drift_valid = true;
+            } else {
+                s_stats.rejected++;
+            }
+        }
+
+        /* Carry on from where the extrapolation is and slew into the new time */
+        if (error_ns > -SLEW_MAX_NS && error_ns < SLEW_MAX_NS) {
+            anchor_utc_ns = extrapolated_ns;
+            slew_ns = error_ns;
+        }
+    }
+    s_anchor_mono_us = mono_us;
+    s_anchor_utc_ns = anchor_utc_ns;
+    s_slew_ns = slew_ns;
+    s_slew_us = (slew_ns < 0 ? -slew_ns : slew_ns) * 1000LL / SLEW_PPM;
+    s_stats.syncs++;
+    s_stats.drift_ppb = s_drift_ppb;
+    portEXIT_CRITICAL(&s_clock_lock);
+
+    if (first) {
+        /* Log synchronized time */
+        time_t now = tv->tv_sec;
+        char strftime_buf[64];
+        struct tm timeinfo;
+
+        localtime_r(&now, &timeinfo);
+        strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
+        ESP_LOGI(TAG, "NTP time synchronized, local time: %s", strftime_buf);
+        xEventGroupSetBits(s_time_event_group, TIME_SYNCED_BIT);
+    } else {
+        ESP_LOGI(TAG, "NTP resync: off by %ld us, drift %.2f ppm",
+                 (long)s_stats.last_error_us, s_drift_ppb / 1000.0f);
+    }
 }
 
 esp_err_t time_manager_init(void)
 {
     ESP_LOGI(TAG, "Initializing SNTP");
-    
-    /* Initialize SNTP */
-    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, SNTP_SERVER);
-    esp_sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-    esp_sntp_init();
-    
-    /* Wait for time to be set */
-    int retry = 0;
-    const int max_retry = SNTP_TIMEOUT_MS / 500;  /* Check every 500ms */
-    
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < max_retry) {
-        ESP_LOGI(TAG, "Waiting for NTP sync... (%d/%d)", retry, max_retry);
-        vTaskDelay(pdMS_TO_TICKS(500));  /* Wait 500ms between checks */
-    }
-    
-    if (retry >= max_retry) {
-        ESP_LOGW(TAG, "NTP sync timeout, using system time");
-        return ESP_ERR_TIMEOUT;
+
+    s_time_event_group = RTOS_EVENT_GROUP_CREATE();
+    if (s_time_event_group == NULL) {
+        return ESP_ERR_NO_MEM;
     }
-    
+
     /* Set timezone - convert to POSIX format if needed */
     const char *posix_tz = get_posix_tz(g_config.timezone);
     setenv("TZ", posix_tz, 1);
     tzset();
     ESP_LOGI(TAG, "Timezone set to: %s (POSIX: %s)", g_config.timezone, posix_tz);
-    
-    /* Log synchronized time */
-    time_t now;
-    char strftime_buf[64];
-    struct tm timeinfo;
-    
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
-    ESP_LOGI(TAG, "Current local time: %s", strftime_buf);
-    
+
+    /* Initialize SNTP; sync completes in the background */
+    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, SNTP_SERVER);
+    esp_sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+    esp_sntp_init();
+
     return ESP_OK;
 }
 
+bool time_manager_is_synced(void)
+{
+    return s_time_event_group != NULL &&
+           (xEventGroupGetBits(s_time_event_group) & TIME_SYNCED_BIT) != 0;
+}
+
+bool time_manager_wait_synced(uint32_t timeout_ms)
+{
+    if (s_time_event_group == NULL) {
+        return false;
+    }
+    const EventBits_t bits = xEventGroupWaitBits(s_time_event_group, TIME_SYNCED_BIT,
+                                                 pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & TIME_SYNCED_BIT) != 0;
+}
+
 int64_t time_manager_get_timestamp_ns(void)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    
-    /* Convert to nanoseconds */
-    const int64_t timestamp_ns = (int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_usec * 1000LL;
-    
+    const int64_t mono_us = esp_timer_get_time();
+
+    /* Until SNTP has synced, hand out monotonic time since boot */
+    if (!time_manager_is_synced()) {
+        return mono_us * 1000LL;
+    }
+
+    portENTER_CRITICAL(&s_clock_lock);
+    int64_t timestamp_ns = anchored_utc_ns(mono_us);
+    if (timestamp_ns < s_last_ns) {
+        timestamp_ns = s_last_ns;
+    }
+    s_last_ns = timestamp_ns;
+    portEXIT_CRITICAL(&s_clock_lock);
+
     return timestamp_ns;
 }
+
+bool time_manager_is_utc(int64_t timestamp_ns)
+{
+    return timestamp_ns >= TIME_VALID_NS;
+}
+
+int64_t time_manager_to_utc_ns(int64_t timestamp_ns)
+{
+    if (time_manager_is_utc(timestamp_ns) || !time_manager_is_synced()) {
+        return timestamp_ns;
+    }
+
+    /* Boot-relative ns are esp_timer time; map them through the anchor */
+    portENTER_CRITICAL(&s_clock_lock);
+    const int64_t utc_ns = anchored_utc_ns(timestamp_ns / 1000LL);
+    portEXIT_CRITICAL(&s_clock_lock);
+
+    return utc_ns;
+}
+
+void time_manager_get_stats(time_clock_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_clock_lock);
+    *stats = s_stats;
+    stats->synced = time_manager_is_synced();
+    stats->since_sync_sec = stats->synced
+        ? (uint32_t)((esp_timer_get_time() - s_anchor_mono_us) / 1000000LL) : 0;
+    portEXIT_CRITICAL(&s_clock_lock);
+}
@@ -2,15 +2,66 @@
 
 #include "esp_err.h"
 #include <stdint.h>
+#include <stdbool.h>
+
+/* Clock discipline state */
+typedef struct {
+    bool synced;              /* At least one SNTP sync */
+    uint32_t syncs;           /* SNTP syncs since boot */
+    uint32_t since_sync_sec;  /* Time since the last sync */
+    int32_t drift_ppb;        /* Estimated esp_timer rate error (ppb, + = slow) */
+    int32_t last_error_us;    /* Extrapolation error found at the last resync */
+    uint32_t rejected;        /* Drift measurements discarded as implausible */
+} time_clock_stats_t;
 
 /**
- * Initialize SNTP and synchronize time
+ * Set the timezone and start SNTP
+ * Returns right away; synchronization completes in the background.
  * @return ESP_OK on success
  */
 esp_err_t time_manager_init(void);
 
+/**
+ * Check whether SNTP has synchronized the clock
+ * @return true once the first sync has completed
+ */
+bool time_manager_is_synced(void);
+
+/**
+ * Wait for the first SNTP sync
+ * @param timeout_ms Maximum time to wait
+ * @return true if the clock is synchronized
+ */
+bool time_manager_wait_synced(uint32_t timeout_ms);
+
 /**
  * Get current timestamp in nanoseconds
- * @return timestamp in nanoseconds (UTC)
+ * esp_timer time anchored to UTC at the last SNTP sync and corrected for
+ * the estimated crystal drift; cheap, and unaffected by settimeofday().
+ * Never decreases: resync errors are slewed out, and a large step back
+ * holds the value until time catches up.
+ * Before the first sync this is monotonic time since boot; pass such
+ * timestamps through time_manager_to_utc_ns() before using them.
+ * @return timestamp in nanoseconds (UTC once synced)
  */
 int64_t time_manager_get_timestamp_ns(void);
+
+/**
+ * Check whether a timestamp is UTC or boot-relative
+ * @param timestamp_ns Timestamp from time_manager_get_timestamp_ns()
+ * @return true if the timestamp was taken after the first sync
+ */
+bool time_manager_is_utc(int64_t timestamp_ns);
+
+/**
+ * Convert a timestamp taken before the first sync to UTC
+ * @param timestamp_ns Timestamp from time_manager_get_timestamp_ns()
+ * @return UTC timestamp, or timestamp_ns unchanged if already UTC or not yet synced
+ */
+int64_t time_manager_to_utc_ns(int64_t timestamp_ns);
+
+/**
+ * Get clock discipline statistics
+ * @param stats Pointer to store statistics
+ */
+void time_manager_get_stats(time_clock_stats_t *stats);
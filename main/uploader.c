@@ -0,0 +1,214 @@
+#include "uploader.h"
+#include "influxdb.h"
+#include "remote_write.h"
+#include "sink.h"
+#include "config.h"
+#include "time_manager.h"
+#include "binlog.h"
+#include "supervisor.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "static_alloc.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "uploader";
+
+#define UPLOADER_TASK_STACK  6144
+#define UPLOADER_TASK_PRIO   4
+#define SESSION_QUEUE_LEN    4
+#define ALERT_QUEUE_LEN      8
+
+/* Longest encoding a batch may take before the supervisor reboots */
+#define UPLOAD_STALL_MS      (CONFIG_CHARGER_HEALTH_UPLOAD_STALL_SEC * 1000)
+
+static QueueHandle_t s_queue = NULL;
+static QueueHandle_t s_session_queue = NULL;
+static QueueHandle_t s_alert_queue = NULL;
+static TaskHandle_t s_task = NULL;
+static volatile uint32_t s_interval_sec = CONFIG_CHARGER_UPLOAD_NORMAL_SEC;
+static uint32_t s_dropped = 0;
+
+/* Points taken off the queue but not yet handed to the sinks */
+static sensor_data_t s_batch[INFLUXDB_BATCH_MAX_POINTS];
+static size_t s_pending = 0;
+
+/* One encoded payload at a time; sink_submit() copies it */
+static char s_payload[SINK_PAYLOAD_MAX];
+
+/* Alerts and sessions go to the line protocol sinks only */
+static void submit_alerts(void)
+{
+    anomaly_event_t event;
+    while (xQueueReceive(s_alert_queue, &event, 0) == pdTRUE) {
+        if (!event.time_synced) {
+            event.timestamp_ns = time_manager_to_utc_ns(event.timestamp_ns);
+        }
+        const int len = influxdb_format_alert(&event, s_payload, sizeof(s_payload));
+        if (len < 0 || (size_t)len >= sizeof(s_payload)) {
+            ESP_LOGE(TAG, "Failed to format %s alert for %s", anomaly_type_str(event.type), event.cell_id);
+            continue;
+        }
+        sink_submit(SINK_FORMAT_LINE, s_payload, len);
+    }
+}
+
+static void submit_sessions(void)
+{
+    session_summary_t summary;
+    while (xQueueReceive(s_session_queue, &summary, 0) == pdTRUE) {
+        summary.start_ns = time_manager_to_utc_ns(summary.start_ns);
+        summary.end_ns = time_manager_to_utc_ns(summary.end_ns);
+        const int len = influxdb_format_session(&summary, s_payload, sizeof(s_payload));
+        if (len < 0 || (size_t)len >= sizeof(s_payload)) {
+            ESP_LOGE(TAG, "Failed to format session summary for %s", summary.cell_id);
+            continue;
+        }
+        sink_submit(SINK_FORMAT_LINE, s_payload, len);
+    }
+}
+
+/* Encode the pending batch once per wire format */
+static void submit_batch(void)
+{
+    const int len = influxdb_format_batch(s_batch, s_pending, s_payload, sizeof(s_payload));
+    if (len < 0) {
+        ESP_LOGE(TAG, "Batch buffer too small");
+    } else {
+        BINLOG(INFLUX_BATCH, (uint32_t)s_pending, (uint32_t)len);
+        sink_submit(SINK_FORMAT_LINE, s_payload, len);
+    }
+
+    if (sink_wants(SINK_FORMAT_REMOTE_WRITE)) {
+        const size_t rw_len = remote_write_encode(s_batch, s_pending, g_config.device_id,
+                                                  (uint8_t *)s_payload, sizeof(s_payload));
+        if (rw_len == 0) {
+            ESP_LOGE(TAG, "Remote-write request too large for %u points", (unsigned)s_pending);
+        } else {
+            sink_submit(SINK_FORMAT_REMOTE_WRITE, s_payload, rw_len);
+        }
+    }
+}
+
+static void uploader_task(void *arg)
+{
+    while (1) {
+        /* Wait for the interval to elapse or for an explicit flush */
+        supervisor_heartbeat(SUPERVISOR_UPLOADER, s_interval_sec * 1000 + UPLOAD_STALL_MS);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(s_interval_sec * 1000));
+
+        /* Hold everything until points can be sent with UTC timestamps;
+         * each sink waits for its own network */
+        if (!time_manager_is_synced()) {
+            continue;
+        }
+
+        submit_alerts();
+        submit_sessions();
+
+        do {
+            while (s_pending < INFLUXDB_BATCH_MAX_POINTS &&
+                   xQueueReceive(s_queue, &s_batch[s_pending], 0) == pdTRUE) {
+                s_pending++;
+            }
+            if (s_pending == 0) {
+                break;
+            }
+            /* Points sampled before the first SNTP sync carry boot-relative time */
+            for (size_t i = 0; i < s_pending; i++) {
+                if (!s_batch[i].time_synced) {
+                    s_batch[i].timestamp_ns = time_manager_to_utc_ns(s_batch[i].timestamp_ns);
+                    s_batch[i].time_synced = true;
+                }
+            }
+            supervisor_heartbeat(SUPERVISOR_UPLOADER, UPLOAD_STALL_MS);
+            submit_batch();
+            s_pending = 0;
+        } while (uxQueueMessagesWaiting(s_queue) > 0);
+    }
+}
+
+esp_err_t uploader_start(void)
+{
+    s_queue = RTOS_QUEUE_CREATE(CONFIG_CHARGER_UPLOAD_QUEUE_LEN, sizeof(sensor_data_t));
+    s_session_queue = RTOS_QUEUE_CREATE(SESSION_QUEUE_LEN, sizeof(session_summary_t));
+    s_alert_queue = RTOS_QUEUE_CREATE(ALERT_QUEUE_LEN, sizeof(anomaly_event_t));
+    if (s_queue == NULL || s_session_queue == NULL || s_alert_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create upload queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (RTOS_TASK_CREATE(uploader_task, "uploader", UPLOADER_TASK_STACK, NULL,
+                         UPLOADER_TASK_PRIO, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create uploader task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Uploader started (queue %d points)", CONFIG_CHARGER_UPLOAD_QUEUE_LEN);
+    return ESP_OK;
+}
+
+esp_err_t uploader_enqueue(const sensor_data_t *data)
+{
+    if (s_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (xQueueSend(s_queue, data, 0) == pdTRUE) {
+        return ESP_OK;
+    }
+
+    /* Queue full (clock never synced): drop the oldest point */
+    sensor_data_t oldest;
+    xQueueReceive(s_queue, &oldest, 0);
+    xQueueSend(s_queue, data, 0);
+    s_dropped++;
+    ESP_LOGW(TAG, "Upload queue full, dropped oldest point (%lu total)", s_dropped);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t uploader_enqueue_session(const session_summary_t *summary)
+{
+    if (s_session_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xQueueSend(s_session_queue, summary, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Session queue full, summary for %s not uploaded", summary->cell_id);
+        return ESP_ERR_NO_MEM;
+    }
+    uploader_flush_now();
+    return ESP_OK;
+}
+
+esp_err_t uploader_enqueue_alert(const anomaly_event_t *event)
+{
+    if (s_alert_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xQueueSend(s_alert_queue, event, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Alert queue full, %s alert for %s not uploaded",
+                 anomaly_type_str(event->type), event->cell_id);
+        return ESP_ERR_NO_MEM;
+    }
+    uploader_flush_now();
+    return ESP_OK;
+}
+
+void uploader_set_interval(uint32_t interval_sec)
+{
+    const uint32_t previous = s_interval_sec;
+    s_interval_sec = interval_sec > 0 ? interval_sec : 1;
+
+    /* Don't sit out a long slow-mode wait after switching to a faster rate */
+    if (s_interval_sec < previous) {
+        uploader_flush_now();
+    }
+}
+
+void uploader_flush_now(void)
+{
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
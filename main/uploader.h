@@ -0,0 +1,49 @@
+#pragma once
+
+#include "esp_err.h"
+#include "sensor.h"
+#include "session.h"
+#include "anomaly.h"
+
+/**
+ * Start the uploader task
+ * Points are queued by the sampler and handed to the upload sinks in
+ * batches. Nothing is submitted until SNTP has synced; timestamps taken
+ * before the sync are converted to UTC when their batch is encoded.
+ * Call after sink_start().
+ * @return ESP_OK on success
+ */
+esp_err_t uploader_start(void);
+
+/**
+ * Queue a point for upload (drops the oldest point if the queue is full)
+ * @param data Point to upload
+ * @return ESP_OK if queued without dropping anything
+ */
+esp_err_t uploader_enqueue(const sensor_data_t *data);
+
+/**
+ * Queue a session summary for upload; it is sent right away
+ * @param summary Summary of a closed session
+ * @return ESP_OK if queued
+ */
+esp_err_t uploader_enqueue_session(const session_summary_t *summary);
+
+/**
+ * Queue an anomaly alert for upload; it is sent right away, ahead of
+ * session summaries and points
+ * @param event Alert raised by anomaly_push
+ * @return ESP_OK if queued
+ */
+esp_err_t uploader_enqueue_alert(const anomaly_event_t *event);
+
+/**
+ * Set the interval between uploads
+ * @param interval_sec Seconds between batches
+ */
+void uploader_set_interval(uint32_t interval_sec);
+
+/**
+ * Send queued points now instead of waiting for the next interval
+ */
+void uploader_flush_now(void);
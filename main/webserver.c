@@ -1,16 +1,95 @@
 #include "webserver.h"
 #include "sensor.h"
 #include "config.h"
+#include "scheduler.h"
+#include "compressor.h"
+#include "series_store.h"
+#include "session.h"
+#include "time_manager.h"
+#include "boot_trace.h"
+#include "wifi_manager.h"
+#include "cbor_writer.h"
+#include "api_schema.h"
+#include "ota.h"
+#include "params.h"
+#include "calibration.h"
+#include "thermal.h"
+#include "anomaly.h"
+#include "filter.h"
+#include "ir_capture.h"
+#include "binlog.h"
+#include "heap_monitor.h"
+#include "supervisor.h"
+#include "sink.h"
+#include "esp_ota_ops.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "cJSON.h"
+#include "sdkconfig.h"
 
 static const char *TAG = "webserver";
 
+/* httpd runs every handler on its one task, one request at a time, so
+ * handlers keep large buffers in static storage and shared counters
+ * need no lock */
 static httpd_handle_t server = NULL;
 
+/* A handler may block httpd this long before the supervisor reboots;
+ * long transfers report progress so they aren't cut off */
+#define WEB_STALL_MS  (CONFIG_CHARGER_HEALTH_WEB_STALL_SEC * 1000)
+
+/* Per-endpoint handler timing, reported by /api/heap */
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+} endpoint_t;
+
+#if CONFIG_CHARGER_STATIC_ALLOC
+/* cJSON allocates every node and key. With static allocation they come
+ * from an arena that is rewound before each request instead; httpd runs
+ * one handler at a time and nothing else uses cJSON (provisioning runs
+ * without the web server, before the hooks are installed). Whatever cJSON
+ * returns, printed strings included, must be released with cJSON_free()
+ * or cJSON_Delete(), never free(). A response that outgrows the arena
+ * spills to the heap and is counted. */
+static uint8_t s_json_arena[CONFIG_CHARGER_JSON_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t s_json_used = 0;
+static size_t s_json_high_water = 0;
+static uint32_t s_json_spills = 0;
+
+static void *json_arena_malloc(size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if (size > sizeof(s_json_arena) - s_json_used) {
+        s_json_spills++;
+        return malloc(size);
+    }
+    void *p = &s_json_arena[s_json_used];
+    s_json_used += size;
+    if (s_json_used > s_json_high_water) {
+        s_json_high_water = s_json_used;
+    }
+    return p;
+}
+
+static void json_arena_free(void *p)
+{
+    const uint8_t *b = p;
+    if (b < s_json_arena || b >= s_json_arena + sizeof(s_json_arena)) {
+        free(p);
+    }
+}
+#endif
+
 /* External function to get sensor data from main */
 extern esp_err_t main_get_sensor_data(sensor_data_t *data);
 
@@ -18,6 +97,64 @@ extern esp_err_t main_get_sensor_data(sensor_data_t *data);
 extern const uint8_t dashboard_html_start[] asm("_binary_dashboard_html_start");
 extern const uint8_t dashboard_html_end[]   asm("_binary_dashboard_html_end");
 
+/* Encoded size budgets for CBOR responses */
+#define CBOR_DATA_MAX            256
+#define CBOR_SESSION_MAX         192
+#define CBOR_SERIES_SESSION_MAX  64
+
+/* True if the client asked for CBOR (see api_schema.h) rather than JSON */
+static bool wants_cbor(httpd_req_t *req)
+{
+    char accept[96];
+    if (httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept)) != ESP_OK) {
+        return false;
+    }
+    return strstr(accept, "application/cbor") != NULL;
+}
+
+static esp_err_t send_cbor(httpd_req_t *req, const cbor_writer_t *w)
+{
+    if (w->overflow) {
+        ESP_LOGE(TAG, "CBOR response for %s exceeds %u bytes", req->uri, (unsigned)w->cap);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response too large");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/cbor");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, (const char *)w->buf, w->len);
+}
+
+static esp_err_t send_data_cbor(httpd_req_t *req, const sensor_data_t *data)
+{
+    uint8_t buf[CBOR_DATA_MAX];
+    cbor_writer_t w;
+    cbor_writer_init(&w, buf, sizeof(buf));
+    
+    cbor_put_map(&w, API_FIELD_COUNT(API_DATA_FIELDS));
+    cbor_put_uint(&w, API_DATA_schema);              cbor_put_uint(&w, API_SCHEMA_VERSION);
+    cbor_put_uint(&w, API_DATA_voltage);             cbor_put_float(&w, data->battery_voltage);
+    cbor_put_uint(&w, API_DATA_percentage);          cbor_put_float(&w, data->battery_percentage);
+    cbor_put_uint(&w, API_DATA_temperature);         cbor_put_float(&w, data->internal_temp);
+    cbor_put_uint(&w, API_DATA_charge_state);        cbor_put_uint(&w, data->charge_state);
+    cbor_put_uint(&w, API_DATA_cell_id);             cbor_put_text(&w, data->cell_id);
+    cbor_put_uint(&w, API_DATA_charging_time_sec);   cbor_put_uint(&w, data->charging_time_sec);
+    cbor_put_uint(&w, API_DATA_cell_present);        cbor_put_bool(&w, data->cell_present);
+    cbor_put_uint(&w, API_DATA_timestamp_ms);
+    cbor_put_int(&w, time_manager_to_utc_ns(data->timestamp_ns) / 1000000LL);
+    cbor_put_uint(&w, API_DATA_time_synced);         cbor_put_bool(&w, time_manager_is_synced());
+    cbor_put_uint(&w, API_DATA_sample_interval_ms);  cbor_put_uint(&w, data->sample_interval_ms);
+    cbor_put_uint(&w, API_DATA_upload_interval_sec); cbor_put_uint(&w, data->upload_interval_sec);
+    cbor_put_uint(&w, API_DATA_sched_mode);          cbor_put_uint(&w, data->sched_mode);
+    cbor_put_uint(&w, API_DATA_sched_reason);        cbor_put_uint(&w, data->sched_reason);
+    cbor_put_uint(&w, API_DATA_device_id);           cbor_put_text(&w, g_config.device_id);
+    cbor_put_uint(&w, API_DATA_cell_temp);           cbor_put_float(&w, data->cell_temp);
+    cbor_put_uint(&w, API_DATA_over_temp);           cbor_put_bool(&w, data->over_temp);
+    cbor_put_uint(&w, API_DATA_ir_mohm);             cbor_put_float(&w, data->ir_mohm);
+    
+    return send_cbor(req, &w);
+}
+
 /* Dashboard page handler */
 static esp_err_t dashboard_get_handler(httpd_req_t *req)
 {
@@ -37,17 +174,28 @@ static esp_err_t api_data_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
     
+    /* Just the sample; diagnostics are at /api/diag */
+    if (wants_cbor(req)) {
+        return send_data_cbor(req, &data);
+    }
+    
     /* Build JSON response */
     cJSON *root = cJSON_CreateObject();
     cJSON_AddNumberToObject(root, "voltage", data.battery_voltage);
     cJSON_AddNumberToObject(root, "percentage", data.battery_percentage);
     cJSON_AddNumberToObject(root, "temperature", data.internal_temp);
+    cJSON_AddNumberToObject(root, "cell_temp", data.cell_temp);
+    cJSON_AddBoolToObject(root, "over_temp", data.over_temp);
+    cJSON_AddNumberToObject(root, "ir_mohm", data.ir_mohm);
     cJSON_AddStringToObject(root, "charge_state", sensor_charge_state_str(data.charge_state));
     cJSON_AddNumberToObject(root, "charge_state_code", (int)data.charge_state);
     cJSON_AddStringToObject(root, "cell_id", data.cell_id[0] ? data.cell_id : "");
     cJSON_AddNumberToObject(root, "charging_time_sec", data.charging_time_sec);
     cJSON_AddBoolToObject(root, "cell_present", data.cell_present);
     cJSON_AddStringToObject(root, "device_id", g_config.device_id);
+    cJSON_AddNumberToObject(root, "sample_interval_ms", data.sample_interval_ms);
+    cJSON_AddNumberToObject(root, "upload_interval_sec", data.upload_interval_sec);
+    cJSON_AddStringToObject(root, "sched_mode", scheduler_mode_str(data.sched_mode));
     
     /* Format charging time as string */
     char time_str[32];
@@ -57,6 +205,305 @@ static esp_err_t api_data_handler(httpd_req_t *req)
     snprintf(time_str, sizeof(time_str), "%02lu:%02lu:%02lu", hours, minutes, seconds);
     cJSON_AddStringToObject(root, "charging_time_str", time_str);
     
+    cJSON_AddBoolToObject(root, "time_synced", time_manager_is_synced());
+    /* Sample time as UTC ms, for pollers such as tools/aggregator */
+    cJSON_AddNumberToObject(root, "timestamp_ms",
+                            (double)(time_manager_to_utc_ns(data.timestamp_ns) / 1000000LL));
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* API endpoint with the diagnostics of every subsystem that handles a
+ * sample: upload compression, bring-up, thermal watchdog, anomaly counts,
+ * filter cost, clock, WiFi and upload sinks */
+static esp_err_t api_diag_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    
+    /* Upload compression statistics */
+    compressor_stats_t comp;
+    compressor_get_stats(&comp);
+    cJSON *comp_json = cJSON_AddObjectToObject(root, "compression");
+    cJSON_AddNumberToObject(comp_json, "points_in", comp.points_in);
+    cJSON_AddNumberToObject(comp_json, "points_out", comp.points_out);
+    cJSON_AddNumberToObject(comp_json, "ratio",
+                            comp.points_out ? (double)comp.points_in / comp.points_out : 0);
+    cJSON_AddNumberToObject(comp_json, "max_voltage_err", comp.max_voltage_err);
+    cJSON_AddNumberToObject(comp_json, "max_temp_err", comp.max_temp_err);
+    
+    /* Bring-up milestones (ms since boot, -1 = not reached) */
+    cJSON *boot_json = cJSON_AddObjectToObject(root, "boot");
+    for (int i = 0; i < BOOT_EVENT_COUNT; i++) {
+        cJSON_AddNumberToObject(boot_json, boot_trace_event_str(i), boot_trace_get_ms(i));
+    }
+    /* Thermal watchdog, newer than the last sample */
+    thermal_status_t thermal;
+    thermal_get_status(&thermal);
+    cJSON *thermal_json = cJSON_AddObjectToObject(root, "thermal");
+    cJSON_AddBoolToObject(thermal_json, "enabled", thermal.enabled);
+    cJSON_AddBoolToObject(thermal_json, "over_temp", thermal.over_temp);
+    cJSON_AddBoolToObject(thermal_json, "fault", thermal.fault);
+    cJSON_AddNumberToObject(thermal_json, "cell_temp", thermal.cell_temp);
+    cJSON_AddNumberToObject(thermal_json, "max_cell_temp", thermal.max_cell_temp);
+    cJSON_AddNumberToObject(thermal_json, "cutoff_temp", thermal.cutoff_temp);
+    cJSON_AddNumberToObject(thermal_json, "trips", thermal.trips);
+    cJSON_AddNumberToObject(thermal_json, "last_trip_ms", thermal.last_trip_ms);
+    cJSON_AddNumberToObject(thermal_json, "read_errors", thermal.read_errors);
+    
+    /* Alerts raised since boot, per type */
+    uint32_t anomaly_counts[ANOMALY_TYPE_COUNT];
+    anomaly_get_counts(anomaly_counts);
+    cJSON *anomaly_json = cJSON_AddObjectToObject(root, "anomalies");
+    for (int i = 0; i < ANOMALY_TYPE_COUNT; i++) {
+        cJSON_AddNumberToObject(anomaly_json, anomaly_type_str(i), anomaly_counts[i]);
+    }
+    
+    /* Voltage filter pipeline and what each stage costs */
+    filter_stats_t filter;
+    filter_get_stats(&filter);
+    cJSON *filter_json = cJSON_AddObjectToObject(root, "filter");
+    cJSON_AddStringToObject(filter_json, "decimator", filter_stage_str(filter.config.decimator));
+    cJSON *chain_json = cJSON_AddArrayToObject(filter_json, "chain");
+    for (int i = FILTER_STAGE_EMA; i < FILTER_STAGE_COUNT; i++) {
+        if (filter.config.stages & FILTER_STAGE_BIT(i)) {
+            cJSON_AddItemToArray(chain_json, cJSON_CreateString(filter_stage_str(i)));
+        }
+    }
+    cJSON *stages_json = cJSON_AddObjectToObject(filter_json, "stages");
+    for (int i = 0; i < FILTER_STAGE_COUNT; i++) {
+        if (filter.stages[i].calls == 0) {
+            continue;
+        }
+        cJSON *stage_json = cJSON_AddObjectToObject(stages_json, filter_stage_str(i));
+        cJSON_AddNumberToObject(stage_json, "calls", filter.stages[i].calls);
+        cJSON_AddNumberToObject(stage_json, "avg_cycles", filter.stages[i].avg_cycles);
+        cJSON_AddNumberToObject(stage_json, "max_cycles", filter.stages[i].max_cycles);
+    }
+    
+    /* Clock discipline */
+    time_clock_stats_t clock;
+    time_manager_get_stats(&clock);
+    cJSON *clock_json = cJSON_AddObjectToObject(root, "clock");
+    cJSON_AddNumberToObject(clock_json, "syncs", clock.syncs);
+    cJSON_AddNumberToObject(clock_json, "since_sync_sec", clock.since_sync_sec);
+    cJSON_AddNumberToObject(clock_json, "drift_ppm", clock.drift_ppb / 1000.0);
+    cJSON_AddNumberToObject(clock_json, "last_error_us", clock.last_error_us);
+    
+    /* Reconnect latency and outages */
+    wifi_stats_t wifi;
+    wifi_get_stats(&wifi);
+    cJSON *wifi_json = cJSON_AddObjectToObject(root, "wifi");
+    cJSON_AddNumberToObject(wifi_json, "connects", wifi.connects);
+    cJSON_AddNumberToObject(wifi_json, "disconnects", wifi.disconnects);
+    cJSON_AddNumberToObject(wifi_json, "failed_attempts", wifi.failed_attempts);
+    cJSON_AddNumberToObject(wifi_json, "last_connect_ms", wifi.last_connect_ms);
+    cJSON_AddNumberToObject(wifi_json, "last_outage_ms", wifi.last_outage_ms);
+    cJSON_AddNumberToObject(wifi_json, "max_outage_ms", wifi.max_outage_ms);
+    cJSON_AddNumberToObject(wifi_json, "total_outage_ms", wifi.total_outage_ms);
+    cJSON_AddNumberToObject(wifi_json, "current_outage_ms", wifi.current_outage_ms);
+    cJSON_AddBoolToObject(wifi_json, "fast_path", wifi.fast_path);
+    
+    /* Delivery per enabled upload sink */
+    sink_stats_t sinks[SINK_COUNT];
+    sink_get_stats(sinks);
+    cJSON *sinks_json = cJSON_AddObjectToObject(root, "sinks");
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (!sinks[i].enabled) {
+            continue;
+        }
+        cJSON *sink_json = cJSON_AddObjectToObject(sinks_json, sink_name(i));
+        cJSON_AddNumberToObject(sink_json, "queued", sinks[i].queued);
+        cJSON_AddNumberToObject(sink_json, "queued_bytes", sinks[i].queued_bytes);
+        cJSON_AddNumberToObject(sink_json, "delivered", sinks[i].delivered);
+        cJSON_AddNumberToObject(sink_json, "failed", sinks[i].failed);
+        cJSON_AddNumberToObject(sink_json, "rejected", sinks[i].rejected);
+        cJSON_AddNumberToObject(sink_json, "dropped", sinks[i].dropped);
+        cJSON_AddNumberToObject(sink_json, "restarts", sinks[i].restarts);
+        cJSON_AddNumberToObject(sink_json, "last_status", sinks[i].last_status);
+        cJSON_AddNumberToObject(sink_json, "last_ms", sinks[i].last_ms);
+        cJSON_AddNumberToObject(sink_json, "retry_in_ms", sinks[i].retry_in_ms);
+        cJSON_AddNumberToObject(sink_json, "connects", sinks[i].connects);
+        cJSON_AddNumberToObject(sink_json, "last_connect_ms", sinks[i].last_connect_ms);
+        if (sinks[i].tls) {
+            cJSON_AddNumberToObject(sink_json, "tls_heap_bytes", sinks[i].tls_heap_bytes);
+        }
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* API endpoint listing the session curves held in RAM */
+static esp_err_t api_series_handler(httpd_req_t *req)
+{
+    series_session_info_t sessions[CONFIG_CHARGER_SERIES_SESSIONS];
+    const size_t count = series_store_list(sessions, CONFIG_CHARGER_SERIES_SESSIONS);
+    
+    series_store_stats_t stats;
+    series_store_get_stats(&stats);
+    
+    if (wants_cbor(req)) {
+        uint8_t buf[32 + CONFIG_CHARGER_SERIES_SESSIONS * CBOR_SERIES_SESSION_MAX];
+        cbor_writer_t w;
+        cbor_writer_init(&w, buf, sizeof(buf));
+        
+        cbor_put_map(&w, API_FIELD_COUNT(API_SERIES_FIELDS));
+        cbor_put_uint(&w, API_SERIES_pages_total);   cbor_put_uint(&w, stats.pages_total);
+        cbor_put_uint(&w, API_SERIES_pages_free);    cbor_put_uint(&w, stats.pages_free);
+        cbor_put_uint(&w, API_SERIES_page_size);     cbor_put_uint(&w, stats.page_size);
+        cbor_put_uint(&w, API_SERIES_evicted_pages); cbor_put_uint(&w, stats.evicted_pages);
+        cbor_put_uint(&w, API_SERIES_sessions);
+        cbor_put_array(&w, count);
+        for (size_t i = 0; i < count; i++) {
+            cbor_put_map(&w, API_FIELD_COUNT(API_SERIES_SESSION_FIELDS));
+            cbor_put_uint(&w, API_SERIES_SESSION_cell_id); cbor_put_text(&w, sessions[i].cell_id);
+            cbor_put_uint(&w, API_SERIES_SESSION_active);  cbor_put_bool(&w, sessions[i].active);
+            cbor_put_uint(&w, API_SERIES_SESSION_samples); cbor_put_uint(&w, sessions[i].samples);
+            cbor_put_uint(&w, API_SERIES_SESSION_bytes);   cbor_put_uint(&w, sessions[i].bytes);
+            cbor_put_uint(&w, API_SERIES_SESSION_duration_ms);
+            cbor_put_int(&w, sessions[i].last_t_ms - sessions[i].first_t_ms);
+        }
+        return send_cbor(req, &w);
+    }
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "pages_total", stats.pages_total);
+    cJSON_AddNumberToObject(root, "pages_free", stats.pages_free);
+    cJSON_AddNumberToObject(root, "page_size", stats.page_size);
+    cJSON_AddNumberToObject(root, "evicted_pages", stats.evicted_pages);
+    
+    cJSON *list = cJSON_AddArrayToObject(root, "sessions");
+    for (size_t i = 0; i < count; i++) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "cell_id", sessions[i].cell_id);
+        cJSON_AddBoolToObject(item, "active", sessions[i].active);
+        cJSON_AddNumberToObject(item, "samples", sessions[i].samples);
+        cJSON_AddNumberToObject(item, "bytes", sessions[i].bytes);
+        cJSON_AddNumberToObject(item, "duration_sec",
+                                (double)(sessions[i].last_t_ms - sessions[i].first_t_ms) / 1000.0);
+        cJSON_AddItemToArray(list, item);
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* API endpoint with per-cell session summaries */
+static esp_err_t api_sessions_handler(httpd_req_t *req)
+{
+    static session_summary_t sessions[CONFIG_CHARGER_SESSION_HISTORY + 1];
+    static const char *state_keys[SESSION_STATE_COUNT] = {
+        [CHARGE_STATE_NO_CELL] = "no_cell",
+        [CHARGE_STATE_CHARGING] = "charging",
+        [CHARGE_STATE_FULL] = "full",
+        [CHARGE_STATE_DISCHARGING] = "discharging",
+        [CHARGE_STATE_IDLE] = "idle",
+    };
+    
+    const size_t count = session_list(sessions, CONFIG_CHARGER_SESSION_HISTORY + 1);
+    
+    if (wants_cbor(req)) {
+#if CONFIG_CHARGER_STATIC_ALLOC
+        static uint8_t buf[8 + (CONFIG_CHARGER_SESSION_HISTORY + 1) * CBOR_SESSION_MAX];
+        const size_t cap = sizeof(buf);
+#else
+        const size_t cap = 8 + count * CBOR_SESSION_MAX;
+        uint8_t *buf = malloc(cap);
+        if (buf == NULL) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+            return ESP_FAIL;
+        }
+#endif
+        cbor_writer_t w;
+        cbor_writer_init(&w, buf, cap);
+        
+        cbor_put_array(&w, count);
+        for (size_t i = 0; i < count; i++) {
+            const session_summary_t *s = &sessions[i];
+            cbor_put_map(&w, API_FIELD_COUNT(API_SESSION_FIELDS));
+            cbor_put_uint(&w, API_SESSION_cell_id);          cbor_put_text(&w, s->cell_id);
+            cbor_put_uint(&w, API_SESSION_active);           cbor_put_bool(&w, s->active);
+            cbor_put_uint(&w, API_SESSION_start_ns);         cbor_put_int(&w, time_manager_to_utc_ns(s->start_ns));
+            cbor_put_uint(&w, API_SESSION_end_ns);           cbor_put_int(&w, time_manager_to_utc_ns(s->end_ns));
+            cbor_put_uint(&w, API_SESSION_duration_sec);     cbor_put_uint(&w, s->duration_sec);
+            cbor_put_uint(&w, API_SESSION_samples);          cbor_put_uint(&w, s->samples);
+            cbor_put_uint(&w, API_SESSION_start_voltage);    cbor_put_float(&w, s->start_voltage);
+            cbor_put_uint(&w, API_SESSION_end_voltage);      cbor_put_float(&w, s->end_voltage);
+            cbor_put_uint(&w, API_SESSION_min_voltage);      cbor_put_float(&w, s->min_voltage);
+            cbor_put_uint(&w, API_SESSION_max_voltage);      cbor_put_float(&w, s->max_voltage);
+            cbor_put_uint(&w, API_SESSION_peak_temp);        cbor_put_float(&w, s->peak_temp);
+            cbor_put_uint(&w, API_SESSION_time_to_cv_sec);   cbor_put_int(&w, s->time_to_cv_sec);
+            cbor_put_uint(&w, API_SESSION_time_to_full_sec); cbor_put_int(&w, s->time_to_full_sec);
+            cbor_put_uint(&w, API_SESSION_cc_charge_mah);    cbor_put_float(&w, s->cc_charge_mah);
+            cbor_put_uint(&w, API_SESSION_ir_mohm);          cbor_put_float(&w, s->ir_mohm);
+            cbor_put_uint(&w, API_SESSION_time_in_state_sec);
+            cbor_put_array(&w, SESSION_STATE_COUNT);
+            for (int st = 0; st < SESSION_STATE_COUNT; st++) {
+                cbor_put_uint(&w, s->time_in_state_sec[st]);
+            }
+        }
+        const esp_err_t ret = send_cbor(req, &w);
+#if !CONFIG_CHARGER_STATIC_ALLOC
+        free(buf);
+#endif
+        return ret;
+    }
+    
+    cJSON *root = cJSON_CreateArray();
+    for (size_t i = 0; i < count; i++) {
+        const session_summary_t *s = &sessions[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "cell_id", s->cell_id);
+        cJSON_AddBoolToObject(item, "active", s->active);
+        cJSON_AddNumberToObject(item, "start_ns", (double)time_manager_to_utc_ns(s->start_ns));
+        cJSON_AddNumberToObject(item, "end_ns", (double)time_manager_to_utc_ns(s->end_ns));
+        cJSON_AddNumberToObject(item, "duration_sec", s->duration_sec);
+        cJSON_AddNumberToObject(item, "samples", s->samples);
+        cJSON_AddNumberToObject(item, "start_voltage", s->start_voltage);
+        cJSON_AddNumberToObject(item, "end_voltage", s->end_voltage);
+        cJSON_AddNumberToObject(item, "min_voltage", s->min_voltage);
+        cJSON_AddNumberToObject(item, "max_voltage", s->max_voltage);
+        cJSON_AddNumberToObject(item, "peak_temp", s->peak_temp);
+        cJSON_AddNumberToObject(item, "time_to_cv_sec", s->time_to_cv_sec);
+        cJSON_AddNumberToObject(item, "time_to_full_sec", s->time_to_full_sec);
+        if (s->cc_charge_mah >= 0) {
+            cJSON_AddNumberToObject(item, "cc_charge_mah", s->cc_charge_mah);
+        }
+        if (s->ir_mohm >= 0) {
+            cJSON_AddNumberToObject(item, "ir_mohm", s->ir_mohm);
+        }
+        cJSON *states = cJSON_AddObjectToObject(item, "time_in_state_sec");
+        for (int st = CHARGE_STATE_CHARGING; st < SESSION_STATE_COUNT; st++) {
+            cJSON_AddNumberToObject(states, state_keys[st], s->time_in_state_sec[st]);
+        }
+        cJSON_AddItemToArray(root, item);
+    }
+    
     char *json_str = cJSON_PrintUnformatted(root);
     
     httpd_resp_set_type(req, "application/json");
@@ -69,6 +516,619 @@ static esp_err_t api_data_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Export buffer; flushed as one chunk when the next line might not fit */
+#define EXPORT_CHUNK_SIZE  1024
+#define EXPORT_LINE_MAX    160
+
+typedef enum {
+    EXPORT_FORMAT_CSV,
+    EXPORT_FORMAT_LP,       /* InfluxDB line protocol */
+} export_format_t;
+
+/* API endpoint streaming the stored samples of one session */
+static esp_err_t api_export_handler(httpd_req_t *req)
+{
+    char query[96] = "";
+    char cell_id[24] = "";
+    char format_str[8] = "csv";
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "cell_id", cell_id, sizeof(cell_id));
+        httpd_query_key_value(query, "format", format_str, sizeof(format_str));
+    }
+    
+    export_format_t format;
+    if (strcmp(format_str, "csv") == 0) {
+        format = EXPORT_FORMAT_CSV;
+    } else if (strcmp(format_str, "lp") == 0) {
+        format = EXPORT_FORMAT_LP;
+    } else {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "format must be csv or lp");
+        return ESP_FAIL;
+    }
+    
+    /* Resolve the cell from the store so only device-made IDs are echoed */
+    series_session_info_t sessions[CONFIG_CHARGER_SERIES_SESSIONS];
+    const size_t count = series_store_list(sessions, CONFIG_CHARGER_SERIES_SESSIONS);
+    const series_session_info_t *session = NULL;
+    for (size_t i = 0; i < count && session == NULL; i++) {
+        if (cell_id[0] == '\0' || strcmp(sessions[i].cell_id, cell_id) == 0) {
+            session = &sessions[i];
+        }
+    }
+    series_iter_t it;
+    if (session == NULL || !series_store_iter_init(&it, session->cell_id)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No stored session for that cell");
+        return ESP_FAIL;
+    }
+    
+    /* Line protocol without real timestamps would land in 1970 */
+    const bool synced = time_manager_is_synced();
+    if (format == EXPORT_FORMAT_LP && !synced) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Clock not synced yet, try again or use format=csv");
+        return ESP_FAIL;
+    }
+    
+    char disposition[64];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"%s.%s\"",
+             session->cell_id, format == EXPORT_FORMAT_CSV ? "csv" : "lp");
+    httpd_resp_set_type(req, format == EXPORT_FORMAT_CSV ? "text/csv" : "text/plain");
+    httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    
+    static char buf[EXPORT_CHUNK_SIZE];
+    size_t len = 0;
+    if (format == EXPORT_FORMAT_CSV) {
+        len = snprintf(buf, sizeof(buf), "timestamp_ns,uptime_ms,voltage,temp,charge_state\n");
+    }
+    
+    series_sample_t sample;
+    uint32_t exported = 0;
+    while (series_store_iter_next(&it, &sample)) {
+        /* Samples carry esp_timer time; the clock anchor maps it to UTC */
+        const int64_t utc_ns = synced ? time_manager_to_utc_ns(sample.t_ms * 1000000LL) : 0;
+        const char *state = sensor_charge_state_str(sample.charge_state);
+        const int32_t mv = sample.voltage_mv;
+        
+        if (format == EXPORT_FORMAT_CSV) {
+            if (synced) {
+                len += snprintf(buf + len, sizeof(buf) - len, "%lld,", utc_ns);
+            } else {
+                buf[len++] = ',';
+            }
+            len += snprintf(buf + len, sizeof(buf) - len, "%lld,%ld.%03ld,%.1f,%s\n",
+                            sample.t_ms, mv / 1000, mv % 1000, sample.temp_dc / 10.0f, state);
+        } else {
+            len += snprintf(buf + len, sizeof(buf) - len,
+                            "battery_charging,device=%s,cell_id=%s "
+                            "voltage=%ld.%03ld,temp=%.1f,charge_state=\"%s\" %lld\n",
+                            g_config.device_id, session->cell_id,
+                            mv / 1000, mv % 1000, sample.temp_dc / 10.0f, state, utc_ns);
+        }
+        exported++;
+        
+        if (len > sizeof(buf) - EXPORT_LINE_MAX) {
+            if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+                ESP_LOGW(TAG, "Export of %s aborted after %lu samples", session->cell_id, exported);
+                return ESP_FAIL;
+            }
+            len = 0;
+            supervisor_heartbeat(SUPERVISOR_WEBSERVER, WEB_STALL_MS);
+        }
+    }
+    
+    if (len > 0 && httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Exported %lu samples of %s", exported, session->cell_id);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Firmware upload: raw image in the body, X-OTA-SHA256 with its hex digest */
+#define OTA_RECV_CHUNK     4096
+
+/* Receive timeouts in a row before a request body is given up, so a
+ * client that stops sending can't hold the httpd task */
+#define RECV_RETRIES       5
+
+static bool parse_sha256_hex(const char *hex, uint8_t out[32])
+{
+    if (strlen(hex) != 64) {
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return false;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+static esp_err_t ota_reply(httpd_req_t *req, const char *status, const char *message)
+{
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, message);
+    return ESP_FAIL;
+}
+
+/* Checks the whole buffer whatever matched, so the time taken doesn't
+ * tell how much of the token was right; both are zero padded */
+static bool token_matches(const char *given, const char *expected, size_t size)
+{
+    uint8_t diff = strlen(given) != strlen(expected);
+    for (size_t i = 0; i < size; i++) {
+        diff |= (uint8_t)(given[i] ^ expected[i]);
+    }
+    return diff == 0;
+}
+
+static esp_err_t api_ota_post_handler(httpd_req_t *req)
+{
+    if (CONFIG_CHARGER_OTA_PASSWORD[0] != '\0') {
+        char auth[80] = "";
+        char expected[80] = "";
+        snprintf(expected, sizeof(expected), "Bearer %s", CONFIG_CHARGER_OTA_PASSWORD);
+        /* A truncated header is longer than any token that fits */
+        if (httpd_req_get_hdr_value_str(req, "Authorization", auth, sizeof(auth)) != ESP_OK ||
+            !token_matches(auth, expected, sizeof(expected))) {
+            return ota_reply(req, "401 Unauthorized", "Missing or wrong Authorization header");
+        }
+    }
+    
+    char sha_hex[72] = "";
+    uint8_t expected_sha[32];
+    httpd_req_get_hdr_value_str(req, "X-OTA-SHA256", sha_hex, sizeof(sha_hex));
+    if (!parse_sha256_hex(sha_hex, expected_sha)) {
+        return ota_reply(req, "400 Bad Request", "X-OTA-SHA256 header with the image's hex SHA-256 is required");
+    }
+    if (req->content_len == 0) {
+        return ota_reply(req, "411 Length Required", "Send the image with a Content-Length");
+    }
+    
+    esp_err_t ret = ota_begin(req->content_len);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        return ota_reply(req, "409 Conflict", "Another update is in progress");
+    } else if (ret == ESP_ERR_INVALID_SIZE) {
+        return ota_reply(req, "413 Payload Too Large", "Image doesn't fit the OTA partition");
+    } else if (ret != ESP_OK) {
+        return ota_reply(req, "500 Internal Server Error", esp_err_to_name(ret));
+    }
+    
+    /* Stream straight to flash */
+    static char buf[OTA_RECV_CHUNK];
+    size_t remaining = req->content_len;
+    int retries = 0;
+    while (remaining > 0) {
+        const int n = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= RECV_RETRIES) {
+            continue;
+        }
+        if (n <= 0) {
+            ota_abort();
+            return ota_reply(req, "408 Request Timeout", "Upload interrupted");
+        }
+        retries = 0;
+        if (ota_write(buf, n) != ESP_OK) {
+            return ota_reply(req, "500 Internal Server Error", "Flash write failed");
+        }
+        remaining -= n;
+        supervisor_heartbeat(SUPERVISOR_WEBSERVER, WEB_STALL_MS);
+    }
+    
+    ret = ota_finish(expected_sha);
+    if (ret == ESP_ERR_INVALID_CRC) {
+        return ota_reply(req, "400 Bad Request", "SHA-256 mismatch, image discarded");
+    } else if (ret != ESP_OK) {
+        return ota_reply(req, "400 Bad Request", "Not a valid firmware image");
+    }
+    
+    ota_stats_t stats;
+    ota_get_stats(&stats);
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "status", "ok");
+    cJSON_AddNumberToObject(root, "bytes", stats.bytes_written);
+    cJSON_AddNumberToObject(root, "elapsed_ms", stats.elapsed_ms);
+    cJSON_AddNumberToObject(root, "throughput_kbps", stats.throughput_kbps);
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    ota_schedule_restart();
+    return ESP_OK;
+}
+
+/* API endpoint describing the running image and the last update */
+static esp_err_t api_ota_get_handler(httpd_req_t *req)
+{
+    const esp_app_desc_t *desc = esp_app_get_description();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    ota_stats_t stats;
+    ota_get_stats(&stats);
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", desc->version);
+    cJSON_AddStringToObject(root, "idf_version", desc->idf_ver);
+    cJSON_AddStringToObject(root, "build", desc->date);
+    cJSON_AddStringToObject(root, "partition", running->label);
+    cJSON_AddBoolToObject(root, "pending_verify", ota_is_pending_verify());
+    cJSON_AddBoolToObject(root, "in_progress", stats.in_progress);
+    cJSON_AddNumberToObject(root, "bytes_written", stats.bytes_written);
+    cJSON_AddNumberToObject(root, "image_size", stats.image_size);
+    cJSON_AddNumberToObject(root, "elapsed_ms", stats.elapsed_ms);
+    cJSON_AddNumberToObject(root, "throughput_kbps", stats.throughput_kbps);
+    cJSON_AddStringToObject(root, "last_error", esp_err_to_name(stats.last_error));
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* Largest JSON request body accepted */
+#define CONFIG_BODY_MAX  1024
+
+/* Receive a request body of at most CONFIG_BODY_MAX bytes and parse it.
+ * Returns false if the body couldn't be read; otherwise *root is the
+ * parsed JSON, or NULL if it isn't JSON. */
+static bool receive_json(httpd_req_t *req, cJSON **root)
+{
+    static char body[CONFIG_BODY_MAX + 1];
+    size_t received = 0;
+    int retries = 0;
+    *root = NULL;
+    while (received < req->content_len) {
+        const int n = httpd_req_recv(req, body + received, req->content_len - received);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= RECV_RETRIES) {
+            /* Bounded by the retries, so the wait needn't count as a stall */
+            supervisor_heartbeat(SUPERVISOR_WEBSERVER, WEB_STALL_MS);
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        retries = 0;
+        received += n;
+    }
+    body[received] = '\0';
+    
+    *root = cJSON_Parse(body);
+    return true;
+}
+
+static esp_err_t send_config(httpd_req_t *req)
+{
+    params_t current, defaults;
+    const uint32_t generation = params_get(&current, &defaults);
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "generation", generation);
+    cJSON *list = cJSON_AddObjectToObject(root, "params");
+    for (size_t i = 0; i < params_count(); i++) {
+        const param_def_t *def = params_def(i);
+        cJSON *item = cJSON_AddObjectToObject(list, def->name);
+        cJSON_AddNumberToObject(item, "value", params_value(&current, def));
+        cJSON_AddNumberToObject(item, "default", params_value(&defaults, def));
+        cJSON_AddNumberToObject(item, "min", def->min);
+        cJSON_AddNumberToObject(item, "max", def->max);
+        cJSON_AddStringToObject(item, "unit", def->unit);
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* API endpoint listing the runtime parameters */
+static esp_err_t api_config_get_handler(httpd_req_t *req)
+{
+    return send_config(req);
+}
+
+static esp_err_t reply_error(httpd_req_t *req, const char *status, const char *message)
+{
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_sendstr(req, message);
+    return ESP_OK;
+}
+
+/* API endpoint changing runtime parameters: {"name": value | null, ...}
+ * null restores the default. All changes are applied together or none. */
+static esp_err_t api_config_patch_handler(httpd_req_t *req)
+{
+    if (req->content_len == 0 || req->content_len > CONFIG_BODY_MAX) {
+        return reply_error(req, "400 Bad Request", "Send a JSON object of at most 1024 bytes");
+    }
+    
+    cJSON *root;
+    if (!receive_json(req, &root)) {
+        return reply_error(req, "408 Request Timeout", "Request body incomplete");
+    }
+    if (!cJSON_IsObject(root)) {
+        cJSON_Delete(root);
+        return reply_error(req, "400 Bad Request", "Body must be a JSON object");
+    }
+    
+    param_change_t changes[32];
+    size_t count = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, root) {
+        if (count == sizeof(changes) / sizeof(changes[0])) {
+            cJSON_Delete(root);
+            return reply_error(req, "400 Bad Request", "Too many parameters");
+        }
+        if (!cJSON_IsNumber(item) && !cJSON_IsNull(item)) {
+            cJSON_Delete(root);
+            return reply_error(req, "400 Bad Request", "Values must be numbers or null");
+        }
+        changes[count++] = (param_change_t){
+            .name = item->string,
+            .reset = cJSON_IsNull(item),
+            .value = item->valuedouble,
+        };
+    }
+    
+    char err[128];
+    const esp_err_t ret = params_update(changes, count, err, sizeof(err));
+    cJSON_Delete(root);
+    if (ret != ESP_OK) {
+        return reply_error(req, "400 Bad Request", err);
+    }
+    return send_config(req);
+}
+
+/* Pin readings averaged into one calibration point (about 80 ms each) */
+#define CAL_CAPTURE_READINGS  8
+
+static void add_cal_points(cJSON *root, const char *name, const calibration_point_t *points, size_t count)
+{
+    cJSON *arr = cJSON_AddArrayToObject(root, name);
+    for (size_t i = 0; i < count; i++) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "pin_mv", points[i].pin_mv);
+        cJSON_AddNumberToObject(item, "reference_mv", points[i].reference_mv);
+        cJSON_AddItemToArray(arr, item);
+    }
+}
+
+static esp_err_t send_calibration(httpd_req_t *req)
+{
+    calibration_status_t status;
+    calibration_get_status(&status);
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "active", status.active);
+    add_cal_points(root, "points", status.points, status.count);
+    add_cal_points(root, "pending", status.pending, status.pending_count);
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* API endpoint showing the saved and captured calibration points */
+static esp_err_t api_calibration_get_handler(httpd_req_t *req)
+{
+    return send_calibration(req);
+}
+
+/* API endpoint driving calibration:
+ *   {"action":"capture","reference_mv":3600}  read the pin at a known voltage
+ *   {"action":"save"}                         fit, store in NVS and use
+ *   {"action":"discard"}                      drop captured points
+ *   {"action":"clear"}                        back to the divider ratio */
+static esp_err_t api_calibration_post_handler(httpd_req_t *req)
+{
+    if (req->content_len == 0 || req->content_len > CONFIG_BODY_MAX) {
+        return reply_error(req, "400 Bad Request", "Send a JSON object of at most 1024 bytes");
+    }
+    
+    cJSON *root;
+    if (!receive_json(req, &root)) {
+        return reply_error(req, "408 Request Timeout", "Request body incomplete");
+    }
+    const cJSON *action = cJSON_GetObjectItem(root, "action");
+    if (!cJSON_IsString(action)) {
+        cJSON_Delete(root);
+        return reply_error(req, "400 Bad Request", "Body must be a JSON object with an action");
+    }
+    
+    char err[96] = "";
+    const char *status = NULL;
+    if (strcmp(action->valuestring, "capture") == 0) {
+        const cJSON *ref = cJSON_GetObjectItem(root, "reference_mv");
+        if (!cJSON_IsNumber(ref) || ref->valuedouble < 500 || ref->valuedouble > 20000) {
+            status = "400 Bad Request";
+            snprintf(err, sizeof(err), "reference_mv must be the applied voltage in mV");
+        } else {
+            int64_t sum = 0;
+            int readings = 0;
+            for (int i = 0; i < CAL_CAPTURE_READINGS; i++) {
+                int pin_mv;
+                if (sensor_read_pin_mv(&pin_mv) == ESP_OK) {
+                    sum += pin_mv;
+                    readings++;
+                }
+            }
+            if (readings == 0) {
+                status = "503 Service Unavailable";
+                snprintf(err, sizeof(err), "ADC reads failed, try again");
+            } else if (calibration_add_point((int32_t)(sum / readings),
+                                             (int32_t)ref->valuedouble) != ESP_OK) {
+                status = "409 Conflict";
+                snprintf(err, sizeof(err), "Too many points, save or discard first");
+            }
+        }
+    } else if (strcmp(action->valuestring, "save") == 0) {
+        if (calibration_save(err, sizeof(err)) != ESP_OK) {
+            status = "400 Bad Request";
+        }
+    } else if (strcmp(action->valuestring, "discard") == 0) {
+        calibration_discard();
+    } else if (strcmp(action->valuestring, "clear") == 0) {
+        if (calibration_clear() != ESP_OK) {
+            status = "500 Internal Server Error";
+            snprintf(err, sizeof(err), "Erasing the saved calibration failed");
+        }
+    } else {
+        status = "400 Bad Request";
+        snprintf(err, sizeof(err), "action must be capture, save, discard or clear");
+    }
+    cJSON_Delete(root);
+    
+    if (status) {
+        return reply_error(req, status, err);
+    }
+    return send_calibration(req);
+}
+
+static void add_mv_array(cJSON *parent, const char *name, const int16_t *mv, int count)
+{
+    cJSON *arr = cJSON_AddArrayToObject(parent, name);
+    for (int i = 0; i < count; i++) {
+        cJSON_AddItemToArray(arr, cJSON_CreateNumber(mv[i]));
+    }
+}
+
+/* API endpoint for the last internal resistance capture, with the
+ * waveform around the step (battery mV) */
+static esp_err_t api_ir_handler(httpd_req_t *req)
+{
+    ir_stats_t stats;
+    ir_capture_get_stats(&stats);
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", stats.enabled);
+    cJSON_AddNumberToObject(root, "charge_current_ma", CONFIG_CHARGER_CHARGE_CURRENT_MA);
+    cJSON_AddNumberToObject(root, "triggers", stats.triggers);
+    cJSON_AddNumberToObject(root, "accepted", stats.accepted);
+    cJSON_AddNumberToObject(root, "rejected", stats.rejected);
+    
+    static ir_record_t rec;
+    if (ir_capture_get_record(&rec)) {
+        cJSON *last = cJSON_AddObjectToObject(root, "last");
+        cJSON_AddStringToObject(last, "edge", ir_capture_edge_str(rec.result.edge));
+        cJSON_AddNumberToObject(last, "age_ms", (double)((esp_timer_get_time() - rec.result.time_us) / 1000));
+        cJSON_AddNumberToObject(last, "step_mv", rec.result.step_mv);
+        cJSON_AddNumberToObject(last, "ir_mohm", rec.result.ir_mohm);
+        cJSON_AddNumberToObject(last, "poll_us", rec.poll_us);
+        cJSON_AddNumberToObject(last, "burst_us", rec.burst_us);
+        add_mv_array(last, "pre_mv", rec.pre_mv, IR_PRE_SAMPLES);
+        add_mv_array(last, "burst_mv", rec.burst_mv, IR_BURST_SAMPLES);
+        add_mv_array(last, "post_mv", rec.post_mv, IR_POST_SAMPLES);
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* API endpoint with the binary log ring; decode with tools/logdecode.
+ * ?since=N returns only records from sequence number N on */
+static esp_err_t api_logs_handler(httpd_req_t *req)
+{
+    char query[32] = "";
+    char since_str[12] = "";
+    uint32_t seq = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "since", since_str, sizeof(since_str)) == ESP_OK) {
+        seq = (uint32_t)strtoul(since_str, NULL, 10);
+    }
+    
+    const int64_t now_ns = time_manager_get_timestamp_ns();
+    const binlog_dump_header_t header = {
+        .magic = { 'B', 'L', 'O', 'G' },
+        .version = BINLOG_VERSION,
+        .record_size = sizeof(binlog_record_t),
+        .uptime_ms = (uint32_t)(esp_timer_get_time() / 1000),
+        .synced = time_manager_is_utc(now_ns),
+        .utc_ms = now_ns / 1000000,
+    };
+    
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if (httpd_resp_send_chunk(req, (const char *)&header, sizeof(header)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    
+    /* Records written while sending are included; the loop ends once
+     * caught up */
+    binlog_record_t records[16];
+    size_t count;
+    while ((count = binlog_read(&seq, records, sizeof(records) / sizeof(records[0]))) > 0) {
+        if (httpd_resp_send_chunk(req, (const char *)records, count * sizeof(records[0])) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* API endpoint returning the flash journal as line protocol, oldest first */
+static esp_err_t api_journal_handler(httpd_req_t *req)
+{
+    sink_stats_t sinks[SINK_COUNT];
+    sink_get_stats(sinks);
+    if (!sinks[SINK_JOURNAL].enabled) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Journal sink not enabled");
+        return ESP_FAIL;
+    }
+    
+    httpd_resp_set_type(req, "text/plain; charset=utf-8");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    
+    /* A rotation while sending can repeat or skip the lines of one file */
+    static const char *const paths[] = { SINK_JOURNAL_OLD_PATH, SINK_JOURNAL_PATH };
+    char buf[1024];
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        FILE *f = fopen(paths[i], "r");
+        if (f == NULL) {
+            continue;
+        }
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            if (httpd_resp_send_chunk(req, buf, n) != ESP_OK) {
+                fclose(f);
+                return ESP_FAIL;
+            }
+            supervisor_heartbeat(SUPERVISOR_WEBSERVER, WEB_STALL_MS);
+        }
+        fclose(f);
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 /* Favicon handler */
 static esp_err_t favicon_handler(httpd_req_t *req)
 {
@@ -77,44 +1137,192 @@ static esp_err_t favicon_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+static esp_err_t api_heap_handler(httpd_req_t *req);
+
+/* API endpoint with uptime, reset reasons and subsystem restarts */
+static esp_err_t api_health_handler(httpd_req_t *req)
+{
+    static supervisor_report_t report;
+    supervisor_get_report(&report);
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "uptime_sec", (double)(esp_timer_get_time() / 1000000));
+    cJSON_AddNumberToObject(root, "boot_count", report.boot_count);
+    cJSON_AddStringToObject(root, "reset_reason", supervisor_reset_reason_str());
+    if (report.reboot_reason[0] != '\0') {
+        cJSON_AddStringToObject(root, "supervisor_reboot", report.reboot_reason);
+    }
+    
+    cJSON *subsystems = cJSON_AddObjectToObject(root, "subsystems");
+    for (size_t i = 0; i < SUPERVISOR_COUNT; i++) {
+        const supervisor_status_t *st = &report.subsystems[i];
+        cJSON *item = cJSON_AddObjectToObject(subsystems, st->name);
+        cJSON_AddBoolToObject(item, "armed", st->armed);
+        cJSON_AddNumberToObject(item, "restarts", st->restarts);
+        cJSON_AddNumberToObject(item, "heartbeat_age_ms", (double)st->heartbeat_age_ms);
+        cJSON_AddNumberToObject(item, "restart_age_ms", (double)st->restart_age_ms);
+        if (st->last_reason[0] != '\0') {
+            cJSON_AddStringToObject(item, "last_reason", st->last_reason);
+        }
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+static endpoint_t s_endpoints[] = {
+    { .uri = "/",             .method = HTTP_GET, .handler = dashboard_get_handler },
+    { .uri = "/api/data",     .method = HTTP_GET, .handler = api_data_handler },
+    { .uri = "/api/diag",     .method = HTTP_GET, .handler = api_diag_handler },
+    { .uri = "/api/series",   .method = HTTP_GET, .handler = api_series_handler },
+    { .uri = "/api/sessions", .method = HTTP_GET, .handler = api_sessions_handler },
+    { .uri = "/api/export",   .method = HTTP_GET, .handler = api_export_handler },
+    { .uri = "/api/ota",      .method = HTTP_GET, .handler = api_ota_get_handler },
+    { .uri = "/api/ota",      .method = HTTP_POST, .handler = api_ota_post_handler },
+    { .uri = "/api/config",   .method = HTTP_GET, .handler = api_config_get_handler },
+    { .uri = "/api/config",   .method = HTTP_PATCH, .handler = api_config_patch_handler },
+    { .uri = "/api/calibration", .method = HTTP_GET, .handler = api_calibration_get_handler },
+    { .uri = "/api/calibration", .method = HTTP_POST, .handler = api_calibration_post_handler },
+    { .uri = "/api/ir",       .method = HTTP_GET, .handler = api_ir_handler },
+    { .uri = "/api/logs",     .method = HTTP_GET, .handler = api_logs_handler },
+    { .uri = "/api/journal",  .method = HTTP_GET, .handler = api_journal_handler },
+    { .uri = "/api/heap",     .method = HTTP_GET, .handler = api_heap_handler },
+    { .uri = "/api/health",   .method = HTTP_GET, .handler = api_health_handler },
+    { .uri = "/favicon.ico",  .method = HTTP_GET, .handler = favicon_handler },
+};
+static const size_t s_endpoint_count = sizeof(s_endpoints) / sizeof(s_endpoints[0]);
+
+/* API endpoint with heap and HTTP server figures, used by tools/httpbench */
+static esp_err_t api_heap_handler(httpd_req_t *req)
+{
+    int client_fds[CONFIG_CHARGER_HTTP_MAX_SOCKETS];
+    size_t clients = CONFIG_CHARGER_HTTP_MAX_SOCKETS;
+    if (httpd_get_client_list(server, &clients, client_fds) != ESP_OK) {
+        clients = 0;
+    }
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "free", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    cJSON_AddNumberToObject(root, "min_free", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    cJSON_AddNumberToObject(root, "largest_block", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    cJSON_AddNumberToObject(root, "total", heap_caps_get_total_size(MALLOC_CAP_8BIT));
+    cJSON_AddNumberToObject(root, "open_sockets", clients);
+    cJSON_AddNumberToObject(root, "max_sockets", CONFIG_CHARGER_HTTP_MAX_SOCKETS);
+    cJSON_AddNumberToObject(root, "uptime_sec", (double)(esp_timer_get_time() / 1000000));
+#if CONFIG_CHARGER_STATIC_ALLOC
+    cJSON_AddBoolToObject(root, "static_alloc", true);
+    cJSON *arena = cJSON_AddObjectToObject(root, "json_arena");
+    cJSON_AddNumberToObject(arena, "size", sizeof(s_json_arena));
+    cJSON_AddNumberToObject(arena, "high_water", s_json_high_water);
+    cJSON_AddNumberToObject(arena, "spills", s_json_spills);
+#else
+    cJSON_AddBoolToObject(root, "static_alloc", false);
+#endif
+    
+    /* Free heap over the whole uptime, to show it stays flat */
+    static heap_report_t report;
+    heap_monitor_get_report(&report);
+    cJSON *history = cJSON_AddObjectToObject(root, "history");
+    cJSON_AddNumberToObject(history, "interval_sec", report.interval_sec);
+    cJSON_AddNumberToObject(history, "trend_bytes_per_day", report.trend_bytes_per_day);
+    cJSON *free_list = cJSON_AddArrayToObject(history, "free");
+    cJSON *largest_list = cJSON_AddArrayToObject(history, "largest_block");
+    for (size_t i = 0; i < report.count; i++) {
+        cJSON_AddItemToArray(free_list, cJSON_CreateNumber(report.history[i].free));
+        cJSON_AddItemToArray(largest_list, cJSON_CreateNumber(report.history[i].largest_block));
+    }
+    
+    /* Heap held by TLS connections of the upload sinks */
+    heap_tls_usage_t tls;
+    heap_monitor_get_tls(&tls);
+    if (tls.counted) {
+        cJSON *tls_json = cJSON_AddObjectToObject(root, "tls");
+        cJSON_AddNumberToObject(tls_json, "current", tls.current);
+        cJSON_AddNumberToObject(tls_json, "peak", tls.peak);
+    }
+    
+    cJSON *handlers = cJSON_AddObjectToObject(root, "handlers");
+    for (size_t i = 0; i < s_endpoint_count; i++) {
+        const endpoint_t *ep = &s_endpoints[i];
+        cJSON *item = cJSON_AddObjectToObject(handlers, ep->uri);
+        cJSON_AddNumberToObject(item, "count", ep->count);
+        cJSON_AddNumberToObject(item, "total_us", (double)ep->total_us);
+        cJSON_AddNumberToObject(item, "max_us", ep->max_us);
+    }
+    
+    char *json_str = cJSON_PrintUnformatted(root);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    
+    return ESP_OK;
+}
+
+/* Runs the endpoint's handler and records how long it took */
+static esp_err_t timed_handler(httpd_req_t *req)
+{
+    endpoint_t *ep = req->user_ctx;
+    
+#if CONFIG_CHARGER_STATIC_ALLOC
+    s_json_used = 0;
+#endif
+    const int64_t start_us = esp_timer_get_time();
+    const esp_err_t ret = ep->handler(req);
+    const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    
+    ep->count++;
+    ep->total_us += elapsed_us;
+    if (elapsed_us > ep->max_us) {
+        ep->max_us = elapsed_us;
+    }
+    return ret;
+}
+
 esp_err_t webserver_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 8192;
-    config.max_uri_handlers = 8;
+    config.max_uri_handlers = s_endpoint_count;
+    config.max_open_sockets = CONFIG_CHARGER_HTTP_MAX_SOCKETS;
     config.lru_purge_enable = true;
     
     ESP_LOGI(TAG, "Starting web server on port %d", config.server_port);
     
+#if CONFIG_CHARGER_STATIC_ALLOC
+    cJSON_Hooks hooks = {
+        .malloc_fn = json_arena_malloc,
+        .free_fn = json_arena_free,
+    };
+    cJSON_InitHooks(&hooks);
+#endif
+    
     if (httpd_start(&server, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start HTTP server");
         return ESP_FAIL;
     }
     
     /* Register URI handlers */
-    const httpd_uri_t uri_dashboard = {
-        .uri = "/",
-        .method = HTTP_GET,
-        .handler = dashboard_get_handler,
-        .user_ctx = NULL
-    };
-    httpd_register_uri_handler(server, &uri_dashboard);
-    
-    const httpd_uri_t uri_api_data = {
-        .uri = "/api/data",
-        .method = HTTP_GET,
-        .handler = api_data_handler,
-        .user_ctx = NULL
-    };
-    httpd_register_uri_handler(server, &uri_api_data);
-    
-    const httpd_uri_t uri_favicon = {
-        .uri = "/favicon.ico",
-        .method = HTTP_GET,
-        .handler = favicon_handler,
-        .user_ctx = NULL
-    };
-    httpd_register_uri_handler(server, &uri_favicon);
+    for (size_t i = 0; i < s_endpoint_count; i++) {
+        const httpd_uri_t uri = {
+            .uri = s_endpoints[i].uri,
+            .method = s_endpoints[i].method,
+            .handler = timed_handler,
+            .user_ctx = &s_endpoints[i]
+        };
+        httpd_register_uri_handler(server, &uri);
+    }
     
     ESP_LOGI(TAG, "Web server started successfully");
     return ESP_OK;
@@ -128,3 +1336,16 @@ void webserver_stop(void)
         ESP_LOGI(TAG, "Web server stopped");
     }
 }
+
+/* Runs on the httpd task, so it only gets there if httpd is responsive */
+static void probe_work(void *arg)
+{
+    supervisor_heartbeat(SUPERVISOR_WEBSERVER, WEB_STALL_MS);
+}
+
+void webserver_probe(void)
+{
+    if (server) {
+        httpd_queue_work(server, probe_work, NULL);
+    }
+}
@@ -12,3 +12,10 @@ esp_err_t webserver_start(void);
  * Stop the web server
  */
 void webserver_stop(void);
+
+/**
+ * Ask the server for a heartbeat
+ * Queues a job on the httpd task that calls supervisor_heartbeat(), so
+ * the heartbeat stops while a handler is stuck. Does nothing until started.
+ */
+void webserver_probe(void);
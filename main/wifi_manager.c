@@ -5,52 +5,269 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "static_alloc.h"
+#include "sdkconfig.h"
 
 static const char *TAG = "wifi";
 
 #define WIFI_CONNECTED_BIT   BIT0
-#define WIFI_FAIL_BIT        BIT1
-#define WIFI_MAX_RETRY       5
+
+/* Failed attempts on the cached BSSID/channel before scanning all channels */
+#define WIFI_FAST_PATH_TRIES 2
+
+#define WIFI_BACKOFF_MIN_MS  1000
+#define WIFI_BACKOFF_MAX_MS  (CONFIG_CHARGER_WIFI_BACKOFF_MAX_SEC * 1000)
+
+#define NVS_NAMESPACE        "wifi_cache"
+#define NVS_KEY_AP           "ap"
+
+/* Last AP we associated with, for a single-channel fast path on boot */
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    char ssid[33];
+} wifi_ap_cache_t;
 
 static EventGroupHandle_t s_wifi_event_group;
-static int s_retry_num = 0;
+static esp_netif_t *s_sta_netif = NULL;
+static wifi_config_t s_sta_config;    /* Full scan; the fast path pins the cached AP */
+static esp_timer_handle_t s_retry_timer = NULL;
 static char device_ip[16] = "0.0.0.0";
 
+static wifi_ap_cache_t s_cache;
+static bool s_cache_valid = false;
+static bool s_fast_path = false;
+static bool s_stopping = false;
+
+static uint32_t s_attempts = 0;       /* Failed attempts in the current outage */
+static uint32_t s_backoff_ms = 0;
+static int64_t s_attempt_start_us = 0;
+static int64_t s_outage_start_us = 0;
+static wifi_stats_t s_stats;
+
+static void load_ap_cache(void)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(s_cache);
+    const esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_AP, &s_cache, &len);
+    nvs_close(nvs_handle);
+
+    /* Only useful for the network we are configured for */
+    s_cache_valid = err == ESP_OK && len == sizeof(s_cache) && s_cache.channel != 0 &&
+                    strncmp(s_cache.ssid, g_config.wifi_ssid, sizeof(s_cache.ssid)) == 0;
+}
+
+static void save_ap_cache(void)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+
+    wifi_ap_cache_t cache = {0};
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.channel = ap.primary;
+    strncpy(cache.ssid, g_config.wifi_ssid, sizeof(cache.ssid) - 1);
+
+    /* Spare the flash when nothing changed */
+    if (s_cache_valid && memcmp(&cache, &s_cache, sizeof(cache)) == 0) {
+        return;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to open NVS for AP cache");
+        return;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_KEY_AP, &cache, sizeof(cache));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
+    if (err == ESP_OK) {
+        s_cache = cache;
+        s_cache_valid = true;
+        ESP_LOGI(TAG, "Cached AP %02x:%02x:%02x:%02x:%02x:%02x on channel %d",
+                 cache.bssid[0], cache.bssid[1], cache.bssid[2],
+                 cache.bssid[3], cache.bssid[4], cache.bssid[5], cache.channel);
+    }
+}
+
+#if CONFIG_CHARGER_WIFI_STATIC_IP
+static bool apply_static_ip(esp_netif_t *netif)
+{
+    esp_netif_ip_info_t ip_info = {0};
+    esp_netif_dns_info_t dns = {0};
+
+    if (esp_netif_str_to_ip4(CONFIG_CHARGER_WIFI_STATIC_ADDR, &ip_info.ip) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_CHARGER_WIFI_STATIC_NETMASK, &ip_info.netmask) != ESP_OK ||
+        esp_netif_str_to_ip4(CONFIG_CHARGER_WIFI_STATIC_GATEWAY, &ip_info.gw) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid static IP configuration, using DHCP");
+        return false;
+    }
+
+    esp_netif_dhcpc_stop(netif);
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(netif, &ip_info));
+
+    if (esp_netif_str_to_ip4(CONFIG_CHARGER_WIFI_STATIC_DNS, &dns.ip.u_addr.ip4) == ESP_OK) {
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    ESP_LOGI(TAG, "Static IP " IPSTR, IP2STR(&ip_info.ip));
+    return true;
+}
+#endif
+
+bool wifi_prepare_sta(esp_netif_t *netif, const char *ssid, const char *password, wifi_config_t *cfg)
+{
+    *cfg = (wifi_config_t) {
+        .sta = {
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .pmf_cfg = {
+                .capable = true,
+                .required = false
+            },
+        },
+    };
+
+    strncpy((char *)cfg->sta.ssid, ssid, sizeof(cfg->sta.ssid));
+    strncpy((char *)cfg->sta.password, password, sizeof(cfg->sta.password));
+
+#if CONFIG_CHARGER_WIFI_STATIC_IP
+    return apply_static_ip(netif);
+#else
+    return false;
+#endif
+}
+
+/* Station config: pinned to the cached AP on the fast path, full scan otherwise */
+static void apply_sta_config(bool fast_path)
+{
+    wifi_config_t wifi_config = s_sta_config;
+
+    if (fast_path) {
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, s_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = s_cache.channel;
+    }
+
+    s_fast_path = fast_path;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+}
+
+static void start_attempt(void)
+{
+    s_attempt_start_us = esp_timer_get_time();
+    esp_wifi_connect();
+}
+
+static void retry_timer_cb(void *arg)
+{
+    if (!s_stopping) {
+        start_attempt();
+    }
+}
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        /* After wifi_restart() the outage goes on from the disconnect */
+        if (s_outage_start_us == 0) {
+            s_outage_start_us = esp_timer_get_time();
+        }
+        start_attempt();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         wifi_event_sta_disconnected_t* disconnected = (wifi_event_sta_disconnected_t*) event_data;
-        ESP_LOGW(TAG, "WiFi disconnected, reason: %d", disconnected->reason);
-        if (s_retry_num < WIFI_MAX_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "Retry connecting to WiFi (attempt %d/%d)", s_retry_num, WIFI_MAX_RETRY);
-        } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
-            ESP_LOGE(TAG, "Failed to connect to WiFi after %d attempts", WIFI_MAX_RETRY);
+        const bool was_connected = wifi_is_connected();
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        if (s_stopping) {
+            return;
+        }
+
+        if (was_connected) {
+            /* Link lost: reconnect straight away, back off only if that fails */
+            ESP_LOGW(TAG, "WiFi disconnected, reason: %d", disconnected->reason);
+            s_outage_start_us = esp_timer_get_time();
+            s_stats.disconnects++;
+            s_attempts = 0;
+            s_backoff_ms = 0;
+            start_attempt();
+            return;
+        }
+
+        s_attempts++;
+        s_stats.failed_attempts++;
+
+        /* The cached AP may have moved channel or gone away */
+        if (s_fast_path && s_attempts >= WIFI_FAST_PATH_TRIES) {
+            ESP_LOGW(TAG, "Cached AP not reachable, scanning all channels");
+            apply_sta_config(false);
+        }
+
+        s_backoff_ms = s_backoff_ms == 0 ? WIFI_BACKOFF_MIN_MS : s_backoff_ms * 2;
+        if (s_backoff_ms > WIFI_BACKOFF_MAX_MS) {
+            s_backoff_ms = WIFI_BACKOFF_MAX_MS;
         }
+        ESP_LOGW(TAG, "Connect attempt %lu failed (reason %d), retrying in %lu ms",
+                 s_attempts, disconnected->reason, s_backoff_ms);
+        esp_timer_stop(s_retry_timer);
+        esp_timer_start_once(s_retry_timer, (uint64_t)s_backoff_ms * 1000ULL);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
         snprintf(device_ip, sizeof(device_ip), IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
+
+        const int64_t now = esp_timer_get_time();
+        s_stats.connects++;
+        s_stats.last_connect_ms = (uint32_t)((now - s_attempt_start_us) / 1000);
+        s_stats.last_outage_ms = (uint32_t)((now - s_outage_start_us) / 1000);
+        s_stats.total_outage_ms += s_stats.last_outage_ms;
+        if (s_stats.last_outage_ms > s_stats.max_outage_ms) {
+            s_stats.max_outage_ms = s_stats.last_outage_ms;
+        }
+        s_stats.fast_path = s_fast_path;
+        ESP_LOGI(TAG, "Connected in %lu ms (%s), offline for %lu ms after %lu failed attempts",
+                 s_stats.last_connect_ms, s_fast_path ? "cached AP" : "full scan",
+                 s_stats.last_outage_ms, s_attempts);
+
+        s_attempts = 0;
+        s_backoff_ms = 0;
+        save_ap_cache();
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
 }
 
-esp_err_t wifi_connect(void)
+esp_err_t wifi_start(void)
 {
-    s_wifi_event_group = xEventGroupCreate();
+    s_wifi_event_group = RTOS_EVENT_GROUP_CREATE();
+    if (s_wifi_event_group == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = retry_timer_cb,
+        .name = "wifi_retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_retry_timer));
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    wifi_prepare_sta(s_sta_netif, g_config.wifi_ssid, g_config.wifi_password, &s_sta_config);
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -68,46 +285,48 @@ esp_err_t wifi_connect(void)
                                                         NULL,
                                                         &instance_got_ip));
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
-    
-    strncpy((char *)wifi_config.sta.ssid, g_config.wifi_ssid, sizeof(wifi_config.sta.ssid));
-    strncpy((char *)wifi_config.sta.password, g_config.wifi_password, sizeof(wifi_config.sta.password));
-    
-    ESP_LOGI(TAG, "WiFi config - SSID: '%s' (len=%d), Password len: %d", 
-             wifi_config.sta.ssid, strlen((char*)wifi_config.sta.ssid), 
-             strlen((char*)wifi_config.sta.password));
-
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    load_ap_cache();
+    apply_sta_config(s_cache_valid);
+
+    ESP_LOGI(TAG, "WiFi config - SSID: '%s' (len=%d), Password len: %d",
+             g_config.wifi_ssid, strlen(g_config.wifi_ssid), strlen(g_config.wifi_password));
+
+    s_stopping = false;
     ESP_ERROR_CHECK(esp_wifi_start());
 
-    ESP_LOGI(TAG, "Connecting to WiFi SSID: %s", g_config.wifi_ssid);
+    ESP_LOGI(TAG, "Connecting to WiFi SSID: %s%s", g_config.wifi_ssid,
+             s_fast_path ? " (cached AP)" : "");
+    return ESP_OK;
+}
+
+esp_err_t wifi_wait_connected(uint32_t timeout_ms)
+{
+    if (s_wifi_event_group == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+            WIFI_CONNECTED_BIT,
             pdFALSE,
             pdFALSE,
-            pdMS_TO_TICKS(20000)); // 20 second timeout
-
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "Connected to WiFi successfully");
-        return ESP_OK;
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGE(TAG, "Failed to connect to WiFi");
-        return ESP_FAIL;
-    } else {
-        ESP_LOGE(TAG, "WiFi connection timeout");
-        return ESP_ERR_TIMEOUT;
+            pdMS_TO_TICKS(timeout_ms));
+
+    return (bits & WIFI_CONNECTED_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+bool wifi_is_connected(void)
+{
+    return s_wifi_event_group != NULL &&
+           (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT) != 0;
+}
+
+void wifi_get_stats(wifi_stats_t *stats)
+{
+    *stats = s_stats;
+    if (!wifi_is_connected() && s_outage_start_us > 0) {
+        stats->current_outage_ms = (uint32_t)((esp_timer_get_time() - s_outage_start_us) / 1000);
     }
 }
 
@@ -116,8 +335,31 @@ const char* wifi_get_ip(void)
     return device_ip;
 }
 
+esp_err_t wifi_restart(void)
+{
+    if (s_retry_timer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGW(TAG, "Restarting WiFi driver after %lu failed attempts", s_attempts);
+    s_stopping = true;
+    esp_timer_stop(s_retry_timer);
+    esp_wifi_stop();
+
+    /* The cached AP may be what keeps failing; scan all channels */
+    apply_sta_config(false);
+    s_attempts = 0;
+    s_backoff_ms = 0;
+    s_stopping = false;
+    return esp_wifi_start();
+}
+
 void wifi_disconnect(void)
 {
+    s_stopping = true;
+    if (s_retry_timer) {
+        esp_timer_stop(s_retry_timer);
+    }
     esp_wifi_stop();
     esp_wifi_deinit();
 }
@@ -1,12 +1,64 @@
 #pragma once
 
 #include "esp_err.h"
+#include "esp_netif.h"
+#include "esp_wifi_types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Connection statistics since boot */
+typedef struct {
+    uint32_t connects;            /* Successful connections (incl. the first) */
+    uint32_t disconnects;         /* Links lost after being connected */
+    uint32_t failed_attempts;     /* Connect attempts that failed */
+    uint32_t last_connect_ms;     /* Last successful attempt: connect to IP */
+    uint32_t last_outage_ms;      /* Last outage: link lost (or boot) to IP */
+    uint32_t max_outage_ms;       /* Longest outage */
+    uint32_t total_outage_ms;     /* Sum of completed outages */
+    uint32_t current_outage_ms;   /* Ongoing outage, 0 while connected */
+    bool fast_path;               /* Last connection used the cached AP */
+} wifi_stats_t;
+
+/**
+ * Initialize WiFi in station mode and start connecting
+ * Returns right away; use wifi_wait_connected() or wifi_is_connected().
+ * The last AP (BSSID + channel) is cached in NVS and tried first. Lost
+ * connections are retried with exponential backoff, never by rebooting.
+ * @return ESP_OK if the driver was started
+ */
+esp_err_t wifi_start(void);
+
+/**
+ * Prepare a station to join a network the way wifi_start() does
+ * Fills the station config (full scan, WPA2 or better) and, with
+ * CHARGER_WIFI_STATIC_IP, stops DHCP on the interface and sets the
+ * static address. Provisioning uses it to check submitted credentials.
+ * @param netif Station interface
+ * @param ssid Network name
+ * @param password Network password
+ * @param cfg Filled in for esp_wifi_set_config()
+ * @return true if a static address is set, so there's no lease to wait for
+ */
+bool wifi_prepare_sta(esp_netif_t *netif, const char *ssid, const char *password, wifi_config_t *cfg);
+
+/**
+ * Wait until the station has an IP address
+ * @param timeout_ms Maximum time to wait
+ * @return ESP_OK when connected, ESP_ERR_TIMEOUT otherwise
+ */
+esp_err_t wifi_wait_connected(uint32_t timeout_ms);
+
+/**
+ * Check whether the station currently has an IP address
+ * @return true if connected
+ */
+bool wifi_is_connected(void);
 
 /**
- * Initialize WiFi in station mode and connect
- * @return ESP_OK on successful connection
+ * Get reconnect latency and outage statistics
+ * @param stats Pointer to store statistics
  */
-esp_err_t wifi_connect(void);
+void wifi_get_stats(wifi_stats_t *stats);
 
 /**
  * Get the device IP address as a string
@@ -14,6 +66,14 @@ esp_err_t wifi_connect(void);
  */
 const char* wifi_get_ip(void);
 
+/**
+ * Stop and start the WiFi driver and connect with a full scan
+ * For outages that backoff retries haven't ended; called by the supervisor.
+ * Outage statistics carry on across the restart.
+ * @return ESP_OK if the driver was started again
+ */
+esp_err_t wifi_restart(void);
+
 /**
  * Disconnect and deinitialize WiFi to save power
  */
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Growable byte buffer */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+void buf_append(buf_t *b, const void *data, size_t len);
+void buf_printf(buf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void buf_consume(buf_t *b, size_t len);
+void buf_free(buf_t *b);
+
+/* Every fd registered with epoll points at one of these */
+typedef struct io_handler {
+    void (*on_event)(struct io_handler *self, uint32_t events);
+} io_handler_t;
+
+/* Resolved HTTP endpoint */
+typedef struct {
+    char host[128];
+    char port[8];
+    char path[128];           /* Prefix for InfluxDB, e.g. "" or "/influx" */
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+} endpoint_t;
+
+/* Command line options */
+typedef struct {
+    int listen_port;          /* 0 = don't accept pushed writes */
+    char **scrape_targets;    /* host[:port] of chargers to poll */
+    int scrape_count;
+    int scrape_interval_ms;
+    bool have_influx;
+    endpoint_t influx;
+    const char *influx_org;
+    const char *influx_bucket;
+    const char *influx_token;
+    const char *accept_token; /* Required token for pushed writes, or NULL */
+    bool to_stdout;           /* Write batches to stdout instead of InfluxDB */
+    int batch_lines;
+    int flush_ms;
+    size_t max_buffer_bytes;
+    int dedupe_window_sec;
+    /* Load test */
+    int sim_devices;
+    int sim_interval_ms;
+    int sim_points;
+    int sim_duplicate_pct;
+    int duration_sec;
+} agg_options_t;
+
+/* Counters (single-threaded: only the event loop writes them) */
+typedef struct {
+    uint64_t requests_in;     /* Pushed write requests */
+    uint64_t points_in;       /* Lines received (pushed + scraped) */
+    uint64_t points_dup;      /* Dropped as already seen */
+    uint64_t points_bad;      /* Unparseable lines */
+    uint64_t points_out;      /* Lines written to the sink */
+    uint64_t points_dropped;  /* Lost to the buffer limit */
+    uint64_t batches_out;
+    uint64_t sink_errors;
+    uint64_t scrapes_ok;
+    uint64_t scrapes_failed;
+} agg_stats_t;
+
+extern agg_options_t g_opt;
+extern agg_stats_t g_stats;
+extern int g_epoll_fd;
+
+/* util.c */
+int64_t now_ms(void);
+int64_t now_ns(void);
+int set_nonblocking(int fd);
+int epoll_add(int fd, uint32_t events, io_handler_t *handler);
+int epoll_mod(int fd, uint32_t events, io_handler_t *handler);
+void epoll_del(int fd);
+int endpoint_parse(endpoint_t *ep, const char *url, const char *default_port);
+int connect_nonblocking(const endpoint_t *ep);
+bool json_get(const char *json, const char *key, char *out, size_t out_len);
+const char *http_find_header(const char *headers, size_t len, const char *name);
+int http_parse_status(const char *resp, size_t len);
+
+/* points.c: dedupe and hand lines to the sink */
+void points_init(void);
+void points_submit(const char *body, size_t len, int64_t precision_mult);
+void points_expire(void);
+
+/* sink.c */
+void sink_init(void);
+void sink_add_line(const char *line, size_t len, int64_t ts_ns);
+void sink_tick(void);
+size_t sink_buffered_lines(void);
+
+/* ingest.c */
+int ingest_start(int port);
+
+/* scrape.c */
+void scrape_init(void);
+void scrape_tick(void);
+
+/* loadtest.c */
+int loadtest_start(void);
+void loadtest_stop(void);
+void loadtest_report(double wall_sec, double loop_cpu_sec);
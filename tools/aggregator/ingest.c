@@ -0,0 +1,236 @@
+#include "agg.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/* Push endpoint
+ *
+ * Speaks enough of the InfluxDB v2 write API for the firmware's
+ * influx_v2 sink: POST /api/v2/write with a line protocol body and
+ * Content-Length. Chargers only need their InfluxDB URL pointed here.
+ * org/bucket in the query are ignored (the aggregator writes to its own);
+ * precision is honoured. Keep-alive connections are supported.
+ */
+
+#define INGEST_MAX_BODY     (1024 * 1024)
+#define INGEST_MAX_HEADERS  8192
+
+typedef struct {
+    io_handler_t handler;
+    int fd;
+    buf_t in;
+    buf_t out;
+    size_t sent;
+    bool close_after;
+} ingest_conn_t;
+
+static io_handler_t s_listen_handler;
+static int s_listen_fd = -1;
+
+static void conn_close(ingest_conn_t *c)
+{
+    epoll_del(c->fd);
+    close(c->fd);
+    buf_free(&c->in);
+    buf_free(&c->out);
+    free(c);
+}
+
+static void respond(ingest_conn_t *c, int status, const char *reason, const char *body)
+{
+    buf_printf(&c->out, "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s\r\n%s",
+               status, reason, strlen(body),
+               c->close_after ? "Connection: close\r\n" : "", body);
+}
+
+static int64_t precision_mult(const char *query)
+{
+    const char *p = query ? strstr(query, "precision=") : NULL;
+    if (p == NULL) {
+        return 1;
+    }
+    p += 10;
+    if (strncmp(p, "ns", 2) == 0) {
+        return 1;
+    } else if (strncmp(p, "us", 2) == 0) {
+        return 1000;
+    } else if (strncmp(p, "ms", 2) == 0) {
+        return 1000000;
+    } else if (*p == 's') {
+        return 1000000000;
+    }
+    return 1;
+}
+
+/* Handle every complete request in the input buffer */
+static void process_requests(ingest_conn_t *c)
+{
+    while (c->in.len > 0) {
+        const char *hdr_end = strstr(c->in.data, "\r\n\r\n");
+        if (hdr_end == NULL) {
+            if (c->in.len > INGEST_MAX_HEADERS) {
+                c->close_after = true;
+                respond(c, 431, "Request Header Fields Too Large", "");
+                c->in.len = 0;
+            }
+            return;
+        }
+        const size_t hdr_len = (size_t)(hdr_end - c->in.data) + 4;
+        const char *cl = http_find_header(c->in.data, hdr_len, "Content-Length");
+        const size_t body_len = cl ? strtoul(cl, NULL, 10) : 0;
+        if (body_len > INGEST_MAX_BODY) {
+            c->close_after = true;
+            respond(c, 413, "Payload Too Large", "");
+            c->in.len = 0;
+            return;
+        }
+        if (c->in.len < hdr_len + body_len) {
+            return;
+        }
+
+        const char *conn_hdr = http_find_header(c->in.data, hdr_len, "Connection");
+        if (conn_hdr && strncasecmp(conn_hdr, "close", 5) == 0) {
+            c->close_after = true;
+        }
+
+        /* Request line: METHOD SP target SP version */
+        char method[8] = "";
+        char target[512] = "";
+        sscanf(c->in.data, "%7s %511s", method, target);
+        char *query = strchr(target, '?');
+        if (query) {
+            *query++ = '\0';
+        }
+
+        if (strcmp(method, "POST") != 0 || strcmp(target, "/api/v2/write") != 0) {
+            respond(c, 404, "Not Found", "");
+        } else if (g_opt.accept_token) {
+            const char *auth = http_find_header(c->in.data, hdr_len, "Authorization");
+            const size_t tok_len = strlen(g_opt.accept_token);
+            if (auth == NULL || strncmp(auth, "Token ", 6) != 0 ||
+                strncmp(auth + 6, g_opt.accept_token, tok_len) != 0 ||
+                (auth[6 + tok_len] != '\r' && auth[6 + tok_len] != '\n')) {
+                respond(c, 401, "Unauthorized", "");
+            } else {
+                g_stats.requests_in++;
+                points_submit(c->in.data + hdr_len, body_len, precision_mult(query));
+                respond(c, 204, "No Content", "");
+            }
+        } else {
+            g_stats.requests_in++;
+            points_submit(c->in.data + hdr_len, body_len, precision_mult(query));
+            respond(c, 204, "No Content", "");
+        }
+
+        buf_consume(&c->in, hdr_len + body_len);
+        if (c->close_after) {
+            c->in.len = 0;
+        }
+    }
+}
+
+static void conn_on_event(io_handler_t *self, uint32_t events)
+{
+    ingest_conn_t *c = (ingest_conn_t *)self;
+
+    if (events & EPOLLIN) {
+        char tmp[16384];
+        ssize_t n;
+        while ((n = recv(c->fd, tmp, sizeof(tmp), 0)) > 0) {
+            buf_append(&c->in, tmp, (size_t)n);
+        }
+        /* Take what was sent even if the peer closed right after */
+        process_requests(c);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            c->close_after = true;
+        }
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        conn_close(c);
+        return;
+    }
+
+    /* Write what we can; wait for EPOLLOUT only when the socket is full */
+    while (c->sent < c->out.len) {
+        const ssize_t n = send(c->fd, c->out.data + c->sent, c->out.len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                epoll_mod(c->fd, EPOLLIN | EPOLLOUT, &c->handler);
+                return;
+            }
+            conn_close(c);
+            return;
+        }
+        c->sent += (size_t)n;
+    }
+    c->out.len = 0;
+    c->sent = 0;
+    if (c->close_after) {
+        conn_close(c);
+        return;
+    }
+    if (events & EPOLLOUT) {
+        epoll_mod(c->fd, EPOLLIN, &c->handler);
+    }
+}
+
+static void listen_on_event(io_handler_t *self, uint32_t events)
+{
+    while (1) {
+        const int fd = accept4(s_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        ingest_conn_t *c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            close(fd);
+            return;
+        }
+        c->fd = fd;
+        c->handler.on_event = conn_on_event;
+        if (epoll_add(fd, EPOLLIN, &c->handler) < 0) {
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+int ingest_start(int port)
+{
+    s_listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s_listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    const int one = 1;
+    const int zero = 0;
+    setsockopt(s_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(s_listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons((uint16_t)port),
+        .sin6_addr = IN6ADDR_ANY_INIT,
+    };
+    if (bind(s_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(s_listen_fd, SOMAXCONN) < 0) {
+        perror("bind/listen");
+        close(s_listen_fd);
+        return -1;
+    }
+
+    s_listen_handler.on_event = listen_on_event;
+    return epoll_add(s_listen_fd, EPOLLIN, &s_listen_handler);
+}
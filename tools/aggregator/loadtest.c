@@ -0,0 +1,283 @@
+#include "agg.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Load test
+ *
+ * Simulated chargers run in their own thread with their own epoll loop and
+ * push to the aggregator's listener on loopback exactly like the firmware
+ * does: a new connection per batch, Connection: close, sim_points lines
+ * per POST. A share of batches is re-sent to exercise dedupe. Only the
+ * aggregator's event loop thread is charged for the capacity estimate.
+ */
+
+#define SIM_LATENCY_BUCKETS  20000   /* 100 us each, up to 2 s */
+#define SIM_LATENCY_STEP_US  100
+
+typedef enum {
+    SIM_IDLE,
+    SIM_SENDING,
+    SIM_READING,
+} sim_state_t;
+
+typedef struct {
+    int index;
+    int fd;
+    sim_state_t state;
+    buf_t out;
+    size_t sent;
+    char in[256];
+    size_t in_len;
+    int64_t next_us;
+    int64_t started_us;
+    int64_t ts_ns;           /* Timestamp of the next point */
+    uint32_t charging_sec;
+    bool have_last;
+} sim_device_t;
+
+static pthread_t s_thread;
+static atomic_bool s_stop;
+static int s_sim_epoll = -1;
+static sim_device_t *s_devices = NULL;
+static struct sockaddr_in s_target;
+
+static uint64_t s_batches_sent = 0;
+static uint64_t s_batches_ok = 0;
+static uint64_t s_batches_failed = 0;
+static uint64_t s_points_sent = 0;
+static uint64_t s_latency_hist[SIM_LATENCY_BUCKETS + 1];
+static int64_t s_latency_max_us = 0;
+static double s_sim_cpu_sec = 0;
+
+static int64_t mono_us(void)
+{
+    return now_ms() * 1000;
+}
+
+static void build_batch(sim_device_t *d)
+{
+    buf_t body = {0};
+    const int64_t step_ns = (int64_t)g_opt.sim_interval_ms * 1000000LL / g_opt.sim_points;
+
+    for (int i = 0; i < g_opt.sim_points; i++) {
+        buf_printf(&body,
+                   "battery_charging,device=sim-%05d,cell_id=CELL-SIM%05d "
+                   "voltage=%.3f,percentage=%.1f,temp=%.1f,charge_state=\"Charging\","
+                   "charging_time_sec=%ui,cell_present=true,"
+                   "sample_interval_ms=1000i,upload_interval_sec=%di,"
+                   "sched_mode=\"normal\",sched_reason=\"default\" %lld\n",
+                   d->index, d->index, 3.6 + (d->charging_sec % 3600) / 6000.0,
+                   50.0 + (d->charging_sec % 3600) / 72.0, 27.5,
+                   d->charging_sec, g_opt.sim_interval_ms / 1000, (long long)d->ts_ns);
+        d->ts_ns += step_ns;
+        d->charging_sec += (uint32_t)(step_ns / 1000000000LL);
+    }
+
+    d->out.len = 0;
+    buf_printf(&d->out,
+               "POST /api/v2/write?org=sim&bucket=sim&precision=ns HTTP/1.1\r\n"
+               "Host: aggregator\r\n"
+               "Authorization: Token %s\r\n"
+               "Content-Type: text/plain\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n\r\n",
+               g_opt.accept_token ? g_opt.accept_token : "sim", body.len);
+    buf_append(&d->out, body.data, body.len);
+    buf_free(&body);
+    d->have_last = true;
+}
+
+static void sim_finish(sim_device_t *d, bool ok)
+{
+    epoll_ctl(s_sim_epoll, EPOLL_CTL_DEL, d->fd, NULL);
+    close(d->fd);
+    d->fd = -1;
+    d->state = SIM_IDLE;
+
+    if (ok) {
+        s_batches_ok++;
+        const int64_t lat = mono_us() - d->started_us;
+        const int64_t bucket = lat / SIM_LATENCY_STEP_US;
+        s_latency_hist[bucket < SIM_LATENCY_BUCKETS ? bucket : SIM_LATENCY_BUCKETS]++;
+        if (lat > s_latency_max_us) {
+            s_latency_max_us = lat;
+        }
+    } else {
+        s_batches_failed++;
+    }
+}
+
+static void sim_start(sim_device_t *d)
+{
+    /* Occasionally re-send the previous batch, as after a lost response */
+    const bool resend = d->have_last && (rand() % 100) < g_opt.sim_duplicate_pct;
+    if (!resend) {
+        build_batch(d);
+    }
+
+    d->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (d->fd < 0) {
+        s_batches_failed++;
+        return;
+    }
+    if (connect(d->fd, (struct sockaddr *)&s_target, sizeof(s_target)) < 0 && errno != EINPROGRESS) {
+        close(d->fd);
+        d->fd = -1;
+        s_batches_failed++;
+        return;
+    }
+    d->state = SIM_SENDING;
+    d->sent = 0;
+    d->in_len = 0;
+    d->started_us = mono_us();
+    s_batches_sent++;
+    s_points_sent += (uint64_t)g_opt.sim_points;
+
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = d };
+    epoll_ctl(s_sim_epoll, EPOLL_CTL_ADD, d->fd, &ev);
+}
+
+static void sim_on_event(sim_device_t *d, uint32_t events)
+{
+    if (d->state == SIM_SENDING && (events & EPOLLOUT)) {
+        const ssize_t n = send(d->fd, d->out.data + d->sent, d->out.len - d->sent, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN) {
+            sim_finish(d, false);
+            return;
+        }
+        if (n > 0) {
+            d->sent += (size_t)n;
+        }
+        if (d->sent == d->out.len) {
+            d->state = SIM_READING;
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = d };
+            epoll_ctl(s_sim_epoll, EPOLL_CTL_MOD, d->fd, &ev);
+        }
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ssize_t n;
+        while ((n = recv(d->fd, d->in + d->in_len, sizeof(d->in) - 1 - d->in_len, 0)) > 0) {
+            d->in_len += (size_t)n;
+            if (d->in_len == sizeof(d->in) - 1) {
+                break;
+            }
+        }
+        d->in[d->in_len] = '\0';
+        if (strstr(d->in, "\r\n\r\n") || n == 0 || (n < 0 && errno != EAGAIN)) {
+            const int status = http_parse_status(d->in, d->in_len);
+            sim_finish(d, status >= 200 && status < 300);
+        }
+    }
+}
+
+static void *sim_thread(void *arg)
+{
+    struct epoll_event events[256];
+
+    while (!atomic_load(&s_stop)) {
+        const int n = epoll_wait(s_sim_epoll, events, 256, 2);
+        for (int i = 0; i < n; i++) {
+            sim_on_event(events[i].data.ptr, events[i].events);
+        }
+
+        const int64_t now = mono_us();
+        for (int i = 0; i < g_opt.sim_devices; i++) {
+            sim_device_t *d = &s_devices[i];
+            if (d->state == SIM_IDLE && now >= d->next_us) {
+                d->next_us += (int64_t)g_opt.sim_interval_ms * 1000;
+                sim_start(d);
+            }
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    s_sim_cpu_sec = ts.tv_sec + ts.tv_nsec / 1e9;
+    return NULL;
+}
+
+int loadtest_start(void)
+{
+    s_sim_epoll = epoll_create1(EPOLL_CLOEXEC);
+    s_devices = calloc((size_t)g_opt.sim_devices, sizeof(*s_devices));
+    if (s_sim_epoll < 0 || s_devices == NULL) {
+        perror("loadtest");
+        return -1;
+    }
+
+    s_target.sin_family = AF_INET;
+    s_target.sin_port = htons((uint16_t)g_opt.listen_port);
+    s_target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* Devices start at random offsets within one interval, like real ones */
+    const int64_t now = mono_us();
+    const int64_t ts0 = now_ns();
+    for (int i = 0; i < g_opt.sim_devices; i++) {
+        sim_device_t *d = &s_devices[i];
+        d->index = i;
+        d->fd = -1;
+        d->next_us = now + (rand() % (g_opt.sim_interval_ms * 1000));
+        d->ts_ns = ts0 + (int64_t)i;
+    }
+
+    atomic_store(&s_stop, false);
+    return pthread_create(&s_thread, NULL, sim_thread, NULL);
+}
+
+static double latency_percentile(uint64_t total, double pct)
+{
+    const uint64_t target = (uint64_t)(total * pct);
+    uint64_t seen = 0;
+    for (int i = 0; i <= SIM_LATENCY_BUCKETS; i++) {
+        seen += s_latency_hist[i];
+        if (seen > target) {
+            return (i + 1) * SIM_LATENCY_STEP_US / 1000.0;
+        }
+    }
+    return s_latency_max_us / 1000.0;
+}
+
+void loadtest_stop(void)
+{
+    atomic_store(&s_stop, true);
+    pthread_join(s_thread, NULL);
+}
+
+void loadtest_report(double wall_sec, double loop_cpu_sec)
+{
+    const double cpu_frac = wall_sec > 0 ? loop_cpu_sec / wall_sec : 0;
+    const double offered_pps = s_points_sent / wall_sec;
+
+    printf("\n=== Load test: %d simulated chargers, %d points every %d ms ===\n",
+           g_opt.sim_devices, g_opt.sim_points, g_opt.sim_interval_ms);
+    printf("duration            %.1f s\n", wall_sec);
+    printf("batches             %llu sent, %llu ok, %llu failed\n",
+           (unsigned long long)s_batches_sent, (unsigned long long)s_batches_ok,
+           (unsigned long long)s_batches_failed);
+    printf("points              %llu sent (%.0f/s), %llu received, %llu duplicates dropped\n",
+           (unsigned long long)s_points_sent, offered_pps,
+           (unsigned long long)g_stats.points_in, (unsigned long long)g_stats.points_dup);
+    printf("written             %llu points in %llu batches (%.0f points/batch)\n",
+           (unsigned long long)g_stats.points_out, (unsigned long long)g_stats.batches_out,
+           g_stats.batches_out ? (double)g_stats.points_out / g_stats.batches_out : 0);
+    printf("ack latency         p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+           latency_percentile(s_batches_ok, 0.50), latency_percentile(s_batches_ok, 0.99),
+           s_latency_max_us / 1000.0);
+    printf("aggregator CPU      %.1f%% of one core\n", cpu_frac * 100.0);
+    printf("simulator CPU       %.1f%% of one core%s\n", s_sim_cpu_sec / wall_sec * 100.0,
+           s_sim_cpu_sec / wall_sec > 0.8 ? " (saturated: latency includes simulator queueing)" : "");
+    if (cpu_frac > 0) {
+        printf("estimated capacity  ~%.0f chargers at this rate per core (CPU bound)\n",
+               g_opt.sim_devices / cpu_frac);
+    }
+}
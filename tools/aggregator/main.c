@@ -0,0 +1,282 @@
+/* Charger telemetry aggregator
+ *
+ * Fans in telemetry from many chargers and writes it to InfluxDB in large
+ * batches with a single token:
+ * - push: chargers point their InfluxDB URL at --listen; their batched
+ *   line protocol writes are accepted as-is
+ * - pull: --scrape polls /api/data on each charger
+ * Points are deduplicated on (series, timestamp) and coalesced into writes
+ * of up to --batch-lines lines. Everything runs on one epoll loop.
+ *
+ * --simulate N adds N simulated chargers (in a second thread) pushing to
+ * the listener, and reports throughput, latency and an estimate of how
+ * many chargers one aggregator core can take.
+ */
+
+#include "agg.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOOP_TICK_MS         10
+#define STATS_INTERVAL_MS    10000
+#define SHUTDOWN_FLUSH_MS    5000
+
+agg_options_t g_opt;
+agg_stats_t g_stats;
+int g_epoll_fd = -1;
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void on_signal(int sig)
+{
+    s_stop = 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Input:\n"
+        "  --listen PORT            Accept InfluxDB v2 writes from chargers (default 8086, 0 = off)\n"
+        "  --accept-token TOKEN     Require this token on pushed writes\n"
+        "  --scrape HOST[:PORT]     Poll /api/data on a charger (repeatable)\n"
+        "  --scrape-interval MS     Poll interval (default 1000)\n"
+        "\n"
+        "Output:\n"
+        "  --influx-url URL         InfluxDB base URL (http only), e.g. http://influx:8086\n"
+        "  --org ORG --bucket BUCKET\n"
+        "  --token TOKEN            InfluxDB token (default $INFLUX_TOKEN)\n"
+        "  --stdout                 Write line protocol to stdout instead\n"
+        "  --batch-lines N          Lines per write (default 5000)\n"
+        "  --flush-ms MS            Max time a line waits for a batch (default 1000)\n"
+        "  --max-buffer-mb MB       Buffered data kept while InfluxDB is down (default 64)\n"
+        "  --dedupe-window SEC      How long points are remembered (default 600)\n"
+        "\n"
+        "Load test:\n"
+        "  --simulate N             Run N simulated chargers against --listen\n"
+        "  --sim-interval MS        Upload interval per charger (default 10000)\n"
+        "  --sim-points N           Points per upload (default 16)\n"
+        "  --sim-dup-pct PCT        Share of uploads re-sent (default 2)\n"
+        "  --duration SEC           Stop after SEC seconds (default: run until ^C; 30 with --simulate)\n",
+        prog);
+}
+
+static void parse_args(int argc, char **argv)
+{
+    enum {
+        OPT_LISTEN = 1, OPT_ACCEPT_TOKEN, OPT_SCRAPE, OPT_SCRAPE_INTERVAL, OPT_INFLUX_URL,
+        OPT_ORG, OPT_BUCKET, OPT_TOKEN, OPT_STDOUT, OPT_BATCH_LINES, OPT_FLUSH_MS,
+        OPT_MAX_BUFFER, OPT_DEDUPE, OPT_SIMULATE, OPT_SIM_INTERVAL, OPT_SIM_POINTS,
+        OPT_SIM_DUP, OPT_DURATION, OPT_HELP,
+    };
+    static const struct option options[] = {
+        { "listen", required_argument, NULL, OPT_LISTEN },
+        { "accept-token", required_argument, NULL, OPT_ACCEPT_TOKEN },
+        { "scrape", required_argument, NULL, OPT_SCRAPE },
+        { "scrape-interval", required_argument, NULL, OPT_SCRAPE_INTERVAL },
+        { "influx-url", required_argument, NULL, OPT_INFLUX_URL },
+        { "org", required_argument, NULL, OPT_ORG },
+        { "bucket", required_argument, NULL, OPT_BUCKET },
+        { "token", required_argument, NULL, OPT_TOKEN },
+        { "stdout", no_argument, NULL, OPT_STDOUT },
+        { "batch-lines", required_argument, NULL, OPT_BATCH_LINES },
+        { "flush-ms", required_argument, NULL, OPT_FLUSH_MS },
+        { "max-buffer-mb", required_argument, NULL, OPT_MAX_BUFFER },
+        { "dedupe-window", required_argument, NULL, OPT_DEDUPE },
+        { "simulate", required_argument, NULL, OPT_SIMULATE },
+        { "sim-interval", required_argument, NULL, OPT_SIM_INTERVAL },
+        { "sim-points", required_argument, NULL, OPT_SIM_POINTS },
+        { "sim-dup-pct", required_argument, NULL, OPT_SIM_DUP },
+        { "duration", required_argument, NULL, OPT_DURATION },
+        { "help", no_argument, NULL, OPT_HELP },
+        { NULL, 0, NULL, 0 },
+    };
+
+    g_opt.listen_port = 8086;
+    g_opt.scrape_interval_ms = 1000;
+    g_opt.influx_token = getenv("INFLUX_TOKEN");
+    g_opt.batch_lines = 5000;
+    g_opt.flush_ms = 1000;
+    g_opt.max_buffer_bytes = 64u * 1024 * 1024;
+    g_opt.dedupe_window_sec = 600;
+    g_opt.sim_interval_ms = 10000;
+    g_opt.sim_points = 16;
+    g_opt.sim_duplicate_pct = 2;
+    g_opt.duration_sec = -1;
+
+    const char *influx_url = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (c) {
+        case OPT_LISTEN:          g_opt.listen_port = atoi(optarg); break;
+        case OPT_ACCEPT_TOKEN:    g_opt.accept_token = optarg; break;
+        case OPT_SCRAPE:
+            g_opt.scrape_targets = realloc(g_opt.scrape_targets,
+                                           sizeof(char *) * (size_t)(g_opt.scrape_count + 1));
+            g_opt.scrape_targets[g_opt.scrape_count++] = optarg;
+            break;
+        case OPT_SCRAPE_INTERVAL: g_opt.scrape_interval_ms = atoi(optarg); break;
+        case OPT_INFLUX_URL:      influx_url = optarg; break;
+        case OPT_ORG:             g_opt.influx_org = optarg; break;
+        case OPT_BUCKET:          g_opt.influx_bucket = optarg; break;
+        case OPT_TOKEN:           g_opt.influx_token = optarg; break;
+        case OPT_STDOUT:          g_opt.to_stdout = true; break;
+        case OPT_BATCH_LINES:     g_opt.batch_lines = atoi(optarg); break;
+        case OPT_FLUSH_MS:        g_opt.flush_ms = atoi(optarg); break;
+        case OPT_MAX_BUFFER:      g_opt.max_buffer_bytes = strtoul(optarg, NULL, 10) * 1024 * 1024; break;
+        case OPT_DEDUPE:          g_opt.dedupe_window_sec = atoi(optarg); break;
+        case OPT_SIMULATE:        g_opt.sim_devices = atoi(optarg); break;
+        case OPT_SIM_INTERVAL:    g_opt.sim_interval_ms = atoi(optarg); break;
+        case OPT_SIM_POINTS:      g_opt.sim_points = atoi(optarg); break;
+        case OPT_SIM_DUP:         g_opt.sim_duplicate_pct = atoi(optarg); break;
+        case OPT_DURATION:        g_opt.duration_sec = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            exit(c == OPT_HELP ? 0 : 2);
+        }
+    }
+
+    if (influx_url) {
+        if (!g_opt.influx_org || !g_opt.influx_bucket || !g_opt.influx_token) {
+            fprintf(stderr, "--influx-url needs --org, --bucket and --token (or $INFLUX_TOKEN)\n");
+            exit(2);
+        }
+        if (endpoint_parse(&g_opt.influx, influx_url, "8086") != 0) {
+            exit(2);
+        }
+        g_opt.have_influx = true;
+    } else if (!g_opt.to_stdout && g_opt.sim_devices == 0) {
+        fprintf(stderr, "Need --influx-url or --stdout\n");
+        usage(argv[0]);
+        exit(2);
+    }
+    if (g_opt.sim_devices > 0 && g_opt.listen_port == 0) {
+        fprintf(stderr, "--simulate needs --listen\n");
+        exit(2);
+    }
+    if (g_opt.listen_port == 0 && g_opt.scrape_count == 0) {
+        fprintf(stderr, "Nothing to do: no --listen port and no --scrape targets\n");
+        exit(2);
+    }
+    if (g_opt.batch_lines <= 0 || g_opt.flush_ms <= 0 || g_opt.scrape_interval_ms <= 0 ||
+        g_opt.sim_interval_ms <= 0 || g_opt.sim_points <= 0 || g_opt.dedupe_window_sec <= 0) {
+        fprintf(stderr, "Intervals and counts must be positive\n");
+        exit(2);
+    }
+    if (g_opt.duration_sec < 0) {
+        g_opt.duration_sec = g_opt.sim_devices > 0 ? 30 : 0;
+    }
+}
+
+static double thread_cpu_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_stats(void)
+{
+    fprintf(stderr,
+            "in %llu (req %llu, dup %llu, bad %llu) | out %llu in %llu batches, "
+            "buffered %zu, dropped %llu, errors %llu | scrapes %llu ok / %llu failed\n",
+            (unsigned long long)g_stats.points_in, (unsigned long long)g_stats.requests_in,
+            (unsigned long long)g_stats.points_dup, (unsigned long long)g_stats.points_bad,
+            (unsigned long long)g_stats.points_out, (unsigned long long)g_stats.batches_out,
+            sink_buffered_lines(), (unsigned long long)g_stats.points_dropped,
+            (unsigned long long)g_stats.sink_errors, (unsigned long long)g_stats.scrapes_ok,
+            (unsigned long long)g_stats.scrapes_failed);
+}
+
+static void run_loop(int64_t until_ms)
+{
+    struct epoll_event events[512];
+
+    while (!s_stop && (until_ms == 0 || now_ms() < until_ms)) {
+        const int n = epoll_wait(g_epoll_fd, events, 512, LOOP_TICK_MS);
+        for (int i = 0; i < n; i++) {
+            io_handler_t *h = events[i].data.ptr;
+            h->on_event(h, events[i].events);
+        }
+        scrape_tick();
+        points_expire();
+        sink_tick();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+
+    /* One fd per charger connection */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    points_init();
+    sink_init();
+    scrape_init();
+    if (g_opt.listen_port > 0 && ingest_start(g_opt.listen_port) != 0) {
+        return 1;
+    }
+    fprintf(stderr, "aggregator: listening on %d, %d scrape targets, writing to %s\n",
+            g_opt.listen_port, g_opt.scrape_count,
+            g_opt.have_influx ? g_opt.influx.host : g_opt.to_stdout ? "stdout" : "nowhere (load test)");
+
+    if (g_opt.sim_devices > 0 && loadtest_start() != 0) {
+        return 1;
+    }
+
+    const int64_t start_ms = now_ms();
+    const double start_cpu = thread_cpu_sec();
+    const int64_t end_ms = g_opt.duration_sec > 0 ? start_ms + g_opt.duration_sec * 1000LL : 0;
+
+    while (!s_stop && (end_ms == 0 || now_ms() < end_ms)) {
+        int64_t until = now_ms() + STATS_INTERVAL_MS;
+        if (end_ms && until > end_ms) {
+            until = end_ms;
+        }
+        run_loop(until);
+        print_stats();
+    }
+
+    const double wall_sec = (now_ms() - start_ms) / 1000.0;
+    const double loop_cpu = thread_cpu_sec() - start_cpu;
+    if (g_opt.sim_devices > 0) {
+        loadtest_stop();
+    }
+
+    /* Give buffered points a last chance to go out */
+    s_stop = 0;
+    const int64_t flush_until = now_ms() + SHUTDOWN_FLUSH_MS;
+    g_opt.flush_ms = 1;
+    while (sink_buffered_lines() > 0 && now_ms() < flush_until && !s_stop) {
+        run_loop(now_ms() + LOOP_TICK_MS);
+    }
+    print_stats();
+
+    if (g_opt.sim_devices > 0) {
+        loadtest_report(wall_sec, loop_cpu);
+    }
+    return 0;
+}
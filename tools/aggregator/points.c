@@ -0,0 +1,186 @@
+#include "agg.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Duplicate detection
+ *
+ * A point is identified by its series (measurement + tag set) and its
+ * timestamp; the same pair seen again within the window is dropped. This
+ * catches batches a charger re-sends after a timeout and points that
+ * arrive both pushed and scraped. Two open-addressed sets of 64-bit keys
+ * are kept and rotated every half window, so nothing needs deleting.
+ */
+
+typedef struct {
+    uint64_t *slots;      /* 0 = empty */
+    size_t mask;
+    size_t used;
+} keyset_t;
+
+static keyset_t s_sets[2];
+static int s_current = 0;
+static int64_t s_rotated_ms = 0;
+
+static uint64_t hash_point(const char *series, size_t len, int64_t ts_ns)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)series[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= (uint64_t)ts_ns + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h ? h : 1;
+}
+
+static void keyset_init(keyset_t *set, size_t size)
+{
+    free(set->slots);
+    set->slots = calloc(size, sizeof(uint64_t));
+    if (set->slots == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    set->mask = size - 1;
+    set->used = 0;
+}
+
+static bool keyset_contains(const keyset_t *set, uint64_t key)
+{
+    for (size_t i = key & set->mask;; i = (i + 1) & set->mask) {
+        if (set->slots[i] == 0) {
+            return false;
+        }
+        if (set->slots[i] == key) {
+            return true;
+        }
+    }
+}
+
+static void keyset_insert(keyset_t *set, uint64_t key);
+
+static void keyset_grow(keyset_t *set)
+{
+    keyset_t bigger = {0};
+    keyset_init(&bigger, (set->mask + 1) * 2);
+    for (size_t i = 0; i <= set->mask; i++) {
+        if (set->slots[i]) {
+            keyset_insert(&bigger, set->slots[i]);
+        }
+    }
+    free(set->slots);
+    *set = bigger;
+}
+
+static void keyset_insert(keyset_t *set, uint64_t key)
+{
+    if ((set->used + 1) * 2 > set->mask + 1) {
+        keyset_grow(set);
+    }
+    for (size_t i = key & set->mask;; i = (i + 1) & set->mask) {
+        if (set->slots[i] == 0) {
+            set->slots[i] = key;
+            set->used++;
+            return;
+        }
+        if (set->slots[i] == key) {
+            return;
+        }
+    }
+}
+
+void points_init(void)
+{
+    keyset_init(&s_sets[0], 4096);
+    keyset_init(&s_sets[1], 4096);
+    s_rotated_ms = now_ms();
+}
+
+void points_expire(void)
+{
+    const int64_t half_window_ms = (int64_t)g_opt.dedupe_window_sec * 500;
+    if (now_ms() - s_rotated_ms < half_window_ms) {
+        return;
+    }
+    /* Forget the older half; start a fresh set sized for the current rate */
+    s_current ^= 1;
+    size_t size = 4096;
+    while (size < s_sets[s_current ^ 1].used * 2) {
+        size *= 2;
+    }
+    keyset_init(&s_sets[s_current], size);
+    s_rotated_ms = now_ms();
+}
+
+/* End of the series key: first space not escaped with a backslash */
+static size_t series_len(const char *line, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '\\') {
+            i++;
+        } else if (line[i] == ' ') {
+            return i;
+        }
+    }
+    return len;
+}
+
+static void submit_line(const char *line, size_t len, int64_t precision_mult)
+{
+    g_stats.points_in++;
+
+    const size_t key_len = series_len(line, len);
+    if (key_len == 0 || key_len >= len) {
+        g_stats.points_bad++;
+        return;
+    }
+
+    /* Optional trailing timestamp */
+    int64_t ts_ns = 0;
+    size_t body_len = len;
+    const char *sp = line + len;
+    while (sp > line + key_len && sp[-1] != ' ') {
+        sp--;
+    }
+    const size_t tail = (size_t)(line + len - sp);
+    bool numeric = tail > 0 && sp > line + key_len + 1;
+    for (size_t i = 0; numeric && i < tail; i++) {
+        numeric = isdigit((unsigned char)sp[i]) || (i == 0 && sp[i] == '-');
+    }
+    if (numeric) {
+        ts_ns = strtoll(sp, NULL, 10) * precision_mult;
+        body_len = (size_t)(sp - line - 1);
+    } else {
+        ts_ns = now_ns();
+    }
+
+    const uint64_t key = hash_point(line, key_len, ts_ns);
+    if (keyset_contains(&s_sets[0], key) || keyset_contains(&s_sets[1], key)) {
+        g_stats.points_dup++;
+        return;
+    }
+    keyset_insert(&s_sets[s_current], key);
+
+    sink_add_line(line, body_len, ts_ns);
+}
+
+void points_submit(const char *body, size_t len, int64_t precision_mult)
+{
+    const char *p = body;
+    const char *end = body + len;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *line_end = eol ? eol : end;
+        size_t n = (size_t)(line_end - p);
+        while (n > 0 && (p[n - 1] == '\r' || p[n - 1] == ' ')) {
+            n--;
+        }
+        if (n > 0 && p[0] != '#') {
+            submit_line(p, n, precision_mult);
+        }
+        p = eol ? eol + 1 : end;
+    }
+}
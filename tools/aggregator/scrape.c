@@ -0,0 +1,227 @@
+#include "agg.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/* Pull mode
+ *
+ * Polls /api/data on every target each scrape interval, all requests in
+ * flight at once on the shared epoll loop. Each response becomes one
+ * battery_charging point stamped with the device's own timestamp_ms, so
+ * polling faster than the charger samples yields duplicates that the
+ * dedupe step drops. Responses from chargers whose clock isn't synced
+ * yet are skipped.
+ */
+
+#define SCRAPE_TIMEOUT_MS   5000
+#define SCRAPE_MAX_RESPONSE 16384
+
+typedef struct {
+    io_handler_t handler;
+    endpoint_t ep;
+    int fd;
+    buf_t out;
+    size_t sent;
+    buf_t in;
+    int64_t next_ms;
+    int64_t deadline_ms;
+} scrape_target_t;
+
+static scrape_target_t *s_targets = NULL;
+
+/* Escape commas, spaces and equals signs in a tag value */
+static void append_tag(buf_t *b, const char *value)
+{
+    for (const char *p = value; *p; p++) {
+        if (*p == ',' || *p == ' ' || *p == '=') {
+            buf_append(b, "\\", 1);
+        }
+        buf_append(b, p, 1);
+    }
+}
+
+static void handle_response(scrape_target_t *t)
+{
+    const char *body = t->in.data ? strstr(t->in.data, "\r\n\r\n") : NULL;
+    if (body == NULL || http_parse_status(t->in.data, t->in.len) != 200) {
+        g_stats.scrapes_failed++;
+        return;
+    }
+    body += 4;
+
+    char synced[8], ts_ms[24], device[64], cell[32], voltage[24], pct[24], temp[24];
+    char state[32], charging[24], present[8];
+    if (!json_get(body, "timestamp_ms", ts_ms, sizeof(ts_ms)) ||
+        !json_get(body, "device_id", device, sizeof(device)) ||
+        !json_get(body, "voltage", voltage, sizeof(voltage))) {
+        g_stats.scrapes_failed++;
+        return;
+    }
+    g_stats.scrapes_ok++;
+    if (json_get(body, "time_synced", synced, sizeof(synced)) && strcmp(synced, "true") != 0) {
+        return;
+    }
+    if (!json_get(body, "cell_id", cell, sizeof(cell)) || cell[0] == '\0') {
+        strcpy(cell, "none");
+    }
+    if (!json_get(body, "percentage", pct, sizeof(pct))) {
+        strcpy(pct, "0");
+    }
+    if (!json_get(body, "temperature", temp, sizeof(temp))) {
+        strcpy(temp, "0");
+    }
+    if (!json_get(body, "charge_state", state, sizeof(state))) {
+        strcpy(state, "Unknown");
+    }
+    if (!json_get(body, "charging_time_sec", charging, sizeof(charging))) {
+        strcpy(charging, "0");
+    }
+    if (!json_get(body, "cell_present", present, sizeof(present))) {
+        strcpy(present, "false");
+    }
+
+    /* Same measurement and field names as the firmware's own upload */
+    buf_t line = {0};
+    buf_append(&line, "battery_charging,device=", 24);
+    append_tag(&line, device);
+    buf_append(&line, ",cell_id=", 9);
+    append_tag(&line, cell);
+    buf_printf(&line, " voltage=%s,percentage=%s,temp=%s,charge_state=\"%s\","
+               "charging_time_sec=%si,cell_present=%s %lld",
+               voltage, pct, temp, state, charging, present,
+               (long long)(strtod(ts_ms, NULL) * 1e6));
+    points_submit(line.data, line.len, 1);
+    buf_free(&line);
+}
+
+static void target_done(scrape_target_t *t, bool ok)
+{
+    if (ok) {
+        handle_response(t);
+    } else {
+        g_stats.scrapes_failed++;
+    }
+    epoll_del(t->fd);
+    close(t->fd);
+    t->fd = -1;
+}
+
+static void target_on_event(io_handler_t *self, uint32_t events)
+{
+    scrape_target_t *t = (scrape_target_t *)self;
+
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        target_done(t, false);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && t->sent < t->out.len) {
+        const ssize_t n = send(t->fd, t->out.data + t->sent, t->out.len - t->sent, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN) {
+            target_done(t, false);
+            return;
+        }
+        if (n > 0) {
+            t->sent += (size_t)n;
+        }
+        if (t->sent == t->out.len) {
+            epoll_mod(t->fd, EPOLLIN, &t->handler);
+        }
+    }
+
+    if (events & EPOLLIN) {
+        char tmp[4096];
+        ssize_t n;
+        while ((n = recv(t->fd, tmp, sizeof(tmp), 0)) > 0) {
+            buf_append(&t->in, tmp, (size_t)n);
+        }
+        if (t->in.len > SCRAPE_MAX_RESPONSE) {
+            target_done(t, false);
+            return;
+        }
+
+        /* esp_http_server sends Content-Length; don't wait for the close */
+        const char *hdr_end = t->in.data ? strstr(t->in.data, "\r\n\r\n") : NULL;
+        if (hdr_end) {
+            const size_t hdr_len = (size_t)(hdr_end - t->in.data) + 4;
+            const char *cl = http_find_header(t->in.data, hdr_len, "Content-Length");
+            if (cl && t->in.len >= hdr_len + strtoul(cl, NULL, 10)) {
+                target_done(t, true);
+                return;
+            }
+        }
+        if (n == 0) {
+            target_done(t, hdr_end != NULL);
+        } else if (n < 0 && errno != EAGAIN) {
+            target_done(t, false);
+        }
+    }
+}
+
+static void target_start(scrape_target_t *t)
+{
+    t->fd = connect_nonblocking(&t->ep);
+    if (t->fd < 0) {
+        g_stats.scrapes_failed++;
+        return;
+    }
+    t->out.len = 0;
+    t->in.len = 0;
+    t->sent = 0;
+    buf_printf(&t->out, "GET /api/data HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", t->ep.host);
+    t->deadline_ms = now_ms() + SCRAPE_TIMEOUT_MS;
+    t->handler.on_event = target_on_event;
+    if (epoll_add(t->fd, EPOLLOUT | EPOLLIN, &t->handler) < 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+}
+
+void scrape_init(void)
+{
+    if (g_opt.scrape_count == 0) {
+        return;
+    }
+    s_targets = calloc((size_t)g_opt.scrape_count, sizeof(*s_targets));
+    if (s_targets == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    const int64_t now = now_ms();
+    for (int i = 0; i < g_opt.scrape_count; i++) {
+        scrape_target_t *t = &s_targets[i];
+        t->fd = -1;
+        if (endpoint_parse(&t->ep, g_opt.scrape_targets[i], "80") != 0) {
+            exit(1);
+        }
+        /* Spread the polls over the interval */
+        t->next_ms = now + (int64_t)g_opt.scrape_interval_ms * i / g_opt.scrape_count;
+    }
+}
+
+void scrape_tick(void)
+{
+    const int64_t now = now_ms();
+
+    for (int i = 0; i < g_opt.scrape_count; i++) {
+        scrape_target_t *t = &s_targets[i];
+        if (t->fd >= 0) {
+            if (now > t->deadline_ms) {
+                target_done(t, false);
+            }
+            continue;
+        }
+        if (now >= t->next_ms) {
+            t->next_ms += g_opt.scrape_interval_ms;
+            if (t->next_ms < now) {
+                t->next_ms = now + g_opt.scrape_interval_ms;
+            }
+            target_start(t);
+        }
+    }
+}
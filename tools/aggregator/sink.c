@@ -0,0 +1,254 @@
+#include "agg.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/* Batched writer
+ *
+ * Accepted lines collect in s_pending and go out as one InfluxDB write
+ * when batch_lines is reached or the oldest line is flush_ms old. Only one
+ * write is in flight; a failed batch goes back to the front of s_pending
+ * and is retried with backoff. Past max_buffer_bytes the oldest lines are
+ * dropped so an InfluxDB outage can't exhaust memory.
+ */
+
+#define SINK_TIMEOUT_MS      10000
+#define SINK_BACKOFF_MIN_MS  500
+#define SINK_BACKOFF_MAX_MS  30000
+
+typedef struct {
+    io_handler_t handler;
+    int fd;
+    buf_t out;
+    size_t sent;
+    buf_t in;
+    buf_t batch;           /* Body, kept for a retry */
+    size_t lines;
+    int64_t deadline_ms;
+} sink_conn_t;
+
+static buf_t s_pending;
+static size_t s_pending_lines = 0;
+static int64_t s_pending_since_ms = 0;
+
+static sink_conn_t s_conn = { .fd = -1 };
+static int64_t s_retry_at_ms = 0;
+static int s_backoff_ms = 0;
+
+void sink_init(void)
+{
+    s_pending_lines = 0;
+}
+
+size_t sink_buffered_lines(void)
+{
+    return s_pending_lines + (s_conn.fd >= 0 ? s_conn.lines : 0);
+}
+
+/* Drop whole lines from the front until the buffer fits */
+static void enforce_limit(void)
+{
+    while (s_pending.len > g_opt.max_buffer_bytes && s_pending_lines > 0) {
+        const char *eol = memchr(s_pending.data, '\n', s_pending.len);
+        buf_consume(&s_pending, eol ? (size_t)(eol - s_pending.data) + 1 : s_pending.len);
+        s_pending_lines--;
+        g_stats.points_dropped++;
+    }
+}
+
+void sink_add_line(const char *line, size_t len, int64_t ts_ns)
+{
+    if (s_pending_lines == 0) {
+        s_pending_since_ms = now_ms();
+    }
+    char ts[32];
+    const int n = snprintf(ts, sizeof(ts), " %lld\n", (long long)ts_ns);
+    buf_append(&s_pending, line, len);
+    buf_append(&s_pending, ts, (size_t)n);
+    s_pending_lines++;
+    enforce_limit();
+}
+
+static void finish(bool ok)
+{
+    if (s_conn.fd >= 0) {
+        epoll_del(s_conn.fd);
+        close(s_conn.fd);
+        s_conn.fd = -1;
+    }
+
+    if (ok) {
+        g_stats.points_out += s_conn.lines;
+        g_stats.batches_out++;
+        s_backoff_ms = 0;
+    } else {
+        /* Put the batch back in front of anything that arrived meanwhile */
+        g_stats.sink_errors++;
+        buf_t merged = {0};
+        buf_append(&merged, s_conn.batch.data, s_conn.batch.len);
+        buf_append(&merged, s_pending.data ? s_pending.data : "", s_pending.len);
+        buf_free(&s_pending);
+        s_pending = merged;
+        s_pending_lines += s_conn.lines;
+        s_pending_since_ms = now_ms();
+        enforce_limit();
+
+        s_backoff_ms = s_backoff_ms ? s_backoff_ms * 2 : SINK_BACKOFF_MIN_MS;
+        if (s_backoff_ms > SINK_BACKOFF_MAX_MS) {
+            s_backoff_ms = SINK_BACKOFF_MAX_MS;
+        }
+        s_retry_at_ms = now_ms() + s_backoff_ms;
+        fprintf(stderr, "sink: write of %zu lines failed, retrying in %d ms\n",
+                s_conn.lines, s_backoff_ms);
+    }
+
+    s_conn.lines = 0;
+    s_conn.batch.len = 0;
+    s_conn.out.len = 0;
+    s_conn.in.len = 0;
+}
+
+/* Response is complete once the headers and Content-Length bytes are in */
+static bool response_complete(int *status)
+{
+    const char *hdr_end = s_conn.in.data ? strstr(s_conn.in.data, "\r\n\r\n") : NULL;
+    if (hdr_end == NULL) {
+        return false;
+    }
+    const size_t hdr_len = (size_t)(hdr_end - s_conn.in.data) + 4;
+    const char *cl = http_find_header(s_conn.in.data, hdr_len, "Content-Length");
+    const size_t body_len = cl ? strtoul(cl, NULL, 10) : 0;
+    if (s_conn.in.len < hdr_len + body_len) {
+        return false;
+    }
+    *status = http_parse_status(s_conn.in.data, s_conn.in.len);
+    return true;
+}
+
+static void sink_on_event(io_handler_t *self, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        if (!(events & EPOLLIN)) {
+            finish(false);
+            return;
+        }
+    }
+
+    if ((events & EPOLLOUT) && s_conn.sent < s_conn.out.len) {
+        const ssize_t n = send(s_conn.fd, s_conn.out.data + s_conn.sent,
+                               s_conn.out.len - s_conn.sent, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN) {
+            finish(false);
+            return;
+        }
+        if (n > 0) {
+            s_conn.sent += (size_t)n;
+        }
+        if (s_conn.sent == s_conn.out.len) {
+            epoll_mod(s_conn.fd, EPOLLIN, &s_conn.handler);
+        }
+    }
+
+    if (events & EPOLLIN) {
+        char tmp[4096];
+        ssize_t n;
+        while ((n = recv(s_conn.fd, tmp, sizeof(tmp), 0)) > 0) {
+            buf_append(&s_conn.in, tmp, (size_t)n);
+        }
+        int status = 0;
+        if (response_complete(&status) || n == 0) {
+            if (status == 0) {
+                status = http_parse_status(s_conn.in.data ? s_conn.in.data : "", s_conn.in.len);
+            }
+            if (status < 200 || status >= 300) {
+                fprintf(stderr, "sink: InfluxDB returned %d: %.200s\n", status,
+                        s_conn.in.data ? s_conn.in.data : "");
+            }
+            finish(status >= 200 && status < 300);
+        } else if (n < 0 && errno != EAGAIN) {
+            finish(false);
+        }
+    }
+}
+
+static void start_write(void)
+{
+    /* Take up to batch_lines lines off the front */
+    size_t lines = s_pending_lines;
+    size_t bytes = s_pending.len;
+    if (lines > (size_t)g_opt.batch_lines) {
+        const char *p = s_pending.data;
+        for (lines = 0; lines < (size_t)g_opt.batch_lines; lines++) {
+            p = memchr(p, '\n', s_pending.data + s_pending.len - p) + 1;
+        }
+        bytes = (size_t)(p - s_pending.data);
+    }
+    s_conn.batch.len = 0;
+    buf_append(&s_conn.batch, s_pending.data, bytes);
+    buf_consume(&s_pending, bytes);
+    s_conn.lines = lines;
+    s_pending_lines -= lines;
+    s_pending_since_ms = now_ms();
+
+    if (g_opt.to_stdout) {
+        fwrite(s_conn.batch.data, 1, s_conn.batch.len, stdout);
+        fflush(stdout);
+        finish(true);
+        return;
+    }
+    if (!g_opt.have_influx) {
+        /* Load test without a database: count and discard */
+        finish(true);
+        return;
+    }
+
+    s_conn.fd = connect_nonblocking(&g_opt.influx);
+    if (s_conn.fd < 0) {
+        finish(false);
+        return;
+    }
+
+    s_conn.out.len = 0;
+    s_conn.in.len = 0;
+    s_conn.sent = 0;
+    buf_printf(&s_conn.out,
+               "POST %s/api/v2/write?org=%s&bucket=%s&precision=ns HTTP/1.1\r\n"
+               "Host: %s:%s\r\n"
+               "Authorization: Token %s\r\n"
+               "Content-Type: text/plain; charset=utf-8\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n\r\n",
+               g_opt.influx.path, g_opt.influx_org, g_opt.influx_bucket,
+               g_opt.influx.host, g_opt.influx.port, g_opt.influx_token,
+               s_conn.batch.len);
+    buf_append(&s_conn.out, s_conn.batch.data, s_conn.batch.len);
+
+    s_conn.handler.on_event = sink_on_event;
+    s_conn.deadline_ms = now_ms() + SINK_TIMEOUT_MS;
+    if (epoll_add(s_conn.fd, EPOLLOUT | EPOLLIN, &s_conn.handler) < 0) {
+        finish(false);
+    }
+}
+
+void sink_tick(void)
+{
+    const int64_t now = now_ms();
+
+    if (s_conn.fd >= 0) {
+        if (now > s_conn.deadline_ms) {
+            fprintf(stderr, "sink: InfluxDB write timed out\n");
+            finish(false);
+        }
+        return;
+    }
+    if (s_pending_lines == 0 || now < s_retry_at_ms) {
+        return;
+    }
+    if (s_pending_lines >= (size_t)g_opt.batch_lines || now - s_pending_since_ms >= g_opt.flush_ms) {
+        start_write();
+    }
+}
@@ -0,0 +1,228 @@
+#include "agg.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+void buf_append(buf_t *b, const void *data, size_t len)
+{
+    if (b->len + len + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 1024;
+        while (cap < b->len + len + 1) {
+            cap *= 2;
+        }
+        char *p = realloc(b->data, cap);
+        if (p == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+void buf_printf(buf_t *b, const char *fmt, ...)
+{
+    char tmp[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        buf_append(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+    }
+}
+
+void buf_consume(buf_t *b, size_t len)
+{
+    if (len >= b->len) {
+        b->len = 0;
+    } else {
+        memmove(b->data, b->data + len, b->len - len);
+        b->len -= len;
+    }
+    if (b->data) {
+        b->data[b->len] = '\0';
+    }
+}
+
+void buf_free(buf_t *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int set_nonblocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int epoll_add(int fd, uint32_t events, io_handler_t *handler)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = handler };
+    return epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int epoll_mod(int fd, uint32_t events, io_handler_t *handler)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = handler };
+    return epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void epoll_del(int fd)
+{
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Accepts "http://host[:port][/path]" or "host[:port]" */
+int endpoint_parse(endpoint_t *ep, const char *url, const char *default_port)
+{
+    memset(ep, 0, sizeof(*ep));
+
+    if (strncmp(url, "https://", 8) == 0) {
+        fprintf(stderr, "%s: https is not supported, point at a plain HTTP listener\n", url);
+        return -1;
+    }
+    if (strncmp(url, "http://", 7) == 0) {
+        url += 7;
+    }
+
+    const char *slash = strchr(url, '/');
+    const size_t hostport_len = slash ? (size_t)(slash - url) : strlen(url);
+    if (slash) {
+        snprintf(ep->path, sizeof(ep->path), "%s", slash);
+        /* Strip a trailing slash so "/api/v2/write" can be appended */
+        const size_t n = strlen(ep->path);
+        if (n > 0 && ep->path[n - 1] == '/') {
+            ep->path[n - 1] = '\0';
+        }
+    }
+
+    char hostport[160];
+    snprintf(hostport, sizeof(hostport), "%.*s", (int)hostport_len, url);
+    char *colon = strrchr(hostport, ':');
+    if (colon) {
+        *colon = '\0';
+        snprintf(ep->port, sizeof(ep->port), "%s", colon + 1);
+    } else {
+        snprintf(ep->port, sizeof(ep->port), "%s", default_port);
+    }
+    snprintf(ep->host, sizeof(ep->host), "%.127s", hostport);
+
+    /* Resolve once; chargers and InfluxDB don't move around */
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    const int err = getaddrinfo(ep->host, ep->port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", ep->host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&ep->addr, res->ai_addr, res->ai_addrlen);
+    ep->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+int connect_nonblocking(const endpoint_t *ep)
+{
+    const int fd = socket(ep->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&ep->addr, ep->addr_len) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Copy the value of a top-level "key": in a flat JSON object (no unescaping) */
+bool json_get(const char *json, const char *key, char *out, size_t out_len)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(json, pattern);
+    if (p == NULL || out_len == 0) {
+        return false;
+    }
+    p += strlen(pattern);
+    while (*p == ' ') {
+        p++;
+    }
+
+    size_t n = 0;
+    if (*p == '"') {
+        p++;
+        while (*p && *p != '"' && n + 1 < out_len) {
+            out[n++] = *p++;
+        }
+    } else {
+        while (*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p) && n + 1 < out_len) {
+            out[n++] = *p++;
+        }
+    }
+    out[n] = '\0';
+    return true;
+}
+
+/* Find a header value in a raw header block (case-insensitive name) */
+const char *http_find_header(const char *headers, size_t len, const char *name)
+{
+    const size_t name_len = strlen(name);
+    const char *p = headers;
+    const char *end = headers + len;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            break;
+        }
+        if ((size_t)(eol - p) > name_len && strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            const char *v = p + name_len + 1;
+            while (v < eol && *v == ' ') {
+                v++;
+            }
+            return v;
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+int http_parse_status(const char *resp, size_t len)
+{
+    int status = 0;
+    if (len > 12 && strncmp(resp, "HTTP/1.", 7) == 0) {
+        status = atoi(resp + 9);
+    }
+    return status;
+}
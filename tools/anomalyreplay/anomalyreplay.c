@@ -0,0 +1,288 @@
+/* Replay recorded sessions through the firmware's anomaly detectors
+ *
+ * Reads CSV as written by /api/export?format=csv or charger-logdecode
+ * --csv and feeds every row to main/anomaly.c - the same code the charger
+ * runs - printing each alert with the uptime it would have been raised
+ * at. Columns are matched by header name; raw_voltage (unsmoothed reading,
+ * for the ADC noise detector), cell_temp and cell_id are optional, and
+ * only the log capture has the first two. Each file starts from a fresh
+ * detector state.
+ *
+ * With --expect, each file must raise exactly the listed alert types and
+ * the exit status is 2 otherwise, so a directory of labelled traces can be
+ * replayed after changing a detector or its thresholds. ctest does that
+ * for the labelled traces in traces/:
+ *
+ *   charger-anomalyreplay --expect voltage_sag traces/voltage_sag/sag-150mv.csv
+ *   charger-anomalyreplay --expect none traces/none/full-charge.csv traces/none/noisy-adc.csv
+ */
+
+#include "anomaly.h"
+#include "api_schema.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN  512
+#define MAX_COLUMNS   16
+
+/* Columns of interest, -1 when the trace doesn't have them */
+typedef struct {
+    int timestamp_ns;
+    int uptime_ms;
+    int voltage;
+    int raw_voltage;
+    int temp;
+    int cell_temp;
+    int charge_state;
+    int cell_id;
+} columns_t;
+
+static const char *const s_charge_states[] = API_CHARGE_STATE_NAMES;
+
+static int split(char *line, char **fields)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char *p = line; n < MAX_COLUMNS; ) {
+        fields[n++] = p;
+        p = strchr(p, ',');
+        if (p == NULL) {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static bool parse_header(char *line, columns_t *cols)
+{
+    char *fields[MAX_COLUMNS];
+    const int n = split(line, fields);
+    int *const slots[] = {
+        &cols->timestamp_ns, &cols->uptime_ms, &cols->voltage, &cols->raw_voltage,
+        &cols->temp, &cols->cell_temp, &cols->charge_state, &cols->cell_id,
+    };
+    static const char *const names[] = {
+        "timestamp_ns", "uptime_ms", "voltage", "raw_voltage",
+        "temp", "cell_temp", "charge_state", "cell_id",
+    };
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        *slots[i] = -1;
+        for (int j = 0; j < n; j++) {
+            if (strcmp(fields[j], names[i]) == 0) {
+                *slots[i] = j;
+            }
+        }
+    }
+    return cols->uptime_ms >= 0 && cols->voltage >= 0 && cols->charge_state >= 0;
+}
+
+/* Empty or missing cells read as NAN */
+static double field_num(char **fields, int n, int col)
+{
+    if (col < 0 || col >= n || fields[col][0] == '\0') {
+        return NAN;
+    }
+    return strtod(fields[col], NULL);
+}
+
+/* State by name as exported, or by number */
+static int parse_state(const char *s)
+{
+    for (size_t i = 0; i < sizeof(s_charge_states) / sizeof(s_charge_states[0]); i++) {
+        if (strcmp(s, s_charge_states[i]) == 0) {
+            return (int)i;
+        }
+    }
+    char *end;
+    const long v = strtol(s, &end, 10);
+    return (*end == '\0' && end != s) ? (int)v : -1;
+}
+
+static int parse_type(const char *name)
+{
+    for (int i = 0; i < ANOMALY_TYPE_COUNT; i++) {
+        if (strcmp(name, anomaly_type_str(i)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Replay one trace; returns a bit per alert type raised, or -1 on error */
+static int replay(const char *path, const anomaly_config_t *cfg)
+{
+    FILE *in = stdin;
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            perror(path);
+            return -1;
+        }
+    }
+
+    char line[LINE_MAX_LEN];
+    columns_t cols;
+    if (fgets(line, sizeof(line), in) == NULL || !parse_header(line, &cols)) {
+        fprintf(stderr, "%s: expected a CSV header with uptime_ms, voltage and charge_state\n", path);
+        if (in != stdin) {
+            fclose(in);
+        }
+        return -1;
+    }
+
+    anomaly_init(cfg);
+    int raised = 0;
+    unsigned long row = 1;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        row++;
+        char *fields[MAX_COLUMNS];
+        const int n = split(line, fields);
+        const double uptime_ms = field_num(fields, n, cols.uptime_ms);
+        const double voltage = field_num(fields, n, cols.voltage);
+        const int state = cols.charge_state < n ? parse_state(fields[cols.charge_state]) : -1;
+        if (isnan(uptime_ms) || isnan(voltage) || state < 0) {
+            fprintf(stderr, "%s:%lu: skipping malformed row\n", path, row);
+            continue;
+        }
+
+        sensor_data_t data;
+        memset(&data, 0, sizeof(data));
+        data.battery_voltage = (float)voltage;
+        const double raw = field_num(fields, n, cols.raw_voltage);
+        data.raw_voltage = isnan(raw) ? data.battery_voltage : (float)raw;
+        data.internal_temp = (float)field_num(fields, n, cols.temp);
+        data.cell_temp = (float)field_num(fields, n, cols.cell_temp);
+        data.charge_state = (charge_state_t)state;
+        data.cell_present = state != CHARGE_STATE_NO_CELL;
+        const char *cell_id = (cols.cell_id >= 0 && cols.cell_id < n) ? fields[cols.cell_id] : "replay";
+        snprintf(data.cell_id, sizeof(data.cell_id), "%s", cell_id);
+
+        const double ts = field_num(fields, n, cols.timestamp_ns);
+        data.time_synced = !isnan(ts);
+        data.timestamp_ns = data.time_synced ? (int64_t)ts : (int64_t)uptime_ms * 1000000LL;
+
+        anomaly_event_t events[ANOMALY_MAX_EVENTS];
+        const size_t count = anomaly_push(&data, (int64_t)(uptime_ms * 1000.0), events);
+        for (size_t i = 0; i < count; i++) {
+            /* Report the uptime of the sample that raised it, which for a
+             * spike is the row before */
+            const double at_ms = data.time_synced ? uptime_ms - (ts - events[i].timestamp_ns) / 1e6
+                                                  : events[i].timestamp_ns / 1e6;
+            printf("%s\t%.0f\t%s\t%s\t%.3f\t%.3f\t%s\n", path, at_ms, events[i].cell_id,
+                   anomaly_type_str(events[i].type), events[i].value, events[i].threshold,
+                   anomaly_unit_str(events[i].type));
+            raised |= 1 << events[i].type;
+        }
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    return raised;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] [FILE.csv ...]   (stdin if no file, or -)\n"
+        "\n"
+        "  --expect LIST            Alert types each file must raise, comma-separated, or none;\n"
+        "                           exit 2 on any mismatch\n"
+        "  --sag-mv MV              Voltage sag while charging\n"
+        "  --cv-mv MV               Voltage that counts as CV reached\n"
+        "  --cv-budget-min MIN      Charging time allowed to reach CV\n"
+        "  --self-discharge MV_H    Drop rate allowed after Full (mV/h)\n"
+        "  --temp-rise C_MIN        Temperature slope allowed (°C/min)\n"
+        "  --spike-mv MV            Raw-vs-smoothed deviation that is a spike\n"
+        "\n"
+        "Thresholds default to the project sdkconfig. Prints one line per alert:\n"
+        "file, uptime_ms, cell_id, type, value, threshold, unit (tab-separated).\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    anomaly_config_t cfg;
+    anomaly_get_default_config(&cfg);
+    const char *expect_arg = NULL;
+
+    static const struct option long_opts[] = {
+        { "expect",         required_argument, NULL, 'e' },
+        { "sag-mv",         required_argument, NULL, 's' },
+        { "cv-mv",          required_argument, NULL, 'c' },
+        { "cv-budget-min",  required_argument, NULL, 'b' },
+        { "self-discharge", required_argument, NULL, 'd' },
+        { "temp-rise",      required_argument, NULL, 't' },
+        { "spike-mv",       required_argument, NULL, 'n' },
+        { "help",           no_argument,       NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'e': expect_arg = optarg; break;
+        case 's': cfg.sag_mv = (uint32_t)atoi(optarg); break;
+        case 'c': cfg.cv_mv = (uint32_t)atoi(optarg); break;
+        case 'b': cfg.cv_budget_sec = (uint32_t)atoi(optarg) * 60; break;
+        case 'd': cfg.self_discharge_mv_per_h = (uint32_t)atoi(optarg); break;
+        case 't': cfg.temp_rise_c_per_min = (float)atof(optarg); break;
+        case 'n': cfg.spike_mv = (uint32_t)atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int expected = -1;
+    if (expect_arg != NULL) {
+        expected = 0;
+        char list[256];
+        snprintf(list, sizeof(list), "%s", expect_arg);
+        for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+            if (strcmp(name, "none") == 0) {
+                continue;
+            }
+            const int type = parse_type(name);
+            if (type < 0) {
+                fprintf(stderr, "unknown alert type: %s\n", name);
+                return 1;
+            }
+            expected |= 1 << type;
+        }
+    }
+
+    static char *const stdin_only[] = { "-" };
+    char *const *files = optind < argc ? &argv[optind] : stdin_only;
+    const int file_count = optind < argc ? argc - optind : 1;
+
+    int mismatches = 0;
+    for (int f = 0; f < file_count; f++) {
+        const int raised = replay(files[f], &cfg);
+        if (raised < 0) {
+            return 1;
+        }
+        if (expected >= 0 && raised != expected) {
+            fprintf(stderr, "%s: FAIL, raised", files[f]);
+            for (int i = 0; i < ANOMALY_TYPE_COUNT; i++) {
+                if ((raised >> i) & 1) {
+                    fprintf(stderr, " %s", anomaly_type_str(i));
+                }
+            }
+            fprintf(stderr, "%s, expected %s\n", raised ? "" : " none", expect_arg);
+            mismatches++;
+        }
+    }
+
+    if (expected >= 0) {
+        fprintf(stderr, "%d of %d traces as expected\n", file_count - mismatches, file_count);
+    }
+    return mismatches > 0 ? 2 : 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+/* Just enough of ESP-IDF's esp_err.h for the firmware headers */
+typedef int esp_err_t;
+
+#define ESP_OK    0
+#define ESP_FAIL  -1
@@ -0,0 +1,191 @@
+/* Generator for the labelled traces in traces/
+ *
+ * Writes synthetic charge curves, one per file, in the CSV layout that
+ * charger-logdecode --csv produces from a real capture. Each directory is
+ * named after the alert types its traces must raise (or "none"), which is
+ * what the replay tests pass to --expect. The output is deterministic, so
+ * regenerating after a change here shows up as a plain diff:
+ *
+ *   charger-tracegen tools/anomalyreplay/traces
+ *
+ * The faults are sized well past the default thresholds and the healthy
+ * traces well inside them, so the suite pins the detectors' behaviour
+ * without depending on the exact sdkconfig values.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    FILE *out;
+    const char *cell_id;
+    uint32_t t_ms;
+    uint32_t seed;
+} trace_t;
+
+/* Repeatable noise in [-1, 1] */
+static double noise(trace_t *tr)
+{
+    tr->seed = tr->seed * 1664525u + 1013904223u;
+    return (double)(tr->seed >> 8) / (double)(1u << 23) - 1.0;
+}
+
+static bool trace_open(trace_t *tr, const char *dir, const char *label, const char *name,
+                       const char *cell_id, uint32_t seed)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, label);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/%s/%s.csv", dir, label, name);
+    tr->out = fopen(path, "w");
+    if (tr->out == NULL) {
+        perror(path);
+        return false;
+    }
+    tr->cell_id = cell_id;
+    tr->t_ms = 0;
+    tr->seed = seed;
+    fprintf(tr->out, "uptime_ms,voltage,raw_voltage,temp,cell_temp,charge_state,cell_id\n");
+    return true;
+}
+
+/* One sample; cell_temp NAN leaves the column empty (no NTC) */
+static void sample(trace_t *tr, double v, double raw, double temp, double cell_temp, const char *state)
+{
+    fprintf(tr->out, "%u,%.3f,%.3f,%.1f,", tr->t_ms, v, raw, temp);
+    if (!isnan(cell_temp)) {
+        fprintf(tr->out, "%.1f", cell_temp);
+    }
+    fprintf(tr->out, ",%s,%s\n", state, tr->cell_id);
+}
+
+/* A healthy CC/CV curve: 3.60 V to 4.20 V over charge_min, then Full
+ * for full_min settling from 4.19 V to 4.175 V. adc_spread_mv is the
+ * raw-vs-smoothed scatter; temp_end is where the cell ends up. */
+static void charge_curve(trace_t *tr, uint32_t step_ms, double charge_min, double full_min,
+                         double adc_spread_mv, bool ntc, double temp_end)
+{
+    const double charge_ms = charge_min * 60000.0;
+    for (; tr->t_ms <= charge_ms; tr->t_ms += step_ms) {
+        const double x = tr->t_ms / charge_ms;
+        const double v = 3.60 + 0.60 * (1.0 - pow(1.0 - x, 2.0)) + 0.002 * noise(tr);
+        const double temp = 25.0 + (temp_end - 25.0) * x;
+        sample(tr, v, v + adc_spread_mv / 1000.0 * noise(tr), ntc ? 30.0 + 2.0 * x : temp,
+               ntc ? temp : NAN, "Charging");
+    }
+    const uint32_t full_start = tr->t_ms;
+    for (; tr->t_ms < full_start + full_min * 60000.0; tr->t_ms += step_ms) {
+        const double m = (tr->t_ms - full_start) / 60000.0;
+        const double v = 4.175 + 0.015 * exp(-m / 4.0) + 0.001 * noise(tr);
+        sample(tr, v, v + adc_spread_mv / 1000.0 * noise(tr), ntc ? 32.0 : temp_end,
+               ntc ? temp_end : NAN, "Full");
+    }
+}
+
+static int generate(const char *dir)
+{
+    trace_t tr;
+
+    /* ---- Healthy ---- */
+    if (!trace_open(&tr, dir, "none", "full-charge", "h1", 1)) return 1;
+    charge_curve(&tr, 10000, 120, 60, 8, true, 30.0);
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "none", "noisy-adc", "h2", 2)) return 1;
+    /* Steady scatter of up to 60 mV: big, but it is the usual spread */
+    charge_curve(&tr, 2000, 30, 0, 60, true, 27.0);
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "none", "no-ntc-warmup", "h3", 3)) return 1;
+    /* Die temperature warming 10 °C over the first half hour: 0.33 °C/min */
+    charge_curve(&tr, 5000, 30, 0, 5, false, 35.0);
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "none", "removed-and-back", "h4", 4)) return 1;
+    /* Pulled out for a minute mid-charge; same cell back in, picking up
+     * where it was */
+    for (int i = 0; i < 240; i++, tr.t_ms += 10000) {
+        if (i >= 120 && i < 126) {
+            sample(&tr, 0.0, 0.0, 30.0, NAN, "No Cell");
+            continue;
+        }
+        const double v = 3.70 + 0.30 * i / 240.0 + 0.002 * noise(&tr);
+        sample(&tr, v, v + 0.005 * noise(&tr), 31.0, 28.0, "Charging");
+    }
+    fclose(tr.out);
+
+    /* ---- One fault each ---- */
+    if (!trace_open(&tr, dir, "voltage_sag", "sag-150mv", "f1", 11)) return 1;
+    for (int i = 0; i <= 720; i++, tr.t_ms += 10000) {
+        /* 3.95 V at 60 min, then 150 mV lower for good from 62 min */
+        double v = 3.60 + 0.35 * fmin(i / 360.0, 1.0) + 0.25 * fmax(0.0, (i - 360) / 360.0);
+        if (i >= 360 && i < 372) {
+            v -= 0.150 * (i - 360) / 12.0;
+        } else if (i >= 372) {
+            v -= 0.150;
+        }
+        v += 0.002 * noise(&tr);
+        sample(&tr, v, v + 0.005 * noise(&tr), 31.0, 28.0, "Charging");
+    }
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "cv_timeout", "stuck-at-4v", "f2", 12)) return 1;
+    /* Creeps up to 4.00 V and stays there for over five hours */
+    for (int i = 0; i <= 660; i++, tr.t_ms += 30000) {
+        const double v = 3.60 + 0.40 * (1.0 - exp(-i / 60.0)) + 0.001 * noise(&tr);
+        sample(&tr, v, v + 0.005 * noise(&tr), 31.0, 28.0, "Charging");
+    }
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "self_discharge", "drop-60mv-per-h", "f3", 13)) return 1;
+    charge_curve(&tr, 10000, 120, 0, 5, true, 30.0);
+    const uint32_t full_start = tr.t_ms;
+    for (; tr.t_ms <= full_start + 90 * 60000u; tr.t_ms += 10000) {
+        const double h = (tr.t_ms - full_start) / 3600000.0;
+        const double v = 4.18 - 0.060 * h + 0.001 * noise(&tr);
+        sample(&tr, v, v + 0.005 * noise(&tr), 32.0, 30.0, "Full");
+    }
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "temp_rise", "ntc-3c-per-min", "f4", 14)) return 1;
+    /* Cell NTC climbs 3 °C/min for five minutes half an hour in */
+    for (int i = 0; i <= 720; i++, tr.t_ms += 5000) {
+        const double m = tr.t_ms / 60000.0;
+        const double v = 3.60 + 0.40 * m / 60.0 + 0.002 * noise(&tr);
+        const double cell = 26.0 + 3.0 * fmin(fmax(m - 30.0, 0.0), 5.0);
+        sample(&tr, v, v + 0.005 * noise(&tr), 31.0, cell, "Charging");
+    }
+    fclose(tr.out);
+
+    if (!trace_open(&tr, dir, "adc_noise", "single-300mv-glitch", "f5", 15)) return 1;
+    for (int i = 0; i <= 360; i++, tr.t_ms += 5000) {
+        const double v = 3.70 + 0.10 * i / 360.0 + 0.002 * noise(&tr);
+        const double raw = v + (i == 200 ? 0.300 : 0.008 * noise(&tr));
+        sample(&tr, v, raw, 31.0, 27.0, "Charging");
+    }
+    fclose(tr.out);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s DIR   (writes DIR/<expected alerts>/<name>.csv)\n", argv[0]);
+        return 1;
+    }
+    if (mkdir(argv[1], 0755) != 0 && errno != EEXIST) {
+        perror(argv[1]);
+        return 1;
+    }
+    return generate(argv[1]);
+}
@@ -0,0 +1,347 @@
+/* Decoder for the charger's CBOR API responses
+ *
+ * Reads a response body (Accept: application/cbor) from a file or stdin
+ * and prints it as JSON, naming integer keys from main/api_schema.h - the
+ * same header the firmware encodes with. Unknown keys are printed as
+ * numbers so a newer device still decodes.
+ *
+ *   curl -s -H 'Accept: application/cbor' http://charger/api/data | charger-cbordecode data
+ */
+
+#include "api_schema.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INPUT  (1 << 20)
+#define MAX_DEPTH  8
+
+typedef struct schema schema_t;
+
+typedef struct {
+    uint64_t key;
+    const char *name;
+    const schema_t *child;    /* Schema of nested maps (ARRAY of maps), or NULL */
+    const char *const *enum_names;
+    size_t enum_count;
+} field_t;
+
+struct schema {
+    const field_t *fields;
+    size_t count;
+};
+
+static const char *const s_charge_states[] = API_CHARGE_STATE_NAMES;
+static const char *const s_sched_modes[] = API_SCHED_MODE_NAMES;
+
+#define FIELD(key, name, type)  { key, #name, NULL, NULL, 0 },
+
+static const field_t s_session_fields[] = { API_SESSION_FIELDS(FIELD) };
+static const schema_t s_session_schema = { s_session_fields, sizeof(s_session_fields) / sizeof(field_t) };
+
+static const field_t s_series_session_fields[] = { API_SERIES_SESSION_FIELDS(FIELD) };
+static const schema_t s_series_session_schema = {
+    s_series_session_fields, sizeof(s_series_session_fields) / sizeof(field_t)
+};
+
+static field_t s_series_fields[] = { API_SERIES_FIELDS(FIELD) };
+static const schema_t s_series_schema = { s_series_fields, sizeof(s_series_fields) / sizeof(field_t) };
+
+static field_t s_data_fields[] = { API_DATA_FIELDS(FIELD) };
+static const schema_t s_data_schema = { s_data_fields, sizeof(s_data_fields) / sizeof(field_t) };
+
+#undef FIELD
+
+/* Fill in what the X-macro lists can't express */
+static void schema_link(void)
+{
+    for (size_t i = 0; i < s_series_schema.count; i++) {
+        if (s_series_fields[i].key == API_SERIES_sessions) {
+            s_series_fields[i].child = &s_series_session_schema;
+        }
+    }
+    for (size_t i = 0; i < s_data_schema.count; i++) {
+        if (s_data_fields[i].key == API_DATA_charge_state) {
+            s_data_fields[i].enum_names = s_charge_states;
+            s_data_fields[i].enum_count = sizeof(s_charge_states) / sizeof(s_charge_states[0]);
+        } else if (s_data_fields[i].key == API_DATA_sched_mode) {
+            s_data_fields[i].enum_names = s_sched_modes;
+            s_data_fields[i].enum_count = sizeof(s_sched_modes) / sizeof(s_sched_modes[0]);
+        }
+    }
+}
+
+static const field_t *schema_find(const schema_t *schema, uint64_t key)
+{
+    for (size_t i = 0; schema && i < schema->count; i++) {
+        if (schema->fields[i].key == key) {
+            return &schema->fields[i];
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    const char *error;
+} reader_t;
+
+static bool need(reader_t *r, size_t n)
+{
+    if (r->error == NULL && (size_t)(r->end - r->p) < n) {
+        r->error = "truncated input";
+    }
+    return r->error == NULL;
+}
+
+static uint64_t read_be(reader_t *r, size_t n)
+{
+    uint64_t v = 0;
+    if (!need(r, n)) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        v = v << 8 | *r->p++;
+    }
+    return v;
+}
+
+/* Reads an initial byte and its argument. Returns the major type, or -1. */
+static int read_head(reader_t *r, uint8_t *info, uint64_t *arg)
+{
+    if (!need(r, 1)) {
+        return -1;
+    }
+    const uint8_t ib = *r->p++;
+    *info = ib & 0x1f;
+    const int major = ib >> 5;
+
+    if (*info < 24) {
+        *arg = *info;
+    } else if (*info <= 27) {
+        *arg = read_be(r, (size_t)1 << (*info - 24));
+    } else {
+        r->error = "indefinite length or reserved item not supported";
+        return -1;
+    }
+    return r->error ? -1 : major;
+}
+
+static double half_to_double(uint16_t h)
+{
+    const int exp = (h >> 10) & 0x1f;
+    const int mant = h & 0x3ff;
+    double v;
+    if (exp == 0) {
+        v = ldexp(mant, -24);
+    } else if (exp != 31) {
+        v = ldexp(mant + 1024, exp - 25);
+    } else {
+        v = mant == 0 ? INFINITY : NAN;
+    }
+    return (h & 0x8000) ? -v : v;
+}
+
+static void print_string(const uint8_t *s, size_t len)
+{
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = s[i];
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_double(double v)
+{
+    if (isfinite(v)) {
+        printf("%.7g", v);
+    } else {
+        printf("null");
+    }
+}
+
+static void print_item(reader_t *r, const field_t *field, const schema_t *schema, int depth);
+
+static void print_map(reader_t *r, uint64_t count, const schema_t *schema, int depth)
+{
+    putchar('{');
+    for (uint64_t i = 0; i < count && r->error == NULL; i++) {
+        if (i) {
+            putchar(',');
+        }
+        uint8_t info;
+        uint64_t key;
+        const int major = read_head(r, &info, &key);
+        if (major == 0) {
+            const field_t *f = schema_find(schema, key);
+            if (f) {
+                printf("\"%s\":", f->name);
+            } else {
+                printf("\"%llu\":", (unsigned long long)key);
+            }
+            print_item(r, f, f ? f->child : NULL, depth + 1);
+        } else if (major == 3 && need(r, key)) {
+            print_string(r->p, key);
+            r->p += key;
+            putchar(':');
+            print_item(r, NULL, NULL, depth + 1);
+        } else if (r->error == NULL) {
+            r->error = "unsupported map key";
+        }
+    }
+    putchar('}');
+}
+
+/* field/schema describe the item being printed: its enum names, and the
+ * schema of the map it is (or the maps it contains, for arrays) */
+static void print_item(reader_t *r, const field_t *field, const schema_t *schema, int depth)
+{
+    if (depth > MAX_DEPTH) {
+        r->error = "nesting too deep";
+        return;
+    }
+
+    uint8_t info;
+    uint64_t arg;
+    const int major = read_head(r, &info, &arg);
+
+    switch (major) {
+    case 0:
+        if (field && field->enum_names && arg < field->enum_count) {
+            printf("\"%s\"", field->enum_names[arg]);
+        } else {
+            printf("%llu", (unsigned long long)arg);
+        }
+        break;
+    case 1:
+        printf("-%llu", (unsigned long long)arg + 1);
+        break;
+    case 2:
+    case 3:
+        if (need(r, arg)) {
+            if (major == 3) {
+                print_string(r->p, arg);
+            } else {
+                printf("\"<%llu bytes>\"", (unsigned long long)arg);
+            }
+            r->p += arg;
+        }
+        break;
+    case 4:
+        putchar('[');
+        for (uint64_t i = 0; i < arg && r->error == NULL; i++) {
+            if (i) {
+                putchar(',');
+            }
+            print_item(r, NULL, schema, depth + 1);
+        }
+        putchar(']');
+        break;
+    case 5:
+        print_map(r, arg, schema, depth);
+        break;
+    case 6:
+        /* Tags carry no meaning for this API; print the tagged item */
+        print_item(r, field, schema, depth + 1);
+        break;
+    case 7:
+        if (info == 20 || info == 21) {
+            printf(info == 21 ? "true" : "false");
+        } else if (info == 22 || info == 23) {
+            printf("null");
+        } else if (info == 25) {
+            print_double(half_to_double((uint16_t)arg));
+        } else if (info == 26) {
+            const uint32_t bits = (uint32_t)arg;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            print_double(f);
+        } else if (info == 27) {
+            double d;
+            memcpy(&d, &arg, sizeof(d));
+            print_double(d);
+        } else {
+            printf("%llu", (unsigned long long)arg);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s data|sessions|series [FILE]\n"
+        "\n"
+        "Decodes a CBOR response from the charger API (read from FILE or\n"
+        "stdin) and prints it as JSON using the key names in api_schema.h.\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    schema_link();
+
+    const schema_t *schema;
+    if (strcmp(argv[1], "data") == 0) {
+        schema = &s_data_schema;
+    } else if (strcmp(argv[1], "sessions") == 0) {
+        schema = &s_session_schema;
+    } else if (strcmp(argv[1], "series") == 0) {
+        schema = &s_series_schema;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = stdin;
+    if (argc == 3) {
+        in = fopen(argv[2], "rb");
+        if (in == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    uint8_t *buf = malloc(MAX_INPUT);
+    const size_t len = buf ? fread(buf, 1, MAX_INPUT, in) : 0;
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (len == 0) {
+        fprintf(stderr, "no input\n");
+        free(buf);
+        return 1;
+    }
+
+    reader_t r = { .p = buf, .end = buf + len };
+    print_item(&r, NULL, schema, 0);
+    putchar('\n');
+
+    int ret = 0;
+    if (r.error) {
+        fprintf(stderr, "decode error at byte %zu: %s\n", (size_t)(r.p - buf), r.error);
+        ret = 1;
+    } else if (r.p != r.end) {
+        fprintf(stderr, "%zu trailing bytes ignored\n", (size_t)(r.end - r.p));
+    }
+    free(buf);
+    return ret;
+}
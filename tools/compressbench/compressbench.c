@@ -0,0 +1,356 @@
+/* Compression benchmark for recorded charge curves
+ *
+ * Feeds CSV traces (/api/export?format=csv, charger-logdecode --csv or
+ * tools/anomalyreplay/traces) through main/compressor.c - the same code
+ * the charger runs - and reports, per file and in total, how many points
+ * it would upload and how far the curve rebuilt from them strays from
+ * the samples:
+ *
+ *   charger-compressbench --mode swinging-door --voltage-mv 5 c1.csv c2.csv
+ *
+ * The curve is rebuilt here independently of the compressor - straight
+ * lines between points for swinging door, the last point held for
+ * deadband - and checked at every sample. The exit status is 2 if an
+ * error exceeds its bound or the firmware's own statistics
+ * (compressor_get_stats, shown in /api/diag) disagree with this
+ * measurement.
+ */
+
+#include "compressor.h"
+#include "api_schema.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN   512
+#define MAX_COLUMNS    16
+#define STATS_TOL_V    0.00005    /* float vs double arithmetic */
+#define STATS_TOL_C    0.005
+
+/* Columns of interest, -1 when the trace doesn't have them */
+typedef struct {
+    int uptime_ms;
+    int voltage;
+    int temp;
+    int cell_temp;
+    int charge_state;
+    int cell_id;
+} columns_t;
+
+typedef struct {
+    int64_t t_ms;
+    sensor_data_t data;
+} point_t;
+
+typedef struct {
+    size_t count;
+    size_t cap;
+    point_t *items;
+} points_t;
+
+typedef struct {
+    unsigned long samples;
+    unsigned long points;
+    double max_v_err;
+    double max_t_err;
+} result_t;
+
+static const char *const s_charge_states[] = API_CHARGE_STATE_NAMES;
+
+static int split(char *line, char **fields)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char *p = line; n < MAX_COLUMNS; ) {
+        fields[n++] = p;
+        p = strchr(p, ',');
+        if (p == NULL) {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static bool parse_header(char *line, columns_t *cols)
+{
+    char *fields[MAX_COLUMNS];
+    const int n = split(line, fields);
+    int *const slots[] = {
+        &cols->uptime_ms, &cols->voltage, &cols->temp, &cols->cell_temp,
+        &cols->charge_state, &cols->cell_id,
+    };
+    static const char *const names[] = {
+        "uptime_ms", "voltage", "temp", "cell_temp", "charge_state", "cell_id",
+    };
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        *slots[i] = -1;
+        for (int j = 0; j < n; j++) {
+            if (strcmp(fields[j], names[i]) == 0) {
+                *slots[i] = j;
+            }
+        }
+    }
+    return cols->uptime_ms >= 0 && cols->voltage >= 0 && cols->charge_state >= 0;
+}
+
+/* Empty or missing cells read as NAN */
+static double field_num(char **fields, int n, int col)
+{
+    if (col < 0 || col >= n || fields[col][0] == '\0') {
+        return NAN;
+    }
+    return strtod(fields[col], NULL);
+}
+
+/* State by name as exported, or by number */
+static int parse_state(const char *s)
+{
+    for (size_t i = 0; i < sizeof(s_charge_states) / sizeof(s_charge_states[0]); i++) {
+        if (strcmp(s, s_charge_states[i]) == 0) {
+            return (int)i;
+        }
+    }
+    char *end;
+    const long v = strtol(s, &end, 10);
+    return (*end == '\0' && end != s) ? (int)v : -1;
+}
+
+static void points_add(points_t *pts, int64_t t_ms, const sensor_data_t *data)
+{
+    if (pts->count == pts->cap) {
+        pts->cap = pts->cap ? pts->cap * 2 : 1024;
+        pts->items = realloc(pts->items, pts->cap * sizeof(pts->items[0]));
+        if (pts->items == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    pts->items[pts->count].t_ms = t_ms;
+    pts->items[pts->count].data = *data;
+    pts->count++;
+}
+
+/* Emitted points carry their sample time in timestamp_ns */
+static void add_emitted(points_t *out, const sensor_data_t *emitted, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        points_add(out, emitted[i].timestamp_ns / 1000000, &emitted[i]);
+    }
+}
+
+static double lerp(double a, double b, double f)
+{
+    return a + f * (b - a);
+}
+
+static double diff(double a, double b)
+{
+    return isnan(a) && isnan(b) ? 0.0 : fabs(a - b);
+}
+
+/* Rebuild the curve from the emitted points and check it at every sample */
+static void measure(const points_t *samples, const points_t *emitted, compressor_mode_t mode,
+                    result_t *res)
+{
+    size_t k = 0;
+    for (size_t i = 0; i < samples->count; i++) {
+        const point_t *s = &samples->items[i];
+        if (!s->data.cell_present) {
+            continue;
+        }
+        while (k + 1 < emitted->count && emitted->items[k + 1].t_ms <= s->t_ms) {
+            k++;
+        }
+        const point_t *a = &emitted->items[k];
+        if (emitted->count == 0 || a->t_ms > s->t_ms) {
+            fprintf(stderr, "sample at %lld ms before the first emitted point\n", (long long)s->t_ms);
+            res->max_v_err = INFINITY;
+            return;
+        }
+        double v = a->data.battery_voltage;
+        double temp = a->data.internal_temp;
+        double cell = a->data.cell_temp;
+        if (mode == COMPRESSOR_MODE_SWINGING_DOOR && a->t_ms < s->t_ms && k + 1 < emitted->count) {
+            const point_t *b = &emitted->items[k + 1];
+            const double f = (double)(s->t_ms - a->t_ms) / (double)(b->t_ms - a->t_ms);
+            v = lerp(a->data.battery_voltage, b->data.battery_voltage, f);
+            temp = lerp(a->data.internal_temp, b->data.internal_temp, f);
+            cell = lerp(a->data.cell_temp, b->data.cell_temp, f);
+        }
+        const double v_err = diff(v, s->data.battery_voltage);
+        const double t_err = fmax(diff(temp, s->data.internal_temp), diff(cell, s->data.cell_temp));
+        res->max_v_err = fmax(res->max_v_err, v_err);
+        res->max_t_err = fmax(res->max_t_err, t_err);
+    }
+}
+
+/* Returns 0 if within bounds and in agreement with the firmware, 2 if not,
+ * 1 on a read error */
+static int bench(const char *path, const compressor_config_t *cfg, result_t *res)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return 1;
+    }
+    char line[LINE_MAX_LEN];
+    columns_t cols;
+    if (fgets(line, sizeof(line), in) == NULL || !parse_header(line, &cols)) {
+        fprintf(stderr, "%s: expected a CSV header with uptime_ms, voltage and charge_state\n", path);
+        fclose(in);
+        return 1;
+    }
+
+    compressor_init(cfg);
+    points_t samples = {0};
+    points_t emitted = {0};
+    sensor_data_t out[COMPRESSOR_MAX_EMIT];
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char *fields[MAX_COLUMNS];
+        const int n = split(line, fields);
+        const double uptime_ms = field_num(fields, n, cols.uptime_ms);
+        const double voltage = field_num(fields, n, cols.voltage);
+        const int state = cols.charge_state < n ? parse_state(fields[cols.charge_state]) : -1;
+        if (isnan(uptime_ms) || isnan(voltage) || state < 0) {
+            continue;
+        }
+
+        sensor_data_t data;
+        memset(&data, 0, sizeof(data));
+        data.battery_voltage = (float)voltage;
+        data.raw_voltage = data.battery_voltage;
+        const double temp = field_num(fields, n, cols.temp);
+        data.internal_temp = isnan(temp) ? 0.0f : (float)temp;
+        data.cell_temp = (float)field_num(fields, n, cols.cell_temp);
+        data.charge_state = (charge_state_t)state;
+        data.cell_present = state != CHARGE_STATE_NO_CELL;
+        data.ir_mohm = NAN;
+        const char *cell_id = (cols.cell_id >= 0 && cols.cell_id < n) ? fields[cols.cell_id] : "bench";
+        snprintf(data.cell_id, sizeof(data.cell_id), "%s", data.cell_present ? cell_id : "");
+        data.timestamp_ns = (int64_t)uptime_ms * 1000000LL;
+
+        points_add(&samples, (int64_t)uptime_ms, &data);
+        add_emitted(&emitted, out, compressor_push(&data, (int64_t)(uptime_ms * 1000.0), out));
+    }
+    fclose(in);
+    add_emitted(&emitted, out, compressor_flush(out));
+
+    memset(res, 0, sizeof(*res));
+    res->samples = samples.count;
+    res->points = emitted.count;
+    measure(&samples, &emitted, cfg->mode, res);
+
+    compressor_stats_t stats;
+    compressor_get_stats(&stats);
+    int rc = 0;
+    if (res->max_v_err > cfg->voltage_bound + STATS_TOL_V ||
+        res->max_t_err > cfg->temp_bound + STATS_TOL_C) {
+        fprintf(stderr, "%s: error exceeds the bound\n", path);
+        rc = 2;
+    }
+    if (fabs(stats.max_voltage_err - res->max_v_err) > STATS_TOL_V ||
+        fabs(stats.max_temp_err - res->max_t_err) > STATS_TOL_C) {
+        fprintf(stderr, "%s: firmware reports %.3f mV / %.3f C, measured %.3f mV / %.3f C\n",
+                path, stats.max_voltage_err * 1000.0, stats.max_temp_err,
+                res->max_v_err * 1000.0, res->max_t_err);
+        rc = 2;
+    }
+
+    free(samples.items);
+    free(emitted.items);
+    return rc;
+}
+
+static void print_result(const char *name, const result_t *res)
+{
+    printf("%-40s %8lu %8lu %7.1f %9.2f %9.2f\n", name, res->samples, res->points,
+           res->points ? (double)res->samples / res->points : 0.0,
+           res->max_v_err * 1000.0, res->max_t_err);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] FILE.csv ...\n"
+        "\n"
+        "  --mode MODE              swinging-door, deadband or off\n"
+        "  --voltage-mv MV          Voltage bound\n"
+        "  --temp-dc DC             Temperature bound in 0.1 C\n"
+        "  --max-gap S              Longest time between two points\n"
+        "\n"
+        "Defaults come from the project sdkconfig. Errors are in mV and C.\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    compressor_config_t cfg;
+    compressor_get_default_config(&cfg);
+
+    static const struct option long_opts[] = {
+        { "mode",       required_argument, NULL, 'm' },
+        { "voltage-mv", required_argument, NULL, 'v' },
+        { "temp-dc",    required_argument, NULL, 't' },
+        { "max-gap",    required_argument, NULL, 'g' },
+        { "help",       no_argument,       NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "swinging-door") == 0) {
+                cfg.mode = COMPRESSOR_MODE_SWINGING_DOOR;
+            } else if (strcmp(optarg, "deadband") == 0) {
+                cfg.mode = COMPRESSOR_MODE_DEADBAND;
+            } else if (strcmp(optarg, "off") == 0) {
+                cfg.mode = COMPRESSOR_MODE_OFF;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v': cfg.voltage_bound = (float)atof(optarg) / 1000.0f; break;
+        case 't': cfg.temp_bound = (float)atof(optarg) / 10.0f; break;
+        case 'g': cfg.max_gap_sec = (uint32_t)atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static const char *const modes[] = { "off", "deadband", "swinging door" };
+    printf("%s, %.1f mV / %.2f C, gap %u s\n", modes[cfg.mode], cfg.voltage_bound * 1000.0,
+           cfg.temp_bound, (unsigned)cfg.max_gap_sec);
+    printf("%-40s %8s %8s %7s %9s %9s\n", "trace", "samples", "points", "ratio", "max mV", "max C");
+
+    result_t total = {0};
+    int rc = 0;
+    for (int i = optind; i < argc; i++) {
+        result_t res;
+        const int file_rc = bench(argv[i], &cfg, &res);
+        if (file_rc == 1) {
+            return 1;
+        }
+        rc = rc ? rc : file_rc;
+        const char *name = strrchr(argv[i], '/');
+        print_result(name ? name + 1 : argv[i], &res);
+        total.samples += res.samples;
+        total.points += res.points;
+        total.max_v_err = fmax(total.max_v_err, res.max_v_err);
+        total.max_t_err = fmax(total.max_t_err, res.max_t_err);
+    }
+    print_result("total", &total);
+    return rc;
+}
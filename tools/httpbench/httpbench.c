@@ -0,0 +1,713 @@
+/* HTTP benchmark for the charger's web server
+ *
+ * Runs each endpoint at each concurrency level for a fixed time against a
+ * real device, records throughput and latency on the host and heap use as
+ * reported by the device's /api/heap, and writes a JSON report. With
+ * --baseline, results are compared against an earlier report and the exit
+ * status is 2 when anything regressed beyond --tolerance.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIST            32
+#define RESP_HEADER_MAX     2048
+#define HEAP_SAMPLE_MS      1000
+#define P99_NOISE_FLOOR_MS  5.0    /* Smaller p99 changes never count as regressions */
+
+typedef struct {
+    const char *host_arg;
+    char host[128];
+    char port[8];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    const char *endpoints[MAX_LIST];
+    int endpoint_count;
+    int concurrency[MAX_LIST];
+    int concurrency_count;
+    int duration_sec;
+    int timeout_ms;
+    bool keepalive;
+    const char *output;
+    const char *baseline;
+    double tolerance_pct;
+} options_t;
+
+/* Device heap figures from /api/heap; -1 where unknown */
+typedef struct {
+    long free;
+    long min_free;
+    long largest_block;
+    long open_sockets;
+    long handler_count;
+    long handler_total_us;
+    long handler_max_us;
+} heap_info_t;
+
+typedef struct {
+    const char *endpoint;
+    int concurrency;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    double wall_sec;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+    heap_info_t before;
+    heap_info_t after;
+    long heap_free_low;       /* Lowest "free" sampled during the run */
+} result_t;
+
+/* One benchmark client thread */
+typedef struct {
+    const char *endpoint;
+    int64_t deadline_us;
+    uint32_t *lat_us;
+    size_t lat_len;
+    size_t lat_cap;
+    uint64_t errors;
+    uint64_t bytes;
+} worker_t;
+
+static options_t s_opt = {
+    .duration_sec = 10,
+    .timeout_ms = 5000,
+    .tolerance_pct = 20.0,
+};
+
+static int64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int split_list(char *arg, const char **out, int max)
+{
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < max; tok = strtok(NULL, ",")) {
+        out[n++] = tok;
+    }
+    return n;
+}
+
+static int resolve_target(const char *arg)
+{
+    if (strncmp(arg, "http://", 7) == 0) {
+        arg += 7;
+    }
+    snprintf(s_opt.host, sizeof(s_opt.host), "%.*s", (int)strcspn(arg, "/"), arg);
+    char *colon = strrchr(s_opt.host, ':');
+    if (colon) {
+        *colon = '\0';
+        snprintf(s_opt.port, sizeof(s_opt.port), "%s", colon + 1);
+    } else {
+        snprintf(s_opt.port, sizeof(s_opt.port), "80");
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    const int err = getaddrinfo(s_opt.host, s_opt.port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", s_opt.host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(&s_opt.addr, res->ai_addr, res->ai_addrlen);
+    s_opt.addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static int open_connection(void)
+{
+    const int fd = socket(s_opt.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    /* On Linux SO_SNDTIMEO also bounds connect() */
+    struct timeval tv = { .tv_sec = s_opt.timeout_ms / 1000, .tv_usec = (s_opt.timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&s_opt.addr, s_opt.addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Send one GET and read the whole response. Returns the HTTP status (0 on
+ * transport errors); *reusable is false when the connection must be closed.
+ * The body is copied to body/body_len when body is not NULL. */
+static int http_get(int fd, const char *path, bool keepalive, char *body, size_t body_len,
+                    size_t *bytes, bool *reusable)
+{
+    char req[512];
+    const int req_len = snprintf(req, sizeof(req),
+                                 "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                                 path, s_opt.host, keepalive ? "keep-alive" : "close");
+    *reusable = false;
+    *bytes = 0;
+    if (send(fd, req, (size_t)req_len, MSG_NOSIGNAL) != req_len) {
+        return 0;
+    }
+
+    /* Headers */
+    char hdr[RESP_HEADER_MAX + 1];
+    size_t hdr_len = 0;
+    char *body_start = NULL;
+    while (body_start == NULL) {
+        if (hdr_len == RESP_HEADER_MAX) {
+            return 0;
+        }
+        const ssize_t n = recv(fd, hdr + hdr_len, RESP_HEADER_MAX - hdr_len, 0);
+        if (n <= 0) {
+            return 0;
+        }
+        hdr_len += (size_t)n;
+        hdr[hdr_len] = '\0';
+        body_start = strstr(hdr, "\r\n\r\n");
+    }
+    body_start += 4;
+
+    int status = 0;
+    if (strncmp(hdr, "HTTP/1.", 7) == 0) {
+        status = atoi(hdr + 9);
+    }
+
+    long content_length = -1;
+    bool chunked = false;
+    bool server_close = false;
+    for (char *line = strstr(hdr, "\r\n"); line && line < body_start - 2; line = strstr(line + 2, "\r\n")) {
+        const char *h = line + 2;
+        if (strncasecmp(h, "Content-Length:", 15) == 0) {
+            content_length = atol(h + 15);
+        } else if (strncasecmp(h, "Transfer-Encoding:", 18) == 0 && strstr(h, "chunked") != NULL) {
+            chunked = true;
+        } else if (strncasecmp(h, "Connection:", 11) == 0 && strcasestr(h, "close") != NULL) {
+            server_close = true;
+        }
+    }
+
+    /* Body: by length, by chunked terminator, or until the server closes */
+    size_t have = hdr_len - (size_t)(body_start - hdr);
+    size_t copied = 0;
+    if (body && body_len > 0) {
+        copied = have < body_len - 1 ? have : body_len - 1;
+        memcpy(body, body_start, copied);
+        body[copied] = '\0';
+    }
+    char tail[8] = {0};
+    size_t tail_len = 0;
+    if (chunked) {
+        tail_len = have < 5 ? have : 5;
+        memcpy(tail, body_start + have - tail_len, tail_len);
+    }
+
+    size_t total = hdr_len;
+    char buf[4096];
+    for (;;) {
+        if (content_length >= 0 && (long)have >= content_length) {
+            break;
+        }
+        if (chunked && tail_len == 5 && memcmp(tail, "0\r\n\r\n", 5) == 0) {
+            break;
+        }
+        const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            return 0;
+        }
+        if (n == 0) {
+            if (content_length >= 0 || chunked) {
+                return 0;   /* Truncated */
+            }
+            break;
+        }
+        if (body && copied + 1 < body_len) {
+            const size_t c = (size_t)n < body_len - 1 - copied ? (size_t)n : body_len - 1 - copied;
+            memcpy(body + copied, buf, c);
+            copied += c;
+            body[copied] = '\0';
+        }
+        if (chunked) {
+            if ((size_t)n >= 5) {
+                memcpy(tail, buf + n - 5, 5);
+            } else {
+                memmove(tail, tail + n, 5 - (size_t)n);
+                memcpy(tail + 5 - n, buf, (size_t)n);
+            }
+            tail_len = 5;
+        }
+        have += (size_t)n;
+        total += (size_t)n;
+    }
+
+    *bytes = total;
+    *reusable = keepalive && !server_close && (content_length >= 0 || chunked);
+    return status;
+}
+
+/* Value of a numeric "key": after from; -1 when missing */
+static long json_number(const char *from, const char *key)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(from, pattern);
+    return p ? atol(p + strlen(pattern)) : -1;
+}
+
+static bool json_string(const char *from, const char *key, char *out, size_t out_len)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    const char *p = strstr(from, pattern);
+    if (p == NULL) {
+        return false;
+    }
+    p += strlen(pattern);
+    const size_t n = strcspn(p, "\"");
+    snprintf(out, out_len, "%.*s", (int)n, p);
+    return true;
+}
+
+static double json_double(const char *from, const char *key)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(from, pattern);
+    return p ? atof(p + strlen(pattern)) : -1;
+}
+
+static bool fetch_heap(const char *endpoint, heap_info_t *info)
+{
+    memset(info, 0xff, sizeof(*info));   /* All -1 */
+
+    char body[4096];
+    size_t bytes;
+    bool reusable;
+    const int fd = open_connection();
+    if (fd < 0) {
+        return false;
+    }
+    const int status = http_get(fd, "/api/heap", false, body, sizeof(body), &bytes, &reusable);
+    close(fd);
+    if (status != 200) {
+        return false;
+    }
+
+    info->free = json_number(body, "free");
+    info->min_free = json_number(body, "min_free");
+    info->largest_block = json_number(body, "largest_block");
+    info->open_sockets = json_number(body, "open_sockets");
+
+    char key[160];
+    snprintf(key, sizeof(key), "\"%s\":{", endpoint);
+    const char *handler = strstr(body, key);
+    if (handler) {
+        info->handler_count = json_number(handler, "count");
+        info->handler_total_us = json_number(handler, "total_us");
+        info->handler_max_us = json_number(handler, "max_us");
+    } else if (info->free >= 0) {
+        /* Endpoint not registered or not hit yet */
+        info->handler_count = 0;
+        info->handler_total_us = 0;
+        info->handler_max_us = 0;
+    }
+    return true;
+}
+
+static void record_latency(worker_t *w, uint32_t us)
+{
+    if (w->lat_len == w->lat_cap) {
+        w->lat_cap = w->lat_cap ? w->lat_cap * 2 : 1024;
+        w->lat_us = realloc(w->lat_us, w->lat_cap * sizeof(*w->lat_us));
+        if (w->lat_us == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    w->lat_us[w->lat_len++] = us;
+}
+
+static void *worker_thread(void *arg)
+{
+    worker_t *w = arg;
+    int fd = -1;
+
+    while (mono_us() < w->deadline_us) {
+        const int64_t start = mono_us();
+        if (fd < 0) {
+            fd = open_connection();
+        }
+        if (fd < 0) {
+            w->errors++;
+            usleep(10000);
+            continue;
+        }
+
+        size_t bytes;
+        bool reusable;
+        const int status = http_get(fd, w->endpoint, s_opt.keepalive, NULL, 0, &bytes, &reusable);
+        const int64_t elapsed = mono_us() - start;
+        if (!reusable) {
+            close(fd);
+            fd = -1;
+        }
+        if (status < 200 || status >= 300) {
+            w->errors++;
+            continue;
+        }
+        w->bytes += bytes;
+        record_latency(w, (uint32_t)elapsed);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+typedef struct {
+    const char *endpoint;
+    volatile bool stop;
+    long low;
+} heap_sampler_t;
+
+/* Polls /api/heap during a run. This costs the device one request per
+ * second, which is small next to the load being measured. */
+static void *heap_sampler_thread(void *arg)
+{
+    heap_sampler_t *hs = arg;
+    while (!hs->stop) {
+        heap_info_t info;
+        if (fetch_heap(hs->endpoint, &info) && info.free >= 0 && (hs->low < 0 || info.free < hs->low)) {
+            hs->low = info.free;
+        }
+        for (int i = 0; i < HEAP_SAMPLE_MS / 50 && !hs->stop; i++) {
+            usleep(50000);
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const uint32_t *sorted, size_t n, double pct)
+{
+    if (n == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(pct * (double)n);
+    if (idx >= n) {
+        idx = n - 1;
+    }
+    return sorted[idx] / 1000.0;
+}
+
+static void run_level(const char *endpoint, int concurrency, result_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->endpoint = endpoint;
+    r->concurrency = concurrency;
+
+    fetch_heap(endpoint, &r->before);
+    heap_sampler_t sampler = { .endpoint = endpoint, .low = r->before.free };
+    pthread_t sampler_thread;
+    pthread_create(&sampler_thread, NULL, heap_sampler_thread, &sampler);
+
+    worker_t *workers = calloc((size_t)concurrency, sizeof(*workers));
+    pthread_t *threads = calloc((size_t)concurrency, sizeof(*threads));
+    const int64_t start = mono_us();
+    for (int i = 0; i < concurrency; i++) {
+        workers[i].endpoint = endpoint;
+        workers[i].deadline_us = start + (int64_t)s_opt.duration_sec * 1000000;
+        pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(threads[i], NULL);
+        total += workers[i].lat_len;
+    }
+    r->wall_sec = (mono_us() - start) / 1e6;
+
+    sampler.stop = true;
+    pthread_join(sampler_thread, NULL);
+    fetch_heap(endpoint, &r->after);
+    r->heap_free_low = sampler.low;
+    if (r->after.free >= 0 && (r->heap_free_low < 0 || r->after.free < r->heap_free_low)) {
+        r->heap_free_low = r->after.free;
+    }
+
+    uint32_t *all = malloc((total ? total : 1) * sizeof(*all));
+    size_t pos = 0;
+    for (int i = 0; i < concurrency; i++) {
+        memcpy(all + pos, workers[i].lat_us, workers[i].lat_len * sizeof(*all));
+        pos += workers[i].lat_len;
+        r->errors += workers[i].errors;
+        r->bytes += workers[i].bytes;
+        free(workers[i].lat_us);
+    }
+    qsort(all, total, sizeof(*all), cmp_u32);
+
+    r->requests = total;
+    r->p50_ms = percentile_ms(all, total, 0.50);
+    r->p90_ms = percentile_ms(all, total, 0.90);
+    r->p99_ms = percentile_ms(all, total, 0.99);
+    r->max_ms = total ? all[total - 1] / 1000.0 : 0;
+
+    free(all);
+    free(workers);
+    free(threads);
+}
+
+static double rps(const result_t *r)
+{
+    return r->wall_sec > 0 ? r->requests / r->wall_sec : 0;
+}
+
+/* Device-side handler time for this run, from the /api/heap counters */
+static double handler_avg_us(const result_t *r)
+{
+    const long count = r->after.handler_count - r->before.handler_count;
+    const long total = r->after.handler_total_us - r->before.handler_total_us;
+    return (r->before.handler_count >= 0 && count > 0) ? (double)total / count : -1;
+}
+
+/* One result object per line so reports diff well and --baseline can read
+ * them back without a JSON library */
+static void write_report(FILE *f, const result_t *results, int count)
+{
+    char started[32];
+    const time_t now = time(NULL);
+    strftime(started, sizeof(started), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"tool\": \"httpbench\",\n");
+    fprintf(f, "  \"format\": 1,\n");
+    fprintf(f, "  \"target\": \"%s:%s\",\n", s_opt.host, s_opt.port);
+    fprintf(f, "  \"started\": \"%s\",\n", started);
+    fprintf(f, "  \"duration_sec\": %d,\n", s_opt.duration_sec);
+    fprintf(f, "  \"keepalive\": %s,\n", s_opt.keepalive ? "true" : "false");
+    fprintf(f, "  \"results\": [\n");
+    for (int i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        fprintf(f, "    {\"endpoint\":\"%s\",\"concurrency\":%d,\"requests\":%llu,\"errors\":%llu,"
+                   "\"rps\":%.1f,\"p50_ms\":%.2f,\"p90_ms\":%.2f,\"p99_ms\":%.2f,\"max_ms\":%.2f,"
+                   "\"bytes_per_req\":%.0f,\"handler_avg_us\":%.0f,\"handler_max_us\":%ld,"
+                   "\"heap_free_before\":%ld,\"heap_free_low\":%ld,\"heap_free_after\":%ld,"
+                   "\"heap_min_free\":%ld,\"heap_largest_block\":%ld}%s\n",
+                r->endpoint, r->concurrency, (unsigned long long)r->requests,
+                (unsigned long long)r->errors, rps(r), r->p50_ms, r->p90_ms, r->p99_ms, r->max_ms,
+                r->requests ? (double)r->bytes / r->requests : 0, handler_avg_us(r),
+                r->after.handler_max_us, r->before.free, r->heap_free_low, r->after.free,
+                r->after.min_free, r->after.largest_block, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void print_summary(const result_t *results, int count)
+{
+    fprintf(stderr, "\n%-16s %5s %8s %7s %8s %8s %8s %10s %10s\n",
+            "endpoint", "conc", "req/s", "errors", "p50 ms", "p99 ms", "dev us", "heap low", "heap drop");
+    for (int i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        const long drop = (r->before.free >= 0 && r->heap_free_low >= 0) ? r->before.free - r->heap_free_low : -1;
+        fprintf(stderr, "%-16s %5d %8.1f %7llu %8.2f %8.2f %8.0f %10ld %10ld\n",
+                r->endpoint, r->concurrency, rps(r), (unsigned long long)r->errors,
+                r->p50_ms, r->p99_ms, handler_avg_us(r), r->heap_free_low, drop);
+    }
+}
+
+/* Returns the number of regressions against the baseline report */
+static int compare_baseline(const char *path, const result_t *results, int count)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    const double tol = s_opt.tolerance_pct / 100.0;
+    int regressions = 0;
+    int matched = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char endpoint[128];
+        if (!json_string(line, "endpoint", endpoint, sizeof(endpoint))) {
+            continue;
+        }
+        const int conc = (int)json_number(line, "concurrency");
+        const double base_rps = json_double(line, "rps");
+        const double base_p99 = json_double(line, "p99_ms");
+        const long base_errors = json_number(line, "errors");
+        const long base_low = json_number(line, "heap_free_low");
+
+        for (int i = 0; i < count; i++) {
+            const result_t *r = &results[i];
+            if (r->concurrency != conc || strcmp(r->endpoint, endpoint) != 0) {
+                continue;
+            }
+            matched++;
+            if (rps(r) < base_rps * (1.0 - tol)) {
+                fprintf(stderr, "REGRESSION %s x%d: %.1f req/s, baseline %.1f\n",
+                        endpoint, conc, rps(r), base_rps);
+                regressions++;
+            }
+            if (r->p99_ms > base_p99 * (1.0 + tol) && r->p99_ms - base_p99 > P99_NOISE_FLOOR_MS) {
+                fprintf(stderr, "REGRESSION %s x%d: p99 %.2f ms, baseline %.2f ms\n",
+                        endpoint, conc, r->p99_ms, base_p99);
+                regressions++;
+            }
+            if (base_errors == 0 && r->errors > 0) {
+                fprintf(stderr, "REGRESSION %s x%d: %llu errors, baseline none\n",
+                        endpoint, conc, (unsigned long long)r->errors);
+                regressions++;
+            }
+            if (base_low > 0 && r->heap_free_low >= 0 && r->heap_free_low < base_low * (1.0 - tol)) {
+                fprintf(stderr, "REGRESSION %s x%d: heap low %ld bytes, baseline %ld\n",
+                        endpoint, conc, r->heap_free_low, base_low);
+                regressions++;
+            }
+        }
+    }
+    fclose(f);
+
+    fprintf(stderr, "baseline: %d results compared, %d regressions (tolerance %.0f%%)\n",
+            matched, regressions, s_opt.tolerance_pct);
+    return regressions;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s --host HOST[:PORT] [options]\n"
+        "\n"
+        "  --host HOST[:PORT]       Charger to benchmark (required)\n"
+        "  --endpoints LIST         Comma-separated paths (default /,/api/data,/api/series,/api/sessions)\n"
+        "  --concurrency LIST       Comma-separated client counts (default 1,2,4,8,16)\n"
+        "  --duration SEC           Time per endpoint and level (default 10)\n"
+        "  --timeout MS             Per-request timeout (default 5000)\n"
+        "  --keepalive              Reuse connections like a browser (default: one per request)\n"
+        "  --output FILE            Write the JSON report here (default stdout)\n"
+        "  --baseline FILE          Compare against an earlier report; exit 2 on regression\n"
+        "  --tolerance PCT          Allowed change before it counts as a regression (default 20)\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    static char default_endpoints[] = "/,/api/data,/api/series,/api/sessions";
+    static char default_concurrency[] = "1,2,4,8,16";
+    char *endpoints_arg = default_endpoints;
+    char *concurrency_arg = default_concurrency;
+
+    static const struct option long_opts[] = {
+        { "host",        required_argument, NULL, 'h' },
+        { "endpoints",   required_argument, NULL, 'e' },
+        { "concurrency", required_argument, NULL, 'c' },
+        { "duration",    required_argument, NULL, 'd' },
+        { "timeout",     required_argument, NULL, 't' },
+        { "keepalive",   no_argument,       NULL, 'k' },
+        { "output",      required_argument, NULL, 'o' },
+        { "baseline",    required_argument, NULL, 'b' },
+        { "tolerance",   required_argument, NULL, 'T' },
+        { "help",        no_argument,       NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'h': s_opt.host_arg = optarg; break;
+        case 'e': endpoints_arg = optarg; break;
+        case 'c': concurrency_arg = optarg; break;
+        case 'd': s_opt.duration_sec = atoi(optarg); break;
+        case 't': s_opt.timeout_ms = atoi(optarg); break;
+        case 'k': s_opt.keepalive = true; break;
+        case 'o': s_opt.output = optarg; break;
+        case 'b': s_opt.baseline = optarg; break;
+        case 'T': s_opt.tolerance_pct = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (s_opt.host_arg == NULL || s_opt.duration_sec <= 0 || s_opt.timeout_ms <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (resolve_target(s_opt.host_arg) < 0) {
+        return 1;
+    }
+
+    s_opt.endpoint_count = split_list(endpoints_arg, s_opt.endpoints, MAX_LIST);
+    const char *levels[MAX_LIST];
+    s_opt.concurrency_count = split_list(concurrency_arg, levels, MAX_LIST);
+    for (int i = 0; i < s_opt.concurrency_count; i++) {
+        s_opt.concurrency[i] = atoi(levels[i]);
+        if (s_opt.concurrency[i] <= 0) {
+            fprintf(stderr, "bad concurrency level: %s\n", levels[i]);
+            return 1;
+        }
+    }
+
+    heap_info_t probe;
+    if (!fetch_heap("", &probe)) {
+        fprintf(stderr, "warning: %s:%s/api/heap not reachable, heap figures will be -1\n",
+                s_opt.host, s_opt.port);
+    }
+
+    const int count = s_opt.endpoint_count * s_opt.concurrency_count;
+    result_t *results = calloc((size_t)count, sizeof(*results));
+    int n = 0;
+    for (int e = 0; e < s_opt.endpoint_count; e++) {
+        for (int c = 0; c < s_opt.concurrency_count; c++) {
+            fprintf(stderr, "%s x%d ...", s_opt.endpoints[e], s_opt.concurrency[c]);
+            run_level(s_opt.endpoints[e], s_opt.concurrency[c], &results[n]);
+            fprintf(stderr, " %.1f req/s, p99 %.2f ms, %llu errors\n", rps(&results[n]),
+                    results[n].p99_ms, (unsigned long long)results[n].errors);
+            n++;
+        }
+    }
+
+    print_summary(results, count);
+
+    FILE *out = stdout;
+    if (s_opt.output) {
+        out = fopen(s_opt.output, "w");
+        if (out == NULL) {
+            perror(s_opt.output);
+            return 1;
+        }
+    }
+    write_report(out, results, count);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    int ret = 0;
+    if (s_opt.baseline) {
+        const int regressions = compare_baseline(s_opt.baseline, results, count);
+        ret = regressions != 0 ? 2 : 0;
+    }
+    free(results);
+    return ret;
+}
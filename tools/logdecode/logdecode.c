@@ -0,0 +1,289 @@
+/* Decoder for the charger's binary log
+ *
+ * Reads a /api/logs dump from a file or stdin and prints one line per
+ * record, formatted with the event table in main/binlog_events.h - the
+ * same header the firmware records with. Records the ring overwrote
+ * between two reads show up as a gap in the sequence numbers.
+ *
+ *   curl -s http://charger/api/logs | charger-logdecode
+ *   curl -s 'http://charger/api/logs?since=1200' | charger-logdecode
+ *
+ * The sequence number to pass as since= next time is printed to stderr.
+ *
+ * --csv prints only the per-sample records, as CSV that
+ * tools/anomalyreplay reads: smoothed and raw voltage, die and cell
+ * temperature and charge state, which is what its ADC noise and
+ * temperature rise detectors need and /api/export doesn't keep:
+ *
+ *   curl -s http://charger/api/logs | charger-logdecode --csv > trace.csv
+ */
+
+#include "binlog_events.h"
+#include "api_schema.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LINE_MAX_LEN  512
+
+typedef struct {
+    uint16_t id;
+    char level;
+    const char *tag;
+    const char *format;
+} event_def_t;
+
+static const event_def_t s_events[] = {
+#define EVENT_DEF(id, name, level, tag, format) { id, #level[0], tag, format },
+    BINLOG_EVENTS(EVENT_DEF)
+#undef EVENT_DEF
+};
+
+enum {
+#define EVENT_ID(id, name, level, tag, format) EVENT_##name = id,
+    BINLOG_EVENTS(EVENT_ID)
+#undef EVENT_ID
+};
+
+typedef struct {
+    const char *name;
+    const char *const *values;
+    size_t count;
+} enum_def_t;
+
+static const char *const s_charge_states[] = API_CHARGE_STATE_NAMES;
+static const char *const s_sched_modes[] = API_SCHED_MODE_NAMES;
+static const char *const s_sinks[] = API_SINK_NAMES;
+
+static const enum_def_t s_enums[] = {
+    { "charge_state", s_charge_states, sizeof(s_charge_states) / sizeof(s_charge_states[0]) },
+    { "sched_mode",   s_sched_modes,   sizeof(s_sched_modes) / sizeof(s_sched_modes[0]) },
+    { "sink",         s_sinks,         sizeof(s_sinks) / sizeof(s_sinks[0]) },
+};
+
+static const event_def_t *find_event(uint16_t id)
+{
+    for (size_t i = 0; i < sizeof(s_events) / sizeof(s_events[0]); i++) {
+        if (s_events[i].id == id) {
+            return &s_events[i];
+        }
+    }
+    return NULL;
+}
+
+/* %{name}: the enum value name, or the number if out of range */
+static int put_enum(char *out, size_t out_len, const char *name, size_t name_len, uint32_t arg)
+{
+    for (size_t i = 0; i < sizeof(s_enums) / sizeof(s_enums[0]); i++) {
+        if (strlen(s_enums[i].name) == name_len && strncmp(s_enums[i].name, name, name_len) == 0) {
+            if (arg < s_enums[i].count) {
+                return snprintf(out, out_len, "%s", s_enums[i].values[arg]);
+            }
+            break;
+        }
+    }
+    return snprintf(out, out_len, "%u", (unsigned)arg);
+}
+
+/* Expand a format with the record's arguments; missing ones print as ? */
+static void format_record(char *out, size_t out_len, const char *fmt, const binlog_record_t *rec)
+{
+    size_t len = 0;
+    unsigned next_arg = 0;
+    for (const char *p = fmt; *p != '\0' && len + 1 < out_len; ) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+        /* One conversion: flags, width, precision, then the letter */
+        const char *spec = p++;
+        const char *brace_end = NULL;
+        if (*p == '{') {
+            brace_end = strchr(p, '}');
+            if (brace_end == NULL) {
+                break;
+            }
+            p = brace_end + 1;
+        } else {
+            p += strspn(p, "-+ #0123456789.");
+            if (*p == '\0') {
+                break;
+            }
+            p++;
+        }
+
+        const bool have_arg = next_arg < rec->nargs && next_arg < BINLOG_MAX_ARGS;
+        const uint32_t arg = have_arg ? rec->args[next_arg] : 0;
+        next_arg++;
+        int n;
+        if (!have_arg) {
+            n = snprintf(out + len, out_len - len, "?");
+        } else if (brace_end != NULL) {
+            n = put_enum(out + len, out_len - len, spec + 2, (size_t)(brace_end - spec - 2), arg);
+        } else {
+            char conv[16];
+            const size_t spec_len = (size_t)(p - spec);
+            if (spec_len >= sizeof(conv)) {
+                break;
+            }
+            memcpy(conv, spec, spec_len);
+            conv[spec_len] = '\0';
+            switch (p[-1]) {
+            case 'f': case 'e': case 'g': {
+                float v;
+                memcpy(&v, &arg, sizeof(v));
+                n = snprintf(out + len, out_len - len, conv, (double)v);
+                break;
+            }
+            case 'd': case 'i':
+                n = snprintf(out + len, out_len - len, conv, (int)(int32_t)arg);
+                break;
+            case 'u': case 'x': case 'X': case 'c':
+                n = snprintf(out + len, out_len - len, conv, (unsigned)arg);
+                break;
+            default:
+                n = snprintf(out + len, out_len - len, "%s", conv);
+                break;
+            }
+        }
+        if (n < 0) {
+            break;
+        }
+        len += (size_t)n < out_len - len ? (size_t)n : out_len - len - 1;
+    }
+    out[len] = '\0';
+}
+
+static void print_time(const binlog_dump_header_t *hdr, uint32_t time_ms)
+{
+    if (!hdr->synced) {
+        printf("%10u.%03u ", time_ms / 1000, time_ms % 1000);
+        return;
+    }
+    /* Wall time of the record from the clock at the time of the dump */
+    const int64_t utc_ms = hdr->utc_ms - (int64_t)(hdr->uptime_ms - time_ms);
+    const time_t secs = (time_t)(utc_ms / 1000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%03dZ ", buf, (int)(utc_ms % 1000));
+}
+
+static float arg_float(const binlog_record_t *rec, unsigned i)
+{
+    float v;
+    memcpy(&v, &rec->args[i], sizeof(v));
+    return v;
+}
+
+/* One SENSOR_SAMPLE as a CSV row; see csv_header */
+static void print_csv_sample(const binlog_dump_header_t *hdr, const binlog_record_t *rec)
+{
+    if (rec->nargs < 5) {
+        return;
+    }
+    if (hdr->synced) {
+        printf("%lld", (long long)(hdr->utc_ms - (int64_t)(hdr->uptime_ms - rec->time_ms)) * 1000000LL);
+    }
+    const uint32_t state = rec->args[4];
+    const float cell_temp = arg_float(rec, 3);
+    printf(",%u,%.3f,%.3f,%.1f,", (unsigned)rec->time_ms, (double)arg_float(rec, 0),
+           (double)arg_float(rec, 1), (double)arg_float(rec, 2));
+    if (!isnan(cell_temp)) {
+        printf("%.1f", (double)cell_temp);
+    }
+    if (state < sizeof(s_charge_states) / sizeof(s_charge_states[0])) {
+        printf(",%s\n", s_charge_states[state]);
+    } else {
+        printf(",%u\n", (unsigned)state);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool csv = argc > 1 && strcmp(argv[1], "--csv") == 0;
+    if (csv) {
+        argv++;
+        argc--;
+    }
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+        fprintf(stderr, "Usage: %s [--csv] [DUMP]   (stdin if no file, or -)\n", argv[0]);
+        return 1;
+    }
+    FILE *in = stdin;
+    const char *path = argc == 2 ? argv[1] : "-";
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (in == NULL) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    binlog_dump_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, "BLOG", 4) != 0) {
+        fprintf(stderr, "%s: not a binary log dump\n", path);
+        return 1;
+    }
+    if (hdr.version != BINLOG_VERSION || hdr.record_size != sizeof(binlog_record_t)) {
+        fprintf(stderr, "%s: dump version %u (record %u bytes), this decoder reads version %d\n",
+                path, hdr.version, hdr.record_size, BINLOG_VERSION);
+        return 1;
+    }
+
+    binlog_record_t rec;
+    unsigned long records = 0;
+    uint32_t next_seq = 0;
+    if (csv) {
+        printf("timestamp_ns,uptime_ms,voltage,raw_voltage,temp,cell_temp,charge_state\n");
+    }
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        if (csv) {
+            if (rec.event == EVENT_SENSOR_SAMPLE) {
+                print_csv_sample(&hdr, &rec);
+            }
+            next_seq = rec.seq + 1;
+            records++;
+            continue;
+        }
+        if (records > 0 && rec.seq != next_seq) {
+            printf("-- %u records overwritten --\n", (unsigned)(rec.seq - next_seq));
+        }
+        next_seq = rec.seq + 1;
+        records++;
+
+        print_time(&hdr, rec.time_ms);
+        const event_def_t *ev = find_event(rec.event);
+        if (ev == NULL) {
+            printf("? event %u:", rec.event);
+            for (unsigned i = 0; i < rec.nargs && i < BINLOG_MAX_ARGS; i++) {
+                printf(" 0x%08x", (unsigned)rec.args[i]);
+            }
+            printf("\n");
+            continue;
+        }
+        char line[LINE_MAX_LEN];
+        format_record(line, sizeof(line), ev->format, &rec);
+        printf("%c %s: %s\n", ev->level, ev->tag, line);
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    fprintf(stderr, "%lu records%s", records, records ? "" : "\n");
+    if (records > 0) {
+        fprintf(stderr, ", continue with since=%u\n", (unsigned)next_seq);
+    }
+    return 0;
+}
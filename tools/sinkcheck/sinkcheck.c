@@ -0,0 +1,1142 @@
+/* Stand-in backend and encoder check for the charger's upload sinks
+ *
+ * --serve accepts what the sinks send - InfluxDB v2 and v1 writes and
+ * Prometheus remote-write - and prints it. Remote-write bodies go through
+ * a snappy decoder and protobuf parser written independently of the
+ * firmware's encoder, so a malformed request is reported instead of
+ * silently accepted. --fail-pct and --delay-ms make it misbehave, to
+ * watch retry queues and backoff in /api/diag:
+ *
+ *   charger-sinkcheck --serve 8086 --fail-pct 30
+ *
+ * With --tls-cert and --tls-key it speaks https and times each handshake,
+ * full or resumed; --close drops the connection after every request so
+ * each delivery reconnects, and --no-resume issues no session tickets.
+ * The totals are printed on Ctrl-C:
+ *
+ *   charger-sinkcheck --serve 8443 --tls-cert cert.pem --tls-key key.pem --close
+ *
+ * --tls-bench is the client side of the same measurement: it connects N
+ * times, capped at TLS 1.2 like the firmware's mbedTLS, offers the
+ * previous session each time and reports connect and handshake times and
+ * the heap OpenSSL allocated, for full and resumed handshakes apart:
+ *
+ *   charger-sinkcheck --tls-bench localhost:8443 --connections 50 --tls-cert cert.pem
+ *
+ * --send encodes a CSV from /api/export?format=csv with main/remote_write.c
+ * and main/snappy.c - the code the charger runs - and POSTs it, so a real
+ * Prometheus can be checked without a device:
+ *
+ *   charger-sinkcheck --send http://localhost:9090/api/v1/write --cell c1 c1.csv
+ *
+ * --fuzz N round-trips N random buffers through the compressor and the
+ * decoder; the exit status is 2 on any mismatch.
+ */
+
+#include "remote_write.h"
+#include "snappy.h"
+#include "api_schema.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef SINKCHECK_TLS
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#define REQ_HEADER_MAX  4096
+#define REQ_BODY_MAX    (4 * 1024 * 1024)
+#define CSV_LINE_MAX    512
+#define MAX_COLUMNS     16
+#define SEND_BATCH      16    /* INFLUXDB_BATCH_MAX_POINTS, as the uploader encodes */
+#define SEND_OUT_MAX    (32 + REMOTE_WRITE_RAW_MAX + REMOTE_WRITE_RAW_MAX / 6)
+
+typedef struct {
+    int port;
+    int fail_pct;
+    int delay_ms;
+    const char *send_url;
+    const char *cell_id;
+    const char *device;
+    long fuzz_iterations;
+    const char *tls_cert;
+    const char *tls_key;
+    bool no_resume;
+    bool close_each;
+    const char *bench_addr;
+    int bench_connections;
+} options_t;
+
+/* One accepted connection, plain or TLS */
+typedef struct {
+    int fd;
+#ifdef SINKCHECK_TLS
+    SSL *ssl;
+#endif
+} conn_t;
+
+/* Server-side handshake times, [0] full and [1] resumed */
+typedef struct {
+    long count;
+    double total_ms;
+    double max_ms;
+} handshake_stats_t;
+
+static options_t s_opt = {
+    .device = "sinkcheck",
+    .bench_connections = 20,
+};
+
+/* Each connection is served by its own thread; output and stats are
+ * shared */
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static handshake_stats_t s_handshakes[2];
+#ifdef SINKCHECK_TLS
+static SSL_CTX *s_tls_ctx = NULL;
+#endif
+
+/* ---- Snappy decoder, written from the format description ---- */
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p >= end) {
+            return false;
+        }
+        const uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the decoded length, or -1 on malformed input; *out is malloc'd */
+static long snappy_decode(const uint8_t *in, size_t n, uint8_t **out)
+{
+    const uint8_t *p = in;
+    const uint8_t *end = in + n;
+    uint64_t len;
+    if (!get_varint(&p, end, &len) || len > REQ_BODY_MAX * 8) {
+        return -1;
+    }
+    uint8_t *dst = malloc(len ? len : 1);
+    size_t op = 0;
+
+    while (p < end) {
+        const uint8_t tag = *p++;
+        size_t copy_len;
+        size_t offset;
+        switch (tag & 3) {
+        case 0: {
+            size_t lit = tag >> 2;
+            if (lit >= 60) {
+                const int bytes = (int)lit - 59;
+                if (end - p < bytes) {
+                    goto bad;
+                }
+                lit = 0;
+                for (int i = 0; i < bytes; i++) {
+                    lit |= (size_t)p[i] << (8 * i);
+                }
+                p += bytes;
+            }
+            lit++;
+            if ((size_t)(end - p) < lit || len - op < lit) {
+                goto bad;
+            }
+            memcpy(dst + op, p, lit);
+            p += lit;
+            op += lit;
+            continue;
+        }
+        case 1:
+            if (end - p < 1) {
+                goto bad;
+            }
+            copy_len = 4 + ((tag >> 2) & 7);
+            offset = ((size_t)(tag >> 5) << 8) | p[0];
+            p += 1;
+            break;
+        case 2:
+            if (end - p < 2) {
+                goto bad;
+            }
+            copy_len = 1 + (tag >> 2);
+            offset = p[0] | ((size_t)p[1] << 8);
+            p += 2;
+            break;
+        default:
+            if (end - p < 4) {
+                goto bad;
+            }
+            copy_len = 1 + (tag >> 2);
+            offset = p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+            p += 4;
+            break;
+        }
+        if (offset == 0 || offset > op || len - op < copy_len) {
+            goto bad;
+        }
+        /* Byte by byte: source and destination may overlap */
+        for (size_t i = 0; i < copy_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    if (op != len) {
+        goto bad;
+    }
+    *out = dst;
+    return (long)len;
+
+bad:
+    free(dst);
+    return -1;
+}
+
+/* ---- prompb WriteRequest parser ---- */
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} pb_reader_t;
+
+/* Next field; for length-delimited ones sub covers the body */
+static bool pb_next(pb_reader_t *r, uint32_t *field, uint32_t *wire, uint64_t *value, pb_reader_t *sub)
+{
+    uint64_t key;
+    if (!get_varint(&r->p, r->end, &key)) {
+        return false;
+    }
+    *field = (uint32_t)(key >> 3);
+    *wire = (uint32_t)(key & 7);
+    switch (*wire) {
+    case 0:
+        return get_varint(&r->p, r->end, value);
+    case 1:
+        if (r->end - r->p < 8) {
+            return false;
+        }
+        memcpy(value, r->p, 8);
+        r->p += 8;
+        return true;
+    case 2: {
+        uint64_t len;
+        if (!get_varint(&r->p, r->end, &len) || len > (uint64_t)(r->end - r->p)) {
+            return false;
+        }
+        sub->p = r->p;
+        sub->end = r->p + len;
+        r->p += len;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool print_label(pb_reader_t r, bool first)
+{
+    const char *name = "";
+    const char *value = "";
+    int name_len = 0;
+    int value_len = 0;
+    while (r.p < r.end) {
+        uint32_t field, wire;
+        uint64_t v;
+        pb_reader_t s;
+        if (!pb_next(&r, &field, &wire, &v, &s) || wire != 2) {
+            return false;
+        }
+        if (field == 1) {
+            name = (const char *)s.p;
+            name_len = (int)(s.end - s.p);
+        } else if (field == 2) {
+            value = (const char *)s.p;
+            value_len = (int)(s.end - s.p);
+        }
+    }
+    printf("%s%.*s=\"%.*s\"", first ? "" : ", ", name_len, name, value_len, value);
+    return true;
+}
+
+static bool print_sample(pb_reader_t r)
+{
+    double value = NAN;
+    int64_t timestamp_ms = 0;
+    while (r.p < r.end) {
+        uint32_t field, wire;
+        uint64_t v;
+        pb_reader_t s;
+        if (!pb_next(&r, &field, &wire, &v, &s)) {
+            return false;
+        }
+        if (field == 1 && wire == 1) {
+            memcpy(&value, &v, sizeof(value));
+        } else if (field == 2 && wire == 0) {
+            timestamp_ms = (int64_t)v;
+        }
+    }
+    printf("    %lld %g\n", (long long)timestamp_ms, value);
+    return true;
+}
+
+/* Prints every series; returns the number of samples or -1 if malformed */
+static long print_write_request(const uint8_t *buf, size_t len)
+{
+    pb_reader_t r = { buf, buf + len };
+    long samples = 0;
+    while (r.p < r.end) {
+        uint32_t field, wire;
+        uint64_t v;
+        pb_reader_t series;
+        if (!pb_next(&r, &field, &wire, &v, &series)) {
+            return -1;
+        }
+        if (field != 1 || wire != 2) {
+            continue;
+        }
+        /* Labels come first in the encoding, but needn't */
+        printf("  {");
+        bool first = true;
+        pb_reader_t it = series;
+        while (it.p < it.end) {
+            pb_reader_t s;
+            if (!pb_next(&it, &field, &wire, &v, &s)) {
+                return -1;
+            }
+            if (field == 1 && wire == 2) {
+                if (!print_label(s, first)) {
+                    return -1;
+                }
+                first = false;
+            }
+        }
+        printf("}\n");
+        it = series;
+        while (it.p < it.end) {
+            pb_reader_t s;
+            pb_next(&it, &field, &wire, &v, &s);
+            if (field == 2 && wire == 2) {
+                if (!print_sample(s)) {
+                    return -1;
+                }
+                samples++;
+            }
+        }
+    }
+    return samples;
+}
+
+/* ---- Server ---- */
+
+static ssize_t conn_read(conn_t *c, void *buf, size_t n)
+{
+#ifdef SINKCHECK_TLS
+    if (c->ssl != NULL) {
+        return SSL_read(c->ssl, buf, (int)n);
+    }
+#endif
+    return read(c->fd, buf, n);
+}
+
+static ssize_t conn_write(conn_t *c, const void *buf, size_t n)
+{
+#ifdef SINKCHECK_TLS
+    if (c->ssl != NULL) {
+        return SSL_write(c->ssl, buf, (int)n);
+    }
+#endif
+    return write(c->fd, buf, n);
+}
+
+static void respond(conn_t *c, int status, const char *reason, const char *body)
+{
+    char resp[512];
+    const int n = snprintf(resp, sizeof(resp),
+                           "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n%s",
+                           status, reason, strlen(body), s_opt.close_each ? "close" : "keep-alive", body);
+    if (conn_write(c, resp, n) != n) {
+        perror("write");
+    }
+}
+
+static const char *header_value(const char *headers, const char *name)
+{
+    const size_t len = strlen(name);
+    for (const char *p = strstr(headers, "\r\n"); p != NULL; p = strstr(p + 2, "\r\n")) {
+        if (strncasecmp(p + 2, name, len) == 0 && p[2 + len] == ':') {
+            const char *v = p + 3 + len;
+            while (*v == ' ') {
+                v++;
+            }
+            return v;
+        }
+    }
+    return NULL;
+}
+
+/* Handles one request; returns false once the connection is done */
+static bool serve_request(conn_t *c)
+{
+    char head[REQ_HEADER_MAX + 1];
+    size_t have = 0;
+    char *body_start = NULL;
+    while (body_start == NULL) {
+        if (have == REQ_HEADER_MAX) {
+            respond(c, 431, "Request Header Fields Too Large", "");
+            return false;
+        }
+        const ssize_t n = conn_read(c, head + have, REQ_HEADER_MAX - have);
+        if (n <= 0) {
+            return false;
+        }
+        have += n;
+        head[have] = '\0';
+        body_start = strstr(head, "\r\n\r\n");
+    }
+    *body_start = '\0';
+    body_start += 4;
+
+    char method[8] = "";
+    char path[256] = "";
+    sscanf(head, "%7s %255s", method, path);
+    const char *cl = header_value(head, "Content-Length");
+    const size_t body_len = cl ? strtoul(cl, NULL, 10) : 0;
+    if (body_len > REQ_BODY_MAX) {
+        respond(c, 413, "Payload Too Large", "");
+        return false;
+    }
+
+    uint8_t *body = malloc(body_len + 1);
+    size_t got = have - (size_t)(body_start - head);
+    if (got > body_len) {
+        got = body_len;     /* Pipelining isn't used by the firmware */
+    }
+    memcpy(body, body_start, got);
+    while (got < body_len) {
+        const ssize_t n = conn_read(c, body + got, body_len - got);
+        if (n <= 0) {
+            free(body);
+            return false;
+        }
+        got += n;
+    }
+    body[body_len] = '\0';
+
+    if (s_opt.delay_ms > 0) {
+        usleep((useconds_t)s_opt.delay_ms * 1000);
+    }
+    pthread_mutex_lock(&s_lock);
+
+    const bool snappy = header_value(head, "Content-Encoding") != NULL &&
+                        strncasecmp(header_value(head, "Content-Encoding"), "snappy", 6) == 0;
+    const char *auth = header_value(head, "Authorization");
+    printf("%s %s (%zu bytes%s%.*s)\n", method, path, body_len, auth ? ", auth " : "",
+           auth ? (int)strcspn(auth, " \r") : 0, auth ? auth : "");
+
+    if (strcmp(method, "POST") != 0) {
+        respond(c, 405, "Method Not Allowed", "");
+    } else if (s_opt.fail_pct > 0 && rand() % 100 < s_opt.fail_pct) {
+        printf("  -> 503 (injected)\n");
+        respond(c, 503, "Service Unavailable", "injected failure\n");
+    } else if (snappy) {
+        uint8_t *raw = NULL;
+        const long raw_len = snappy_decode(body, body_len, &raw);
+        const long samples = raw_len < 0 ? -1 : print_write_request(raw, raw_len);
+        free(raw);
+        if (samples < 0) {
+            printf("  -> 400: %s\n", raw_len < 0 ? "bad snappy stream" : "bad protobuf");
+            respond(c, 400, "Bad Request", "malformed remote-write request\n");
+        } else {
+            printf("  -> 204 (%ld samples, %ld bytes uncompressed)\n", samples, raw_len);
+            respond(c, 204, "No Content", "");
+        }
+    } else if (strncmp(path, "/api/v2/write", 13) == 0 || strncmp(path, "/write", 6) == 0) {
+        long lines = 0;
+        char *save;
+        for (char *line = strtok_r((char *)body, "\n", &save); line != NULL;
+             line = strtok_r(NULL, "\n", &save)) {
+            printf("  %s\n", line);
+            lines++;
+        }
+        printf("  -> 204 (%ld lines)\n", lines);
+        respond(c, 204, "No Content", "");
+    } else {
+        respond(c, 404, "Not Found", "");
+    }
+    free(body);
+    fflush(stdout);
+    pthread_mutex_unlock(&s_lock);
+
+    const char *conn = header_value(head, "Connection");
+    return !s_opt.close_each && (conn == NULL || strncasecmp(conn, "close", 5) != 0);
+}
+
+#ifdef SINKCHECK_TLS
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static bool tls_init(void)
+{
+    s_tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (SSL_CTX_use_certificate_chain_file(s_tls_ctx, s_opt.tls_cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(s_tls_ctx, s_opt.tls_key, SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+    if (s_opt.no_resume) {
+        SSL_CTX_set_options(s_tls_ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(s_tls_ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_num_tickets(s_tls_ctx, 0);
+    }
+    return true;
+}
+
+/* Handshake and record whether the client resumed a session. Timed from
+ * accept, so it includes waiting for the ClientHello, which a client
+ * sends right after connecting. */
+static bool tls_accept(conn_t *c)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    c->ssl = SSL_new(s_tls_ctx);
+    SSL_set_fd(c->ssl, c->fd);
+    const bool ok = SSL_accept(c->ssl) == 1;
+    const double ms = elapsed_ms(&start);
+
+    pthread_mutex_lock(&s_lock);
+    if (!ok) {
+        printf("TLS handshake failed\n");
+        ERR_print_errors_fp(stdout);
+    } else {
+        const int resumed = SSL_session_reused(c->ssl) ? 1 : 0;
+        handshake_stats_t *hs = &s_handshakes[resumed];
+        hs->count++;
+        hs->total_ms += ms;
+        if (ms > hs->max_ms) {
+            hs->max_ms = ms;
+        }
+        printf("TLS %s handshake in %.1f ms (%s, %s)\n", resumed ? "resumed" : "full", ms,
+               SSL_get_version(c->ssl), SSL_get_cipher_name(c->ssl));
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&s_lock);
+    return ok;
+}
+#endif
+
+static void *serve_connection(void *arg)
+{
+    conn_t c = { .fd = (int)(intptr_t)arg };
+#ifdef SINKCHECK_TLS
+    if (s_tls_ctx == NULL || tls_accept(&c)) {
+        while (serve_request(&c)) {
+        }
+    }
+    if (c.ssl != NULL) {
+        SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+    }
+#else
+    while (serve_request(&c)) {
+    }
+#endif
+    close(c.fd);
+    return NULL;
+}
+
+static void print_handshakes(void)
+{
+    static const char *const kinds[] = { "full", "resumed" };
+    fprintf(stderr, "\nTLS handshakes   count   avg ms   max ms\n");
+    for (int i = 0; i < 2; i++) {
+        const handshake_stats_t *hs = &s_handshakes[i];
+        fprintf(stderr, "%-14s %7ld %8.1f %8.1f\n", kinds[i], hs->count,
+                hs->count ? hs->total_ms / hs->count : 0.0, hs->max_ms);
+    }
+}
+
+static void on_interrupt(int sig)
+{
+    (void)sig;
+}
+
+static int serve(void)
+{
+    const int lfd = socket(AF_INET6, SOCK_STREAM, 0);
+    const int on = 1;
+    const int off = 0;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(lfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons((uint16_t)s_opt.port),
+        .sin6_addr = IN6ADDR_ANY_INIT,
+    };
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 8) < 0) {
+        perror("bind");
+        return 1;
+    }
+    if (s_opt.tls_cert != NULL) {
+#ifdef SINKCHECK_TLS
+        if (!tls_init()) {
+            return 1;
+        }
+#else
+        fprintf(stderr, "Built without OpenSSL, --tls-cert is not available\n");
+        return 1;
+#endif
+    }
+    fprintf(stderr, "Listening on port %d (%s, fail %d%%, delay %d ms%s%s)\n",
+            s_opt.port, s_opt.tls_cert ? "https" : "http", s_opt.fail_pct, s_opt.delay_ms,
+            s_opt.close_each ? ", close" : "", s_opt.no_resume ? ", no resume" : "");
+
+    /* Ctrl-C interrupts accept() to print the handshake totals */
+    struct sigaction sa = { .sa_handler = on_interrupt };
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Sinks hold their connections open, so each gets a thread */
+    while (1) {
+        const int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                break;
+            }
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    pthread_mutex_lock(&s_lock);
+    if (s_opt.tls_cert != NULL) {
+        print_handshakes();
+    }
+    return 0;
+}
+
+/* ---- Sender ---- */
+
+static int split(char *line, char **fields)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char *p = line; n < MAX_COLUMNS; ) {
+        fields[n++] = p;
+        p = strchr(p, ',');
+        if (p == NULL) {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static int column(char **fields, int n, const char *name)
+{
+    for (int i = 0; i < n; i++) {
+        if (strcmp(fields[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int charge_state_index(const char *s)
+{
+    static const char *const names[] = API_CHARGE_STATE_NAMES;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(s, names[i]) == 0) {
+            return (int)i;
+        }
+    }
+    return atoi(s);
+}
+
+static int post(const char *host, const char *port, const char *path, const uint8_t *body, size_t len)
+{
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+    struct addrinfo *ai;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return -1;
+    }
+    const int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        perror("connect");
+        freeaddrinfo(ai);
+        close(fd);
+        return -1;
+    }
+    freeaddrinfo(ai);
+
+    char head[512];
+    const int n = snprintf(head, sizeof(head),
+                           "POST %s HTTP/1.1\r\nHost: %s:%s\r\n"
+                           "Content-Type: application/x-protobuf\r\nContent-Encoding: snappy\r\n"
+                           "X-Prometheus-Remote-Write-Version: 0.1.0\r\n"
+                           "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                           path, host, port, len);
+    if (write(fd, head, n) != n || write(fd, body, len) != (ssize_t)len) {
+        perror("write");
+        close(fd);
+        return -1;
+    }
+    char resp[1024];
+    const ssize_t got = read(fd, resp, sizeof(resp) - 1);
+    close(fd);
+    if (got <= 0) {
+        return -1;
+    }
+    resp[got] = '\0';
+    int status = -1;
+    sscanf(resp, "HTTP/%*s %d", &status);
+    if (status < 200 || status >= 300) {
+        const char *msg = strstr(resp, "\r\n\r\n");
+        fprintf(stderr, "HTTP %d%s%s", status, msg ? ": " : "\n", msg ? msg + 4 : "");
+    }
+    return status;
+}
+
+static int send_csv(const char *path_csv)
+{
+    char host[128] = "";
+    char port[8] = "80";
+    char path[256] = "/api/v1/write";
+    if (sscanf(s_opt.send_url, "http://%127[^:/]:%7[0-9]%255s", host, port, path) < 2 &&
+        sscanf(s_opt.send_url, "http://%127[^:/]%255s", host, path) < 1) {
+        fprintf(stderr, "Only http:// URLs are supported\n");
+        return 1;
+    }
+
+    FILE *f = fopen(path_csv, "r");
+    if (f == NULL) {
+        perror(path_csv);
+        return 1;
+    }
+    char line[CSV_LINE_MAX];
+    char *fields[MAX_COLUMNS];
+    if (fgets(line, sizeof(line), f) == NULL) {
+        fclose(f);
+        return 1;
+    }
+    int n = split(line, fields);
+    const int c_ts = column(fields, n, "timestamp_ns");
+    const int c_voltage = column(fields, n, "voltage");
+    const int c_temp = column(fields, n, "temp");
+    const int c_state = column(fields, n, "charge_state");
+    const int c_cell_temp = column(fields, n, "cell_temp");
+    if (c_ts < 0 || c_voltage < 0) {
+        fprintf(stderr, "%s: needs timestamp_ns and voltage columns\n", path_csv);
+        fclose(f);
+        return 1;
+    }
+
+    /* Exports only carry UTC timestamps once the clock was synced */
+    sensor_data_t batch[SEND_BATCH];
+    static uint8_t out[SEND_OUT_MAX];
+    size_t count = 0;
+    long sent = 0;
+    int rc = 0;
+    bool more = true;
+    while (more) {
+        more = fgets(line, sizeof(line), f) != NULL;
+        if (more && (n = split(line, fields)) > c_voltage) {
+            sensor_data_t *p = &batch[count++];
+            memset(p, 0, sizeof(*p));
+            p->timestamp_ns = strtoll(fields[c_ts], NULL, 10);
+            p->time_synced = true;
+            p->battery_voltage = strtof(fields[c_voltage], NULL);
+            p->battery_percentage = NAN;
+            p->internal_temp = c_temp >= 0 && c_temp < n ? strtof(fields[c_temp], NULL) : NAN;
+            p->cell_temp = c_cell_temp >= 0 && c_cell_temp < n ? strtof(fields[c_cell_temp], NULL) : NAN;
+            p->ir_mohm = NAN;
+            p->charge_state = c_state >= 0 && c_state < n ? charge_state_index(fields[c_state]) : 0;
+            snprintf(p->cell_id, sizeof(p->cell_id), "%s", s_opt.cell_id ? s_opt.cell_id : "");
+        }
+        if (count == SEND_BATCH || (!more && count > 0)) {
+            const size_t len = remote_write_encode(batch, count, s_opt.device, out, sizeof(out));
+            if (len == 0) {
+                fprintf(stderr, "Encoding failed\n");
+                rc = 1;
+                break;
+            }
+            const int status = post(host, port, path, out, len);
+            if (status < 200 || status >= 300) {
+                rc = 2;
+                break;
+            }
+            sent += count;
+            count = 0;
+        }
+    }
+    fclose(f);
+    fprintf(stderr, "Sent %ld points from %s\n", sent, path_csv);
+    return rc;
+}
+
+/* ---- TLS client benchmark ---- */
+
+#ifdef SINKCHECK_TLS
+/* OpenSSL's allocations go through these with a size header, so the
+ * client can report the heap a handshake took; the client is single
+ * threaded */
+typedef union {
+    size_t size;
+    max_align_t align;
+} alloc_header_t;
+
+static size_t s_heap_now = 0;
+static size_t s_heap_peak = 0;
+
+static void *counting_malloc(size_t n, const char *file, int line)
+{
+    alloc_header_t *h = malloc(sizeof(*h) + n);
+    if (h == NULL) {
+        return NULL;
+    }
+    h->size = n;
+    s_heap_now += n;
+    if (s_heap_now > s_heap_peak) {
+        s_heap_peak = s_heap_now;
+    }
+    return h + 1;
+}
+
+static void counting_free(void *p, const char *file, int line)
+{
+    if (p != NULL) {
+        alloc_header_t *h = (alloc_header_t *)p - 1;
+        s_heap_now -= h->size;
+        free(h);
+    }
+}
+
+static void *counting_realloc(void *p, size_t n, const char *file, int line)
+{
+    if (p == NULL) {
+        return counting_malloc(n, file, line);
+    }
+    alloc_header_t *h = (alloc_header_t *)p - 1;
+    const size_t old = h->size;
+    h = realloc(h, sizeof(*h) + n);
+    if (h == NULL) {
+        return NULL;
+    }
+    h->size = n;
+    s_heap_now = s_heap_now - old + n;
+    if (s_heap_now > s_heap_peak) {
+        s_heap_peak = s_heap_now;
+    }
+    return h + 1;
+}
+
+/* Per kind, [0] full and [1] resumed */
+typedef struct {
+    long count;
+    double connect_ms;
+    double handshake_ms;
+    double max_handshake_ms;
+    size_t heap_total;
+    size_t heap_max;
+} bench_stats_t;
+
+static int connect_to(const char *host, const char *port)
+{
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+    struct addrinfo *ai;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return -1;
+    }
+    const int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        perror("connect");
+        freeaddrinfo(ai);
+        close(fd);
+        return -1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* One write as a sink would send it; returns false unless answered 2xx */
+static bool bench_request(SSL *ssl, const char *host, const char *port)
+{
+    static const char body[] = "battery,device=sinkcheck voltage=3.7\n";
+    char req[512];
+    const int n = snprintf(req, sizeof(req),
+                           "POST /api/v2/write HTTP/1.1\r\nHost: %s:%s\r\n"
+                           "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                           host, port, sizeof(body) - 1, body);
+    if (SSL_write(ssl, req, n) != n) {
+        return false;
+    }
+    char resp[512];
+    const int got = SSL_read(ssl, resp, sizeof(resp) - 1);
+    if (got <= 0) {
+        return false;
+    }
+    resp[got] = '\0';
+    int status = -1;
+    sscanf(resp, "HTTP/%*s %d", &status);
+    return status >= 200 && status < 300;
+}
+
+static int tls_bench(void)
+{
+    char host[128] = "";
+    char port[8] = "";
+    if (sscanf(s_opt.bench_addr, "%127[^:]:%7[0-9]", host, port) != 2) {
+        fprintf(stderr, "--tls-bench needs HOST:PORT\n");
+        return 1;
+    }
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    if (s_opt.tls_cert != NULL) {
+        if (SSL_CTX_load_verify_locations(ctx, s_opt.tls_cert, NULL) != 1) {
+            ERR_print_errors_fp(stderr);
+            SSL_CTX_free(ctx);
+            return 1;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    bench_stats_t stats[2] = { 0 };
+    SSL_SESSION *session = NULL;
+    int rc = 0;
+    for (int i = 0; i < s_opt.bench_connections; i++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        const int fd = connect_to(host, port);
+        if (fd < 0) {
+            rc = 1;
+            break;
+        }
+        const double connect_ms = elapsed_ms(&start);
+
+        const size_t heap_before = s_heap_now;
+        s_heap_peak = s_heap_now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        SSL_set_tlsext_host_name(ssl, host);
+        if (session != NULL) {
+            SSL_set_session(ssl, session);
+        }
+        const bool ok = SSL_connect(ssl) == 1;
+        const double handshake_ms = elapsed_ms(&start);
+        const size_t heap = s_heap_peak - heap_before;
+
+        if (!ok) {
+            fprintf(stderr, "TLS handshake %d failed\n", i + 1);
+            ERR_print_errors_fp(stderr);
+            rc = 2;
+        } else {
+            const int resumed = SSL_session_reused(ssl) ? 1 : 0;
+            bench_stats_t *bs = &stats[resumed];
+            bs->count++;
+            bs->connect_ms += connect_ms;
+            bs->handshake_ms += handshake_ms;
+            if (handshake_ms > bs->max_handshake_ms) {
+                bs->max_handshake_ms = handshake_ms;
+            }
+            bs->heap_total += heap;
+            if (heap > bs->heap_max) {
+                bs->heap_max = heap;
+            }
+            if (!bench_request(ssl, host, port)) {
+                fprintf(stderr, "Request %d got no 2xx answer\n", i + 1);
+                rc = 2;
+            }
+            /* The session to offer next time, as the sinks keep theirs */
+            SSL_SESSION_free(session);
+            session = SSL_get1_session(ssl);
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+        close(fd);
+        if (rc != 0) {
+            break;
+        }
+    }
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+
+    static const char *const kinds[] = { "full", "resumed" };
+    printf("TLS handshakes   count  connect ms  handshake ms  max ms  heap avg  heap max\n");
+    for (int i = 0; i < 2; i++) {
+        const bench_stats_t *bs = &stats[i];
+        const long n = bs->count ? bs->count : 1;
+        printf("%-14s %7ld %11.2f %13.2f %7.2f %9zu %9zu\n", kinds[i], bs->count,
+               bs->connect_ms / n, bs->handshake_ms / n, bs->max_handshake_ms,
+               bs->heap_total / n, bs->heap_max);
+    }
+    return rc;
+}
+#endif
+
+/* ---- Round-trip fuzz ---- */
+
+static int fuzz(void)
+{
+    static uint8_t in[3 * 65536 + 100];
+    static uint8_t out[sizeof(in) + sizeof(in) / 6 + 32];
+    srand(1);
+    for (long it = 0; it < s_opt.fuzz_iterations; it++) {
+        /* Mostly small repetitive inputs like the protobuf, some large
+         * ones to cross block boundaries */
+        const size_t n = it % 16 == 0 ? (size_t)rand() % sizeof(in) : (size_t)rand() % 4096;
+        const int alphabet = 1 + rand() % 256;
+        const int run = 1 + rand() % 64;
+        for (size_t i = 0; i < n; ) {
+            const uint8_t b = (uint8_t)(rand() % alphabet);
+            for (int r = rand() % run; r >= 0 && i < n; r--) {
+                in[i++] = b;
+            }
+            if (i > 64 && rand() % 4 == 0) {
+                /* Repeat an earlier stretch */
+                const size_t from = (size_t)rand() % (i - 32);
+                for (size_t k = 0; k < 32 + (size_t)rand() % 200 && i < n; k++) {
+                    in[i++] = in[from + k];
+                }
+            }
+        }
+
+        const size_t len = snappy_compress(in, n, out, sizeof(out));
+        uint8_t *back = NULL;
+        const long back_len = snappy_decode(out, len, &back);
+        if (len == 0 || back_len != (long)n || memcmp(back, in, n) != 0) {
+            fprintf(stderr, "Mismatch at iteration %ld (%zu bytes in, %zu compressed)\n", it, n, len);
+            free(back);
+            return 2;
+        }
+        free(back);
+    }
+    fprintf(stderr, "%ld round trips OK\n", s_opt.fuzz_iterations);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s --serve PORT [--fail-pct PCT] [--delay-ms MS]\n"
+        "                   [--tls-cert FILE --tls-key FILE] [--close] [--no-resume]\n"
+        "       %s --send URL [--cell ID] [--device NAME] FILE.csv\n"
+        "       %s --tls-bench HOST:PORT [--connections N] [--tls-cert FILE]\n"
+        "       %s --fuzz N\n"
+        "\n"
+        "  --serve PORT             Accept InfluxDB v1/v2 and remote-write requests and print them\n"
+        "  --fail-pct PCT           Answer this share of requests with 503\n"
+        "  --delay-ms MS            Wait this long before each answer\n"
+        "  --tls-cert FILE          Serve https with this certificate chain (PEM); --tls-bench trusts it\n"
+        "  --tls-key FILE           Private key for --tls-cert (PEM)\n"
+        "  --close                  Close the connection after each answer\n"
+        "  --no-resume              Issue no session tickets, so every handshake is a full one\n"
+        "  --send URL               Encode FILE.csv as remote-write and POST it to URL\n"
+        "  --cell ID                cell_id label for --send (default none)\n"
+        "  --device NAME            device label for --send (default sinkcheck)\n"
+        "  --tls-bench HOST:PORT    Time TLS 1.2 handshakes against a --serve https server\n"
+        "  --connections N          Connections for --tls-bench (default 20)\n"
+        "  --fuzz N                 Round-trip N random buffers through the snappy encoder\n",
+        prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "serve",    required_argument, NULL, 's' },
+        { "fail-pct", required_argument, NULL, 'f' },
+        { "delay-ms", required_argument, NULL, 'd' },
+        { "send",     required_argument, NULL, 'S' },
+        { "cell",     required_argument, NULL, 'c' },
+        { "device",   required_argument, NULL, 'D' },
+        { "fuzz",     required_argument, NULL, 'z' },
+        { "tls-cert", required_argument, NULL, 'C' },
+        { "tls-key",  required_argument, NULL, 'K' },
+        { "close",    no_argument,       NULL, 'x' },
+        { "no-resume", no_argument,      NULL, 'n' },
+        { "tls-bench", required_argument, NULL, 'b' },
+        { "connections", required_argument, NULL, 'N' },
+        { "help",     no_argument,       NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 's': s_opt.port = atoi(optarg); break;
+        case 'f': s_opt.fail_pct = atoi(optarg); break;
+        case 'd': s_opt.delay_ms = atoi(optarg); break;
+        case 'S': s_opt.send_url = optarg; break;
+        case 'c': s_opt.cell_id = optarg; break;
+        case 'D': s_opt.device = optarg; break;
+        case 'z': s_opt.fuzz_iterations = atol(optarg); break;
+        case 'C': s_opt.tls_cert = optarg; break;
+        case 'K': s_opt.tls_key = optarg; break;
+        case 'x': s_opt.close_each = true; break;
+        case 'n': s_opt.no_resume = true; break;
+        case 'b': s_opt.bench_addr = optarg; break;
+        case 'N': s_opt.bench_connections = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (s_opt.fuzz_iterations > 0) {
+        return fuzz();
+    }
+    if (s_opt.bench_addr != NULL) {
+#ifdef SINKCHECK_TLS
+        /* Before OpenSSL allocates anything */
+        CRYPTO_set_mem_functions(counting_malloc, counting_realloc, counting_free);
+        return tls_bench();
+#else
+        fprintf(stderr, "Built without OpenSSL, --tls-bench is not available\n");
+        return 1;
+#endif
+    }
+    if (s_opt.send_url != NULL && optind < argc) {
+        int rc = 0;
+        for (int i = optind; i < argc && rc == 0; i++) {
+            rc = send_csv(argv[i]);
+        }
+        return rc;
+    }
+    if (s_opt.port > 0 && (s_opt.tls_cert == NULL) == (s_opt.tls_key == NULL)) {
+        srand((unsigned)time(NULL));
+        return serve();
+    }
+    usage(argv[0]);
+    return 1;
+}